@@ -153,6 +153,8 @@ standard names. */
 
 /* USER CODE BEGIN Defines */   	      
 /* Section where parameter definitions can be added (for instance, to override default ones in FreeRTOS.h) */
+/* Per task fd tables of ECLayer, see _FD_TLS_INDEX in ec_config.h */
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS 1
 /* USER CODE END Defines */ 
 
 #endif /* FREERTOS_CONFIG_H */
@@ -64,6 +64,17 @@ void USART6_IRQHandler(void);
 void UART7_IRQHandler(void);
 void UART8_IRQHandler(void);
 /* USER CODE BEGIN EFP */
+void DMA1_Stream0_IRQHandler(void);
+void DMA1_Stream1_IRQHandler(void);
+void DMA1_Stream2_IRQHandler(void);
+void DMA1_Stream3_IRQHandler(void);
+void DMA1_Stream6_IRQHandler(void);
+void DMA2_Stream1_IRQHandler(void);
+void DMA2_Stream5_IRQHandler(void);
+void DMA1_Stream4_IRQHandler(void);
+void DMA1_Stream7_IRQHandler(void);
+void DMA2_Stream6_IRQHandler(void);
+void DMA2_Stream7_IRQHandler(void);
 
 /* USER CODE END EFP */
 
@@ -115,6 +115,10 @@ void StartDefaultTask(void *argument)
 	MX_LWIP_Init();
 	/* USER CODE BEGIN StartDefaultTask */
 	int32_t serial_shell_fd = open("/drivers/stm32/uart5", O_RDWR);
+	// stdin, stdout and stderr of the tasks started by ec_thread_new().
+	dup2(serial_shell_fd, 0);
+	dup2(serial_shell_fd, 1);
+	dup2(serial_shell_fd, 2);
 	ecshell_cmd_map_init();
 
 	ecshell_t *shell = ecshell_new(serial_shell_fd, serial_shell_fd, e_SHELLTYPE_Default, 0);
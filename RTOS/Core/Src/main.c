@@ -92,6 +92,7 @@ int main(void)
 	/* Initialize all configured peripherals */
 	MX_GPIO_Init();
 	/* USER CODE BEGIN 2 */
+	EC_Layer_Initialize();
 	EC_Driver_Initialize();
 	/* USER CODE END 2 */
 
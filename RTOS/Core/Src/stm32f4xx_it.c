@@ -297,5 +297,93 @@ void UART8_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles DMA1 stream0 global interrupt, UART5 RX.
+  */
+void DMA1_Stream0_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_RXDMA(&device_stm32_uart5);
+}
+
+/**
+  * @brief This function handles DMA1 stream1 global interrupt, USART3 RX.
+  */
+void DMA1_Stream1_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_RXDMA(&device_stm32_usart3);
+}
+
+/**
+  * @brief This function handles DMA1 stream2 global interrupt, UART4 RX.
+  */
+void DMA1_Stream2_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_RXDMA(&device_stm32_uart4);
+}
+
+/**
+  * @brief This function handles DMA1 stream3 global interrupt, UART7 RX.
+  */
+void DMA1_Stream3_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_RXDMA(&device_stm32_uart7);
+}
+
+/**
+  * @brief This function handles DMA1 stream6 global interrupt, UART8 RX.
+  */
+void DMA1_Stream6_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_RXDMA(&device_stm32_uart8);
+}
+
+/**
+  * @brief This function handles DMA2 stream1 global interrupt, USART6 RX.
+  */
+void DMA2_Stream1_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_RXDMA(&device_stm32_usart6);
+}
+
+/**
+  * @brief This function handles DMA2 stream5 global interrupt, USART1 RX.
+  */
+void DMA2_Stream5_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_RXDMA(&device_stm32_usart1);
+}
+
+/**
+  * @brief This function handles DMA1 stream4 global interrupt, UART4 TX.
+  */
+void DMA1_Stream4_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_TXDMA(&device_stm32_uart4);
+}
+
+/**
+  * @brief This function handles DMA1 stream7 global interrupt, UART5 TX.
+  */
+void DMA1_Stream7_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_TXDMA(&device_stm32_uart5);
+}
+
+/**
+  * @brief This function handles DMA2 stream6 global interrupt, USART6 TX.
+  */
+void DMA2_Stream6_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_TXDMA(&device_stm32_usart6);
+}
+
+/**
+  * @brief This function handles DMA2 stream7 global interrupt, USART1 TX.
+  */
+void DMA2_Stream7_IRQHandler(void)
+{
+	ECDRV_IRQ_Handler_USART_TXDMA(&device_stm32_usart1);
+}
+
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
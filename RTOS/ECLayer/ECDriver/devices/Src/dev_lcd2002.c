@@ -34,6 +34,9 @@ static file_opts_t _opts_lcd2002 = {
 	.lseek = lcd2002_lseek,
 	.mmap = NULL,
 	.close = lcd2002_close,
+	.poll = lcd2002_poll,
+	.readv = NULL,
+	.writev = NULL,
 };
 
 static dev_lcd2002_t _device_descriptor_lcd2002 = {
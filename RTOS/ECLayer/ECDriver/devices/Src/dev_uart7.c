@@ -26,6 +26,14 @@
 
 #include <stdint.h>
 
+#define UART7_RX_BUFFER_SIZE 256
+#define UART7_TX_BUFFER_SIZE 256
+
+#if _EN_USART_STATIC_BUFFER
+static CFIFO_STORAGE(_rx_fifo_stm32_uart7, UART7_RX_BUFFER_SIZE) __ALIGNED(_CFIFO_CACHELINE_SIZE);
+static CFIFO_STORAGE(_tx_fifo_stm32_uart7, UART7_TX_BUFFER_SIZE) __ALIGNED(_CFIFO_CACHELINE_SIZE);
+#endif
+
 static file_opts_t _opts_stm32_uart7 = {
 	.open = stm32_usart_open,
 	.read = stm32_usart_read,
@@ -34,6 +42,9 @@ static file_opts_t _opts_stm32_uart7 = {
 	.lseek = stm32_usart_lseek,
 	.mmap = NULL,
 	.close = stm32_usart_close,
+	.poll = stm32_usart_poll,
+	.readv = NULL,
+	.writev = stm32_usart_writev,
 };
 
 static LL_USART_InitTypeDef _init_stm32_uart7 = {
@@ -67,14 +78,25 @@ static LL_GPIO_InitTypeDef _init_stm32_uart7_rx = {
 static config_stm32_usart_t _conf_stm32_uart7 = {
 	.clock_bus = USART_Bus_APB1,
 	.clock_ena_bit = LL_APB1_GRP1_PERIPH_UART7,
-	.rx_buffer_size = 256,
-	.tx_buffer_size = 256,
+	.rx_buffer_size = UART7_RX_BUFFER_SIZE,
+	.tx_buffer_size = UART7_TX_BUFFER_SIZE,
 	.rx_pin_conf = &_init_stm32_uart7_rx,
 	.tx_pin_conf = &_init_stm32_uart7_tx,
 	.rx_io_port = GPIOF,
 	.tx_io_port = GPIOF,
 	.irqn = UART7_IRQn,
 	.usart_conf = &_init_stm32_uart7,
+#if _EN_USART_STATIC_BUFFER
+	.rx_fifo_storage = _rx_fifo_stm32_uart7,
+	.tx_fifo_storage = _tx_fifo_stm32_uart7,
+#endif
+	.rx_watermark = 64,
+	.tx_watermark = 64,
+	.rx_idle_wakeup = 1,
+	.rx_dma = NULL,  // DMA1 to opt in to RX DMA
+	.rx_dma_stream = LL_DMA_STREAM_3,
+	.rx_dma_channel = LL_DMA_CHANNEL_5,
+	.rx_dma_irqn = DMA1_Stream3_IRQn,
 };
 
 static dev_stm32_usart_t _device_descriptor_stm32_uart7 = {
@@ -26,6 +26,14 @@
 
 #include <stdint.h>
 
+#define USART1_RX_BUFFER_SIZE 256
+#define USART1_TX_BUFFER_SIZE 256
+
+#if _EN_USART_STATIC_BUFFER
+static CFIFO_STORAGE(_rx_fifo_stm32_usart1, USART1_RX_BUFFER_SIZE) __ALIGNED(_CFIFO_CACHELINE_SIZE);
+static CFIFO_STORAGE(_tx_fifo_stm32_usart1, USART1_TX_BUFFER_SIZE) __ALIGNED(_CFIFO_CACHELINE_SIZE);
+#endif
+
 static file_opts_t _opts_stm32_usart1 = {
 	.open = stm32_usart_open,
 	.read = stm32_usart_read,
@@ -34,6 +42,9 @@ static file_opts_t _opts_stm32_usart1 = {
 	.lseek = stm32_usart_lseek,
 	.mmap = NULL,
 	.close = stm32_usart_close,
+	.poll = stm32_usart_poll,
+	.readv = NULL,
+	.writev = stm32_usart_writev,
 };
 
 static LL_USART_InitTypeDef _init_stm32_usart1 = {
@@ -64,17 +75,56 @@ static LL_GPIO_InitTypeDef _init_stm32_usart1_rx = {
 	.Alternate = LL_GPIO_AF_7,
 };
 
+static LL_GPIO_InitTypeDef _init_stm32_usart1_cts = {
+	.Pin = LL_GPIO_PIN_11,
+	.Mode = LL_GPIO_MODE_ALTERNATE,
+	.Speed = LL_GPIO_SPEED_FREQ_VERY_HIGH,
+	.OutputType = LL_GPIO_OUTPUT_PUSHPULL,
+	.Pull = LL_GPIO_PULL_UP,
+	.Alternate = LL_GPIO_AF_7,
+};
+
+// RTS is driven by the driver from the RX fifo level, not by the USART.
+static LL_GPIO_InitTypeDef _init_stm32_usart1_rts = {
+	.Pin = LL_GPIO_PIN_12,
+	.Mode = LL_GPIO_MODE_OUTPUT,
+	.Speed = LL_GPIO_SPEED_FREQ_VERY_HIGH,
+	.OutputType = LL_GPIO_OUTPUT_PUSHPULL,
+	.Pull = LL_GPIO_PULL_NO,
+	.Alternate = LL_GPIO_AF_0,
+};
+
 static config_stm32_usart_t _conf_stm32_usart1 = {
 	.clock_bus = USART_Bus_APB2,
 	.clock_ena_bit = LL_APB2_GRP1_PERIPH_USART1,
-	.rx_buffer_size = 256,
-	.tx_buffer_size = 256,
+	.rx_buffer_size = USART1_RX_BUFFER_SIZE,
+	.tx_buffer_size = USART1_TX_BUFFER_SIZE,
 	.rx_pin_conf = &_init_stm32_usart1_rx,
 	.tx_pin_conf = &_init_stm32_usart1_tx,
 	.rx_io_port = GPIOA,
 	.tx_io_port = GPIOA,
 	.irqn = USART1_IRQn,
 	.usart_conf = &_init_stm32_usart1,
+#if _EN_USART_STATIC_BUFFER
+	.rx_fifo_storage = _rx_fifo_stm32_usart1,
+	.tx_fifo_storage = _tx_fifo_stm32_usart1,
+#endif
+	.rx_watermark = 64,
+	.tx_watermark = 64,
+	.rx_idle_wakeup = 1,
+	.rx_dma = NULL,  // DMA2 to opt in to RX DMA
+	.rx_dma_stream = LL_DMA_STREAM_5,
+	.rx_dma_channel = LL_DMA_CHANNEL_4,
+	.rx_dma_irqn = DMA2_Stream5_IRQn,
+	.tx_dma = DMA2,
+	.tx_dma_stream = LL_DMA_STREAM_7,
+	.tx_dma_channel = LL_DMA_CHANNEL_4,
+	.tx_dma_irqn = DMA2_Stream7_IRQn,
+	.rts_pin_conf = &_init_stm32_usart1_rts,
+	.rts_io_port = GPIOA,
+	.cts_pin_conf = &_init_stm32_usart1_cts,
+	.cts_io_port = GPIOA,
+	.flow_ctrl = 0,
 };
 
 static dev_stm32_usart_t _device_descriptor_stm32_usart1 = {
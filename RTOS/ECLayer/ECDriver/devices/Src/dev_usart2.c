@@ -26,6 +26,14 @@
 
 #include <stdint.h>
 
+#define USART2_RX_BUFFER_SIZE 256
+#define USART2_TX_BUFFER_SIZE 256
+
+#if _EN_USART_STATIC_BUFFER
+static CFIFO_STORAGE(_rx_fifo_stm32_usart2, USART2_RX_BUFFER_SIZE) __ALIGNED(_CFIFO_CACHELINE_SIZE);
+static CFIFO_STORAGE(_tx_fifo_stm32_usart2, USART2_TX_BUFFER_SIZE) __ALIGNED(_CFIFO_CACHELINE_SIZE);
+#endif
+
 static file_opts_t _opts_stm32_usart2 = {
 	.open = stm32_usart_open,
 	.read = stm32_usart_read,
@@ -34,6 +42,9 @@ static file_opts_t _opts_stm32_usart2 = {
 	.lseek = stm32_usart_lseek,
 	.mmap = NULL,
 	.close = stm32_usart_close,
+	.poll = stm32_usart_poll,
+	.readv = NULL,
+	.writev = stm32_usart_writev,
 };
 
 static LL_USART_InitTypeDef _init_stm32_usart2 = {
@@ -67,14 +78,21 @@ static LL_GPIO_InitTypeDef _init_stm32_usart2_rx = {
 static config_stm32_usart_t _conf_stm32_usart2 = {
 	.clock_bus = USART_Bus_APB2,
 	.clock_ena_bit = LL_APB1_GRP1_PERIPH_USART2,
-	.rx_buffer_size = 256,
-	.tx_buffer_size = 256,
+	.rx_buffer_size = USART2_RX_BUFFER_SIZE,
+	.tx_buffer_size = USART2_TX_BUFFER_SIZE,
 	.rx_pin_conf = &_init_stm32_usart2_rx,
 	.tx_pin_conf = &_init_stm32_usart2_tx,
 	.rx_io_port = GPIOA,
 	.tx_io_port = GPIOA,
 	.irqn = USART2_IRQn,
 	.usart_conf = &_init_stm32_usart2,
+#if _EN_USART_STATIC_BUFFER
+	.rx_fifo_storage = _rx_fifo_stm32_usart2,
+	.tx_fifo_storage = _tx_fifo_stm32_usart2,
+#endif
+	.rx_watermark = 64,
+	.tx_watermark = 64,
+	.rx_idle_wakeup = 1,
 };
 
 static dev_stm32_usart_t _device_descriptor_stm32_usart2 = {
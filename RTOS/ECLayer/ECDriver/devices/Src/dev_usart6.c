@@ -26,6 +26,14 @@
 
 #include <stdint.h>
 
+#define USART6_RX_BUFFER_SIZE 256
+#define USART6_TX_BUFFER_SIZE 256
+
+#if _EN_USART_STATIC_BUFFER
+static CFIFO_STORAGE(_rx_fifo_stm32_usart6, USART6_RX_BUFFER_SIZE) __ALIGNED(_CFIFO_CACHELINE_SIZE);
+static CFIFO_STORAGE(_tx_fifo_stm32_usart6, USART6_TX_BUFFER_SIZE) __ALIGNED(_CFIFO_CACHELINE_SIZE);
+#endif
+
 static file_opts_t _opts_stm32_usart6 = {
 	.open = stm32_usart_open,
 	.read = stm32_usart_read,
@@ -34,6 +42,9 @@ static file_opts_t _opts_stm32_usart6 = {
 	.lseek = stm32_usart_lseek,
 	.mmap = NULL,
 	.close = stm32_usart_close,
+	.poll = stm32_usart_poll,
+	.readv = NULL,
+	.writev = stm32_usart_writev,
 };
 
 static LL_USART_InitTypeDef _init_stm32_usart6 = {
@@ -67,14 +78,29 @@ static LL_GPIO_InitTypeDef _init_stm32_usart6_rx = {
 static config_stm32_usart_t _conf_stm32_usart6 = {
 	.clock_bus = USART_Bus_APB2,
 	.clock_ena_bit = LL_APB2_GRP1_PERIPH_USART6,
-	.rx_buffer_size = 256,
-	.tx_buffer_size = 256,
+	.rx_buffer_size = USART6_RX_BUFFER_SIZE,
+	.tx_buffer_size = USART6_TX_BUFFER_SIZE,
 	.rx_pin_conf = &_init_stm32_usart6_rx,
 	.tx_pin_conf = &_init_stm32_usart6_tx,
 	.rx_io_port = GPIOC,
 	.tx_io_port = GPIOC,
 	.irqn = USART6_IRQn,
 	.usart_conf = &_init_stm32_usart6,
+#if _EN_USART_STATIC_BUFFER
+	.rx_fifo_storage = _rx_fifo_stm32_usart6,
+	.tx_fifo_storage = _tx_fifo_stm32_usart6,
+#endif
+	.rx_watermark = 64,
+	.tx_watermark = 64,
+	.rx_idle_wakeup = 1,
+	.rx_dma = NULL,  // DMA2 to opt in to RX DMA
+	.rx_dma_stream = LL_DMA_STREAM_1,
+	.rx_dma_channel = LL_DMA_CHANNEL_5,
+	.rx_dma_irqn = DMA2_Stream1_IRQn,
+	.tx_dma = DMA2,
+	.tx_dma_stream = LL_DMA_STREAM_6,
+	.tx_dma_channel = LL_DMA_CHANNEL_5,
+	.tx_dma_irqn = DMA2_Stream6_IRQn,
 };
 
 static dev_stm32_usart_t _device_descriptor_stm32_usart6 = {
@@ -25,6 +25,7 @@
 #include "ec_dev.h"
 #include "ec_file.h"
 #include "ec_ioctl.h"
+#include "ec_poll.h"
 #include "ioctl_cmd.h"
 
 #include <stdint.h>
@@ -41,6 +42,7 @@ typedef struct dev_lcd2002_s {
 	int32_t addr_increment;
 	int32_t shift_counter;
 	int32_t shift_enabled;
+	atomic_t open_refs;	 //!< file_refs also counts lookups
 } dev_lcd2002_t;
 
 int32_t lcd2002_open(file_des_t *fd, const char *filename, uint32_t flags);
@@ -54,3 +56,5 @@ int32_t lcd2002_ioctl(file_des_t *fd, uint32_t cmd, uint64_t arg);
 int64_t lcd2002_lseek(file_des_t *fd, int64_t offset, int32_t origin);
 
 int32_t lcd2002_close(file_des_t *fd);
+
+uint32_t lcd2002_poll(file_des_t *fd, ec_poll_table_t *table);
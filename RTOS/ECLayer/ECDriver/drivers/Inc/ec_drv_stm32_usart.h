@@ -27,14 +27,19 @@
 #include "ec_dev.h"
 #include "ec_file.h"
 #include "ec_ioctl.h"
+#include "ec_poll.h"
 #include "ioctl_cmd.h"
 #include "stm32f4xx_ll_bus.h"
+#include "stm32f4xx_ll_dma.h"
 #include "stm32f4xx_ll_gpio.h"
 #include "stm32f4xx_ll_rcc.h"
 #include "stm32f4xx_ll_usart.h"
 
 #if _WITH_CMSISOS_V2
 #	include "cmsis_os2.h"
+#	if _EN_USART_STATIC_BUFFER
+#		include "FreeRTOS.h"
+#	endif
 #endif
 
 #include <stdint.h>
@@ -45,6 +50,34 @@
 
 #define STM32_USART_BLOCK_WITH_SCHEDULE 1
 
+#if _EN_USART_TIMESTAMP
+// Depth of the RX timestamp ring, must be a power of 2.
+#	define STM32_USART_RX_MARKS 16
+
+/**
+ * Arrival time of the first char of a burst (or chunk), offset is the
+ * position of that char in the RX stream.
+*/
+typedef struct usart_rx_mark_s {
+	timeStamp_t ts;
+	uint32_t offset;
+} usart_rx_mark_t;
+
+/**
+ * Argument of CMD_USART_READTS. Reads up to size chars without blocking,
+ * and the marks of the returned data with offsets relative to data[0].
+ * A burst that started before data[0] is reported at offset 0.
+*/
+typedef struct usart_ts_read_s {
+	char *data;
+	uint32_t size;
+	usart_rx_mark_t *marks;
+	uint32_t nmarks;
+	uint32_t len;		 //!< out: chars read
+	uint32_t marks_len;	 //!< out: marks filled
+} usart_ts_read_t;
+#endif
+
 typedef struct config_stm32_usart_s {
 	enum {
 		USART_Bus_APB1,
@@ -59,6 +92,31 @@ typedef struct config_stm32_usart_s {
 	GPIO_TypeDef *tx_io_port;
 	IRQn_Type irqn;
 	LL_USART_InitTypeDef *usart_conf;
+	uint32_t rx_watermark;	  //!< Wake a blocked reader once this many bytes are buffered, at most half rx_buffer_size with RX DMA
+	uint32_t tx_watermark;	  //!< Wake a blocked writer once this many bytes are free
+	uint32_t rx_idle_wakeup;  //!< Also wake a blocked reader when the RX line goes idle
+	DMA_TypeDef *rx_dma;	  //!< DMA controller for circular RX, halves the usable RX fifo, NULL to receive by RXNE interrupt
+	uint32_t rx_dma_stream;	  //!< LL_DMA_STREAM_x
+	uint32_t rx_dma_channel;  //!< LL_DMA_CHANNEL_x
+	IRQn_Type rx_dma_irqn;
+	DMA_TypeDef *tx_dma;	  //!< DMA controller for TX, NULL to transmit by TXE interrupt
+	uint32_t tx_dma_stream;	  //!< LL_DMA_STREAM_x
+	uint32_t tx_dma_channel;  //!< LL_DMA_CHANNEL_x
+	IRQn_Type tx_dma_irqn;
+	LL_GPIO_InitTypeDef *rts_pin_conf;	//!< RTS as a plain output, driven from the RX fill level, NULL if not wired
+	GPIO_TypeDef *rts_io_port;
+	LL_GPIO_InitTypeDef *cts_pin_conf;	//!< CTS in alternate function mode, NULL if not wired
+	GPIO_TypeDef *cts_io_port;
+	uint32_t flow_ctrl;					//!< USART_FLOW_RTS | USART_FLOW_CTS
+	uint32_t rts_high_watermark;		//!< Deassert RTS at this RX fill level, 0 for 3/4 of the fifo, 3/8 with RX DMA
+	uint32_t rts_low_watermark;			//!< Reassert RTS at or below this RX fill level, 0 for 1/4 of the fifo
+#if _EN_USART_STATIC_BUFFER
+	void *rx_fifo_storage;	//!< CFIFO_STORAGE() of rx_buffer_size
+	void *tx_fifo_storage;	//!< CFIFO_STORAGE() of tx_buffer_size
+#endif
+#if _EN_USART_TIMESTAMP
+	uint32_t rx_ts_chunk;  //!< Also start a new mark every this many chars, 0 for bursts only
+#endif
 } config_stm32_usart_t;
 
 typedef struct dev_stm32_usart_s {
@@ -68,12 +126,24 @@ typedef struct dev_stm32_usart_s {
 	osSemaphoreId_t rd_sem;
 	osSemaphoreId_t tx_sem;
 	osSemaphoreId_t rx_sem;
+#	if _EN_USART_STATIC_BUFFER
+	StaticSemaphore_t wr_sem_cb;
+	StaticSemaphore_t rd_sem_cb;
+	StaticSemaphore_t tx_sem_cb;
+	StaticSemaphore_t rx_sem_cb;
+#	endif
 #else
 	ec_lock_t wr_lock;
 	ec_lock_t rd_lock;
 #endif
 	cfifo_t *rx_buffer;
 	cfifo_t *tx_buffer;
+	volatile uint32_t rx_wait_level;
+	volatile uint32_t tx_wait_level;
+	volatile uint32_t tx_dma_len;  //!< Length of the TX DMA transfer in flight, 0 if idle
+	volatile uint32_t rts_held;	   //!< RTS is deasserted, the RX fifo is above the high watermark
+	ec_waitq_t poll_waitq;		   //!< Tasks in ec_poll() on this port
+	atomic_t open_refs;			   //!< Opens of this port, file_refs also counts lookups
 	config_stm32_usart_t *config;
 #if _EN_USART_TIMESTAMP
 	timeStamp_t rx_timestamp;
@@ -82,6 +152,11 @@ typedef struct dev_stm32_usart_s {
 	int32_t tx_ts_valid;
 	timeStamp_t read_timestamp;
 	timeStamp_t write_timestamp;
+	usart_rx_mark_t rx_marks[STM32_USART_RX_MARKS];
+	volatile uint32_t rx_marks_head;
+	volatile uint32_t rx_marks_tail;
+	uint32_t rx_mark_offset;  //!< Stream offset of the latest mark
+	uint32_t rx_burst_open;	  //!< Cleared on idle line, next char starts a new mark
 #endif
 } dev_stm32_usart_t;
 
@@ -91,12 +166,20 @@ int32_t stm32_usart_read(file_des_t *fd, char *data, size_t count);
 
 int32_t stm32_usart_write(file_des_t *fd, const char *data, size_t count);
 
+int32_t stm32_usart_writev(file_des_t *fd, const struct iovec *iov, int32_t iovcnt);
+
 int32_t stm32_usart_ioctl(file_des_t *fd, uint32_t cmd, uint64_t arg);
 
 int64_t stm32_usart_lseek(file_des_t *fd, int64_t offset, int32_t origin);
 
 int32_t stm32_usart_close(file_des_t *fd);
 
+uint32_t stm32_usart_poll(file_des_t *fd, ec_poll_table_t *table);
+
 void ECDRV_IRQ_Handler_USART(ec_dev_t *dev);
 
+void ECDRV_IRQ_Handler_USART_RXDMA(ec_dev_t *dev);
+
+void ECDRV_IRQ_Handler_USART_TXDMA(ec_dev_t *dev);
+
 #endif
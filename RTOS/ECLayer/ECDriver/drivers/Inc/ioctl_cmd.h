@@ -42,6 +42,24 @@
 #define CMD_USART_DISABLE	   _IO(STM32_USART_MAGIC, 10)
 #define CMD_USART_GETREADTS	   _IOR(STM32_USART_MAGIC, 11, void *)
 #define CMD_USART_GETWRITETS   _IOR(STM32_USART_MAGIC, 12, void *)
+#define CMD_USART_GETRXDROPS   _IOR(STM32_USART_MAGIC, 13, uint32_t *)
+#define CMD_USART_SETRXWATERMARK   _IOW(STM32_USART_MAGIC, 14, uint32_t)
+#define CMD_USART_GETRXWATERMARK   _IOR(STM32_USART_MAGIC, 15, uint32_t *)
+#define CMD_USART_SETTXWATERMARK   _IOW(STM32_USART_MAGIC, 16, uint32_t)
+#define CMD_USART_GETTXWATERMARK   _IOR(STM32_USART_MAGIC, 17, uint32_t *)
+#define CMD_USART_SETIDLEWAKEUP	   _IOW(STM32_USART_MAGIC, 18, uint32_t)
+#define CMD_USART_GETIDLEWAKEUP	   _IOR(STM32_USART_MAGIC, 19, uint32_t *)
+#define CMD_USART_READTS	   _IOWR(STM32_USART_MAGIC, 20, void *)
+#define CMD_USART_SETFLOWCTRL  _IOW(STM32_USART_MAGIC, 21, uint32_t)
+#define CMD_USART_GETFLOWCTRL  _IOR(STM32_USART_MAGIC, 22, uint32_t *)
+#define CMD_USART_SETRTSHIGH   _IOW(STM32_USART_MAGIC, 23, uint32_t)
+#define CMD_USART_GETRTSHIGH   _IOR(STM32_USART_MAGIC, 24, uint32_t *)
+#define CMD_USART_SETRTSLOW	   _IOW(STM32_USART_MAGIC, 25, uint32_t)
+#define CMD_USART_GETRTSLOW	   _IOR(STM32_USART_MAGIC, 26, uint32_t *)
+
+// Flags of CMD_USART_SETFLOWCTRL
+#define USART_FLOW_RTS 0x01U
+#define USART_FLOW_CTS 0x02U
 
 /**
  * Char LCD module commands
@@ -58,12 +58,12 @@ int32_t lcd2002_open(file_des_t *fd, const char *filename, uint32_t flags)
 		return -EBADFD;
 	}
 	else {
-		if (atomic_inc_and_eq(&(fd->file->file_refs), 1) == 0) {
+		if (atomic_inc_and_eq(&(lcd_dev->open_refs), 1) == 0) {
 			__init_lcd2002(lcd_dev);
 			return 0;
 		}
 		else {
-			atomic_dec(&(fd->file->file_refs));
+			atomic_dec(&(lcd_dev->open_refs));
 			return -EBUSY;
 		}
 	}
@@ -133,7 +133,7 @@ int32_t lcd2002_write(file_des_t *fd, const char *data, size_t count)
 		}
 	}
 	EC_OPTIMIZE_EXIT
-	return 0;
+	return (int32_t)_to_be_write;
 }
 
 int32_t lcd2002_ioctl(file_des_t *fd, uint32_t cmd, uint64_t arg)
@@ -332,18 +332,27 @@ int64_t lcd2002_lseek(file_des_t *fd, int64_t offset, int32_t origin)
 int32_t lcd2002_close(file_des_t *fd)
 {
 	dev_lcd2002_t *lcd_dev = (dev_lcd2002_t *)(((ec_dev_t *)(fd->file->file_content))->private_data);
-	(void)lcd_dev;
 	if (fd == NULL) {
 		return -EBADFD;
 	}
 	else {
-		if (atomic_dec_and_test(&(fd->file->file_refs)) == 0) {
-			return 0;
-		}
-		else {
-			atomic_inc(&(fd->file->file_refs));
-			return 0;
-		}
+		atomic_dec(&(lcd_dev->open_refs));
+		return 0;
+	}
+}
+
+/**
+ * Writes finish on the bus before returning and reads are not supported,
+ * so the LCD is always writable and never has to wake a poller.
+*/
+uint32_t lcd2002_poll(file_des_t *fd, ec_poll_table_t *table)
+{
+	(void)table;
+	if ((fd == NULL) || (fd->file == NULL)) {
+		return EC_POLLERR;
+	}
+	else {
+		return EC_POLLOUT;
 	}
 }
 
@@ -27,6 +27,7 @@
 #include "ec_fcntl.h"
 #include "ec_file.h"
 #include "exceptions.h"
+#include "stm32f4xx_ll_dma.h"
 #include "stm32f4xx_ll_usart.h"
 
 #if _EN_USART_TIMESTAMP
@@ -43,6 +44,41 @@
 static void __init_stm32_usart(dev_stm32_usart_t *dev, uint32_t flags);
 static void __disable_stm32_usart(dev_stm32_usart_t *dev);
 static uint32_t __get_stm32_usart_periphclk(dev_stm32_usart_t *usart_dev);
+static uint32_t __wait_level(size_t rest_count, uint32_t watermark, int32_t depth);
+static int32_t __rx_capacity(dev_stm32_usart_t *usart_dev);
+#if _WITH_CMSISOS_V2 && _EN_USART_STATIC_BUFFER
+static osSemaphoreId_t __static_sem_new(StaticSemaphore_t *cb);
+#	define __USART_SEM_NEW(dev, sem) __static_sem_new(&((dev)->sem##_cb))
+#elif _WITH_CMSISOS_V2
+#	define __USART_SEM_NEW(dev, sem) osSemaphoreNew(1, 1, NULL)
+#endif
+#if _WITH_CMSISOS_V2
+static uint32_t __ms_to_ticks(uint32_t ms);
+#endif
+static void __enable_rx_it(dev_stm32_usart_t *usart_dev);
+static void __update_idle_it(dev_stm32_usart_t *usart_dev);
+static void __disable_rx_it(dev_stm32_usart_t *usart_dev);
+static void __rx_wakeup(dev_stm32_usart_t *usart_dev, uint32_t idle);
+static void __init_rx_dma(dev_stm32_usart_t *usart_dev);
+static void __disable_rx_dma(dev_stm32_usart_t *usart_dev);
+static void __clear_dma_flags(DMA_TypeDef *dma, uint32_t stream);
+static void __rx_dma_publish(dev_stm32_usart_t *usart_dev);
+static void __start_tx(dev_stm32_usart_t *usart_dev);
+static int32_t __wr_lock(dev_stm32_usart_t *usart_dev, uint32_t flags);
+static void __wr_unlock(dev_stm32_usart_t *usart_dev);
+static int32_t __tx_queue(dev_stm32_usart_t *usart_dev, uint32_t flags, const char *data, size_t count);
+static void __tx_wakeup(dev_stm32_usart_t *usart_dev);
+static void __init_tx_dma(dev_stm32_usart_t *usart_dev);
+static void __disable_tx_dma(dev_stm32_usart_t *usart_dev);
+static void __tx_dma_launch(dev_stm32_usart_t *usart_dev);
+static int32_t __set_flow_ctrl(dev_stm32_usart_t *usart_dev, uint32_t flow);
+static void __rts_check_high(dev_stm32_usart_t *usart_dev);
+static void __rts_check_low(dev_stm32_usart_t *usart_dev);
+#if _EN_USART_TIMESTAMP
+static void __rx_mark(dev_stm32_usart_t *usart_dev, uint32_t offset, const timeStamp_t *ts);
+static void __rx_marks_trim(dev_stm32_usart_t *usart_dev);
+static int32_t __read_ts(dev_stm32_usart_t *usart_dev, usart_ts_read_t *req);
+#endif
 
 int32_t stm32_usart_open(file_des_t *fd, const char *filename, uint32_t flags)
 {
@@ -52,40 +88,50 @@ int32_t stm32_usart_open(file_des_t *fd, const char *filename, uint32_t flags)
 		return -EBADFD;
 	}
 	else {
-		if (atomic_inc_and_eq(&(fd->file->file_refs), 1) == 0) {
+		if (atomic_inc_and_eq(&(usart_dev->open_refs), 1) == 0) {
 			/**
 			 * Read-only or write-only configuration not supported yet.
+			 * A reader falling behind loses the oldest bytes, the ISR
+			 * never waits for space.
 			*/
-			usart_dev->rx_buffer = cfifo_new(usart_dev->config->rx_buffer_size);
+#if _EN_USART_STATIC_BUFFER
+			usart_dev->rx_buffer = cfifo_init(usart_dev->config->rx_fifo_storage, usart_dev->config->rx_buffer_size, e_CFIFO_OverwriteOldest);
+#else
+			usart_dev->rx_buffer = cfifo_new(usart_dev->config->rx_buffer_size, e_CFIFO_OverwriteOldest);
+#endif
 			if (usart_dev->rx_buffer == NULL) {
 				err = -ENOMEM;
-				goto release_file_refs;
+				goto release_open_refs;
 			}
-			usart_dev->tx_buffer = cfifo_new(usart_dev->config->tx_buffer_size);
+#if _EN_USART_STATIC_BUFFER
+			usart_dev->tx_buffer = cfifo_init(usart_dev->config->tx_fifo_storage, usart_dev->config->tx_buffer_size, e_CFIFO_Reject);
+#else
+			usart_dev->tx_buffer = cfifo_new(usart_dev->config->tx_buffer_size, e_CFIFO_Reject);
+#endif
 			if (usart_dev->tx_buffer == NULL) {
 				err = -ENOMEM;
 				goto release_rx_buffer;
 			}
 #if _WITH_CMSISOS_V2
-			usart_dev->wr_sem = osSemaphoreNew(1, 1, NULL);
+			usart_dev->wr_sem = __USART_SEM_NEW(usart_dev, wr_sem);
 			if (usart_dev->wr_sem == NULL) {
 				err = -ENOMEM;
 				goto release_tx_buffer;
 			}
 
-			usart_dev->rd_sem = osSemaphoreNew(1, 1, NULL);
+			usart_dev->rd_sem = __USART_SEM_NEW(usart_dev, rd_sem);
 			if (usart_dev->rd_sem == NULL) {
 				err = -ENOMEM;
 				goto release_wr_sem;
 			}
 
-			usart_dev->rx_sem = osSemaphoreNew(1, 1, NULL);
+			usart_dev->rx_sem = __USART_SEM_NEW(usart_dev, rx_sem);
 			if (usart_dev->rx_sem == NULL) {
 				err = -ENOMEM;
 				goto release_rd_sem;
 			}
 
-			usart_dev->tx_sem = osSemaphoreNew(1, 1, NULL);
+			usart_dev->tx_sem = __USART_SEM_NEW(usart_dev, tx_sem);
 			if (usart_dev->tx_sem == NULL) {
 				err = -ENOMEM;
 				goto release_rx_sem;
@@ -102,7 +148,7 @@ int32_t stm32_usart_open(file_des_t *fd, const char *filename, uint32_t flags)
 			 * Multiple open not supported for USART yet.
 			*/
 			err = -EBUSY;
-			goto release_file_refs;
+			goto release_open_refs;
 		}
 	}
 #if _WITH_CMSISOS_V2
@@ -114,11 +160,15 @@ release_wr_sem:
 	osSemaphoreDelete(usart_dev->wr_sem);
 #endif
 release_tx_buffer:
-	cfifo_delete(usart_dev->rx_buffer);
+#if !_EN_USART_STATIC_BUFFER
+	cfifo_delete(usart_dev->tx_buffer);
+#endif
 release_rx_buffer:
+#if !_EN_USART_STATIC_BUFFER
 	cfifo_delete(usart_dev->rx_buffer);
-release_file_refs:
-	atomic_dec(&(fd->file->file_refs));
+#endif
+release_open_refs:
+	atomic_dec(&(usart_dev->open_refs));
 	return err;
 }
 
@@ -199,17 +249,63 @@ int32_t stm32_usart_read(file_des_t *fd, char *data, size_t count)
 #endif
 	if (fd->file_flags & O_NOBLOCK) {
 		err = cfifo_popn(usart_dev->rx_buffer, data, count);
+		__rts_check_low(usart_dev);
 	}
 	else {
+		// With no read_min/read_timeout/read_interval set on the fd, this
+		// waits for the whole count.
+		size_t min_count = ((fd->read_min == 0) || (fd->read_min > count)) ? count : fd->read_min;
+#if _WITH_CMSISOS_V2 && STM32_USART_BLOCK_WITH_SCHEDULE
+		uint32_t start = osKernelGetTickCount();
+		uint32_t total = __ms_to_ticks(fd->read_timeout);
+		uint32_t interval = __ms_to_ticks(fd->read_interval);
+#endif
 		while (rest_count > 0) {
 			err = cfifo_popn(usart_dev->rx_buffer, &data[count - rest_count], rest_count);
 			if (err < 0) {
+				if ((count - rest_count) >= min_count) {
+					break;
+				}
 #if _WITH_CMSISOS_V2 && STM32_USART_BLOCK_WITH_SCHEDULE
-				if (osSemaphoreAcquire(usart_dev->rx_sem, osWaitForever) != osOK) {
-					// Semaphore is not active or something else is wrong.
-					// Normally unreachable.
-					return -ENOLCK;
+				uint32_t level = __wait_level(min_count - (count - rest_count), usart_dev->config->rx_watermark, __rx_capacity(usart_dev));
+				uint32_t timeout = osWaitForever;
+				uint32_t tail = usart_dev->rx_buffer->tail;
+				int32_t gap_wait = 0;
+				osStatus_t stat;
+				if (fd->read_timeout != 0) {
+					uint32_t elapsed = osKernelGetTickCount() - start;
+					if (elapsed >= total) {
+						break;
+					}
+					timeout = total - elapsed;
+				}
+				// Inter-char timer runs only once the first char is in.
+				if ((fd->read_interval != 0) && (rest_count < count) && (interval < timeout)) {
+					timeout = interval;
+					gap_wait = 1;
+				}
+				// Publish the level first, then re-check, so bytes that
+				// arrived in between are not slept on.
+				usart_dev->rx_wait_level = level;
+				if (cfifo_used(usart_dev->rx_buffer) < level) {
+					stat = osSemaphoreAcquire(usart_dev->rx_sem, timeout);
+					if (stat == osErrorTimeout) {
+						// Nothing arrived for a whole interval, the frame is over.
+						if (gap_wait && (usart_dev->rx_buffer->tail == tail)) {
+							usart_dev->rx_wait_level = 0;
+							break;
+						}
+					}
+					else if (stat != osOK) {
+						// Semaphore is not active or something else is wrong.
+						// Normally unreachable.
+						usart_dev->rx_wait_level = 0;
+						return -ENOLCK;
+					}
+					else {
+					}
 				}
+				usart_dev->rx_wait_level = 0;
 #else
 				/**
 				 * @todo Coroutine or something else for no-os configuration.
@@ -218,14 +314,16 @@ int32_t stm32_usart_read(file_des_t *fd, char *data, size_t count)
 			}
 			else {
 				rest_count -= err;
+				__rts_check_low(usart_dev);
 			}
 		}
-		err = count;
+		err = count - rest_count;
 	}
 #if _EN_USART_TIMESTAMP
 	if (err > 0) {
 		memcpy(&(usart_dev->read_timestamp), &(usart_dev->rx_timestamp), sizeof(timeStamp_t));
 		usart_dev->rx_ts_valid = 0;
+		__rx_marks_trim(usart_dev);
 	}
 #endif
 
@@ -276,79 +374,92 @@ int32_t stm32_usart_write(file_des_t *fd, const char *data, size_t count)
 	else {
 	}
 
-	size_t rest_count = count;
 	int32_t err;
 
-#if _WITH_CMSISOS_V2
-	if (__get_IPSR() != 0) {
-		if (osSemaphoreAcquire(usart_dev->wr_sem, 0) != osOK) {
-			return -EBUSY;
-		}
+	err = __wr_lock(usart_dev, fd->file_flags);
+	if (err != 0) {
+		return err;
+	}
+	err = __tx_queue(usart_dev, fd->file_flags, data, count);
+	__start_tx(usart_dev);
+#if _EN_USART_TIMESTAMP
+	memcpy(&(usart_dev->write_timestamp), &(usart_dev->tx_timestamp), sizeof(timeStamp_t));
+	usart_dev->tx_ts_valid = 0;
+#endif
+	__wr_unlock(usart_dev);
+	return err;
+}
+
+/**
+ * All segments go into the TX fifo under one wr_sem hold and TX is
+ * kicked once, so a header, payload and CRC leave as one burst.
+*/
+int32_t stm32_usart_writev(file_des_t *fd, const struct iovec *iov, int32_t iovcnt)
+{
+	file_t *file;
+	ec_dev_t *dev;
+	dev_stm32_usart_t *usart_dev;
+
+	if (fd == NULL) {
+		return -EBADFD;
 	}
 	else {
-		if (fd->file_flags & O_NOBLOCK) {
-			if (osSemaphoreAcquire(usart_dev->wr_sem, 0) != osOK) {
-				return -EBUSY;
-			}
-		}
-		else {
-			if (osSemaphoreAcquire(usart_dev->wr_sem, osWaitForever) != osOK) {
-				// unlikely
-				return -ENOLCK;
-			}
-		}
+		file = (file_t *)fd->file;
 	}
-#else
-	if (ec_try_lock(&(usart_dev->wr_lock)) == -EBUSY) {
-		if (__get_IPSR() != 0) {
-			// If we are in ISR, we should never block.
-			return -EBUSY;
-		}
-		else {
-			/**
-				 * @todo Coroutine or something else for no-os configuration.
-				 * */
-			return (fd->file_flags & O_NOBLOCK) ? -EBUSY : -ENOTSUP;
-		}
+
+	if (file == NULL) {
+		return -EBADF;
 	}
-#endif
-	if (fd->file_flags & O_NOBLOCK) {
-		err = cfifo_pushn(usart_dev->tx_buffer, data, count);
-		LL_USART_EnableIT_TXE(usart_dev->handle);
+	else {
+		dev = (ec_dev_t *)file->file_content;
+	}
+
+	if (dev == NULL) {
+		return -ENODEV;
 	}
 	else {
-		while (rest_count > 0) {
-			err = cfifo_pushn(usart_dev->tx_buffer, &data[count - rest_count], rest_count);
-			LL_USART_EnableIT_TXE(usart_dev->handle);
-			if (err < 0) {
-#if _WITH_CMSISOS_V2 && STM32_USART_BLOCK_WITH_SCHEDULE
-				if (osSemaphoreAcquire(usart_dev->tx_sem, osWaitForever) != osOK) {
-					// Semaphore is not active or something else is wrong.
-					// Normally unreachable.
-					return -ENOLCK;
-				}
-#else
-				/**
-				 * @todo Coroutine or something else for no-os configuration.
-				*/
-#endif
-			}
-			else {
-				rest_count -= err;
-			}
+		usart_dev = (dev_stm32_usart_t *)dev->private_data;
+	}
+
+	if (usart_dev == NULL) {
+		return -ENODEV;
+	}
+	else {
+	}
+
+	if ((fd->file_flags & O_WRONLY) == 0) {
+		return -ENOTSUP;
+	}
+	else {
+	}
+
+	int32_t total = 0;
+	int32_t err;
+
+	err = __wr_lock(usart_dev, fd->file_flags);
+	if (err != 0) {
+		return err;
+	}
+	for (int32_t i = 0; i < iovcnt; i++) {
+		err = __tx_queue(usart_dev, fd->file_flags, (const char *)iov[i].iov_base, iov[i].iov_len);
+		if (err < 0) {
+			break;
 		}
-		err = count;
+		total += err;
+		if ((size_t)err < iov[i].iov_len) {
+			// O_NOBLOCK and the fifo is full
+			break;
+		}
+	}
+	__start_tx(usart_dev);
+	if ((err >= 0) || (total > 0)) {
+		err = total;
 	}
 #if _EN_USART_TIMESTAMP
 	memcpy(&(usart_dev->write_timestamp), &(usart_dev->tx_timestamp), sizeof(timeStamp_t));
 	usart_dev->tx_ts_valid = 0;
 #endif
-
-#if _WITH_CMSISOS_V2
-	osSemaphoreRelease(usart_dev->wr_sem);
-#else
-	ec_unlock(&(usart_dev->wr_lock));
-#endif
+	__wr_unlock(usart_dev);
 	return err;
 }
 
@@ -390,7 +501,7 @@ int32_t stm32_usart_ioctl(file_des_t *fd, uint32_t cmd, uint64_t arg)
 		uint32_t periphclk;
 		uint32_t oversampling;
 		uint32_t baudrate;
-		LL_USART_DisableIT_RXNE(usart_dev->handle);
+		__disable_rx_it(usart_dev);
 		LL_USART_Disable(usart_dev->handle);
 		periphclk = __get_stm32_usart_periphclk(usart_dev);
 		oversampling = LL_USART_GetOverSampling(usart_dev->handle);
@@ -398,7 +509,7 @@ int32_t stm32_usart_ioctl(file_des_t *fd, uint32_t cmd, uint64_t arg)
 		usart_dev->config->usart_conf->BaudRate = baudrate;
 		LL_USART_SetBaudRate(usart_dev->handle, periphclk, oversampling, baudrate);
 		LL_USART_Enable(usart_dev->handle);
-		LL_USART_EnableIT_RXNE(usart_dev->handle);
+		__enable_rx_it(usart_dev);
 		break;
 	}
 	case CMD_USART_GETBAUD: {
@@ -415,14 +526,86 @@ int32_t stm32_usart_ioctl(file_des_t *fd, uint32_t cmd, uint64_t arg)
 	}
 	case CMD_USART_ENABLE: {
 		LL_USART_Enable(usart_dev->handle);
-		LL_USART_EnableIT_RXNE(usart_dev->handle);
+		__enable_rx_it(usart_dev);
 		break;
 	}
 	case CMD_USART_DISABLE: {
-		LL_USART_DisableIT_RXNE(usart_dev->handle);
+		__disable_rx_it(usart_dev);
 		LL_USART_Disable(usart_dev->handle);
 		break;
 	}
+	case CMD_USART_GETRXDROPS: {
+		uint32_t *rtval;
+		rtval = (uint32_t *)((uintptr_t)arg & 0xffffffffU);
+		*rtval = cfifo_dropped(usart_dev->rx_buffer);
+		break;
+	}
+	case CMD_USART_SETRXWATERMARK: {
+		if ((arg & 0xffffffffU) > (uint64_t)__rx_capacity(usart_dev)) {
+			return -EINVAL;	 // the RX fifo never gets that full.
+		}
+		usart_dev->config->rx_watermark = (uint32_t)(arg & 0xffffffffU);
+		break;
+	}
+	case CMD_USART_GETRXWATERMARK: {
+		uint32_t *rtval;
+		rtval = (uint32_t *)((uintptr_t)arg & 0xffffffffU);
+		*rtval = usart_dev->config->rx_watermark;
+		break;
+	}
+	case CMD_USART_SETTXWATERMARK: {
+		usart_dev->config->tx_watermark = (uint32_t)(arg & 0xffffffffU);
+		break;
+	}
+	case CMD_USART_GETTXWATERMARK: {
+		uint32_t *rtval;
+		rtval = (uint32_t *)((uintptr_t)arg & 0xffffffffU);
+		*rtval = usart_dev->config->tx_watermark;
+		break;
+	}
+	case CMD_USART_SETIDLEWAKEUP: {
+		usart_dev->config->rx_idle_wakeup = (arg != 0) ? 1 : 0;
+		// A stopped receiver picks it up on CMD_USART_ENABLE.
+		if (LL_USART_IsEnabled(usart_dev->handle) && ((LL_USART_GetTransferDirection(usart_dev->handle) & LL_USART_DIRECTION_RX) != 0)) {
+			__update_idle_it(usart_dev);
+		}
+		break;
+	}
+	case CMD_USART_GETIDLEWAKEUP: {
+		uint32_t *rtval;
+		rtval = (uint32_t *)((uintptr_t)arg & 0xffffffffU);
+		*rtval = usart_dev->config->rx_idle_wakeup;
+		break;
+	}
+	case CMD_USART_SETFLOWCTRL: {
+		return __set_flow_ctrl(usart_dev, (uint32_t)(arg & 0xffffffffU));
+	}
+	case CMD_USART_GETFLOWCTRL: {
+		uint32_t *rtval;
+		rtval = (uint32_t *)((uintptr_t)arg & 0xffffffffU);
+		*rtval = usart_dev->config->flow_ctrl;
+		break;
+	}
+	case CMD_USART_SETRTSHIGH: {
+		usart_dev->config->rts_high_watermark = (uint32_t)(arg & 0xffffffffU);
+		break;
+	}
+	case CMD_USART_GETRTSHIGH: {
+		uint32_t *rtval;
+		rtval = (uint32_t *)((uintptr_t)arg & 0xffffffffU);
+		*rtval = usart_dev->config->rts_high_watermark;
+		break;
+	}
+	case CMD_USART_SETRTSLOW: {
+		usart_dev->config->rts_low_watermark = (uint32_t)(arg & 0xffffffffU);
+		break;
+	}
+	case CMD_USART_GETRTSLOW: {
+		uint32_t *rtval;
+		rtval = (uint32_t *)((uintptr_t)arg & 0xffffffffU);
+		*rtval = usart_dev->config->rts_low_watermark;
+		break;
+	}
 #if _EN_USART_TIMESTAMP
 	case CMD_USART_GETREADTS: {
 		timeStamp_t *dest = (timeStamp_t *)((uintptr_t)arg & 0xffffffffU);
@@ -434,6 +617,10 @@ int32_t stm32_usart_ioctl(file_des_t *fd, uint32_t cmd, uint64_t arg)
 		memcpy(dest, &(usart_dev->write_timestamp), sizeof(timeStamp_t));
 		break;
 	}
+	case CMD_USART_READTS: {
+		usart_ts_read_t *req = (usart_ts_read_t *)((uintptr_t)arg & 0xffffffffU);
+		return __read_ts(usart_dev, req);
+	}
 #endif
 	default:
 		return -EBADCMD;
@@ -453,11 +640,12 @@ int32_t stm32_usart_close(file_des_t *fd)
 		return -EBADFD;
 	}
 	else {
-		if (atomic_dec_and_test(&(fd->file->file_refs)) == 0) {
+		if (atomic_dec_and_test(&(usart_dev->open_refs)) == 0) {
 			__disable_stm32_usart(usart_dev);
-			atomic_inc(&(fd->file->file_refs));
+#if !_EN_USART_STATIC_BUFFER
 			cfifo_delete(usart_dev->rx_buffer);
 			cfifo_delete(usart_dev->tx_buffer);
+#endif
 #if _WITH_CMSISOS_V2
 			osSemaphoreDelete(usart_dev->rd_sem);
 			osSemaphoreDelete(usart_dev->wr_sem);
@@ -467,18 +655,67 @@ int32_t stm32_usart_close(file_des_t *fd)
 			return 0;
 		}
 		else {
-			atomic_inc(&(fd->file->file_refs));
 			return 0;
 		}
 	}
 }
 
+/**
+ * Readable once anything is buffered, writable once the TX watermark
+ * worth of space is free, the same level a blocked write waits for.
+*/
+uint32_t stm32_usart_poll(file_des_t *fd, ec_poll_table_t *table)
+{
+	file_t *file;
+	ec_dev_t *dev;
+	dev_stm32_usart_t *usart_dev;
+	uint32_t mask = 0;
+
+	if (fd == NULL) {
+		return EC_POLLERR;
+	}
+	else {
+		file = (file_t *)fd->file;
+	}
+
+	if (file == NULL) {
+		return EC_POLLERR;
+	}
+	else {
+		dev = (ec_dev_t *)file->file_content;
+	}
+
+	if (dev == NULL) {
+		return EC_POLLERR;
+	}
+	else {
+		usart_dev = (dev_stm32_usart_t *)dev->private_data;
+	}
+
+	if ((usart_dev == NULL) || (usart_dev->rx_buffer == NULL) || (usart_dev->tx_buffer == NULL)) {
+		return EC_POLLERR;
+	}
+	else {
+	}
+
+	// Hook before checking, data landing in between still wakes us.
+	ec_poll_wait(&(usart_dev->poll_waitq), table);
+	if ((fd->file_flags & O_RDONLY) && (cfifo_used(usart_dev->rx_buffer) > 0)) {
+		mask |= EC_POLLIN;
+	}
+	if ((fd->file_flags & O_WRONLY) &&
+		(cfifo_free(usart_dev->tx_buffer) >= (int32_t)__wait_level(usart_dev->tx_buffer->depth, usart_dev->config->tx_watermark, usart_dev->tx_buffer->depth))) {
+		mask |= EC_POLLOUT;
+	}
+	return mask;
+}
+
 void ECDRV_IRQ_Handler_USART(ec_dev_t *dev)
 {
 	dev_stm32_usart_t *dev_usart = (dev_stm32_usart_t *)dev->private_data;
 	USART_TypeDef *husart = dev_usart->handle;
 	int32_t err;
-	char ch, discard;
+	char ch;
 
 #if _EN_USART_TIMESTAMP
 	timeStamp_t tmp_ts;
@@ -497,15 +734,19 @@ void ECDRV_IRQ_Handler_USART(ec_dev_t *dev)
 		return;
 	}
 
-	if (LL_USART_IsActiveFlag_RXNE(husart)) {
+	if ((dev_usart->config->rx_dma == NULL) && LL_USART_IsActiveFlag_RXNE(husart)) {
 		if (dev_usart->rx_buffer == NULL) {
 			return;
 		}
 		else {
 			ch = LL_USART_ReceiveData8(husart);
-			while (cfifo_push(dev_usart->rx_buffer, ch) == -EFIFOFULL) {
-				err = cfifo_pop(dev_usart->rx_buffer, &discard);
-			}
+#if _EN_USART_TIMESTAMP
+			__rx_mark(dev_usart, dev_usart->rx_buffer->tail, &tmp_ts);
+#endif
+			// RX fifo overwrites the oldest byte when full, drops are
+			// counted inside the fifo.
+			err = cfifo_push(dev_usart->rx_buffer, ch);
+			__rts_check_high(dev_usart);
 #if _EN_USART_TIMESTAMP
 			if (!dev_usart->rx_ts_valid) {
 				memcpy(&(dev_usart->rx_timestamp), &tmp_ts, sizeof(timeStamp_t));
@@ -513,7 +754,22 @@ void ECDRV_IRQ_Handler_USART(ec_dev_t *dev)
 			}
 #endif
 		}
-		osSemaphoreRelease(dev_usart->rx_sem);
+		__rx_wakeup(dev_usart, 0);
+	}
+
+	if (LL_USART_IsEnabledIT_IDLE(husart) && LL_USART_IsActiveFlag_IDLE(husart)) {
+		// Clearing IDLE reads DR, RXNE above has already drained it.
+		LL_USART_ClearFlag_IDLE(husart);
+		if (dev_usart->rx_buffer != NULL) {
+			if (dev_usart->config->rx_dma != NULL) {
+				__rx_dma_publish(dev_usart);
+			}
+#if _EN_USART_TIMESTAMP
+			dev_usart->rx_burst_open = 0;
+#endif
+			// Line went quiet, hand a short burst to the reader now.
+			__rx_wakeup(dev_usart, dev_usart->config->rx_idle_wakeup);
+		}
 	}
 
 	if (LL_USART_IsEnabledIT_TXE(husart)) {
@@ -538,11 +794,66 @@ void ECDRV_IRQ_Handler_USART(ec_dev_t *dev)
 					LL_USART_TransmitData8(husart, ch);
 				}
 			}
-			osSemaphoreRelease(dev_usart->tx_sem);
+			__tx_wakeup(dev_usart);
 		}
 	}
 }
 
+void ECDRV_IRQ_Handler_USART_RXDMA(ec_dev_t *dev)
+{
+	dev_stm32_usart_t *dev_usart;
+
+	if (dev == NULL) {
+		return;
+	}
+	else {
+		dev_usart = (dev_stm32_usart_t *)dev->private_data;
+	}
+
+	if ((dev_usart == NULL) || (dev_usart->config->rx_dma == NULL)) {
+		return;
+	}
+	else {
+	}
+
+	// Half or full transfer, publish whatever the DMA has written so far.
+	__clear_dma_flags(dev_usart->config->rx_dma, dev_usart->config->rx_dma_stream);
+	if (dev_usart->rx_buffer != NULL) {
+		__rx_dma_publish(dev_usart);
+		__rx_wakeup(dev_usart, 0);
+	}
+}
+
+void ECDRV_IRQ_Handler_USART_TXDMA(ec_dev_t *dev)
+{
+	dev_stm32_usart_t *dev_usart;
+
+	if (dev == NULL) {
+		return;
+	}
+	else {
+		dev_usart = (dev_stm32_usart_t *)dev->private_data;
+	}
+
+	if ((dev_usart == NULL) || (dev_usart->config->tx_dma == NULL)) {
+		return;
+	}
+	else {
+	}
+
+	__clear_dma_flags(dev_usart->config->tx_dma, dev_usart->config->tx_dma_stream);
+	if (dev_usart->tx_buffer == NULL) {
+		dev_usart->tx_dma_len = 0;
+		return;
+	}
+	// Transfer complete, free the sent span and chain whatever was
+	// queued behind it while it was in flight.
+	cfifo_read_release(dev_usart->tx_buffer, (int32_t)dev_usart->tx_dma_len);
+	dev_usart->tx_dma_len = 0;
+	__tx_dma_launch(dev_usart);
+	__tx_wakeup(dev_usart);
+}
+
 static void __init_stm32_usart(dev_stm32_usart_t *usart_dev, uint32_t flags)
 {
 	// Peripheral clock enable
@@ -559,6 +870,16 @@ static void __init_stm32_usart(dev_stm32_usart_t *usart_dev, uint32_t flags)
 	// Config peripheral GPIO
 	LL_GPIO_Init(usart_dev->config->rx_io_port, usart_dev->config->rx_pin_conf);
 	LL_GPIO_Init(usart_dev->config->tx_io_port, usart_dev->config->tx_pin_conf);
+	if (usart_dev->config->rts_pin_conf != NULL) {
+		// Asserted (low) until the RX fifo fills up
+		LL_GPIO_ResetOutputPin(usart_dev->config->rts_io_port, usart_dev->config->rts_pin_conf->Pin);
+		LL_GPIO_Init(usart_dev->config->rts_io_port, usart_dev->config->rts_pin_conf);
+	}
+	if (usart_dev->config->cts_pin_conf != NULL) {
+		LL_GPIO_Init(usart_dev->config->cts_io_port, usart_dev->config->cts_pin_conf);
+	}
+	usart_dev->rts_held = 0;
+	ec_waitq_init(&(usart_dev->poll_waitq));
 	// Config peripheral IRQn
 	NVIC_SetPriority(usart_dev->config->irqn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 5, 0));
 	NVIC_EnableIRQ(usart_dev->config->irqn);
@@ -567,10 +888,26 @@ static void __init_stm32_usart(dev_stm32_usart_t *usart_dev, uint32_t flags)
 	// Currently, we only use USART ports as asynchronize mode.
 	// You could add synchronize mode support by yourself.
 	LL_USART_ConfigAsyncMode(usart_dev->handle);
+	// Circular RX DMA straight into the RX fifo buffer
+	if (usart_dev->config->rx_dma != NULL) {
+		__init_rx_dma(usart_dev);
+	}
+	if (usart_dev->config->tx_dma != NULL) {
+		__init_tx_dma(usart_dev);
+	}
+	// RTS/CTS as configured, unwired pins just leave it off
+	if (__set_flow_ctrl(usart_dev, usart_dev->config->flow_ctrl) != 0) {
+		usart_dev->config->flow_ctrl = 0;
+	}
 	// Enable peripheral
 	LL_USART_Enable(usart_dev->handle);
-	// Enable 'receive not empty' interrupt
-	LL_USART_EnableIT_RXNE(usart_dev->handle);
+#if _EN_USART_TIMESTAMP
+	usart_dev->rx_marks_head = 0;
+	usart_dev->rx_marks_tail = 0;
+	usart_dev->rx_burst_open = 0;
+#endif
+	// Enable 'receive not empty' and 'idle line' interrupts
+	__enable_rx_it(usart_dev);
 	return;
 }
 
@@ -579,10 +916,17 @@ static void __disable_stm32_usart(dev_stm32_usart_t *usart_dev)
 	// Should we disable the peripheral clock here?
 	// Not sure about it. Should check if this clock is shared with other periphs.
 
-	// Disable 'receive not empty' interrupt
-	LL_USART_DisableIT_RXNE(usart_dev->handle);
+	// Disable 'receive not empty' and 'idle line' interrupts
+	__disable_rx_it(usart_dev);
 	// Disable peripheral
 	LL_USART_Disable(usart_dev->handle);
+	// Stop RX DMA, the fifo buffer is about to be freed
+	if (usart_dev->config->rx_dma != NULL) {
+		__disable_rx_dma(usart_dev);
+	}
+	if (usart_dev->config->tx_dma != NULL) {
+		__disable_tx_dma(usart_dev);
+	}
 	// Disable peripheral IRQn
 	NVIC_DisableIRQ(usart_dev->config->irqn);
 	return;
@@ -606,3 +950,557 @@ uint32_t __get_stm32_usart_periphclk(dev_stm32_usart_t *usart_dev)
 	}
 	return periphclk;
 }
+
+/**
+ * Fill level (RX) or free space (TX) a blocked task waits for: the
+ * watermark, but never more than the task still needs or the fifo holds.
+*/
+static uint32_t __wait_level(size_t rest_count, uint32_t watermark, int32_t depth)
+{
+	uint32_t level = (watermark == 0) ? 1 : watermark;
+	if (level > rest_count) {
+		level = rest_count;
+	}
+	if (level > (uint32_t)depth) {
+		level = (uint32_t)depth;
+	}
+	return (level == 0) ? 1 : level;
+}
+
+/**
+ * Most chars the RX fifo holds, RX DMA keeps half of it free, see
+ * __rx_dma_publish().
+*/
+static int32_t __rx_capacity(dev_stm32_usart_t *usart_dev)
+{
+	int32_t depth = usart_dev->rx_buffer->depth;
+	return (usart_dev->config->rx_dma != NULL) ? (depth >> 1) : depth;
+}
+
+#if _WITH_CMSISOS_V2 && _EN_USART_STATIC_BUFFER
+static osSemaphoreId_t __static_sem_new(StaticSemaphore_t *cb)
+{
+	osSemaphoreAttr_t attr = {
+		.name = NULL,
+		.attr_bits = 0,
+		.cb_mem = cb,
+		.cb_size = sizeof(StaticSemaphore_t),
+	};
+	return osSemaphoreNew(1, 1, &attr);
+}
+#endif
+
+#if _WITH_CMSISOS_V2
+static uint32_t __ms_to_ticks(uint32_t ms)
+{
+	return (uint32_t)(((uint64_t)ms * osKernelGetTickFreq() + 999U) / 1000U);
+}
+#endif
+
+/**
+ * RXNE is used only without RX DMA. IDLE is needed by RX DMA to publish
+ * a short tail, otherwise only if idle wakeup is asked for.
+*/
+static void __enable_rx_it(dev_stm32_usart_t *usart_dev)
+{
+	if (usart_dev->config->rx_dma == NULL) {
+		LL_USART_EnableIT_RXNE(usart_dev->handle);
+	}
+	__update_idle_it(usart_dev);
+}
+
+/**
+ * IDLE is needed by RX DMA and timestamps regardless of rx_idle_wakeup.
+*/
+static void __update_idle_it(dev_stm32_usart_t *usart_dev)
+{
+	if ((usart_dev->config->rx_dma != NULL) || usart_dev->config->rx_idle_wakeup || _EN_USART_TIMESTAMP) {
+		LL_USART_EnableIT_IDLE(usart_dev->handle);
+	}
+	else {
+		LL_USART_DisableIT_IDLE(usart_dev->handle);
+	}
+}
+
+static void __disable_rx_it(dev_stm32_usart_t *usart_dev)
+{
+	LL_USART_DisableIT_RXNE(usart_dev->handle);
+	LL_USART_DisableIT_IDLE(usart_dev->handle);
+}
+
+/**
+ * Wake the blocked reader if the fill level it waits for is reached, or
+ * on idle line if anything at all is buffered.
+*/
+static void __rx_wakeup(dev_stm32_usart_t *usart_dev, uint32_t idle)
+{
+	uint32_t level = usart_dev->rx_wait_level;
+	int32_t used;
+	ec_waitq_wake(&(usart_dev->poll_waitq));
+	if (level == 0) {
+		return;
+	}
+	used = cfifo_used(usart_dev->rx_buffer);
+	if ((used >= (int32_t)level) || (idle && (used > 0))) {
+		usart_dev->rx_wait_level = 0;
+		osSemaphoreRelease(usart_dev->rx_sem);
+	}
+}
+
+static void __init_rx_dma(dev_stm32_usart_t *usart_dev)
+{
+	DMA_TypeDef *dma = usart_dev->config->rx_dma;
+	uint32_t stream = usart_dev->config->rx_dma_stream;
+	cfifo_t *fifo = usart_dev->rx_buffer;
+
+	LL_AHB1_GRP1_EnableClock((dma == DMA1) ? LL_AHB1_GRP1_PERIPH_DMA1 : LL_AHB1_GRP1_PERIPH_DMA2);
+	LL_DMA_DisableStream(dma, stream);
+	while (LL_DMA_IsEnabledStream(dma, stream)) {
+	}
+	LL_DMA_SetChannelSelection(dma, stream, usart_dev->config->rx_dma_channel);
+	LL_DMA_ConfigTransfer(dma, stream,
+						  LL_DMA_DIRECTION_PERIPH_TO_MEMORY | LL_DMA_MODE_CIRCULAR |
+							  LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+							  LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE |
+							  LL_DMA_PRIORITY_HIGH);
+	LL_DMA_DisableFifoMode(dma, stream);
+	LL_DMA_SetPeriphAddress(dma, stream, (uint32_t)&(usart_dev->handle->DR));
+	// DMA writes position (tail & mask) onwards, the fifo tail starts at 0
+	// and its depth is the DMA buffer length, so both wrap together.
+	LL_DMA_SetMemoryAddress(dma, stream, (uint32_t)(fifo->fifo));
+	LL_DMA_SetDataLength(dma, stream, (uint32_t)fifo->depth);
+	__clear_dma_flags(dma, stream);
+	LL_DMA_EnableIT_HT(dma, stream);
+	LL_DMA_EnableIT_TC(dma, stream);
+	// Same priority as the USART IRQ, the two never preempt each other
+	// so the fifo keeps a single producer.
+	NVIC_SetPriority(usart_dev->config->rx_dma_irqn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 5, 0));
+	NVIC_EnableIRQ(usart_dev->config->rx_dma_irqn);
+	LL_DMA_EnableStream(dma, stream);
+	LL_USART_EnableDMAReq_RX(usart_dev->handle);
+}
+
+static void __disable_rx_dma(dev_stm32_usart_t *usart_dev)
+{
+	DMA_TypeDef *dma = usart_dev->config->rx_dma;
+	uint32_t stream = usart_dev->config->rx_dma_stream;
+
+	LL_USART_DisableDMAReq_RX(usart_dev->handle);
+	NVIC_DisableIRQ(usart_dev->config->rx_dma_irqn);
+	LL_DMA_DisableIT_HT(dma, stream);
+	LL_DMA_DisableIT_TC(dma, stream);
+	LL_DMA_DisableStream(dma, stream);
+	while (LL_DMA_IsEnabledStream(dma, stream)) {
+	}
+	__clear_dma_flags(dma, stream);
+}
+
+static void __clear_dma_flags(DMA_TypeDef *dma, uint32_t stream)
+{
+	// Flag groups of streams 0..3 in LIFCR and 4..7 in HIFCR.
+	static const uint8_t shift[4] = {0, 6, 16, 22};
+	uint32_t bits = (DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CTEIF0 | DMA_LIFCR_CDMEIF0 | DMA_LIFCR_CFEIF0) << shift[stream & 3U];
+	if (stream < LL_DMA_STREAM_4) {
+		WRITE_REG(dma->LIFCR, bits);
+	}
+	else {
+		WRITE_REG(dma->HIFCR, bits);
+	}
+}
+
+/**
+ * Commit the chars the DMA wrote since the last call. HT and TC come
+ * every half buffer, so before the next one the DMA writes at most up to
+ * the coming half boundary; that region is kept free, dropping the oldest
+ * unread chars, so the DMA never lands on data a reader may be copying.
+ * The fifo holds at most half its depth once it gets that full.
+ * If an interrupt was late and the DMA ran past the free space anyway,
+ * the overwritten chars are dropped and counted by the advance instead of
+ * being read as if they were the old ones.
+*/
+static void __rx_dma_publish(dev_stm32_usart_t *usart_dev)
+{
+	cfifo_t *fifo = usart_dev->rx_buffer;
+	uint32_t half = (uint32_t)fifo->depth >> 1;
+	uint32_t pos;
+	int32_t n;
+	pos = (uint32_t)fifo->depth - LL_DMA_GetDataLength(usart_dev->config->rx_dma, usart_dev->config->rx_dma_stream);
+	n = (int32_t)((pos - fifo->tail) & fifo->mask);
+	if (n > 0) {
+#if _EN_USART_TIMESTAMP
+		// Only as fine as HT/TC/IDLE, the chars came in before now.
+		timeStamp_t ts;
+		ECTimeStamp(&ts);
+		__rx_mark(usart_dev, fifo->tail, &ts);
+		if (!usart_dev->rx_ts_valid) {
+			memcpy(&(usart_dev->rx_timestamp), &ts, sizeof(timeStamp_t));
+			usart_dev->rx_ts_valid = 1;
+		}
+#endif
+		// Overrun if n > cfifo_free(), the advance drops what was lost.
+		cfifo_write_advance(fifo, n);
+		__rts_check_high(usart_dev);
+	}
+	cfifo_write_guard(fifo, (int32_t)(half - (pos & (half - 1U))));
+}
+
+/**
+ * Take wr_sem, without waiting in ISR or with O_NOBLOCK.
+*/
+static int32_t __wr_lock(dev_stm32_usart_t *usart_dev, uint32_t flags)
+{
+#if _WITH_CMSISOS_V2
+	if (__get_IPSR() != 0) {
+		if (osSemaphoreAcquire(usart_dev->wr_sem, 0) != osOK) {
+			return -EBUSY;
+		}
+	}
+	else {
+		if (flags & O_NOBLOCK) {
+			if (osSemaphoreAcquire(usart_dev->wr_sem, 0) != osOK) {
+				return -EBUSY;
+			}
+		}
+		else {
+			if (osSemaphoreAcquire(usart_dev->wr_sem, osWaitForever) != osOK) {
+				// unlikely
+				return -ENOLCK;
+			}
+		}
+	}
+#else
+	if (ec_try_lock(&(usart_dev->wr_lock)) == -EBUSY) {
+		if (__get_IPSR() != 0) {
+			// If we are in ISR, we should never block.
+			return -EBUSY;
+		}
+		else {
+			/**
+				 * @todo Coroutine or something else for no-os configuration.
+				 * */
+			return (flags & O_NOBLOCK) ? -EBUSY : -ENOTSUP;
+		}
+	}
+#endif
+	return 0;
+}
+
+static void __wr_unlock(dev_stm32_usart_t *usart_dev)
+{
+#if _WITH_CMSISOS_V2
+	osSemaphoreRelease(usart_dev->wr_sem);
+#else
+	ec_unlock(&(usart_dev->wr_lock));
+#endif
+}
+
+/**
+ * Copy count chars into the TX fifo, wr_sem held. Blocks for space
+ * unless O_NOBLOCK. TX is kicked here only when the fifo is full, the
+ * caller kicks it once after its last segment.
+*/
+static int32_t __tx_queue(dev_stm32_usart_t *usart_dev, uint32_t flags, const char *data, size_t count)
+{
+	size_t rest_count = count;
+	int32_t err;
+
+	if (flags & O_NOBLOCK) {
+		return cfifo_pushn(usart_dev->tx_buffer, data, count);
+	}
+	while (rest_count > 0) {
+		err = cfifo_pushn(usart_dev->tx_buffer, &data[count - rest_count], rest_count);
+		if (err < 0) {
+			__start_tx(usart_dev);
+#if _WITH_CMSISOS_V2 && STM32_USART_BLOCK_WITH_SCHEDULE
+			uint32_t level = __wait_level(rest_count, usart_dev->config->tx_watermark, usart_dev->tx_buffer->depth);
+			usart_dev->tx_wait_level = level;
+			if (cfifo_free(usart_dev->tx_buffer) < level) {
+				if (osSemaphoreAcquire(usart_dev->tx_sem, osWaitForever) != osOK) {
+					// Semaphore is not active or something else is wrong.
+					// Normally unreachable.
+					usart_dev->tx_wait_level = 0;
+					return -ENOLCK;
+				}
+			}
+			usart_dev->tx_wait_level = 0;
+#else
+			/**
+			 * @todo Coroutine or something else for no-os configuration.
+			*/
+#endif
+		}
+		else {
+			rest_count -= err;
+		}
+	}
+	return (int32_t)count;
+}
+
+/**
+ * Kick the transmitter after pushing into the TX fifo: TXE interrupt, or
+ * a DMA transfer if none is in flight. The DMA IRQ is masked meanwhile,
+ * it is the only other place launching transfers.
+*/
+static void __start_tx(dev_stm32_usart_t *usart_dev)
+{
+	if (usart_dev->config->tx_dma == NULL) {
+		LL_USART_EnableIT_TXE(usart_dev->handle);
+	}
+	else {
+		NVIC_DisableIRQ(usart_dev->config->tx_dma_irqn);
+		if (usart_dev->tx_dma_len == 0) {
+			__tx_dma_launch(usart_dev);
+		}
+		NVIC_EnableIRQ(usart_dev->config->tx_dma_irqn);
+	}
+}
+
+static void __tx_wakeup(dev_stm32_usart_t *usart_dev)
+{
+	uint32_t level = usart_dev->tx_wait_level;
+	ec_waitq_wake(&(usart_dev->poll_waitq));
+	if ((level != 0) && (cfifo_free(usart_dev->tx_buffer) >= (int32_t)level)) {
+		usart_dev->tx_wait_level = 0;
+		osSemaphoreRelease(usart_dev->tx_sem);
+	}
+}
+
+static void __init_tx_dma(dev_stm32_usart_t *usart_dev)
+{
+	DMA_TypeDef *dma = usart_dev->config->tx_dma;
+	uint32_t stream = usart_dev->config->tx_dma_stream;
+
+	LL_AHB1_GRP1_EnableClock((dma == DMA1) ? LL_AHB1_GRP1_PERIPH_DMA1 : LL_AHB1_GRP1_PERIPH_DMA2);
+	LL_DMA_DisableStream(dma, stream);
+	while (LL_DMA_IsEnabledStream(dma, stream)) {
+	}
+	LL_DMA_SetChannelSelection(dma, stream, usart_dev->config->tx_dma_channel);
+	LL_DMA_ConfigTransfer(dma, stream,
+						  LL_DMA_DIRECTION_MEMORY_TO_PERIPH | LL_DMA_MODE_NORMAL |
+							  LL_DMA_PERIPH_NOINCREMENT | LL_DMA_MEMORY_INCREMENT |
+							  LL_DMA_PDATAALIGN_BYTE | LL_DMA_MDATAALIGN_BYTE |
+							  LL_DMA_PRIORITY_MEDIUM);
+	LL_DMA_DisableFifoMode(dma, stream);
+	LL_DMA_SetPeriphAddress(dma, stream, (uint32_t)&(usart_dev->handle->DR));
+	__clear_dma_flags(dma, stream);
+	LL_DMA_EnableIT_TC(dma, stream);
+	usart_dev->tx_dma_len = 0;
+	NVIC_SetPriority(usart_dev->config->tx_dma_irqn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 5, 0));
+	NVIC_EnableIRQ(usart_dev->config->tx_dma_irqn);
+	LL_USART_EnableDMAReq_TX(usart_dev->handle);
+}
+
+static void __disable_tx_dma(dev_stm32_usart_t *usart_dev)
+{
+	DMA_TypeDef *dma = usart_dev->config->tx_dma;
+	uint32_t stream = usart_dev->config->tx_dma_stream;
+
+	LL_USART_DisableDMAReq_TX(usart_dev->handle);
+	NVIC_DisableIRQ(usart_dev->config->tx_dma_irqn);
+	LL_DMA_DisableIT_TC(dma, stream);
+	LL_DMA_DisableStream(dma, stream);
+	while (LL_DMA_IsEnabledStream(dma, stream)) {
+	}
+	__clear_dma_flags(dma, stream);
+	usart_dev->tx_dma_len = 0;
+}
+
+/**
+ * Send the first contiguous span of the TX fifo. A wrapped tail is sent
+ * by the next launch from the TC interrupt. The span stays in the fifo
+ * until its transfer completes.
+*/
+static void __tx_dma_launch(dev_stm32_usart_t *usart_dev)
+{
+	DMA_TypeDef *dma = usart_dev->config->tx_dma;
+	uint32_t stream = usart_dev->config->tx_dma_stream;
+	cfifo_span_t span[2];
+
+	if (cfifo_read_peek(usart_dev->tx_buffer, span) <= 0) {
+		return;
+	}
+#if _EN_USART_TIMESTAMP
+	if (!usart_dev->tx_ts_valid) {
+		ECTimeStamp(&(usart_dev->tx_timestamp));
+		usart_dev->tx_ts_valid = 1;
+	}
+#endif
+	usart_dev->tx_dma_len = (uint32_t)span[0].len;
+	LL_DMA_SetMemoryAddress(dma, stream, (uint32_t)(span[0].ptr));
+	LL_DMA_SetDataLength(dma, stream, (uint32_t)span[0].len);
+	__clear_dma_flags(dma, stream);
+	LL_DMA_EnableStream(dma, stream);
+}
+
+#if _EN_USART_TIMESTAMP
+/**
+ * Called by the RX producer before publishing chars starting at offset.
+ * Starts a new mark on the first char after an idle line, or every
+ * rx_ts_chunk chars. A full ring drops the new mark.
+*/
+static void __rx_mark(dev_stm32_usart_t *usart_dev, uint32_t offset, const timeStamp_t *ts)
+{
+	uint32_t tail = usart_dev->rx_marks_tail;
+	uint32_t chunk = usart_dev->config->rx_ts_chunk;
+	usart_rx_mark_t *mark;
+
+	if (usart_dev->rx_burst_open && ((chunk == 0) || ((offset - usart_dev->rx_mark_offset) < chunk))) {
+		return;
+	}
+	usart_dev->rx_burst_open = 1;
+	usart_dev->rx_mark_offset = offset;
+	if ((tail - usart_dev->rx_marks_head) >= STM32_USART_RX_MARKS) {
+		return;
+	}
+	mark = &(usart_dev->rx_marks[tail & (STM32_USART_RX_MARKS - 1)]);
+	memcpy(&(mark->ts), ts, sizeof(timeStamp_t));
+	mark->offset = offset;
+	__DMB();
+	usart_dev->rx_marks_tail = tail + 1;
+}
+
+/**
+ * Drop marks whose burst is entirely consumed, that is, followed by a
+ * mark at or before the fifo head. The latest such mark is kept, it
+ * still describes the data at the head.
+*/
+static void __rx_marks_trim(dev_stm32_usart_t *usart_dev)
+{
+	uint32_t head = usart_dev->rx_marks_head;
+	uint32_t tail = usart_dev->rx_marks_tail;
+	uint32_t data_head = usart_dev->rx_buffer->head;
+
+	while (((tail - head) >= 2) &&
+		   ((int32_t)(usart_dev->rx_marks[(head + 1) & (STM32_USART_RX_MARKS - 1)].offset - data_head) <= 0)) {
+		head++;
+	}
+	usart_dev->rx_marks_head = head;
+}
+
+static int32_t __read_ts(dev_stm32_usart_t *usart_dev, usart_ts_read_t *req)
+{
+	uint32_t data_head;
+	uint32_t head;
+	uint32_t tail;
+	int32_t n;
+	usart_rx_mark_t *mark;
+
+	if ((req == NULL) || (req->data == NULL)) {
+		return -EINVAL;
+	}
+	else {
+	}
+
+#if _WITH_CMSISOS_V2
+	if (osSemaphoreAcquire(usart_dev->rd_sem, 0) != osOK) {
+		return -EBUSY;
+	}
+#else
+	if (ec_try_lock(&(usart_dev->rd_lock)) == -EBUSY) {
+		return -EBUSY;
+	}
+#endif
+	__rx_marks_trim(usart_dev);
+	data_head = usart_dev->rx_buffer->head;
+	n = cfifo_popn(usart_dev->rx_buffer, req->data, (int32_t)req->size);
+	__rts_check_low(usart_dev);
+	if (n < 0) {
+		n = 0;
+	}
+	else {
+		// An overwriting producer may have moved head under us, the
+		// chars read always end at the new head.
+		data_head = usart_dev->rx_buffer->head - (uint32_t)n;
+	}
+	req->len = (uint32_t)n;
+	req->marks_len = 0;
+	head = usart_dev->rx_marks_head;
+	tail = usart_dev->rx_marks_tail;
+	while ((head != tail) && (req->marks_len < req->nmarks) && (req->marks != NULL)) {
+		mark = &(usart_dev->rx_marks[head & (STM32_USART_RX_MARKS - 1)]);
+		if ((int32_t)(mark->offset - (data_head + (uint32_t)n)) >= 0) {
+			break;
+		}
+		memcpy(&(req->marks[req->marks_len].ts), &(mark->ts), sizeof(timeStamp_t));
+		req->marks[req->marks_len].offset = ((int32_t)(mark->offset - data_head) > 0) ? (mark->offset - data_head) : 0;
+		req->marks_len++;
+		head++;
+	}
+	__rx_marks_trim(usart_dev);
+#if _WITH_CMSISOS_V2
+	osSemaphoreRelease(usart_dev->rd_sem);
+#else
+	ec_unlock(&(usart_dev->rd_lock));
+#endif
+	return n;
+}
+#endif
+
+/**
+ * RTS is a plain output so it follows the fifo fill level rather than
+ * the single-char receive register the hardware RTS would watch. CTS is
+ * left to the hardware, which exists only on USART1/2/3/6.
+*/
+static int32_t __set_flow_ctrl(dev_stm32_usart_t *usart_dev, uint32_t flow)
+{
+	if ((flow & ~(USART_FLOW_RTS | USART_FLOW_CTS)) != 0) {
+		return -EINVAL;
+	}
+	if ((flow & USART_FLOW_RTS) && (usart_dev->config->rts_pin_conf == NULL)) {
+		return -ENOTSUP;
+	}
+	if ((flow & USART_FLOW_CTS) && ((usart_dev->config->cts_pin_conf == NULL) || !IS_UART_HWFLOW_INSTANCE(usart_dev->handle))) {
+		return -ENOTSUP;
+	}
+	usart_dev->config->flow_ctrl = flow;
+	if (flow & USART_FLOW_CTS) {
+		LL_USART_EnableCTSHWFlowCtrl(usart_dev->handle);
+	}
+	else {
+		LL_USART_DisableCTSHWFlowCtrl(usart_dev->handle);
+	}
+	if ((usart_dev->config->rts_pin_conf != NULL) && ((flow & USART_FLOW_RTS) == 0)) {
+		usart_dev->rts_held = 0;
+		LL_GPIO_ResetOutputPin(usart_dev->config->rts_io_port, usart_dev->config->rts_pin_conf->Pin);
+	}
+	return 0;
+}
+
+/**
+ * Producer side, deassert RTS once the RX fifo is above the high mark.
+ * With RX DMA this runs at HT/TC/IDLE only, leave some room above it.
+*/
+static void __rts_check_high(dev_stm32_usart_t *usart_dev)
+{
+	uint32_t high = usart_dev->config->rts_high_watermark;
+	if (((usart_dev->config->flow_ctrl & USART_FLOW_RTS) == 0) || usart_dev->rts_held) {
+		return;
+	}
+	if (high == 0) {
+		// RX DMA keeps up to half the fifo free, see __rx_dma_publish().
+		high = (uint32_t)usart_dev->rx_buffer->depth / 8U * ((usart_dev->config->rx_dma != NULL) ? 3U : 6U);
+	}
+	if ((uint32_t)cfifo_used(usart_dev->rx_buffer) >= high) {
+		usart_dev->rts_held = 1;
+		LL_GPIO_SetOutputPin(usart_dev->config->rts_io_port, usart_dev->config->rts_pin_conf->Pin);
+	}
+}
+
+/**
+ * Consumer side, reassert RTS once the reader drained below the low mark.
+ * If this races with the ISR, the next received char deasserts it again.
+*/
+static void __rts_check_low(dev_stm32_usart_t *usart_dev)
+{
+	uint32_t low = usart_dev->config->rts_low_watermark;
+	if (((usart_dev->config->flow_ctrl & USART_FLOW_RTS) == 0) || !usart_dev->rts_held) {
+		return;
+	}
+	if (low == 0) {
+		low = (uint32_t)usart_dev->rx_buffer->depth / 4U;
+	}
+	if ((uint32_t)cfifo_used(usart_dev->rx_buffer) <= low) {
+		usart_dev->rts_held = 0;
+		LL_GPIO_ResetOutputPin(usart_dev->config->rts_io_port, usart_dev->config->rts_pin_conf->Pin);
+	}
+}
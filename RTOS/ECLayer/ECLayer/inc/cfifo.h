@@ -21,24 +21,82 @@
 */
 
 #pragma once
+#include "ec_config.h"
 #include "ec_lock.h"
 
 #include <stdint.h>
 
+/**
+ * What to do when pushing into a full fifo.
+ */
+typedef enum {
+	e_CFIFO_Reject = 0,		  //!< fail with -EFIFOFULL
+	e_CFIFO_OverwriteOldest,  //!< discard the oldest stored chars
+	e_CFIFO_DropNewest,		  //!< discard the chars being pushed
+} cfifo_policy_t;
+
+/**
+ * Depth of cfifo is always a power of 2, head and tail are free-running
+ * counters and are masked only when indexing the buffer, so the used
+ * count is simply (tail - head).
+ * Consumer side fields and producer side fields are kept in separate
+ * cache lines. The producer only writes tail, the consumer only writes
+ * head, except that an overwriting producer advances head with an
+ * exclusive store, which makes the consumer retry its read.
+ */
 typedef struct {
-	int32_t head;
-	int32_t tail;
-	int32_t usedw;
-	int32_t depth;
-	ec_lock_t pushlock;
+	volatile uint32_t head;
 	ec_lock_t poplock;
+	uint32_t peek;
+	char __pad_head[_CFIFO_CACHELINE_SIZE - 3 * sizeof(uint32_t)];
+	volatile uint32_t tail;
+	ec_lock_t pushlock;
+	uint32_t dropped;
+	char __pad_tail[_CFIFO_CACHELINE_SIZE - 3 * sizeof(uint32_t)];
+	uint32_t mask;
+	int32_t depth;
+	cfifo_policy_t policy;
 	char fifo[1];
 } cfifo_t;
 
-cfifo_t *cfifo_new(int32_t n);
+/**
+ * Bytes of storage needed by cfifo_init() for a requested depth n, and
+ * a declaration of such storage, usable at file scope. Place alignment
+ * attributes after it, e.g. __ALIGNED(_CFIFO_CACHELINE_SIZE).
+ */
+#define __CFIFO_SMEAR1(x)	((x) | ((x) >> 1))
+#define __CFIFO_SMEAR2(x)	(__CFIFO_SMEAR1(x) | (__CFIFO_SMEAR1(x) >> 2))
+#define __CFIFO_SMEAR4(x)	(__CFIFO_SMEAR2(x) | (__CFIFO_SMEAR2(x) >> 4))
+#define __CFIFO_SMEAR8(x)	(__CFIFO_SMEAR4(x) | (__CFIFO_SMEAR4(x) >> 8))
+#define __CFIFO_SMEAR16(x)	(__CFIFO_SMEAR8(x) | (__CFIFO_SMEAR8(x) >> 16))
+#define CFIFO_DEPTH(n)		(__CFIFO_SMEAR16((uint32_t)(n) - 1U) + 1U)
+#define CFIFO_STORAGE_SIZE(n)	(sizeof(cfifo_t) - 1U + CFIFO_DEPTH(n))
+#define CFIFO_STORAGE(name, n)	uint32_t name[(CFIFO_STORAGE_SIZE(n) + sizeof(uint32_t) - 1U) / sizeof(uint32_t)]
+
+/**
+ * A contiguous region inside the fifo buffer. Free space or stored data
+ * is described by at most two spans, the second one is used only when
+ * the region wraps around the end of the buffer.
+ */
+typedef struct cfifo_span_s {
+	char *ptr;
+	int32_t len;
+} cfifo_span_t;
+
+/**
+ * _CFIFO_LOCKFREE_SPSC in ec_config.h applies to every fifo. When it is
+ * set, each fifo must have a single pusher and a single popper at a
+ * time, e.g. an ISR on one side and a task holding a semaphore on the
+ * other. Callers that share a side between tasks lock it themselves.
+ */
+cfifo_t *cfifo_new(int32_t n, cfifo_policy_t policy);
+
+void cfifo_stat_init(void);
 
 void cfifo_delete(cfifo_t *fifo);
 
+cfifo_t *cfifo_init(void *storage, int32_t n, cfifo_policy_t policy);
+
 int32_t cfifo_push(cfifo_t *fifo, const char ch);
 
 int32_t cfifo_pop(cfifo_t *fifo, char *ch);
@@ -46,3 +104,34 @@ int32_t cfifo_pop(cfifo_t *fifo, char *ch);
 int32_t cfifo_pushn(cfifo_t *fifo, const char ch[], int32_t n);
 
 int32_t cfifo_popn(cfifo_t *fifo, char ch[], int32_t n);
+
+int32_t cfifo_write_reserve(cfifo_t *fifo, cfifo_span_t span[2]);
+
+int32_t cfifo_write_commit(cfifo_t *fifo, int32_t n);
+
+int32_t cfifo_write_advance(cfifo_t *fifo, int32_t n);
+
+int32_t cfifo_write_guard(cfifo_t *fifo, int32_t n);
+
+int32_t cfifo_read_peek(cfifo_t *fifo, cfifo_span_t span[2]);
+
+int32_t cfifo_read_release(cfifo_t *fifo, int32_t n);
+
+static inline int32_t cfifo_used(const cfifo_t *fifo)
+{
+	return (int32_t)(fifo->tail - fifo->head);
+}
+
+static inline int32_t cfifo_free(const cfifo_t *fifo)
+{
+	return fifo->depth - (int32_t)(fifo->tail - fifo->head);
+}
+
+/**
+ * Count of chars discarded by e_CFIFO_OverwriteOldest or
+ * e_CFIFO_DropNewest since the fifo was created.
+ */
+static inline uint32_t cfifo_dropped(const cfifo_t *fifo)
+{
+	return fifo->dropped;
+}
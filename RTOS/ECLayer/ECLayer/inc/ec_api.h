@@ -24,29 +24,60 @@
 
 #include "ec_config.h"
 #include "ec_fcntl.h"
+#include "ec_file.h"
 #include "ec_mmap.h"
+#include "ec_pipe.h"
+#include "ec_poll.h"
+#include "ec_vfs.h"
 #include "heap_port.h"
 #include "ioctl_cmd.h"
 #if _WITH_LWIP_SOCKET_WRAPPER
 #	include "ec_lwip_wrapper.h"
 #endif
+#if _FD_PER_TASK
+#	include "cmsis_os2.h"
+#endif
 
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+void EC_Layer_Initialize(void);
+
 int32_t open(const char *filename, uint32_t flags);
 
 int32_t close(int32_t fd);
 
+int32_t dup(int32_t fd);
+
+int32_t dup2(int32_t oldfd, int32_t newfd);
+
 int32_t write(int32_t fd, const char *data, size_t length);
 
 int32_t read(int32_t fd, char *data, size_t length);
 
+int32_t writev(int32_t fd, const struct iovec *iov, int32_t iovcnt);
+
+int32_t readv(int32_t fd, const struct iovec *iov, int32_t iovcnt);
+
 int32_t ioctl(int32_t fd, uint32_t cmd, uint64_t arg);
 
 int64_t lseek(int32_t fd, int64_t offset, int32_t origin);
 
 int32_t fcntl(int32_t fd, int32_t cmd, int32_t arg);
 
+#if _USE_MMAP > 0
+void *mmap(void *addr, size_t len, int32_t prot, int32_t flags, int32_t fd, int32_t offset);
+#endif
+
+int32_t ec_poll(ec_pollfd_t *fds, uint32_t nfds, int32_t timeout);
+
+#if _FD_PER_TASK
+osThreadId_t ec_thread_new(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr);
+
+osThreadId_t ec_thread_new_fds(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr, const int32_t fds[3]);
+
+void ec_thread_exit(void);
+#endif
+
 #endif
@@ -22,10 +22,36 @@
 #ifndef __EC_ATOMIC_H
 #define __EC_ATOMIC_H
 
+#include "ec_config.h"
+
 #include <stdint.h>
 
+#if !_ATOMIC_USE_STDATOMIC
+#include "cmsis_port.h"
+#endif
+
 typedef int32_t atomic_t;
 
+/**
+ * Pointer sized atomic, touched only through the atomic_ptr_*() helpers.
+ */
+typedef void *atomic_ptr_t;
+
+/**
+ * Barriers order plain memory accesses around the atomics below, which
+ * themselves imply no ordering. On a single Cortex-M core one DMB serves
+ * all three.
+ */
+#if _ATOMIC_USE_STDATOMIC
+void ec_mb(void);
+void ec_rmb(void);
+void ec_wmb(void);
+#else
+#define ec_mb()	 __DMB()
+#define ec_rmb() __DMB()
+#define ec_wmb() __DMB()
+#endif
+
 void atomic_set(atomic_t *ptr, atomic_t val);
 
 atomic_t atomic_get(atomic_t *ptr);
@@ -44,4 +70,29 @@ void atomic_inc(atomic_t *ptr);
 
 void atomic_dec(atomic_t *ptr);
 
+/**
+ * Store newval if *ptr equals oldval. Returns the value found in *ptr,
+ * the swap happened if and only if it equals oldval.
+ */
+atomic_t atomic_cmpxchg(atomic_t *ptr, atomic_t oldval, atomic_t newval);
+
+atomic_t atomic_xchg(atomic_t *ptr, atomic_t val);
+
+/**
+ * Apply the operation and return the value *ptr held before it.
+ */
+atomic_t atomic_fetch_add(atomic_t *ptr, int32_t n);
+
+atomic_t atomic_fetch_or(atomic_t *ptr, atomic_t mask);
+
+atomic_t atomic_fetch_and(atomic_t *ptr, atomic_t mask);
+
+void atomic_ptr_set(atomic_ptr_t *ptr, void *val);
+
+void *atomic_ptr_get(atomic_ptr_t *ptr);
+
+void *atomic_ptr_cmpxchg(atomic_ptr_t *ptr, void *oldval, void *newval);
+
+void *atomic_ptr_xchg(atomic_ptr_t *ptr, void *val);
+
 #endif
@@ -24,20 +24,140 @@
 
 #define	_FILE_NAME_MAXLEN	32
 
+/**
+ * Open files system wide, 8 bytes of RAM each plus a bit in the fd
+ * bitmap. At most 32767, per task tables keep slots in an int16_t.
+ */
+#ifndef _FD_LIST_MAXNUM
 #define _FD_LIST_MAXNUM		128
+#endif
+
+// Buckets of the file name index, must be a power of 2.
+#define _FILE_HASH_BUCKETS	32
 
 #define _DEV_NAME_MAXLEN	32
 
-#define _USE_MMAP			0
+#define _USE_MMAP			1
 #define _MMU_EXIST			0
 #define _MPU_EXIST			0
 #define _MMU_MPU_EXIST		_MMU_EXIST|_MPU_EXIST
 
 #define _EN_USART_TIMESTAMP	1
 
+/**
+ * Set to 1 to back USART fifos and semaphores with static storage
+ * declared in each device file, open and close never touch the heap.
+ */
+#define _EN_USART_STATIC_BUFFER	1
+
+/**
+ * Set to 1 if every cfifo has exactly one producer and one consumer.
+ * Push/pop then never touch PRIMASK or the push/pop locks. USART and
+ * pipe fifos serialise each side with their rd_sem/wr_sem, any other
+ * user of cfifo_new() or cfifo_init() must do the same.
+ */
+#ifndef _CFIFO_LOCKFREE_SPSC
+#define _CFIFO_LOCKFREE_SPSC	1
+#endif
+/**
+ * Distance kept between producer and consumer indexes of cfifo,
+ * set it to the data cache line size of your CPU.
+ */
+#define _CFIFO_CACHELINE_SIZE	32
+
 #define _WITH_CMSISOS_V2	1
 
-#define _WITH_LWIP_SOCKET_WRAPPER	1
+/**
+ * Set to 1 to build ec_atomic on C11 <stdatomic.h> instead of LDREX/STREX,
+ * so code using it can be compiled and stress-tested with threads on a
+ * host. Host builds may pass -D_ATOMIC_USE_STDATOMIC=1 instead.
+ */
+#ifndef _ATOMIC_USE_STDATOMIC
+#define _ATOMIC_USE_STDATOMIC	0
+#endif
+
+/**
+ * Set to 1 when compiling for a host instead of the Cortex-M target, so
+ * ec_lock stops touching PRIMASK, IPSR and the DWT cycle counter. Implies
+ * _ATOMIC_USE_STDATOMIC, host builds pass -D_EC_HOST_BUILD=1 and put
+ * test/host, the host port of the CMSIS, LL and RTOS headers, first on
+ * the include path.
+ */
+#ifndef _EC_HOST_BUILD
+#define _EC_HOST_BUILD	0
+#endif
+#if _EC_HOST_BUILD && !_ATOMIC_USE_STDATOMIC
+#	error "_EC_HOST_BUILD needs _ATOMIC_USE_STDATOMIC"
+#endif
+
+// Tries an ISR gets on a busy ec_mutex_t or ec_rwlock_t before it gives up.
+#define _MUTEX_SPIN_COUNT	32
+
+/**
+ * Set to 1 to count acquires and -EBUSY returns and to measure hold times
+ * of the locks named with ec_lock_stat_regist(), and of the spin locks
+ * taken with ec_try_lock_irqsave_stat() (cfifo, slab, wait queues, file
+ * locks). "lockstat" in ECShell prints them. Hold times are DWT cycles,
+ * the counter is started by the first registration.
+ */
+#ifndef _LOCK_STATS
+#define _LOCK_STATS			0
+#endif
+#define _LOCK_STATS_MAXNUM	16
+
+#if _WITH_CMSISOS_V2
+// Thread flag ec_poll() sleeps on, keep it clear of flags used by tasks.
+#define _POLL_THREAD_FLAG		0x40000000U
+
+/**
+ * Set to 1 to give tasks started by ec_thread_new() their own fd table,
+ * with fd 0, 1 and 2 inherited from the creator. Needs FreeRTOS thread
+ * local storage, _FD_TLS_INDEX below configNUM_THREAD_LOCAL_STORAGE_POINTERS.
+ */
+#define _FD_PER_TASK			1
+// fds of a task, at most 32.
+#define _FD_TASK_MAXNUM			16
+#define _FD_TLS_INDEX			0
+#else
+#define _FD_PER_TASK			0
+#endif
+
+// ec_poll() on both device fds and sockets rechecks sockets this often.
+#define _POLL_SOCKET_SLICE_MS	10
+
+/**
+ * Set to 1 to back files created by open() with O_CREAT by RAM, they
+ * are empty placeholders otherwise. Needs _WITH_CMSISOS_V2.
+ */
+#define _USE_TMPFS			1
+// Smallest extent a tmpfs file grows by.
+#define _TMPFS_EXTENT_MIN	256
+// Where tmpfs data lives, point these at an external SDRAM heap to keep
+// big captures out of the internal RAM.
+#define _TMPFS_MALLOC(size)	ecmalloc(size)
+#define _TMPFS_FREE(p)		ecfree(p)
+
+/**
+ * Set to 1 to serve ecslab_alloc() from per size class free lists, for
+ * fds, files, fifos and other ECLayer objects. Classes are powers of 2
+ * from 16 to 256 bytes, bigger requests go to ecmalloc(). A class first
+ * carves objects from its _SLAB_STATIC_xx static ones, then from heap
+ * pages of _SLAB_PAGE_SIZE bytes. Freed objects stay in their class.
+ */
+#define _USE_SLAB			1
+#define _SLAB_PAGE_SIZE		512
+#define _SLAB_STATIC_16		0
+#define _SLAB_STATIC_32		0
+#define _SLAB_STATIC_64		0	// file_des_t
+#define _SLAB_STATIC_128	0	// file_t
+#define _SLAB_STATIC_256	0
+
+// Pipes open at the same time, and the buffer of each, a power of 2.
+#define _PIPE_MAXNUM		4
+#define _PIPE_BUFFER_SIZE	256
+
+// lwIP is target only, host builds go without the socket wrapper.
+#define _WITH_LWIP_SOCKET_WRAPPER	(!_EC_HOST_BUILD)
 
 #if _WITH_LWIP_SOCKET_WRAPPER
 #define _LWIP_SOCKET_HEADER_FILE	"lwip/sockets.h"
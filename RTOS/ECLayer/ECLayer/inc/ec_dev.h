@@ -45,6 +45,8 @@ typedef struct ec_dev_s {
 	void *private_data;
 } ec_dev_t;
 
+void device_list_init(void);
+
 int32_t device_regist(ec_dev_t *dev);
 
 int32_t device_deregist(ec_dev_t *dev);
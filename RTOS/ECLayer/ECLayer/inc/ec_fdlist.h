@@ -22,14 +22,69 @@
 #ifndef __EC_FDLIST_H
 #define __EC_FDLIST_H
 
+#include "ec_config.h"
 #include "ec_file.h"
 
 #include <stdint.h>
 
+void fd_list_init(void);
+
 file_des_t *get_fd_struct(int32_t fd);
 
 int32_t alloc_fd(file_des_t *fs);
 
+int32_t fd_replace(int32_t fd, file_des_t *fs, file_des_t **old);
+
 int32_t free_fd(int32_t fd);
 
+void fd_publish(int32_t fd);
+
+file_des_t *fd_pin(int32_t fd);
+
+int32_t fd_unpin(int32_t fd);
+
+int32_t fd_shut(int32_t fd);
+
+/**
+ * fds handed to a task are looked up in its own table when it has one,
+ * the table maps them to slots of the global table above.
+ */
+#if _FD_PER_TASK
+typedef struct fd_table_s fd_table_t;
+
+fd_table_t *fd_table_new(void);
+
+void fd_table_delete(fd_table_t *table);
+
+void fd_table_attach(fd_table_t *table);
+
+fd_table_t *fd_table_current(void);
+
+int32_t fd_table_install(fd_table_t *table, int32_t fd, int32_t slot);
+
+int32_t fd_table_take(fd_table_t *table);
+
+int32_t fd_resolve(int32_t fd);
+
+int32_t fd_install(int32_t slot);
+
+int32_t fd_forget(int32_t fd);
+#else
+// Without per task tables an fd is its global slot.
+static inline int32_t fd_resolve(int32_t fd)
+{
+	return fd;
+}
+
+static inline int32_t fd_install(int32_t slot)
+{
+	return slot;
+}
+
+static inline int32_t fd_forget(int32_t fd)
+{
+	return fd;
+}
+#endif
+
 #endif
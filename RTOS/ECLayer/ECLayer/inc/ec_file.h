@@ -31,15 +31,51 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#if _WITH_LWIP_SOCKET_WRAPPER
+// struct iovec comes with lwip_readv/lwip_writev, share it.
+#	ifndef _LWIP_SOCKET_HEADER_FILE
+#		include "lwip/sockets.h"
+#	else
+#		include _LWIP_SOCKET_HEADER_FILE
+#	endif
+#else
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#endif
+
 typedef enum file_type_e {
 	e_FTYPE_DEV,
 	e_FTYPE_LINK,
 	e_FTYPE_SOCKET,
+	e_FTYPE_PIPE,
 } file_type_t;
 
+/**
+ * Node of the path trie in ec_vfs.c. Embedded in file_t for the file
+ * itself, directories on its path come from the slab.
+ */
+typedef struct ec_dentry_s {
+	list_t d_sibling;
+	list_t d_children;
+	struct ec_dentry_s *d_parent;
+	struct ec_dentry_s *d_cache;  //!< child hit by the last lookup
+	struct ec_mount_s *d_mount;	  //!< set on mount points
+	const char *d_name;			  //!< path component, not terminated
+	uint32_t d_hash;
+	uint32_t d_gen;	 //!< bumped whenever children are added or removed
+	uint16_t d_namelen;
+	uint8_t d_type;	 //!< EC_DT_xx
+	uint8_t d_refs;	 //!< open dirs, keeps an empty directory alive, at most UINT8_MAX
+} ec_dentry_t;
+
 typedef struct file_s {
 	char file_name[_FILE_NAME_MAXLEN + 1];
 	list_t file_list;
+	list_t file_hash_list;	//!< node in the name index bucket
+	uint32_t file_hash;		//!< hash of file_name, set by file_regist()
+	ec_dentry_t file_dentry;
 	atomic_t file_refs;
 	ec_lock_t file_lock;
 	struct file_opts_s *file_opts;
@@ -47,26 +83,42 @@ typedef struct file_s {
 	//!< point to dev struct
 } file_t;
 
+/**
+ * Open file description, shared by every fd dup() made from the one
+ * open() returned. Drivers see the first open and the last close only.
+ */
 typedef struct file_des_s {
+	atomic_t file_des_refs;	 //!< fds referring to this description
 	uint32_t file_flags;
 	int64_t file_pos;
 	file_type_t file_type;
+	uint32_t read_min;		 //!< read returns once this many chars are in, 0 for the whole count
+	uint32_t read_timeout;	 //!< ms a read may block in total, 0 for no limit
+	uint32_t read_interval;	 //!< ms of silence after the first char that ends a read, 0 for no limit
 	union {
 		struct file_s *file;
 		int sock_num;
 	};
 } file_des_t;
 
+struct ec_poll_table_s;
+
 typedef struct file_opts_s {
-	int32_t (*open)(file_des_t *, const char *, uint32_t);
+	int32_t (*open)(file_des_t *, const char *, uint32_t);	 //!< ECLayer holds one file_refs reference per open fd
 	int32_t (*read)(file_des_t *, char *, size_t);
 	int32_t (*write)(file_des_t *, const char *, size_t);
 	int32_t (*ioctl)(file_des_t *, uint32_t, uint64_t);
 	int64_t (*lseek)(file_des_t *, int64_t, int32_t);
 	void *(*mmap)(file_des_t *, size_t, int32_t);
 	int32_t (*close)(file_des_t *);
+	uint32_t (*poll)(file_des_t *, struct ec_poll_table_s *);	//!< EC_POLLxx mask, NULL for always ready
+	int32_t (*readv)(file_des_t *, const struct iovec *, int32_t);	 //!< NULL to loop over read
+	int32_t (*writev)(file_des_t *, const struct iovec *, int32_t);	 //!< NULL to loop over write
+	void (*release)(struct file_s *);	//!< frees file_content before the file_t goes, may be NULL
 } file_opts_t;
 
+void file_list_init(void);
+
 int32_t file_regist(file_t *file);
 
 int32_t file_deregist(file_t *file);
@@ -75,8 +127,12 @@ file_t *create_file(const char *filename, file_opts_t *fopts, void *content);
 
 int32_t delete_file(file_t *file);
 
+void destroy_file(file_t *file);
+
 file_t *search_file(const char *filename);
 
+void put_file(file_t *file);
+
 int32_t empty_file(file_t *file);
 
 #endif
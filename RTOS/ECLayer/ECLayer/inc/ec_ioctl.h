@@ -68,4 +68,17 @@
 #define _IOC_NR(nr) (((nr) >> _IOC_NRSHIFT) & _IOC_NRMASK)
 #define _IOC_SIZE(nr) (((nr) >> _IOC_SIZESHIFT) & _IOC_SIZEMASK)
 
+/**
+ * File descriptor commands, handled by ECLayer itself and stored in the
+ * file descriptor. Stream drivers use them to end a blocking read early,
+ * like VMIN/VTIME of termios.
+*/
+#define EC_FD_MAGIC			   'F'
+#define CMD_FD_SETREADMIN	   _IOW(EC_FD_MAGIC, 1, uint32_t)
+#define CMD_FD_GETREADMIN	   _IOR(EC_FD_MAGIC, 2, uint32_t *)
+#define CMD_FD_SETREADTIMEOUT  _IOW(EC_FD_MAGIC, 3, uint32_t)
+#define CMD_FD_GETREADTIMEOUT  _IOR(EC_FD_MAGIC, 4, uint32_t *)
+#define CMD_FD_SETREADINTERVAL _IOW(EC_FD_MAGIC, 5, uint32_t)
+#define CMD_FD_GETREADINTERVAL _IOR(EC_FD_MAGIC, 6, uint32_t *)
+
 #endif
@@ -23,6 +23,10 @@
 #ifndef __EC_LOCK_H
 #define __EC_LOCK_H
 
+#include "ec_atomic.h"
+#include "ec_config.h"
+
+#include <stddef.h>
 #include <stdint.h>
 
 #define	e_Locked 1
@@ -30,12 +34,129 @@
 
 typedef uint32_t ec_lock_t;
 
+typedef struct ec_mutex_s ec_mutex_t;
+
+typedef struct ec_lock_stat_s ec_lock_stat_t;
+
+#if _LOCK_STATS
+/**
+ * Counters of an ec_mutex_t named with ec_lock_stat_regist(), name an
+ * ec_rwlock_t by its writer member. Spin locks count into an entry from
+ * ec_lock_stat_new() that they pass to ec_try_lock_irqsave_stat(), mutex
+ * is NULL then.
+ */
+struct ec_lock_stat_s {
+	const ec_mutex_t *mutex;
+	const char *name;
+	uint32_t acquires;
+	atomic_t contended;	 //!< -EBUSY returns and acquires that had to wait
+	uint32_t hold_max;	 //!< cycles
+	uint64_t hold_total;  //!< cycles, divide by acquires for the average
+	uint32_t since;		 //!< cycle count at the current acquire
+};
+
+int32_t ec_lock_stat_regist(ec_mutex_t *mutex, const char *name);
+
+ec_lock_stat_t *ec_lock_stat_new(const char *name);
+
+int32_t ec_lock_stat_get(uint32_t index, ec_lock_stat_t *stat);
+
+void ec_lock_stat_reset(void);
+#else
+static inline int32_t ec_lock_stat_regist(ec_mutex_t *mutex, const char *name)
+{
+	(void)mutex;
+	(void)name;
+	return 0;
+}
+
+static inline ec_lock_stat_t *ec_lock_stat_new(const char *name)
+{
+	(void)name;
+	return NULL;
+}
+#endif
+
 int32_t ec_try_lock_irqsave(ec_lock_t *lock, uint32_t *irqflag);
 
 void ec_unlock_irqrestore(ec_lock_t *lock, uint32_t irqflag);
 
+#if _LOCK_STATS
+/**
+ * ec_try_lock_irqsave() counted in stat, which may be NULL. Every -EBUSY
+ * counts as contended, hold times are taken with IRQs masked. A family
+ * of locks may share one entry as long as they do not nest.
+ */
+int32_t ec_try_lock_irqsave_stat(ec_lock_t *lock, uint32_t *irqflag, ec_lock_stat_t *stat);
+
+void ec_unlock_irqrestore_stat(ec_lock_t *lock, uint32_t irqflag, ec_lock_stat_t *stat);
+#else
+static inline int32_t ec_try_lock_irqsave_stat(ec_lock_t *lock, uint32_t *irqflag, ec_lock_stat_t *stat)
+{
+	(void)stat;
+	return ec_try_lock_irqsave(lock, irqflag);
+}
+
+static inline void ec_unlock_irqrestore_stat(ec_lock_t *lock, uint32_t irqflag, ec_lock_stat_t *stat)
+{
+	(void)stat;
+	ec_unlock_irqrestore(lock, irqflag);
+}
+#endif
+
 int32_t ec_try_lock(ec_lock_t *lock);
 
 void ec_unlock(ec_lock_t *lock);
 
+/**
+ * Lock for registries and other task level data. Tasks sleep on an RTOS
+ * mutex created by ec_mutex_init(), which lends the holder their
+ * priority. In ISR, before the scheduler runs and without an RTOS it is
+ * a plain spin lock, an ISR gives up with -EBUSY rather than spin on a
+ * task it interrupted.
+ */
+struct ec_mutex_s {
+	ec_lock_t lock;	 //!< held by whoever owns the mutex, task or ISR
+	void *os_mutex;	 //!< RTOS mutex tasks sleep on, from ec_mutex_init()
+#if _LOCK_STATS
+	struct ec_lock_stat_s *stat;  //!< set by ec_lock_stat_regist(), NULL if unnamed
+#endif
+};
+
+#define EC_MUTEX_INIT {.lock = e_Unlocked, .os_mutex = NULL}
+
+int32_t ec_mutex_init(ec_mutex_t *mutex);
+
+int32_t ec_mutex_lock(ec_mutex_t *mutex);
+
+int32_t ec_mutex_trylock(ec_mutex_t *mutex);
+
+void ec_mutex_unlock(ec_mutex_t *mutex);
+
+/**
+ * Readers-writer lock for registries that are searched far more often
+ * than changed. Readers only count themselves in, without masking IRQs.
+ * Writers are serialised by an ec_mutex_t and hold new readers back
+ * while the current ones leave, readers that find a writer wait on its
+ * mutex, and the last reader out wakes a waiting writer. Like ec_mutex_t,
+ * an ISR gives up with -EBUSY instead of waiting on a task.
+ */
+typedef struct ec_rwlock_s {
+	atomic_t readers;	 //!< readers inside, plus a flag while a writer is in or waiting
+	ec_mutex_t writer;	 //!< held by the writer
+	void *drained;		 //!< binary semaphore the last reader gives to the writer
+} ec_rwlock_t;
+
+#define EC_RWLOCK_INIT {.readers = 0, .writer = EC_MUTEX_INIT, .drained = NULL}
+
+int32_t ec_rwlock_init(ec_rwlock_t *rwlock);
+
+int32_t ec_read_lock(ec_rwlock_t *rwlock);
+
+void ec_read_unlock(ec_rwlock_t *rwlock);
+
+int32_t ec_write_lock(ec_rwlock_t *rwlock);
+
+void ec_write_unlock(ec_rwlock_t *rwlock);
+
 #endif
@@ -35,92 +35,106 @@
 #		include _LWIP_SOCKET_HEADER_FILE
 #	endif
 
-int ec_fd2sock(int32_t fd);
+/**
+ * An fd pinned for the length of one lwip call, so that a close() on
+ * another task can't free or reuse its description meanwhile.
+ */
+typedef struct ec_sockref_s {
+	int32_t slot;
+	struct file_des_s *fd_st;
+} ec_sockref_t;
+
+int ec_sock_get(int32_t fd, ec_sockref_t *ref);
+void ec_sock_put(ec_sockref_t *ref);
 int socket(int domain, int type, int protocol);
 
+#	define __EC_SOCKCALL(type, s, call)                \
+		do {                                           \
+			ec_sockref_t __ref;                        \
+			type __ret;                                \
+			int __sock = ec_sock_get((s), &__ref);     \
+			if (__sock < 0) {                          \
+				/* lwip reports the bad socket */      \
+				return (call);                         \
+			}                                          \
+			__ret = (call);                            \
+			ec_sock_put(&__ref);                       \
+			return __ret;                              \
+		} while (0)
+
 static inline int accept(int s, struct sockaddr *addr, socklen_t *addrlen)
 {
-	return lwip_accept(ec_fd2sock(s), addr, addrlen);
+	__EC_SOCKCALL(int, s, lwip_accept(__sock, addr, addrlen));
 }
 
 static inline int bind(int s, const struct sockaddr *name, socklen_t namelen)
 {
-	return lwip_bind(ec_fd2sock(s), name, namelen);
+	__EC_SOCKCALL(int, s, lwip_bind(__sock, name, namelen));
 }
 
 static inline int shutdown(int s, int how)
 {
-	return lwip_shutdown(ec_fd2sock(s), how);
+	__EC_SOCKCALL(int, s, lwip_shutdown(__sock, how));
 }
 
 static inline int getpeername(int s, struct sockaddr *name, socklen_t *namelen)
 {
-	return lwip_getpeername(ec_fd2sock(s), name, namelen);
+	__EC_SOCKCALL(int, s, lwip_getpeername(__sock, name, namelen));
 }
 
 static inline int getsockname(int s, struct sockaddr *name, socklen_t *namelen)
 {
-	return lwip_getsockname(ec_fd2sock(s), name, namelen);
+	__EC_SOCKCALL(int, s, lwip_getsockname(__sock, name, namelen));
 }
 
 static inline int getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen)
 {
-	return lwip_getsockopt(ec_fd2sock(s), level, optname, optval, optlen);
+	__EC_SOCKCALL(int, s, lwip_getsockopt(__sock, level, optname, optval, optlen));
 }
 
 static inline int setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen)
 {
-	return lwip_setsockopt(ec_fd2sock(s), level, optname, optval, optlen);
+	__EC_SOCKCALL(int, s, lwip_setsockopt(__sock, level, optname, optval, optlen));
 }
 
 static inline int connect(int s, const struct sockaddr *name, socklen_t namelen)
 {
-	return lwip_connect(ec_fd2sock(s), name, namelen);
+	__EC_SOCKCALL(int, s, lwip_connect(__sock, name, namelen));
 }
 
 static inline int listen(int s, int backlog)
 {
-	return lwip_listen(ec_fd2sock(s), backlog);
+	__EC_SOCKCALL(int, s, lwip_listen(__sock, backlog));
 }
 
 static inline ssize_t recv(int s, void *mem, size_t len, int flags)
 {
-	return lwip_recv(ec_fd2sock(s), mem, len, flags);
-}
-
-static inline ssize_t readv(int s, const struct iovec *iov, int iovcnt)
-{
-	return lwip_readv(ec_fd2sock(s), iov, iovcnt);
+	__EC_SOCKCALL(ssize_t, s, lwip_recv(__sock, mem, len, flags));
 }
 
 static inline ssize_t recvfrom(int s, void *mem, size_t len, int flags, struct sockaddr *from, socklen_t *fromlen)
 {
-	return lwip_recvfrom(ec_fd2sock(s), mem, len, flags, from, fromlen);
+	__EC_SOCKCALL(ssize_t, s, lwip_recvfrom(__sock, mem, len, flags, from, fromlen));
 }
 
 static inline ssize_t recvmsg(int s, struct msghdr *message, int flags)
 {
-	return lwip_recvmsg(ec_fd2sock(s), message, flags);
+	__EC_SOCKCALL(ssize_t, s, lwip_recvmsg(__sock, message, flags));
 }
 
 static inline ssize_t send(int s, const void *dataptr, size_t size, int flags)
 {
-	return lwip_send(ec_fd2sock(s), dataptr, size, flags);
+	__EC_SOCKCALL(ssize_t, s, lwip_send(__sock, dataptr, size, flags));
 }
 
 static inline ssize_t sendmsg(int s, const struct msghdr *message, int flags)
 {
-	return lwip_sendmsg(ec_fd2sock(s), message, flags);
+	__EC_SOCKCALL(ssize_t, s, lwip_sendmsg(__sock, message, flags));
 }
 
 static inline ssize_t sendto(int s, const void *dataptr, size_t size, int flags, const struct sockaddr *to, socklen_t tolen)
 {
-	return lwip_sendto(ec_fd2sock(s), dataptr, size, flags, to, tolen);
-}
-
-static inline ssize_t writev(int s, const struct iovec *iov, int iovcnt)
-{
-	return lwip_writev(ec_fd2sock(s), iov, iovcnt);
+	__EC_SOCKCALL(ssize_t, s, lwip_sendto(__sock, dataptr, size, flags, to, tolen));
 }
 
 #	if LWIP_SOCKET_SELECT
@@ -128,7 +142,7 @@ static inline ssize_t writev(int s, const struct iovec *iov, int iovcnt)
 // int select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout);
 #	endif
 #	if LWIP_SOCKET_POLL
-// Not support yet.
+// Not support yet, ec_poll() in ec_api.h takes sockets and device fds.
 // int poll(struct pollfd *fds, nfds_t nfds, int timeout);
 #	endif
 static inline const char *inet_ntop(int af, const void *src, char *dst, socklen_t size)
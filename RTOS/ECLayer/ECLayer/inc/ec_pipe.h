@@ -0,0 +1,33 @@
+/**
+ * @file	ec_pipe.h
+ * @brief	Anonymous pipes for streaming between tasks.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __EC_PIPE_H
+#define __EC_PIPE_H
+
+#include "ec_config.h"
+
+#include <stdint.h>
+
+void pipe_list_init(void);
+
+int32_t ec_pipe(int32_t fds[2]);
+
+#endif
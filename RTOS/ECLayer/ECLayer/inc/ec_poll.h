@@ -0,0 +1,79 @@
+/**
+ * @file	ec_poll.h
+ * @brief	Readiness polling over device files and sockets.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __EC_POLL_H
+#define __EC_POLL_H
+
+#include "ec_config.h"
+#include "ec_file.h"
+#include "ec_list.h"
+#include "ec_lock.h"
+
+#include <stdint.h>
+
+#define EC_POLLIN	0x0001U	 //!< data can be read without blocking
+#define EC_POLLOUT	0x0004U	 //!< data can be written without blocking
+#define EC_POLLERR	0x0008U	 //!< error on the file, always reported
+#define EC_POLLHUP	0x0010U	 //!< peer hung up, always reported
+#define EC_POLLNVAL 0x0020U	 //!< fd is not open, always reported
+
+typedef struct ec_pollfd_s {
+	int32_t fd;
+	uint16_t events;   //!< EC_POLLIN | EC_POLLOUT
+	uint16_t revents;  //!< out: events that are ready
+} ec_pollfd_t;
+
+/**
+ * Tasks sleeping in ec_poll() on a driver, the driver wakes them from
+ * ISR or task context whenever the readiness it reports may have changed.
+*/
+typedef struct ec_waitq_s {
+	list_t waiters;
+	ec_lock_t lock;
+} ec_waitq_t;
+
+typedef struct ec_poll_entry_s {
+	list_t node;
+	ec_waitq_t *waitq;
+	void *thread;
+} ec_poll_entry_t;
+
+/**
+ * Passed to file_opts_t::poll on the first scan only, NULL afterwards.
+ * A driver hooks at most one wait queue per fd.
+*/
+typedef struct ec_poll_table_s {
+	ec_poll_entry_t *entries;
+	uint32_t nentries;
+	uint32_t maxentries;
+} ec_poll_table_t;
+
+void ec_poll_init(void);
+
+void ec_waitq_init(ec_waitq_t *waitq);
+
+void ec_waitq_wake(ec_waitq_t *waitq);
+
+void ec_poll_wait(ec_waitq_t *waitq, ec_poll_table_t *table);
+
+void ec_poll_unwait(ec_poll_table_t *table);
+
+#endif
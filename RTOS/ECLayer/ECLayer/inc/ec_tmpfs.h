@@ -0,0 +1,30 @@
+/**
+ * @file	ec_tmpfs.h
+ * @brief	RAM backed files, created by open() with O_CREAT.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __EC_TMPFS_H
+#define __EC_TMPFS_H
+
+#include "ec_config.h"
+#include "ec_file.h"
+
+file_t *tmpfs_create(const char *filename);
+
+#endif
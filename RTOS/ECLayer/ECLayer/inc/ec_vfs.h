@@ -0,0 +1,86 @@
+/**
+ * @file	ec_vfs.h
+ * @brief	Hierarchical path namespace, mount points and directory listing.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __EC_VFS_H
+#define __EC_VFS_H
+
+#include "ec_atomic.h"
+#include "ec_config.h"
+#include "ec_file.h"
+
+#include <stdint.h>
+
+#define EC_DT_NONE	0
+#define EC_DT_REG	1	//!< registered file
+#define EC_DT_DIR	2	//!< directory, mount points included
+#define EC_DT_MOUNT 3	//!< internal, reported as EC_DT_DIR
+
+typedef struct ec_dirent_s {
+	uint8_t d_type;
+	char d_name[_FILE_NAME_MAXLEN + 1];
+} ec_dirent_t;
+
+struct ec_mount_s;
+
+/**
+ * Filesystem driver behind a mount point. Paths handed to it are relative
+ * to the mount point, without leading '/', "" for the mount point itself.
+ */
+typedef struct ec_fs_opts_s {
+	//!< file_t for path with a file_refs reference taken, or NULL
+	file_t *(*lookup)(struct ec_mount_s *, const char *);
+	//!< fill in the index-th entry of directory path, -ENOENT past the end
+	int32_t (*readdir)(struct ec_mount_s *, const char *, uint32_t, ec_dirent_t *);
+} ec_fs_opts_t;
+
+typedef struct ec_mount_s {
+	ec_fs_opts_t *mnt_opts;
+	void *mnt_data;
+	atomic_t mnt_refs;	//!< lookups and open dirs in progress
+} ec_mount_t;
+
+typedef struct ec_dir_s ec_dir_t;
+
+int32_t ec_mount(const char *path, ec_fs_opts_t *fs_opts, void *fs_data);
+
+int32_t ec_umount(const char *path);
+
+ec_dir_t *opendir(const char *path);
+
+ec_dirent_t *readdir(ec_dir_t *dir);
+
+int32_t closedir(ec_dir_t *dir);
+
+void vfs_init(void);
+
+/**
+ * Used by ec_file.c, file_regist() links the file into the trie and
+ * search_file() falls back to vfs_lookup() for names it does not know.
+ */
+int32_t vfs_link(file_t *file);
+
+void vfs_unlink(file_t *file);
+
+int32_t vfs_unlink_unused(file_t *file);
+
+file_t *vfs_lookup(const char *path);
+
+#endif
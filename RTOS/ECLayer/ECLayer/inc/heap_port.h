@@ -41,4 +41,23 @@ void *ecrealloc(void *p, size_t size);
 
 void *eccalloc(size_t n, size_t size);
 
+/**
+ * Allocator for fixed size objects that come and go often. Constant time
+ * and safe in ISR, where it returns NULL once the class has no free
+ * object left instead of growing it from the heap. Sizes above the
+ * largest class go to the heap. From ISR they get NULL, and their
+ * ecslab_free() is deferred to the next ecslab_alloc() or ecslab_free()
+ * called from a task. The size passed to ecslab_free() must be the
+ * one the object was allocated with.
+ */
+void *ecslab_alloc(size_t size);
+
+void ecslab_free(void *p, size_t size);
+
+/**
+ * Names the class locks for lock statistics, EC_Layer_Initialize() calls
+ * it. The allocator works before that as well.
+ */
+void ecslab_init(void);
+
 #endif
@@ -22,31 +22,69 @@
 
 #include "cfifo.h"
 
+#include "cmsis_port.h"
+#include "ec_atomic.h"
+#include "ec_config.h"
 #include "ec_lock.h"
 #include "exceptions.h"
 #include "heap_port.h"
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
-static inline void __push(cfifo_t *fifo, const char ch);
-static inline void __pop(cfifo_t *fifo, char *ch);
+#if !_CFIFO_LOCKFREE_SPSC
+// Push locks of every fifo count into one entry, pop locks into another.
+static ec_lock_stat_t *pv_push_stat = NULL;
+static ec_lock_stat_t *pv_pop_stat = NULL;
+#endif
 
-cfifo_t *cfifo_new(int32_t n)
+static inline void __setup(cfifo_t *fifo, uint32_t depth, cfifo_policy_t policy);
+static inline int32_t __push_lock(cfifo_t *fifo, uint32_t *irqflag);
+static inline void __push_unlock(cfifo_t *fifo, uint32_t irqflag);
+static inline int32_t __pop_lock(cfifo_t *fifo, uint32_t *irqflag);
+static inline void __pop_unlock(cfifo_t *fifo, uint32_t irqflag);
+static inline uint32_t __make_room(cfifo_t *fifo, uint32_t tail, uint32_t n);
+static inline int32_t __advance_head(cfifo_t *fifo, uint32_t head, uint32_t n);
+static inline uint32_t __pushn(cfifo_t *fifo, const char ch[], uint32_t n);
+static inline uint32_t __popn(cfifo_t *fifo, char ch[], uint32_t n);
+static inline int32_t __spans(cfifo_t *fifo, uint32_t index, uint32_t n, cfifo_span_t span[2]);
+static inline int32_t __commit(cfifo_t *fifo, int32_t n);
+
+/**
+  *@brief	Name the push and pop locks for lock statistics, called once by
+  *			EC_Layer_Initialize(). Fifos work before that as well.
+  */
+void cfifo_stat_init(void)
+{
+#if !_CFIFO_LOCKFREE_SPSC
+	pv_push_stat = ec_lock_stat_new("cfifo push");
+	pv_pop_stat = ec_lock_stat_new("cfifo pop");
+#endif
+}
+
+/**
+  *@brief	Create a new fifo.
+  *@details	With _CFIFO_LOCKFREE_SPSC set, push and pop take no lock. Only
+  *			one task or ISR may push and only one may pop at a time, more
+  *			of them must serialise each side themselves.
+  *@param	n			requested depth, rounded up to the next power of 2
+  *@param	policy		behaviour of push operations when fifo is full
+  *@retval	NULL		illegal depth or out of memory
+  */
+cfifo_t *cfifo_new(int32_t n, cfifo_policy_t policy)
 {
 	cfifo_t *fifo;
-	if (n <= 0) {
+	uint32_t depth;
+	if ((n <= 0) || (n > (INT32_MAX / 2 + 1))) {
 		return NULL;
 	}
 	else {
-		fifo = (cfifo_t *)ecmalloc(sizeof(cfifo_t) + (sizeof(char) * (n - 1)));
+		for (depth = 1; depth < (uint32_t)n; depth <<= 1)
+			;
+		fifo = (cfifo_t *)ecslab_alloc(sizeof(cfifo_t) + (sizeof(char) * (depth - 1)));
 		if (fifo != NULL) {
-			fifo->head = 0;
-			fifo->tail = 0;
-			fifo->usedw = 0;
-			fifo->depth = n;
-			fifo->pushlock = e_Unlocked;
-			fifo->poplock = e_Unlocked;
+			__setup(fifo, depth, policy);
 		}
 		return fifo;
 	}
@@ -54,11 +92,53 @@ cfifo_t *cfifo_new(int32_t n)
 
 void cfifo_delete(cfifo_t *fifo)
 {
-	ecfree(fifo);
+	if (fifo != NULL) {
+		ecslab_free(fifo, sizeof(cfifo_t) + (sizeof(char) * ((uint32_t)fifo->depth - 1)));
+	}
+}
+
+/**
+  *@brief	Create a fifo on caller provided storage, never allocates.
+  *@details	The fifo must not be passed to cfifo_delete(), simply stop
+  *			using the storage. The single pusher and popper rule of
+  *			cfifo_new() under _CFIFO_LOCKFREE_SPSC applies as well.
+  *@param	*storage	at least CFIFO_STORAGE_SIZE(n) bytes, 4 byte aligned,
+  *						declared with CFIFO_STORAGE() typically
+  *@param	n			requested depth, rounded up to the next power of 2
+  *@param	policy		behaviour of push operations when fifo is full
+  *@retval	NULL		illegal depth or no storage
+  */
+cfifo_t *cfifo_init(void *storage, int32_t n, cfifo_policy_t policy)
+{
+	uint32_t depth;
+	if ((storage == NULL) || (n <= 0) || (n > (INT32_MAX / 2 + 1))) {
+		return NULL;
+	}
+	else {
+		for (depth = 1; depth < (uint32_t)n; depth <<= 1)
+			;
+		__setup((cfifo_t *)storage, depth, policy);
+		return (cfifo_t *)storage;
+	}
+}
+
+static inline void __setup(cfifo_t *fifo, uint32_t depth, cfifo_policy_t policy)
+{
+	fifo->head = 0;
+	fifo->tail = 0;
+	fifo->peek = 0;
+	fifo->dropped = 0;
+	fifo->mask = depth - 1;
+	fifo->depth = (int32_t)depth;
+	fifo->policy = policy;
+	fifo->pushlock = e_Unlocked;
+	fifo->poplock = e_Unlocked;
 }
 
 /**
   *@brief	Push a character into a specified fifo.
+  *@details	Only e_CFIFO_Reject fifo reports -EFIFOFULL, the other policies
+  *			discard a char and count it in cfifo_dropped().
   *@param	*fifo		pointer to fifo structure to be operated
   *@param	ch			character to be pushed
   *@retval	0			operation succeed
@@ -68,7 +148,8 @@ void cfifo_delete(cfifo_t *fifo)
 int32_t cfifo_push(cfifo_t *fifo, const char ch)
 {
 	uint32_t irqflag;
-	if (fifo->usedw >= fifo->depth) {
+	uint32_t tail;
+	if ((cfifo_free(fifo) <= 0) && (fifo->policy == e_CFIFO_Reject)) {
 		/*
 		 * Because these situations below are unlikely to happen while using our legal 
 		 * process funcs in this file, and we need this func runs very frequently, so 
@@ -78,12 +159,27 @@ int32_t cfifo_push(cfifo_t *fifo, const char ch)
 		 */
 		return -EFIFOFULL;
 	}
-	else if (ec_try_lock_irqsave(&(fifo->pushlock), &irqflag) != 0) {
+	else if (__push_lock(fifo, &irqflag) != 0) {
 		return -EBUSY;
 	}
 	else {
-		__push(fifo, ch);
-		ec_unlock_irqrestore(&(fifo->pushlock), irqflag);
+		tail = fifo->tail;
+		if (fifo->policy == e_CFIFO_OverwriteOldest) {
+			fifo->dropped += __make_room(fifo, tail, 1);
+		}
+		else if (cfifo_free(fifo) <= 0) {
+			fifo->dropped++;
+			__push_unlock(fifo, irqflag);
+			return 0;
+		}
+		/*
+		 * The branches on free space keep the slot store behind the head
+		 * load, only the tail store needs ordering after the slot.
+		 */
+		fifo->fifo[tail & fifo->mask] = ch;
+		ec_wmb();
+		fifo->tail = tail + 1;
+		__push_unlock(fifo, irqflag);
 		return 0;
 	}
 }
@@ -99,21 +195,31 @@ int32_t cfifo_push(cfifo_t *fifo, const char ch)
 int32_t cfifo_pop(cfifo_t *fifo, char *ch)
 {
 	uint32_t irqflag;
-	if (fifo->usedw <= 0) {
+	uint32_t head;
+	if (cfifo_used(fifo) <= 0) {
 		return -EFIFOEMPTY;
 	}
-	else if (ec_try_lock_irqsave(&(fifo->poplock), &irqflag) != 0) {
+	else if (__pop_lock(fifo, &irqflag) != 0) {
 		return -EBUSY;
 	}
 	else {
-		__pop(fifo, ch);
-		ec_unlock_irqrestore(&(fifo->poplock), irqflag);
+		do {
+			head = fifo->head;
+			*ch = fifo->fifo[head & fifo->mask];
+			// Read the slot before head is checked and moved. The branch on
+			// the used count already keeps this load behind the tail load.
+			ec_rmb();
+		} while (__advance_head(fifo, head, 1) != 0);
+		__pop_unlock(fifo, irqflag);
 		return 0;
 	}
 }
 
 /**
   *@brief	Push n characters into a specified fifo
+  *@details	For e_CFIFO_OverwriteOldest and e_CFIFO_DropNewest fifo, all n
+  *			characters are always consumed, discarded ones are counted in
+  *			cfifo_dropped().
   *@param	*fifo		pointer to fifo structure to be operated
   *@param	ch[]		characters to be pushed
   *@param	n			count of pushed chars
@@ -124,21 +230,20 @@ int32_t cfifo_pop(cfifo_t *fifo, char *ch)
 int32_t cfifo_pushn(cfifo_t *fifo, const char ch[], int32_t n)
 {
 	uint32_t irqflag;
-	if (fifo->usedw >= fifo->depth) {
+	uint32_t pushed;
+	if ((cfifo_free(fifo) <= 0) && (fifo->policy == e_CFIFO_Reject)) {
 		return -EFIFOFULL;
 	}
-	else if (ec_try_lock_irqsave(&(fifo->pushlock), &irqflag) != 0) {
+	else if (n <= 0) {
+		return 0;
+	}
+	else if (__push_lock(fifo, &irqflag) != 0) {
 		return -EBUSY;
 	}
 	else {
-		int i;
-		for (i = 0;
-			 (fifo->usedw < fifo->depth) && (i < n);
-			 i++) {
-			__push(fifo, ch[i]);
-		}
-		ec_unlock_irqrestore(&(fifo->pushlock), irqflag);
-		return i;
+		pushed = __pushn(fifo, ch, (uint32_t)n);
+		__push_unlock(fifo, irqflag);
+		return (fifo->policy == e_CFIFO_Reject) ? (int32_t)pushed : n;
 	}
 }
 
@@ -154,46 +259,368 @@ int32_t cfifo_pushn(cfifo_t *fifo, const char ch[], int32_t n)
 int32_t cfifo_popn(cfifo_t *fifo, char ch[], int32_t n)
 {
 	uint32_t irqflag;
-	if (fifo->usedw <= 0) {
+	uint32_t popped;
+	if (cfifo_used(fifo) <= 0) {
 		return -EFIFOEMPTY;
 	}
-	else if (ec_try_lock_irqsave(&(fifo->poplock), &irqflag) != 0) {
+	else if (n <= 0) {
+		return 0;
+	}
+	else if (__pop_lock(fifo, &irqflag) != 0) {
 		return -EBUSY;
 	}
 	else {
-		int i;
-		for (i = 0;
-			 (fifo->usedw > 0) && (i < n);
-			 i++) {
-			__pop(fifo, &ch[i]);
+		popped = __popn(fifo, ch, (uint32_t)n);
+		__pop_unlock(fifo, irqflag);
+		return (int32_t)popped;
+	}
+}
+
+/**
+  *@brief	Reserve all free space of a fifo for in-place writing.
+  *@details	The push lock is kept until cfifo_write_commit() is called,
+  *			other pushers get -EBUSY in the meantime. Interrupts are
+  *			not masked, so the region can be filled by DMA or a parser.
+  *@param	*fifo		pointer to fifo structure to be operated
+  *@param	span[2]		free regions, span[1].len is 0 if not wrapped
+  *@retval	-EFIFOFULL	fifo is full
+  *@retval	-EBUSY		fifo is push-locked
+  *@retval	>0			total length of reserved space
+  */
+int32_t cfifo_write_reserve(cfifo_t *fifo, cfifo_span_t span[2])
+{
+	uint32_t tail;
+	if (cfifo_free(fifo) <= 0) {
+		return -EFIFOFULL;
+	}
+#if !_CFIFO_LOCKFREE_SPSC
+	if (ec_try_lock(&(fifo->pushlock)) != 0) {
+		return -EBUSY;
+	}
+#endif
+	tail = fifo->tail;
+	__DMB();
+	return __spans(fifo, tail, (uint32_t)fifo->depth - (tail - fifo->head), span);
+}
+
+/**
+  *@brief	Publish n characters written into reserved space.
+  *@details	If more than the free space was written (a circular DMA may
+  *			do that), an e_CFIFO_OverwriteOldest fifo drops the oldest
+  *			chars, other fifos clamp n to the free space.
+  *@param	*fifo		pointer to fifo structure to be operated
+  *@param	n			count of written chars
+  *@retval	>=0			count of committed characters
+  */
+int32_t cfifo_write_commit(cfifo_t *fifo, int32_t n)
+{
+	n = __commit(fifo, n);
+#if !_CFIFO_LOCKFREE_SPSC
+	ec_unlock(&(fifo->pushlock));
+#endif
+	return n;
+}
+
+/**
+  *@brief	Publish n characters a producer wrote ahead of tail on its own,
+  *			without cfifo_write_reserve().
+  *@details	For a circular DMA kept clear of unread data with
+  *			cfifo_write_guard(). No lock is taken or released, the caller
+  *			must be the only pusher of the fifo. Overflow is handled as in
+  *			cfifo_write_commit().
+  *@param	*fifo		pointer to fifo structure to be operated
+  *@param	n			count of written chars
+  *@retval	>=0			count of committed characters
+  */
+int32_t cfifo_write_advance(cfifo_t *fifo, int32_t n)
+{
+	return __commit(fifo, n);
+}
+
+/**
+  *@brief	Keep n slots behind tail free for a producer that writes
+  *			ahead of cfifo_write_commit().
+  *@details	Only for e_CFIFO_OverwriteOldest, the oldest chars are dropped
+  *			and counted in cfifo_dropped() before they get overwritten,
+  *			so a consumer never copies them half replaced.
+  *@param	*fifo		pointer to fifo structure to be operated
+  *@param	n			count of slots to keep free, clamped to depth
+  *@retval	-EINVAL		fifo does not overwrite
+  *@retval	>=0			count of dropped characters
+  */
+int32_t cfifo_write_guard(cfifo_t *fifo, int32_t n)
+{
+	uint32_t dropped;
+	if (fifo->policy != e_CFIFO_OverwriteOldest) {
+		return -EINVAL;
+	}
+	else if (n <= 0) {
+		return 0;
+	}
+	else {
+		if (n > fifo->depth) {
+			n = fifo->depth;
 		}
-		ec_unlock_irqrestore(&(fifo->poplock), irqflag);
-		return i;
+		dropped = __make_room(fifo, fifo->tail, (uint32_t)n);
+		fifo->dropped += dropped;
+		return (int32_t)dropped;
 	}
 }
 
-static inline void __push(cfifo_t *fifo, const char ch)
+/**
+  *@brief	Get the stored data of a fifo without copying it out.
+  *@details	The pop lock is kept until cfifo_read_release() is called.
+  *			With e_CFIFO_OverwriteOldest the producer may overwrite
+  *			peeked data in the meantime, check cfifo_dropped() if it
+  *			matters.
+  *@param	*fifo		pointer to fifo structure to be operated
+  *@param	span[2]		data regions, span[1].len is 0 if not wrapped
+  *@retval	-EFIFOEMPTY	fifo is empty
+  *@retval	-EBUSY		fifo is pop-locked
+  *@retval	>0			total length of stored data
+  */
+int32_t cfifo_read_peek(cfifo_t *fifo, cfifo_span_t span[2])
 {
-	fifo->fifo[fifo->tail] = ch;
-	fifo->usedw++;
-	if (fifo->tail == fifo->depth - 1) {
-		fifo->tail = 0;
+	uint32_t head;
+	if (cfifo_used(fifo) <= 0) {
+		return -EFIFOEMPTY;
+	}
+#if !_CFIFO_LOCKFREE_SPSC
+	if (ec_try_lock(&(fifo->poplock)) != 0) {
+		return -EBUSY;
+	}
+#endif
+	head = fifo->head;
+	fifo->peek = head;
+	__DMB();
+	return __spans(fifo, head, fifo->tail - head, span);
+}
+
+/**
+  *@brief	Drop n characters that have been consumed in place.
+  *@param	*fifo		pointer to fifo structure to be operated
+  *@param	n			count of consumed chars, clamped to the peeked data
+  *@retval	>=0			count of released characters
+  */
+int32_t cfifo_read_release(cfifo_t *fifo, int32_t n)
+{
+	uint32_t used = fifo->tail - fifo->peek;
+	uint32_t head;
+	if (n < 0) {
+		n = 0;
+	}
+	else if ((uint32_t)n > used) {
+		n = (int32_t)used;
+	}
+	__DMB();
+	if (fifo->policy == e_CFIFO_OverwriteOldest) {
+		// Producer may have already pushed head beyond what we release.
+		do {
+			head = __LDREXW(&(fifo->head));
+			if ((int32_t)(fifo->peek + (uint32_t)n - head) <= 0) {
+				__CLREX();
+				break;
+			}
+		} while (__STREXW(fifo->peek + (uint32_t)n, &(fifo->head)) != 0);
 	}
 	else {
-		fifo->tail++;
+		fifo->head = fifo->peek + (uint32_t)n;
+	}
+#if !_CFIFO_LOCKFREE_SPSC
+	ec_unlock(&(fifo->poplock));
+#endif
+	return n;
+}
+
+/**
+ * With _CFIFO_LOCKFREE_SPSC, the caller guarantees there is only one
+ * pusher and one popper, so the ordering of index updates is enough and
+ * no lock is taken at all.
+ */
+static inline int32_t __push_lock(cfifo_t *fifo, uint32_t *irqflag)
+{
+#if _CFIFO_LOCKFREE_SPSC
+	(void)fifo;
+	(void)irqflag;
+	return 0;
+#else
+	return ec_try_lock_irqsave_stat(&(fifo->pushlock), irqflag, pv_push_stat);
+#endif
+}
+
+static inline void __push_unlock(cfifo_t *fifo, uint32_t irqflag)
+{
+#if _CFIFO_LOCKFREE_SPSC
+	(void)fifo;
+	(void)irqflag;
+#else
+	ec_unlock_irqrestore_stat(&(fifo->pushlock), irqflag, pv_push_stat);
+#endif
+}
+
+static inline int32_t __pop_lock(cfifo_t *fifo, uint32_t *irqflag)
+{
+#if _CFIFO_LOCKFREE_SPSC
+	(void)fifo;
+	(void)irqflag;
+	return 0;
+#else
+	return ec_try_lock_irqsave_stat(&(fifo->poplock), irqflag, pv_pop_stat);
+#endif
+}
+
+static inline void __pop_unlock(cfifo_t *fifo, uint32_t irqflag)
+{
+#if _CFIFO_LOCKFREE_SPSC
+	(void)fifo;
+	(void)irqflag;
+#else
+	ec_unlock_irqrestore_stat(&(fifo->poplock), irqflag, pv_pop_stat);
+#endif
+}
+
+/**
+ * Overwriting producer only. Advance head in a single step so that n
+ * more chars (n <= depth) fit behind tail, return count of chars lost.
+ */
+static inline uint32_t __make_room(cfifo_t *fifo, uint32_t tail, uint32_t n)
+{
+	uint32_t head;
+	uint32_t over;
+	do {
+		head = __LDREXW(&(fifo->head));
+		over = (tail - head) + n;
+		if (over <= (uint32_t)fifo->depth) {
+			__CLREX();
+			return 0;
+		}
+		over -= (uint32_t)fifo->depth;
+	} while (__STREXW(head + over, &(fifo->head)) != 0);
+	return over;
+}
+
+/**
+ * Consumer side head update. For an overwriting fifo, fail if the
+ * producer moved head while we were copying, the copy may be torn and
+ * must be redone from the new head.
+ */
+static inline int32_t __advance_head(cfifo_t *fifo, uint32_t head, uint32_t n)
+{
+	if (fifo->policy != e_CFIFO_OverwriteOldest) {
+		fifo->head = head + n;
+		return 0;
 	}
-	return;
+	do {
+		if (__LDREXW(&(fifo->head)) != head) {
+			__CLREX();
+			return -1;
+		}
+	} while (__STREXW(head + n, &(fifo->head)) != 0);
+	return 0;
 }
 
-static inline void __pop(cfifo_t *fifo, char *ch)
+/**
+ * Move tail over n written chars, the lock is up to the caller.
+ */
+static inline int32_t __commit(cfifo_t *fifo, int32_t n)
 {
-	*ch = fifo->fifo[fifo->head];
-	if (fifo->head == fifo->depth - 1) {
-		fifo->head = 0;
+	uint32_t tail = fifo->tail;
+	uint32_t space = (uint32_t)fifo->depth - (tail - fifo->head);
+	if (n < 0) {
+		n = 0;
+	}
+	else if (n > fifo->depth) {
+		fifo->dropped += (uint32_t)(n - fifo->depth);
+		n = fifo->depth;
+	}
+	if ((uint32_t)n > space) {
+		if (fifo->policy == e_CFIFO_OverwriteOldest) {
+			fifo->dropped += __make_room(fifo, tail, (uint32_t)n);
+		}
+		else {
+			n = (int32_t)space;
+		}
+	}
+	__DMB();
+	fifo->tail = tail + (uint32_t)n;
+	return n;
+}
+
+/**
+ * Copy at most n characters in, in two segments if the free space
+ * wraps around the end of the buffer. Return count of stored chars.
+ */
+static inline uint32_t __pushn(cfifo_t *fifo, const char ch[], uint32_t n)
+{
+	uint32_t tail = fifo->tail;
+	uint32_t depth = (uint32_t)fifo->depth;
+	uint32_t offset = tail & fifo->mask;
+	uint32_t space;
+	uint32_t first;
+	if (fifo->policy == e_CFIFO_OverwriteOldest) {
+		if (n > depth) {
+			// Only the last depth chars could survive anyway.
+			fifo->dropped += n - depth;
+			ch = &ch[n - depth];
+			n = depth;
+		}
+		fifo->dropped += __make_room(fifo, tail, n);
 	}
 	else {
-		fifo->head++;
+		space = depth - (tail - fifo->head);
+		if (n > space) {
+			if (fifo->policy == e_CFIFO_DropNewest) {
+				fifo->dropped += n - space;
+			}
+			n = space;
+		}
+	}
+	first = depth - offset;
+	if (first > n) {
+		first = n;
+	}
+	memcpy(&(fifo->fifo[offset]), ch, first);
+	memcpy(&(fifo->fifo[0]), &ch[first], n - first);
+	// Data must be visible before the consumer sees the new tail.
+	ec_wmb();
+	fifo->tail = tail + n;
+	return n;
+}
+
+static inline uint32_t __popn(cfifo_t *fifo, char ch[], uint32_t n)
+{
+	uint32_t head;
+	uint32_t used;
+	uint32_t offset;
+	uint32_t first;
+	uint32_t count;
+	do {
+		head = fifo->head;
+		used = fifo->tail - head;
+		offset = head & fifo->mask;
+		count = (n > used) ? used : n;
+		first = (uint32_t)fifo->depth - offset;
+		if (first > count) {
+			first = count;
+		}
+		memcpy(ch, &(fifo->fifo[offset]), first);
+		memcpy(&ch[first], &(fifo->fifo[0]), count - first);
+		// Data must be read out before the producer may reuse the slots.
+		ec_rmb();
+	} while (__advance_head(fifo, head, count) != 0);
+	return count;
+}
+
+static inline int32_t __spans(cfifo_t *fifo, uint32_t index, uint32_t n, cfifo_span_t span[2])
+{
+	uint32_t offset = index & fifo->mask;
+	uint32_t first = (uint32_t)fifo->depth - offset;
+	if (first > n) {
+		first = n;
 	}
-	fifo->usedw--;
-	return;
+	span[0].ptr = &(fifo->fifo[offset]);
+	span[0].len = (int32_t)first;
+	span[1].ptr = &(fifo->fifo[0]);
+	span[1].len = (int32_t)(n - first);
+	return (int32_t)n;
 }
@@ -21,37 +21,85 @@
 
 #include "ec_api.h"
 
+#include "cfifo.h"
+#include "cmsis_port.h"
 #include "ec_config.h"
+#include "ec_dev.h"
 #include "ec_fcntl.h"
 #include "ec_fdlist.h"
 #include "ec_file.h"
+#include "ec_ioctl.h"
 #include "ec_mmap.h"
+#include "ec_poll.h"
+#include "ec_tmpfs.h"
 #include "exceptions.h"
 #include "heap_port.h"
 
 #include <stddef.h>
 #include <stdint.h>
 
+#if _WITH_CMSISOS_V2
+#	include "cmsis_os2.h"
+#endif
+
 #if _WITH_LWIP_SOCKET_WRAPPER
 #	include "ec_lwip_wrapper.h"
 #endif
 
+static int32_t __fd_put(int32_t fd, file_des_t *fd_st);
+static int32_t __close(int32_t fd, int32_t slot);
+static int32_t __dup(int32_t slot);
+static int32_t __fd_release(int32_t fd, file_des_t *fd_st);
+static int32_t __fd_drop(file_des_t *fd_st);
+static int32_t __writev_loop(file_des_t *file_des, const struct iovec *iov, int32_t iovcnt);
+static int32_t __readv_loop(file_des_t *file_des, const struct iovec *iov, int32_t iovcnt);
+
+/**
+ * Set up the ECLayer tables, call it once before EC_Driver_Initialize()
+ * and before any task uses the api.
+ */
+void EC_Layer_Initialize(void)
+{
+	ecslab_init();
+	cfifo_stat_init();
+	ec_poll_init();
+	fd_list_init();
+	file_list_init();
+	device_list_init();
+	vfs_init();
+#if _WITH_CMSISOS_V2
+	pipe_list_init();
+#endif
+}
+
 int32_t open(const char *filename, uint32_t flags)
 {
 	int32_t err;
 	file_t *file;
-	int16_t new_file_opened = 0;
 	file = search_file(filename);
 
 	if (file == NULL) {
 		if ((flags & O_CREAT) != 0x0) {
+#if _USE_TMPFS && _WITH_CMSISOS_V2
+			file = tmpfs_create(filename);
+#else
 			file = create_file(filename, NULL, NULL);
+#endif
 			if (file == NULL) {
 				err = -ENOMEM;	// failed to create new file.
 				goto error;
 			}
-			else {
-				new_file_opened = 1;
+			// Referenced before anybody else can find it.
+			atomic_inc(&(file->file_refs));
+			// Registered right away, the file outlives a failed open
+			// below just like on disk.
+			err = file_regist(file);
+			if (err != 0) {
+				// Somebody created the same name meanwhile, or the path
+				// lies below a mount point.
+				destroy_file(file);
+				err = (err == -EFREGED) ? -EEXIST : err;
+				goto error;
 			}
 		}
 		else {
@@ -63,12 +111,13 @@ int32_t open(const char *filename, uint32_t flags)
 		if ((flags & O_CREAT) != 0x0) {
 			if ((flags & O_EXEC) != 0x0) {
 				err = -EEXIST;	// file already exists.
-				goto error;
+				goto release_file;
 			}
-			else if ((flags & O_TRUNC) != 0x0) {
+			else if (((flags & O_TRUNC) != 0x0) && ((file->file_opts == NULL) || (file->file_opts->open == NULL))) {
+				// Files with an open op truncate themselves.
 				if (empty_file(file) != 0) {
 					err = -EBUSY;  // failed to trunc file, probably file is locked
-					goto error;
+					goto release_file;
 				}
 			}
 			else {
@@ -81,41 +130,35 @@ int32_t open(const char *filename, uint32_t flags)
 	}
 
 	int32_t fd;
+	int32_t lfd;
 	file_des_t *fd_st;
-	fd_st = (file_des_t *)ecmalloc(sizeof(file_des_t));
+	fd_st = (file_des_t *)ecslab_alloc(sizeof(file_des_t));
 	if (fd_st == NULL) {
 		err = -ENOMEM;
-		if (new_file_opened) {
-			ecfree(file);
-		}
-		goto error;
+		goto release_file;
 	}
 	else {
-		/**
-		 *@warning	if RTOS is not used, and fdlist is locked,
-		 *			a deadlock is produced here.
-		 *@todo		Probable solutions :
-		 *			1.Use mutex or semaphore instead of ec_lock in ECLayer kernel
-		 *			2.Introduce a wrapper for manual thread manager that suits RTOS and non-RTOS
-		 *			3.Use macro that indicates non-RTOS situation and return error directly
-		 *			I would like to modify ec_lock to support non block lock wait mechanism.
-		 */
-		do {
-			fd = alloc_fd(fd_st);
-		} while (fd == -EBUSY);
+		// Sleeps on the fd list mutex if another task holds it.
+		fd = alloc_fd(fd_st);
 		if (fd < 0) {
 			err = fd;
-			if (new_file_opened) {
-				ecfree(file);
-			}
-			ecfree(fd_st);
-			while (free_fd(fd) != 0)
-				;
-			goto error;
+			ecslab_free(fd_st, sizeof(file_des_t));
+			goto release_file;
+		}
+		lfd = fd_install(fd);
+		if (lfd < 0) {
+			err = lfd;
+			free_fd(fd);
+			ecslab_free(fd_st, sizeof(file_des_t));
+			goto release_file;
 		}
 		else {
+			atomic_set(&(fd_st->file_des_refs), 1);
 			fd_st->file_flags = flags;
 			fd_st->file_pos = 0;
+			fd_st->read_min = 0;
+			fd_st->read_timeout = 0;
+			fd_st->read_interval = 0;
 			/**
 			 * Default set file type to e_FTYPE_DEV, but might be changed
 			 * in later version. Do not rely on it.
@@ -130,13 +173,13 @@ int32_t open(const char *filename, uint32_t flags)
 			err = file->file_opts->open(fd_st, filename, flags);
 			if (err < 0) {
 				// error occurred when calling file specified open operation
-				ecfree(fd_st);
-				while (free_fd(fd) != 0)
-					;
-				goto error;
+				fd_forget(lfd);
+				ecslab_free(fd_st, sizeof(file_des_t));
+				free_fd(fd);
+				goto release_file;
 			}
 			else {
-				goto private_open_success;	// file-defined open operation success
+				goto success;  // file-defined open operation success
 			}
 		}
 		else {
@@ -148,57 +191,98 @@ int32_t open(const char *filename, uint32_t flags)
 	}
 
 success:
-	atomic_inc(&(file->file_refs));
-private_open_success:
-	err = fd;
+	// The reference search_file() took stays with the fd, close() drops it.
+	fd_publish(fd);
+	err = lfd;
+	return err;
+release_file:
+	put_file(file);
 error:
 	return err;
 }
 
 int32_t close(int32_t fd)
 {
+	return __close(fd, fd_resolve(fd));
+}
+
+/**
+ * New fd sharing the open file description of fd, flags and position
+ * included. The lowest free fd is returned.
+ */
+int32_t dup(int32_t fd)
+{
+	int32_t slot;
 	int32_t err;
-	if ((fd < 0) || (fd > _FD_LIST_MAXNUM)) {
-		err = -EMFILE;	// illegal fd input
-		goto error;
+	slot = __dup(fd_resolve(fd));
+	if (slot < 0) {
+		return slot;
+	}
+	err = fd_install(slot);
+	if (err < 0) {
+		__close(-1, slot);
 	}
+	return err;
+}
+
+/**
+ * As dup(), on newfd, which is closed first if open. newfd is left alone
+ * if oldfd is not open. Returns -EBUSY if a call on another task is still
+ * running on newfd.
+ */
+int32_t dup2(int32_t oldfd, int32_t newfd)
+{
+	int32_t slot;
+	int32_t err;
 	file_des_t *fd_st;
-	fd_st = get_fd_struct(fd);
+	file_des_t *old;
+	slot = fd_resolve(oldfd);
+	fd_st = fd_pin(slot);
 	if (fd_st == NULL) {
-		// fd does not exist
-		err = -EBADF;
-		goto error;
+		return -EBADF;
 	}
-#if _WITH_LWIP_SOCKET_WRAPPER
-	if (fd_st->file_type == e_FTYPE_SOCKET) {
-		err = (int32_t)lwip_close(ec_fd2sock(fd));
-		if (!err) {
-			ecfree(fd_st);
+	if (oldfd == newfd) {
+		__fd_put(slot, fd_st);
+		return newfd;
+	}
+#if _FD_PER_TASK
+	fd_table_t *table = fd_table_current();
+	if (table != NULL) {
+		int32_t newslot;
+		if ((newfd < 0) || (newfd >= _FD_TASK_MAXNUM)) {
+			__fd_put(slot, fd_st);
+			return -EBADF;
+		}
+		newslot = __dup(slot);
+		if (newslot < 0) {
+			err = newslot;
+		}
+		else {
+			// Nobody else installs into our table, newfd stays free
+			// from the close to the install.
+			__close(newfd, fd_resolve(newfd));
+			err = fd_table_install(table, newfd, newslot);
+			if (err < 0) {
+				__close(-1, newslot);
+			}
 		}
+		__fd_put(slot, fd_st);
 		return err;
 	}
 #endif
-	file_t *file;
-	file = fd_st->file;
-
-	err = free_fd(fd);
+	atomic_inc(&(fd_st->file_des_refs));
+	err = fd_replace(newfd, fd_st, &old);
 	if (err < 0) {
-		goto error;
-	}
-	if (file->file_opts != NULL) {
-		if (file->file_opts->close != NULL) {
-			err = file->file_opts->close(fd_st);
-		}
-		else {
-			err = 0;
-		}
+		// slot is still pinned, the count can't drop to 0 here.
+		atomic_dec(&(fd_st->file_des_refs));
 	}
 	else {
-		err = 0;
+		fd_publish(newfd);
+		if (old != NULL) {
+			__fd_drop(old);
+		}
 	}
-	ecfree(fd_st);
-	atomic_dec(&(file->file_refs));
-error:
+	__fd_put(slot, fd_st);
 	return err;
 }
 
@@ -206,13 +290,14 @@ int32_t write(int32_t fd, const char *data, size_t length)
 {
 	int32_t err;
 	file_des_t *file_des;
-	file_des = get_fd_struct(fd);
+	fd = fd_resolve(fd);
+	file_des = fd_pin(fd);
 	if (file_des == NULL) {
 		err = -EBADF;
 	}
 #if _WITH_LWIP_SOCKET_WRAPPER
 	else if (file_des->file_type == e_FTYPE_SOCKET) {
-		err = (int32_t)lwip_write(ec_fd2sock(fd), data, length);
+		err = (int32_t)lwip_write(file_des->sock_num, data, length);
 	}
 #endif
 	else if (file_des->file == NULL) {
@@ -224,6 +309,7 @@ int32_t write(int32_t fd, const char *data, size_t length)
 	else {
 		err = file_des->file->file_opts->write(file_des, data, length);
 	}
+	__fd_put(fd, file_des);
 	return err;
 }
 
@@ -231,13 +317,14 @@ int32_t read(int32_t fd, char *data, size_t length)
 {
 	int32_t err;
 	file_des_t *file_des;
-	file_des = get_fd_struct(fd);
+	fd = fd_resolve(fd);
+	file_des = fd_pin(fd);
 	if (file_des == NULL) {
 		err = -EBADF;
 	}
 #if _WITH_LWIP_SOCKET_WRAPPER
 	else if (file_des->file_type == e_FTYPE_SOCKET) {
-		err = (int32_t)lwip_read(ec_fd2sock(fd), data, length);
+		err = (int32_t)lwip_read(file_des->sock_num, data, length);
 	}
 #endif
 	else if (file_des->file == NULL) {
@@ -249,31 +336,175 @@ int32_t read(int32_t fd, char *data, size_t length)
 	else {
 		err = file_des->file->file_opts->read(file_des, data, length);
 	}
+	__fd_put(fd, file_des);
+	return err;
+}
+
+int32_t writev(int32_t fd, const struct iovec *iov, int32_t iovcnt)
+{
+	int32_t err;
+	file_des_t *file_des;
+	if ((iov == NULL) || (iovcnt < 0)) {
+		return -EINVAL;
+	}
+	fd = fd_resolve(fd);
+	file_des = fd_pin(fd);
+	if (file_des == NULL) {
+		err = -EBADF;
+	}
+#if _WITH_LWIP_SOCKET_WRAPPER
+	else if (file_des->file_type == e_FTYPE_SOCKET) {
+		err = (int32_t)lwip_writev(file_des->sock_num, iov, iovcnt);
+	}
+#endif
+	else if (file_des->file == NULL) {
+		err = -EFDNOFILE;  // file descriptor does not contain valid file.
+	}
+	else if (file_des->file->file_opts == NULL) {
+		err = -ENOTSUP;	 // file has no operations at all.
+	}
+	else if (file_des->file->file_opts->writev != NULL) {
+		err = file_des->file->file_opts->writev(file_des, iov, iovcnt);
+	}
+	else if (file_des->file->file_opts->write == NULL) {
+		err = -ENOTSUP;	 // file does not support write operation.
+	}
+	else {
+		err = __writev_loop(file_des, iov, iovcnt);
+	}
+	__fd_put(fd, file_des);
+	return err;
+}
+
+int32_t readv(int32_t fd, const struct iovec *iov, int32_t iovcnt)
+{
+	int32_t err;
+	file_des_t *file_des;
+	if ((iov == NULL) || (iovcnt < 0)) {
+		return -EINVAL;
+	}
+	fd = fd_resolve(fd);
+	file_des = fd_pin(fd);
+	if (file_des == NULL) {
+		err = -EBADF;
+	}
+#if _WITH_LWIP_SOCKET_WRAPPER
+	else if (file_des->file_type == e_FTYPE_SOCKET) {
+		err = (int32_t)lwip_readv(file_des->sock_num, iov, iovcnt);
+	}
+#endif
+	else if (file_des->file == NULL) {
+		err = -EFDNOFILE;  // file descriptor does not contain valid file.
+	}
+	else if (file_des->file->file_opts == NULL) {
+		err = -ENOTSUP;	 // file has no operations at all.
+	}
+	else if (file_des->file->file_opts->readv != NULL) {
+		err = file_des->file->file_opts->readv(file_des, iov, iovcnt);
+	}
+	else if (file_des->file->file_opts->read == NULL) {
+		err = -ENOTSUP;	 // file does not support read operation.
+	}
+	else {
+		err = __readv_loop(file_des, iov, iovcnt);
+	}
+	__fd_put(fd, file_des);
 	return err;
 }
 
+/**
+ * writev/readv for files without a vectored op, one call per segment.
+ * Stops at the first short transfer, as a single write/read would.
+*/
+static int32_t __writev_loop(file_des_t *file_des, const struct iovec *iov, int32_t iovcnt)
+{
+	int32_t total = 0;
+	int32_t err = 0;
+	for (int32_t i = 0; i < iovcnt; i++) {
+		err = file_des->file->file_opts->write(file_des, (const char *)iov[i].iov_base, iov[i].iov_len);
+		if (err < 0) {
+			break;
+		}
+		total += err;
+		if ((size_t)err < iov[i].iov_len) {
+			break;
+		}
+	}
+	return ((err < 0) && (total == 0)) ? err : total;
+}
+
+static int32_t __readv_loop(file_des_t *file_des, const struct iovec *iov, int32_t iovcnt)
+{
+	int32_t total = 0;
+	int32_t err = 0;
+	for (int32_t i = 0; i < iovcnt; i++) {
+		err = file_des->file->file_opts->read(file_des, (char *)iov[i].iov_base, iov[i].iov_len);
+		if (err < 0) {
+			break;
+		}
+		total += err;
+		if ((size_t)err < iov[i].iov_len) {
+			break;
+		}
+	}
+	return ((err < 0) && (total == 0)) ? err : total;
+}
+
+static int32_t __fd_ioctl(file_des_t *file_des, uint32_t cmd, uint64_t arg)
+{
+	uint32_t *rtval = (uint32_t *)((uintptr_t)arg & 0xffffffffU);
+	switch (cmd) {
+	case CMD_FD_SETREADMIN:
+		file_des->read_min = (uint32_t)(arg & 0xffffffffU);
+		break;
+	case CMD_FD_GETREADMIN:
+		*rtval = file_des->read_min;
+		break;
+	case CMD_FD_SETREADTIMEOUT:
+		file_des->read_timeout = (uint32_t)(arg & 0xffffffffU);
+		break;
+	case CMD_FD_GETREADTIMEOUT:
+		*rtval = file_des->read_timeout;
+		break;
+	case CMD_FD_SETREADINTERVAL:
+		file_des->read_interval = (uint32_t)(arg & 0xffffffffU);
+		break;
+	case CMD_FD_GETREADINTERVAL:
+		*rtval = file_des->read_interval;
+		break;
+	default:
+		return -EBADCMD;
+	}
+	return 0;
+}
+
 int32_t ioctl(int32_t fd, uint32_t cmd, uint64_t arg)
 {
 	int32_t err;
 	file_des_t *file_des;
-	file_des = get_fd_struct(fd);
+	fd = fd_resolve(fd);
+	file_des = fd_pin(fd);
 	if (file_des == NULL) {
 		err = -EBADF;
 	}
 #if _WITH_LWIP_SOCKET_WRAPPER
 	else if (file_des->file_type == e_FTYPE_SOCKET) {
-		err = (int32_t)lwip_ioctl(ec_fd2sock(fd), cmd, (void *)arg);
+		err = (int32_t)lwip_ioctl(file_des->sock_num, cmd, (void *)arg);
 	}
 #endif
 	else if (file_des->file == NULL) {
 		err = -EFDNOFILE;  // file descriptor does not contain valid file.
 	}
+	else if (_IOC_TYPE(cmd) == EC_FD_MAGIC) {
+		err = __fd_ioctl(file_des, cmd, arg);
+	}
 	else if (file_des->file->file_opts->ioctl == NULL) {
 		err = -ENOTSUP;
 	}
 	else {
 		err = file_des->file->file_opts->ioctl(file_des, cmd, arg);
 	}
+	__fd_put(fd, file_des);
 	return err;
 }
 
@@ -281,7 +512,8 @@ int64_t lseek(int32_t fd, int64_t offset, int32_t origin)
 {
 	int32_t err;
 	file_des_t *file_des;
-	file_des = get_fd_struct(fd);
+	fd = fd_resolve(fd);
+	file_des = fd_pin(fd);
 	if (file_des == NULL) {
 		err = -EBADF;
 	}
@@ -299,6 +531,7 @@ int64_t lseek(int32_t fd, int64_t offset, int32_t origin)
 	else {
 		err = file_des->file->file_opts->lseek(file_des, offset, origin);
 	}
+	__fd_put(fd, file_des);
 	return err;
 }
 
@@ -306,13 +539,14 @@ int32_t fcntl(int32_t fd, int32_t cmd, int32_t arg)
 {
 	int32_t err;
 	file_des_t *file_des;
-	file_des = get_fd_struct(fd);
+	fd = fd_resolve(fd);
+	file_des = fd_pin(fd);
 	if (file_des == NULL) {
 		err = -EBADF;
 	}
 #if _WITH_LWIP_SOCKET_WRAPPER
 	else if (file_des->file_type == e_FTYPE_SOCKET) {
-		err = lwip_fcntl(ec_fd2sock(fd), (int)cmd, (int)arg);
+		err = lwip_fcntl(file_des->sock_num, (int)cmd, (int)arg);
 		if (err >= 0) {
 			switch (cmd) {
 			case F_GETFL:
@@ -346,9 +580,249 @@ int32_t fcntl(int32_t fd, int32_t cmd, int32_t arg)
 			break;
 		}
 	}
+	__fd_put(fd, file_des);
 	return err;
 }
 
+#if _WITH_CMSISOS_V2
+// Tables up to this many fds live on the stack.
+#	define __POLL_STACK_ENTRIES 8
+
+// An fd stays pinned for the whole ec_poll() unless it was not open.
+#	define __poll_pinned(pfd) (((pfd)->fd >= 0) && (((pfd)->revents & EC_POLLNVAL) == 0))
+
+static uint32_t __poll_ticks(uint32_t ms)
+{
+	return (uint32_t)(((uint64_t)ms * osKernelGetTickFreq() + 999U) / 1000U);
+}
+
+/**
+ * Scan the device fds, sockets are left to __poll_sockets().
+ * Returns the number of fds with revents set.
+*/
+static int32_t __poll_devices(ec_pollfd_t *fds, uint32_t nfds, ec_poll_table_t *table)
+{
+	int32_t ready = 0;
+	file_des_t *fd_st;
+	uint32_t mask;
+	for (uint32_t i = 0; i < nfds; i++) {
+		if (!__poll_pinned(&fds[i])) {
+			ready += (fds[i].revents != 0) ? 1 : 0;
+			continue;
+		}
+		fd_st = get_fd_struct(fd_resolve(fds[i].fd));
+#	if _WITH_LWIP_SOCKET_WRAPPER
+		if (fd_st->file_type == e_FTYPE_SOCKET) {
+			continue;
+		}
+#	endif
+		if (fd_st->file == NULL) {
+			mask = EC_POLLERR;
+		}
+		else if ((fd_st->file->file_opts == NULL) || (fd_st->file->file_opts->poll == NULL)) {
+			// No poll support, read and write never wait on it.
+			mask = EC_POLLIN | EC_POLLOUT;
+		}
+		else {
+			mask = fd_st->file->file_opts->poll(fd_st, table);
+		}
+		fds[i].revents = (uint16_t)(mask & (fds[i].events | EC_POLLERR | EC_POLLHUP));
+		if (fds[i].revents != 0) {
+			ready++;
+		}
+	}
+	return ready;
+}
+
+#	if _WITH_LWIP_SOCKET_WRAPPER && LWIP_SOCKET_SELECT
+/**
+ * Hand the socket fds to lwip_select(), waiting at most ticks.
+ * Returns the number of sockets with revents set.
+*/
+static int32_t __poll_sockets(ec_pollfd_t *fds, uint32_t nfds, uint32_t ticks)
+{
+	fd_set rset;
+	fd_set wset;
+	fd_set eset;
+	struct timeval tv;
+	file_des_t *fd_st;
+	int maxfdp1 = 0;
+	int32_t ready = 0;
+	int s;
+	FD_ZERO(&rset);
+	FD_ZERO(&wset);
+	FD_ZERO(&eset);
+	for (uint32_t i = 0; i < nfds; i++) {
+		if (!__poll_pinned(&fds[i])) {
+			continue;
+		}
+		fd_st = get_fd_struct(fd_resolve(fds[i].fd));
+		if (fd_st->file_type != e_FTYPE_SOCKET) {
+			continue;
+		}
+		s = fd_st->sock_num;
+		if (fds[i].events & EC_POLLIN) {
+			FD_SET(s, &rset);
+		}
+		if (fds[i].events & EC_POLLOUT) {
+			FD_SET(s, &wset);
+		}
+		FD_SET(s, &eset);
+		maxfdp1 = (s + 1 > maxfdp1) ? (s + 1) : maxfdp1;
+	}
+	if (ticks != osWaitForever) {
+		uint64_t us = (uint64_t)ticks * 1000000U / osKernelGetTickFreq();
+		tv.tv_sec = (long)(us / 1000000U);
+		tv.tv_usec = (long)(us % 1000000U);
+	}
+	if (lwip_select(maxfdp1, &rset, &wset, &eset, (ticks == osWaitForever) ? NULL : &tv) < 0) {
+		return -EIO;
+	}
+	for (uint32_t i = 0; i < nfds; i++) {
+		if (!__poll_pinned(&fds[i])) {
+			continue;
+		}
+		fd_st = get_fd_struct(fd_resolve(fds[i].fd));
+		if (fd_st->file_type != e_FTYPE_SOCKET) {
+			continue;
+		}
+		s = fd_st->sock_num;
+		fds[i].revents = 0;
+		if (FD_ISSET(s, &rset)) {
+			fds[i].revents |= EC_POLLIN;
+		}
+		if (FD_ISSET(s, &wset)) {
+			fds[i].revents |= EC_POLLOUT;
+		}
+		if (FD_ISSET(s, &eset)) {
+			fds[i].revents |= EC_POLLERR;
+		}
+		if (fds[i].revents != 0) {
+			ready++;
+		}
+	}
+	return ready;
+}
+#	endif
+
+/**
+ * Wait until one of fds is ready, or timeout ms pass (-1 for ever, 0 to
+ * just check). Device fds sleep on their drivers' wait queues, sockets
+ * are handed to lwip_select(). With both kinds in fds the task sleeps on
+ * the devices and rechecks sockets every _POLL_SOCKET_SLICE_MS.
+ * Returns the number of fds with revents set, 0 on timeout.
+*/
+int32_t ec_poll(ec_pollfd_t *fds, uint32_t nfds, int32_t timeout)
+{
+	ec_poll_entry_t stack_entries[__POLL_STACK_ENTRIES];
+	ec_poll_table_t table;
+	ec_poll_table_t *hook;
+	file_des_t *fd_st;
+	uint32_t ndevs = 0;
+	uint32_t nsocks = 0;
+	uint32_t start;
+	uint32_t total;
+	uint32_t remain;
+	uint32_t wait;
+	int32_t ready;
+	int32_t err;
+
+	if ((fds == NULL) && (nfds != 0)) {
+		return -EINVAL;
+	}
+	if (__get_IPSR() != 0) {
+		// Never sleep in ISR.
+		timeout = 0;
+	}
+	if (nfds > __POLL_STACK_ENTRIES) {
+		table.entries = (ec_poll_entry_t *)ecmalloc(nfds * sizeof(ec_poll_entry_t));
+		if (table.entries == NULL) {
+			return -ENOMEM;
+		}
+	}
+	else {
+		table.entries = stack_entries;
+	}
+	table.nentries = 0;
+	table.maxentries = nfds;
+
+	for (uint32_t i = 0; i < nfds; i++) {
+		fds[i].revents = 0;
+		if (fds[i].fd < 0) {
+			continue;
+		}
+		fd_st = fd_pin(fd_resolve(fds[i].fd));
+		if (fd_st == NULL) {
+			fds[i].revents = EC_POLLNVAL;
+		}
+#	if _WITH_LWIP_SOCKET_WRAPPER
+		else if (fd_st->file_type == e_FTYPE_SOCKET) {
+			nsocks++;
+		}
+#	endif
+		else {
+			ndevs++;
+		}
+	}
+
+	start = osKernelGetTickCount();
+	total = (timeout > 0) ? __poll_ticks((uint32_t)timeout) : 0;
+	// Clear a stale wakeup before hooking, a wakeup after it is kept.
+	if (timeout != 0) {
+		osThreadFlagsClear(_POLL_THREAD_FLAG);
+		hook = &table;
+	}
+	else {
+		hook = NULL;
+	}
+	while (1) {
+		// Hook on the first scan only, the entries stay until we return.
+		ready = __poll_devices(fds, nfds, hook);
+		hook = NULL;
+		if (timeout < 0) {
+			remain = osWaitForever;
+		}
+		else {
+			uint32_t elapsed = osKernelGetTickCount() - start;
+			remain = (elapsed < total) ? (total - elapsed) : 0;
+		}
+#	if _WITH_LWIP_SOCKET_WRAPPER && LWIP_SOCKET_SELECT
+		if (nsocks > 0) {
+			// Sockets block in lwip_select() only when there is nothing else.
+			err = __poll_sockets(fds, nfds, ((ready > 0) || (ndevs > 0)) ? 0 : remain);
+			if (err < 0) {
+				ready = err;
+				break;
+			}
+			ready += err;
+		}
+#	else
+		(void)nsocks;
+#	endif
+		if ((ready != 0) || (remain == 0) || (ndevs == 0)) {
+			break;
+		}
+		wait = remain;
+		if ((nsocks > 0) && (wait > __poll_ticks(_POLL_SOCKET_SLICE_MS))) {
+			wait = __poll_ticks(_POLL_SOCKET_SLICE_MS);
+		}
+		osThreadFlagsWait(_POLL_THREAD_FLAG, osFlagsWaitAny, wait);
+	}
+	ec_poll_unwait(&table);
+
+	for (uint32_t i = 0; i < nfds; i++) {
+		if (__poll_pinned(&fds[i])) {
+			int32_t slot = fd_resolve(fds[i].fd);
+			__fd_put(slot, get_fd_struct(slot));
+		}
+	}
+	if (table.entries != stack_entries) {
+		ecfree(table.entries);
+	}
+	return ready;
+}
+#endif
+
 #if _USE_MMAP > 0
 void *mmap(void *addr, size_t len, int32_t prot, int32_t flags, int32_t fd, int32_t offset)
 {
@@ -361,7 +835,8 @@ void *mmap(void *addr, size_t len, int32_t prot, int32_t flags, int32_t fd, int3
 		rtptr = (void *)err;
 		goto error;
 	}
-	file_des = get_fd_struct(fd);
+	fd = fd_resolve(fd);
+	file_des = fd_pin(fd);
 	if (file_des == NULL) {
 		err = -EBADF;
 		rtptr = (void *)err;
@@ -370,17 +845,228 @@ void *mmap(void *addr, size_t len, int32_t prot, int32_t flags, int32_t fd, int3
 	else if (file_des->file == NULL) {
 		err = -EFDNOFILE;
 		rtptr = (void *)err;
-		goto error;
 	}
-	else if (file_des->file->file_opts->mmap == NULL) {
+	else if ((file_des->file->file_opts == NULL) || (file_des->file->file_opts->mmap == NULL)) {
 		err = -ENOTSUP;
 		rtptr = (void *)err;
-		goto error;
 	}
 	else {
 		rtptr = file_des->file->file_opts->mmap(file_des, len, offset);
 	}
+	__fd_put(fd, file_des);
 error:
 	return rtptr;
 }
 #endif
+
+#if _FD_PER_TASK
+typedef struct thread_start_s {
+	osThreadFunc_t func;
+	void *argument;
+	fd_table_t *table;
+} thread_start_t;
+
+static void __thread_entry(void *argument)
+{
+	thread_start_t start = *(thread_start_t *)argument;
+	ecslab_free(argument, sizeof(thread_start_t));
+	fd_table_attach(start.table);
+	start.func(start.argument);
+	ec_thread_exit();
+}
+
+/**
+ * osThreadNew() for tasks doing file I/O. The task gets its own fd
+ * table, its fd 0, 1 and 2 share the open file descriptions behind the
+ * caller's. Returning from func ends the task as ec_thread_exit() does.
+ */
+osThreadId_t ec_thread_new(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr)
+{
+	const int32_t stdio[3] = {0, 1, 2};
+	return ec_thread_new_fds(func, argument, attr, stdio);
+}
+
+/**
+ * ec_thread_new() handing the task other fds of the caller, its fd i
+ * shares the open file description behind the caller's fds[i], and is
+ * left closed for -1.
+ */
+osThreadId_t ec_thread_new_fds(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr, const int32_t fds[3])
+{
+	thread_start_t *start;
+	osThreadId_t thread;
+	int32_t slot;
+	start = (thread_start_t *)ecslab_alloc(sizeof(thread_start_t));
+	if (start == NULL) {
+		return NULL;
+	}
+	start->table = fd_table_new();
+	if (start->table == NULL) {
+		ecslab_free(start, sizeof(thread_start_t));
+		return NULL;
+	}
+	start->func = func;
+	start->argument = argument;
+	for (int32_t fd = 0; fd < 3; fd++) {
+		slot = (fds[fd] < 0) ? -EBADF : __dup(fd_resolve(fds[fd]));
+		if (slot >= 0) {
+			fd_table_install(start->table, fd, slot);
+		}
+	}
+	thread = osThreadNew(__thread_entry, start, attr);
+	if (thread == NULL) {
+		while ((slot = fd_table_take(start->table)) >= 0) {
+			__close(-1, slot);
+		}
+		fd_table_delete(start->table);
+		ecslab_free(start, sizeof(thread_start_t));
+	}
+	return thread;
+}
+
+/**
+ * Close every fd of the calling task and end it. Tasks from
+ * ec_thread_new() leave through here instead of osThreadExit().
+ */
+void ec_thread_exit(void)
+{
+	fd_table_t *table = fd_table_current();
+	int32_t slot;
+	if (table != NULL) {
+		fd_table_attach(NULL);
+		while ((slot = fd_table_take(table)) >= 0) {
+			__close(-1, slot);
+		}
+		fd_table_delete(table);
+	}
+	osThreadExit();
+}
+#endif
+
+/**
+ * Close slot, fd is the per task fd bound to it, -1 for none.
+ */
+static int32_t __close(int32_t fd, int32_t slot)
+{
+	int32_t err;
+	file_des_t *fd_st;
+	fd_st = fd_pin(slot);
+	if (fd_st == NULL) {
+		// fd does not exist
+		return -EBADF;
+	}
+#if _WITH_LWIP_SOCKET_WRAPPER
+	if ((fd_st->file_type == e_FTYPE_SOCKET) && (atomic_get(&(fd_st->file_des_refs)) == 1)) {
+		// Closed right away so that blocked socket calls return, a
+		// socket shared with a dup() is closed by its last fd.
+		err = (int32_t)lwip_close(fd_st->sock_num);
+		if (err != 0) {
+			__fd_put(slot, fd_st);
+			return err;
+		}
+		fd_st->sock_num = -1;
+	}
+#endif
+	if (fd_shut(slot) != 0) {
+		// closed by someone else meanwhile
+		__fd_put(slot, fd_st);
+		return -EBADF;
+	}
+	if (fd >= 0) {
+		fd_forget(fd);
+	}
+	// Released here, or by the last read/write still running on it.
+	return __fd_put(slot, fd_st);
+}
+
+/**
+ * New slot sharing the description of slot, the lowest free one.
+ */
+static int32_t __dup(int32_t slot)
+{
+	int32_t err;
+	file_des_t *fd_st;
+	fd_st = fd_pin(slot);
+	if (fd_st == NULL) {
+		return -EBADF;
+	}
+	atomic_inc(&(fd_st->file_des_refs));
+	err = alloc_fd(fd_st);
+	if (err < 0) {
+		// slot is still pinned, the count can't drop to 0 here.
+		atomic_dec(&(fd_st->file_des_refs));
+	}
+	else {
+		fd_publish(err);
+	}
+	__fd_put(slot, fd_st);
+	return err;
+}
+
+/**
+ * Drop a reference taken by fd_pin(), releasing the descriptor if it was
+ * the last one on a closed fd.
+ */
+static int32_t __fd_put(int32_t fd, file_des_t *fd_st)
+{
+	if (fd_st == NULL) {
+		return 0;
+	}
+	else if (fd_unpin(fd) > 0) {
+		return __fd_release(fd, fd_st);
+	}
+	else {
+		return 0;
+	}
+}
+
+#if _WITH_LWIP_SOCKET_WRAPPER
+void ec_sock_put(ec_sockref_t *ref)
+{
+	__fd_put(ref->slot, ref->fd_st);
+}
+#endif
+
+static int32_t __fd_release(int32_t fd, file_des_t *fd_st)
+{
+	free_fd(fd);
+	return __fd_drop(fd_st);
+}
+
+/**
+ * Drop one fd's reference on a description, closing it with the last.
+ */
+static int32_t __fd_drop(file_des_t *fd_st)
+{
+	int32_t err = 0;
+	file_t *file;
+	if (atomic_dec_and_test(&(fd_st->file_des_refs)) != 0) {
+		// Description still shared with other fds.
+		return 0;
+	}
+#if _WITH_LWIP_SOCKET_WRAPPER
+	if (fd_st->file_type == e_FTYPE_SOCKET) {
+		// lwip socket is closed by close() already, unless it was shared.
+		if (fd_st->sock_num >= 0) {
+			lwip_close(fd_st->sock_num);
+		}
+		ecslab_free(fd_st, sizeof(file_des_t));
+		return 0;
+	}
+#endif
+	file = fd_st->file;
+	if (file->file_opts != NULL) {
+		if (file->file_opts->close != NULL) {
+			err = file->file_opts->close(fd_st);
+		}
+		else {
+			err = 0;
+		}
+	}
+	else {
+		err = 0;
+	}
+	ecslab_free(fd_st, sizeof(file_des_t));
+	put_file(file);
+	return err;
+}
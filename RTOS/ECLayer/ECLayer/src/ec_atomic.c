@@ -21,11 +21,139 @@
 
 #include "ec_atomic.h"
 
-#include "cmsis_port.h"
-
 #include <stddef.h>
 #include <stdint.h>
 
+#if _ATOMIC_USE_STDATOMIC
+#include <stdatomic.h>
+
+/**
+ * Host backend. <stdatomic.h> has generic macros with the names of
+ * functions defined here. Operations are relaxed like their LDREX/STREX
+ * counterparts, so a missing ec_mb() shows up in host stress tests.
+ */
+#undef atomic_fetch_add
+#undef atomic_fetch_or
+#undef atomic_fetch_and
+
+_Static_assert(sizeof(_Atomic int32_t) == sizeof(atomic_t), "atomic_t size");
+_Static_assert(sizeof(_Atomic(void *)) == sizeof(atomic_ptr_t), "atomic_ptr_t size");
+
+#define __A(ptr)  ((_Atomic int32_t *)(ptr))
+#define __AP(ptr) ((_Atomic(void *) *)(ptr))
+#define __RLX	  memory_order_relaxed
+
+void ec_mb(void)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+void ec_rmb(void)
+{
+	atomic_thread_fence(memory_order_acquire);
+}
+
+void ec_wmb(void)
+{
+	atomic_thread_fence(memory_order_release);
+}
+
+void atomic_set(atomic_t *ptr, atomic_t val)
+{
+	atomic_store_explicit(__A(ptr), val, __RLX);
+}
+
+atomic_t atomic_get(atomic_t *ptr)
+{
+	return atomic_load_explicit(__A(ptr), __RLX);
+}
+
+void atomic_add(atomic_t *ptr, int32_t n)
+{
+	atomic_fetch_add_explicit(__A(ptr), n, __RLX);
+}
+
+int32_t atomic_dec_and_test(atomic_t *ptr)
+{
+	return (atomic_fetch_sub_explicit(__A(ptr), 1, __RLX) == 1) ? 0 : 1;
+}
+
+int32_t atomic_inc_and_test(atomic_t *ptr)
+{
+	return (atomic_fetch_add_explicit(__A(ptr), 1, __RLX) == -1) ? 0 : 1;
+}
+
+int32_t atomic_dec_and_eq(atomic_t *ptr, int32_t val)
+{
+	return ((atomic_fetch_sub_explicit(__A(ptr), 1, __RLX) - 1) == val) ? 0 : 1;
+}
+
+int32_t atomic_inc_and_eq(atomic_t *ptr, int32_t val)
+{
+	return ((atomic_fetch_add_explicit(__A(ptr), 1, __RLX) + 1) == val) ? 0 : 1;
+}
+
+void atomic_inc(atomic_t *ptr)
+{
+	atomic_fetch_add_explicit(__A(ptr), 1, __RLX);
+}
+
+void atomic_dec(atomic_t *ptr)
+{
+	atomic_fetch_sub_explicit(__A(ptr), 1, __RLX);
+}
+
+atomic_t atomic_cmpxchg(atomic_t *ptr, atomic_t oldval, atomic_t newval)
+{
+	atomic_compare_exchange_strong_explicit(__A(ptr), &oldval, newval, __RLX, __RLX);
+	return oldval;
+}
+
+atomic_t atomic_xchg(atomic_t *ptr, atomic_t val)
+{
+	return atomic_exchange_explicit(__A(ptr), val, __RLX);
+}
+
+atomic_t atomic_fetch_add(atomic_t *ptr, int32_t n)
+{
+	return atomic_fetch_add_explicit(__A(ptr), n, __RLX);
+}
+
+atomic_t atomic_fetch_or(atomic_t *ptr, atomic_t mask)
+{
+	return atomic_fetch_or_explicit(__A(ptr), mask, __RLX);
+}
+
+atomic_t atomic_fetch_and(atomic_t *ptr, atomic_t mask)
+{
+	return atomic_fetch_and_explicit(__A(ptr), mask, __RLX);
+}
+
+void atomic_ptr_set(atomic_ptr_t *ptr, void *val)
+{
+	atomic_store_explicit(__AP(ptr), val, __RLX);
+}
+
+void *atomic_ptr_get(atomic_ptr_t *ptr)
+{
+	return atomic_load_explicit(__AP(ptr), __RLX);
+}
+
+void *atomic_ptr_cmpxchg(atomic_ptr_t *ptr, void *oldval, void *newval)
+{
+	atomic_compare_exchange_strong_explicit(__AP(ptr), &oldval, newval, __RLX, __RLX);
+	return oldval;
+}
+
+void *atomic_ptr_xchg(atomic_ptr_t *ptr, void *val)
+{
+	return atomic_exchange_explicit(__AP(ptr), val, __RLX);
+}
+
+#else
+
+#include "cmsis_port.h"
+
 void inline atomic_set(atomic_t *ptr, atomic_t val)
 {
 	atomic_t tmp;
@@ -36,13 +164,12 @@ void inline atomic_set(atomic_t *ptr, atomic_t val)
 	return;
 }
 
+/**
+ * An aligned word load is single-copy atomic, no exclusive access needed.
+ */
 atomic_t inline atomic_get(atomic_t *ptr)
 {
-	atomic_t tmp;
-	do {
-		tmp = __LDREXW(ptr);
-	} while (__STREXW(tmp, ptr) == 1);
-	return tmp;
+	return *(volatile atomic_t *)ptr;
 }
 
 void inline atomic_add(atomic_t *ptr, int32_t n)
@@ -107,3 +234,77 @@ void inline atomic_dec(atomic_t *ptr)
 	} while (__STREXW(tmp, ptr) == 1);
 	return;
 }
+
+atomic_t inline atomic_cmpxchg(atomic_t *ptr, atomic_t oldval, atomic_t newval)
+{
+	atomic_t tmp;
+	do {
+		tmp = __LDREXW(ptr);
+		if (tmp != oldval) {
+			__CLREX();
+			break;
+		}
+	} while (__STREXW(newval, ptr) == 1);
+	return tmp;
+}
+
+atomic_t inline atomic_xchg(atomic_t *ptr, atomic_t val)
+{
+	atomic_t tmp;
+	do {
+		tmp = __LDREXW(ptr);
+	} while (__STREXW(val, ptr) == 1);
+	return tmp;
+}
+
+atomic_t inline atomic_fetch_add(atomic_t *ptr, int32_t n)
+{
+	atomic_t tmp;
+	do {
+		tmp = __LDREXW(ptr);
+	} while (__STREXW(tmp + n, ptr) == 1);
+	return tmp;
+}
+
+atomic_t inline atomic_fetch_or(atomic_t *ptr, atomic_t mask)
+{
+	atomic_t tmp;
+	do {
+		tmp = __LDREXW(ptr);
+	} while (__STREXW(tmp | mask, ptr) == 1);
+	return tmp;
+}
+
+atomic_t inline atomic_fetch_and(atomic_t *ptr, atomic_t mask)
+{
+	atomic_t tmp;
+	do {
+		tmp = __LDREXW(ptr);
+	} while (__STREXW(tmp & mask, ptr) == 1);
+	return tmp;
+}
+
+/**
+ * Pointers are one word wide on Cortex-M, same as atomic_t.
+ */
+void inline atomic_ptr_set(atomic_ptr_t *ptr, void *val)
+{
+	atomic_set((atomic_t *)ptr, (atomic_t)val);
+}
+
+inline void *atomic_ptr_get(atomic_ptr_t *ptr)
+{
+	return *(void *volatile *)ptr;
+}
+
+inline void *atomic_ptr_cmpxchg(atomic_ptr_t *ptr, void *oldval, void *newval)
+{
+	return (void *)atomic_cmpxchg((atomic_t *)ptr, (atomic_t)oldval, (atomic_t)newval);
+}
+
+inline void *atomic_ptr_xchg(atomic_ptr_t *ptr, void *val)
+{
+	return (void *)atomic_xchg((atomic_t *)ptr, (atomic_t)val);
+}
+
+#endif
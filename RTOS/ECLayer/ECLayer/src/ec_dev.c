@@ -30,23 +30,28 @@
 #include <stdint.h>
 
 static list_head_def(pv_dev_list);
-static ec_lock_t pv_lock_dev_list = e_Unlocked;
+static ec_rwlock_t pv_lock_dev_list = EC_RWLOCK_INIT;
+
+void device_list_init(void)
+{
+	ec_rwlock_init(&pv_lock_dev_list);
+	ec_lock_stat_regist(&(pv_lock_dev_list.writer), "device");
+}
 
 int32_t device_regist(ec_dev_t *dev)
 {
-	uint32_t irqflag;
-	if (ec_try_lock_irqsave(&pv_lock_dev_list, &irqflag) != 0) {
-		return -EBUSY;  // Device list is busy
+	if (ec_write_lock(&pv_lock_dev_list) != 0) {
+		return -EBUSY;  // Device list is held by a task, called from ISR
 	}
 	else {
 		if (dev == NULL) {
-			ec_unlock_irqrestore(&pv_lock_dev_list, irqflag);
+			ec_write_unlock(&pv_lock_dev_list);
 			return -ENXIO;  // No such device
 		}
 		else {
 			foreach (dlist_itr, &pv_dev_list) {
 				if (list_get_node(dlist_itr, ec_dev_t, dev_list) == dev) {
-					ec_unlock_irqrestore(&pv_lock_dev_list, irqflag);
+					ec_write_unlock(&pv_lock_dev_list);
 					return -EDEVREGED;  // Device is already registed
 				}
 				else {
@@ -54,7 +59,7 @@ int32_t device_regist(ec_dev_t *dev)
 				}
 			}
 			list_append(&(dev->dev_list), &pv_dev_list);
-			ec_unlock_irqrestore(&pv_lock_dev_list, irqflag);
+			ec_write_unlock(&pv_lock_dev_list);
 			return 0;
 		}
 	}
@@ -62,27 +67,26 @@ int32_t device_regist(ec_dev_t *dev)
 
 int32_t device_deregist(ec_dev_t *dev)
 {
-	uint32_t irqflag;
-	if (ec_try_lock_irqsave(&pv_lock_dev_list, &irqflag) != 0) {
-		return -EBUSY;  // Device list is busy
+	if (ec_write_lock(&pv_lock_dev_list) != 0) {
+		return -EBUSY;  // Device list is held by a task, called from ISR
 	}
 	else {
 		if (dev == NULL) {
-			ec_unlock_irqrestore(&pv_lock_dev_list, irqflag);
+			ec_write_unlock(&pv_lock_dev_list);
 			return -ENXIO;
 		}
 		else {
 			foreach (dlist_itr, &pv_dev_list) {
 				if (list_get_node(dlist_itr, ec_dev_t, dev_list) == dev) {
 					list_delete(&(dev->dev_list));
-					ec_unlock_irqrestore(&pv_lock_dev_list, irqflag);
+					ec_write_unlock(&pv_lock_dev_list);
 					return 0;
 				}
 				else {
 					// continue;
 				}
 			}
-			ec_unlock_irqrestore(&pv_lock_dev_list, irqflag);
+			ec_write_unlock(&pv_lock_dev_list);
 			return -EDEVNOREG;
 		}
 	}
@@ -91,14 +95,19 @@ int32_t device_deregist(ec_dev_t *dev)
 ec_dev_t *search_device(const char *device_name)
 {
 	ec_dev_t *dev_itr;
+	if (ec_read_lock(&pv_lock_dev_list) != 0) {
+		return NULL;
+	}
 	foreach (dlist_itr, &pv_dev_list) {
 		dev_itr = list_get_node(dlist_itr, ec_dev_t, dev_list);
 		if (strcmp(device_name, dev_itr->dev_name) == 0) {
+			ec_read_unlock(&pv_lock_dev_list);
 			return dev_itr;
 		}
 		else {
 			// continue;
 		}
 	}
+	ec_read_unlock(&pv_lock_dev_list);
 	return NULL;
 }
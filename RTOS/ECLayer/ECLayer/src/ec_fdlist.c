@@ -21,57 +21,380 @@
 
 #include "ec_fdlist.h"
 
+#include "cmsis_port.h"
+#include "ec_atomic.h"
 #include "ec_config.h"
 #include "ec_file.h"
 #include "ec_lock.h"
 #include "exceptions.h"
 
+#if _FD_PER_TASK
+#	include "FreeRTOS.h"
+#	include "heap_port.h"
+#	include "task.h"
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
 
+#if _FD_PER_TASK && (_FD_LIST_MAXNUM > 32767)
+#	error "_FD_LIST_MAXNUM does not fit the int16_t slots of fd_table_s"
+#endif
+
+#define __FD_WORDS		   ((_FD_LIST_MAXNUM + 31) / 32)
+#define __FD_SUMMARY_WORDS ((__FD_WORDS + 31) / 32)
+
+/**
+ * Two level bitmap, a set bit in pv_fd_used marks a used fd, a set bit in
+ * pv_fd_full marks a pv_fd_used word with no free fd left. The lowest
+ * free fd is found with two count-trailing-zeros, no slot scanning.
+ * Bits past _FD_LIST_MAXNUM are never set, a lowest free fd beyond the
+ * limit means the table is full.
+ */
 static file_des_t *pv_fd_array[_FD_LIST_MAXNUM];
-static ec_lock_t pv_fd_lock = e_Unlocked;
+static uint32_t pv_fd_used[__FD_WORDS];
+/**
+ * Per slot state word: generation in bits 31..16, open flag in bit 15,
+ * count of pins (in-flight calls) in bits 14..0. The generation is bumped
+ * on every alloc_fd(), so a state word is never seen twice and a stale
+ * compare-and-swap on a recycled slot fails.
+ */
+#define __FD_REFS_MASK 0x00007fffU
+#define __FD_OPEN	   0x00008000U
+#define __FD_GEN_MASK  0xffff0000U
+#define __FD_GEN_ONE   0x00010000U
+static atomic_t pv_fd_state[_FD_LIST_MAXNUM];
+static uint32_t pv_fd_full[__FD_SUMMARY_WORDS];
+static ec_mutex_t pv_fd_lock = EC_MUTEX_INIT;
+
+#if _FD_PER_TASK
+/**
+ * fds of one task, each bound to a slot of pv_fd_array. Only the owning
+ * task touches its table, so there is no lock. Tasks without a table use
+ * slots as fds.
+ */
+struct fd_table_s {
+	uint32_t used;
+	int16_t slot[_FD_TASK_MAXNUM];
+};
+#endif
+
+static inline uint32_t __ctz(uint32_t x)
+{
+	return __CLZ(__RBIT(x));
+}
+
+/**
+ * Mark fd used and bind it to file_des, caller holds pv_fd_lock.
+ */
+static inline void __fd_take(uint32_t fd, file_des_t *file_des)
+{
+	uint32_t word = fd >> 5;
+	pv_fd_used[word] |= (1U << (fd & 31U));
+	if (pv_fd_used[word] == 0xffffffffU) {
+		pv_fd_full[word >> 5] |= (1U << (word & 31U));
+	}
+	pv_fd_array[fd] = file_des;
+	pv_fd_state[fd] = (atomic_t)(((uint32_t)pv_fd_state[fd] & __FD_GEN_MASK) + __FD_GEN_ONE);
+}
 
 file_des_t *get_fd_struct(int32_t fd)
 {
 	if ((fd >= 0) && (fd < _FD_LIST_MAXNUM))
 		return pv_fd_array[fd];
-	// Does get function need to be thread-safe?
 	else
 		return NULL;
 }
 
+/**
+  *@brief	Set up the fd list, called once by EC_Layer_Initialize().
+  */
+void fd_list_init(void)
+{
+	ec_mutex_init(&pv_fd_lock);
+	ec_lock_stat_regist(&pv_fd_lock, "fdlist");
+}
+
 int32_t alloc_fd(file_des_t *file_des)
 {
-	uint32_t irqflag;
-	if (ec_try_lock_irqsave(&pv_fd_lock, &irqflag) == 0) {
-		for (int32_t i = 0; i < _FD_LIST_MAXNUM; i++) {
-			if (pv_fd_array[i] == NULL) {
-				pv_fd_array[i] = file_des;
-				ec_unlock_irqrestore(&pv_fd_lock, irqflag);
-				return i;
+	uint32_t word;
+	uint32_t fd;
+	if (ec_mutex_lock(&pv_fd_lock) == 0) {
+		for (uint32_t i = 0; i < __FD_SUMMARY_WORDS; i++) {
+			if (pv_fd_full[i] != 0xffffffffU) {
+				word = (i << 5) + __ctz(~pv_fd_full[i]);
+				if (word >= __FD_WORDS) {
+					break;
+				}
+				fd = (word << 5) + __ctz(~pv_fd_used[word]);
+				if (fd >= _FD_LIST_MAXNUM) {
+					break;
+				}
+				__fd_take(fd, file_des);
+				ec_mutex_unlock(&pv_fd_lock);
+				return (int32_t)fd;
 			}
 			else {
 				// continue;
 			}
 		}
-		ec_unlock_irqrestore(&pv_fd_lock, irqflag);
+		ec_mutex_unlock(&pv_fd_lock);
 		return -EBADF;  // No alloc-able fd.
 	}
 	else {
-		return -EBUSY;  // file descriptor list is locked.
+		return -EBUSY;  // called from ISR while a task holds the list.
 	}
 }
 
+/**
+  *@brief	Bind a given fd to file_des for dup2(), taking it over in one
+  *			step if it is open, so no open() can grab it in between.
+  *@details	The new binding is not visible until fd_publish().
+  *@param	**old		set to the description fd held, NULL if it was free,
+  *						the caller drops it
+  *@retval	-EBADF		fd out of range
+  *@retval	-EBUSY		fd is being opened or closed, a call is still
+  *						running on it, or called from ISR while a task
+  *						holds the list
+  *@retval	fd			success
+  */
+int32_t fd_replace(int32_t fd, file_des_t *file_des, file_des_t **old)
+{
+	atomic_t state;
+	int32_t err;
+	if ((fd < 0) || (fd >= _FD_LIST_MAXNUM)) {
+		return -EBADF;
+	}
+	if (ec_mutex_lock(&pv_fd_lock) != 0) {
+		return -EBUSY;  // called from ISR while a task holds the list.
+	}
+	if ((pv_fd_used[(uint32_t)fd >> 5] & (1U << ((uint32_t)fd & 31U))) == 0) {
+		__fd_take((uint32_t)fd, file_des);
+		*old = NULL;
+		err = fd;
+	}
+	else {
+		state = atomic_get(&pv_fd_state[fd]);
+		if (((uint32_t)state & (__FD_OPEN | __FD_REFS_MASK)) != __FD_OPEN) {
+			err = -EBUSY;
+		}
+		else if (atomic_cmpxchg(&pv_fd_state[fd], state, (atomic_t)(((uint32_t)state & __FD_GEN_MASK) + __FD_GEN_ONE)) != state) {
+			err = -EBUSY;  // pinned meanwhile
+		}
+		else {
+			// Shut with no pins and a new generation, nobody sees the old
+			// description through fd any more.
+			*old = pv_fd_array[fd];
+			pv_fd_array[fd] = file_des;
+			err = fd;
+		}
+	}
+	ec_mutex_unlock(&pv_fd_lock);
+	return err;
+}
+
 int32_t free_fd(int32_t fd)
 {
-	uint32_t irqflag;
-	if (ec_try_lock_irqsave(&pv_fd_lock, &irqflag) == 0) {
+	uint32_t word;
+	if ((fd < 0) || (fd >= _FD_LIST_MAXNUM)) {
+		return -EBADF;
+	}
+	word = (uint32_t)fd >> 5;
+	if (ec_mutex_lock(&pv_fd_lock) == 0) {
+		pv_fd_state[fd] &= (atomic_t)__FD_GEN_MASK;
 		pv_fd_array[fd] = NULL;
-		ec_unlock_irqrestore(&pv_fd_lock, irqflag);
+		pv_fd_used[word] &= ~(1U << ((uint32_t)fd & 31U));
+		pv_fd_full[word >> 5] &= ~(1U << (word & 31U));
+		ec_mutex_unlock(&pv_fd_lock);
 		return 0;
 	}
 	else {
-		return -EBUSY;  // file descriptor list is locked.
+		return -EBUSY;  // called from ISR while a task holds the list.
+	}
+}
+
+/**
+  *@brief	Make an allocated fd visible to fd_pin(), once it is set up.
+  */
+void fd_publish(int32_t fd)
+{
+	ec_wmb();
+	atomic_fetch_or(&pv_fd_state[fd], (atomic_t)__FD_OPEN);
+}
+
+/**
+  *@brief	Take a reference on an open fd, with one compare-and-swap.
+  *@details	The descriptor stays valid until the matching fd_unpin(),
+  *			even if the fd is closed meanwhile.
+  *@retval	NULL		fd is not open
+  */
+file_des_t *fd_pin(int32_t fd)
+{
+	atomic_t state;
+	atomic_t seen;
+	if ((fd < 0) || (fd >= _FD_LIST_MAXNUM)) {
+		return NULL;
+	}
+	seen = atomic_get(&pv_fd_state[fd]);
+	do {
+		state = seen;
+		if ((((uint32_t)state & __FD_OPEN) == 0) || (((uint32_t)state & __FD_REFS_MASK) == __FD_REFS_MASK)) {
+			return NULL;
+		}
+		seen = atomic_cmpxchg(&pv_fd_state[fd], state, state + 1);
+	} while (seen != state);
+	ec_rmb();
+	return pv_fd_array[fd];
+}
+
+/**
+  *@brief	Drop a reference taken by fd_pin().
+  *@retval	1			fd was shut and this was the last reference, the
+  *						caller has to release the descriptor
+  *@retval	0			otherwise
+  */
+int32_t fd_unpin(int32_t fd)
+{
+	uint32_t state;
+	state = (uint32_t)atomic_fetch_add(&pv_fd_state[fd], -1) - 1U;
+	return ((state & (__FD_OPEN | __FD_REFS_MASK)) == 0) ? 1 : 0;
+}
+
+/**
+  *@brief	Stop new fd_pin() calls on a pinned fd, the descriptor is
+  *			released by whoever drops the last reference.
+  *@retval	-EBADF		fd is already shut
+  *@retval	0			success
+  */
+int32_t fd_shut(int32_t fd)
+{
+	uint32_t state;
+	state = (uint32_t)atomic_fetch_and(&pv_fd_state[fd], (atomic_t)~__FD_OPEN);
+	return ((state & __FD_OPEN) == 0) ? -EBADF : 0;
+}
+
+#if _FD_PER_TASK
+fd_table_t *fd_table_new(void)
+{
+	fd_table_t *table;
+	table = (fd_table_t *)ecslab_alloc(sizeof(fd_table_t));
+	if (table != NULL) {
+		table->used = 0;
+	}
+	return table;
+}
+
+/**
+ * The fds left in table are dropped, not closed, see fd_table_take().
+ */
+void fd_table_delete(fd_table_t *table)
+{
+	ecslab_free(table, sizeof(fd_table_t));
+}
+
+/**
+ * Bind table to the calling task, NULL to go back to global slots.
+ */
+void fd_table_attach(fd_table_t *table)
+{
+	vTaskSetThreadLocalStoragePointer(NULL, _FD_TLS_INDEX, table);
+}
+
+/**
+ * Table of the calling task, NULL before the scheduler runs and in ISR.
+ */
+fd_table_t *fd_table_current(void)
+{
+	if ((__get_IPSR() != 0) || (xTaskGetSchedulerState() == taskSCHEDULER_NOT_STARTED)) {
+		return NULL;
+	}
+	return (fd_table_t *)pvTaskGetThreadLocalStoragePointer(NULL, _FD_TLS_INDEX);
+}
+
+/**
+  *@brief	Bind fd of table to slot, the lowest free fd if fd is negative.
+  *@retval	-EMFILE		table is full
+  *@retval	-EBADF		fd out of range
+  *@retval	-EEXIST		fd in use
+  *@retval	fd			success
+  */
+int32_t fd_table_install(fd_table_t *table, int32_t fd, int32_t slot)
+{
+	if (fd < 0) {
+		fd = (int32_t)__ctz(~table->used);
+		if (fd >= _FD_TASK_MAXNUM) {
+			return -EMFILE;
+		}
+	}
+	else if (fd >= _FD_TASK_MAXNUM) {
+		return -EBADF;
+	}
+	else if ((table->used & (1U << fd)) != 0) {
+		return -EEXIST;
+	}
+	table->used |= (1U << fd);
+	table->slot[fd] = (int16_t)slot;
+	return fd;
+}
+
+/**
+  *@brief	Unbind the lowest fd of table, so its owner can close them all.
+  *@retval	-EBADF		table is empty
+  *@retval	slot		the fd was bound to
+  */
+int32_t fd_table_take(fd_table_t *table)
+{
+	int32_t fd;
+	if (table->used == 0) {
+		return -EBADF;
+	}
+	fd = (int32_t)__ctz(table->used);
+	table->used &= ~(1U << fd);
+	return table->slot[fd];
+}
+
+/**
+  *@brief	Slot behind an fd of the calling task.
+  *@retval	-EBADF		fd is not open in this task
+  */
+int32_t fd_resolve(int32_t fd)
+{
+	fd_table_t *table = fd_table_current();
+	if (table == NULL) {
+		return fd;
+	}
+	if ((fd < 0) || (fd >= _FD_TASK_MAXNUM) || ((table->used & (1U << fd)) == 0)) {
+		return -EBADF;
+	}
+	return table->slot[fd];
+}
+
+/**
+  *@brief	Give a freshly allocated slot an fd in the calling task.
+  *@retval	-EMFILE		the task has no free fd
+  */
+int32_t fd_install(int32_t slot)
+{
+	fd_table_t *table = fd_table_current();
+	if (table == NULL) {
+		return slot;
+	}
+	return fd_table_install(table, -1, slot);
+}
+
+/**
+  *@brief	Unbind an fd of the calling task, the slot is left alone.
+  */
+int32_t fd_forget(int32_t fd)
+{
+	fd_table_t *table = fd_table_current();
+	if (table == NULL) {
+		return fd;
+	}
+	if ((fd < 0) || (fd >= _FD_TASK_MAXNUM) || ((table->used & (1U << fd)) == 0)) {
+		return -EBADF;
 	}
+	table->used &= ~(1U << fd);
+	return table->slot[fd];
 }
+#endif
@@ -23,6 +23,7 @@
 
 #include "ec_config.h"
 #include "ec_list.h"
+#include "ec_vfs.h"
 #include "exceptions.h"
 #include "heap_port.h"
 
@@ -31,59 +32,87 @@
 #include <string.h>
 
 static list_head_def(pv_sysfile_list);
-static ec_lock_t pv_sysfile_list_lock = e_Unlocked;
+static ec_rwlock_t pv_sysfile_list_lock = EC_RWLOCK_INIT;
+
+/**
+ * Name index over the registered files, chained through file_hash_list.
+ * pv_sysfile_list still holds every file in registration order, both are
+ * updated together under pv_sysfile_list_lock. The path trie in ec_vfs.c
+ * is kept in step for directory listing and mount points, exact names
+ * never have to walk it. Buckets are set up by file_list_init().
+ */
+static list_t pv_sysfile_hash[_FILE_HASH_BUCKETS];
+
+// file_lock of every file counts into one entry.
+static ec_lock_stat_t *pv_file_lock_stat = NULL;
+
+static inline uint32_t __name_hash(const char *name);
+static inline list_t *__hash_bucket(uint32_t hash);
+static file_t *__hash_lookup(const char *filename, uint32_t hash);
+
+void file_list_init(void)
+{
+	for (int32_t i = 0; i < _FILE_HASH_BUCKETS; i++) {
+		list_clear(&pv_sysfile_hash[i]);
+	}
+	ec_rwlock_init(&pv_sysfile_list_lock);
+	ec_lock_stat_regist(&(pv_sysfile_list_lock.writer), "sysfile");
+	pv_file_lock_stat = ec_lock_stat_new("file");
+}
 
 int32_t file_regist(file_t *file)
 {
-	uint32_t irqflag;
-	if (ec_try_lock_irqsave(&pv_sysfile_list_lock, &irqflag) != 0) {
-		return -EBUSY;
+	uint32_t hash;
+	int32_t err;
+	if (ec_write_lock(&pv_sysfile_list_lock) != 0) {
+		return -EBUSY;	// only from ISR
 	}
 	else {
 		if (file == NULL) {
-			ec_unlock_irqrestore(&pv_sysfile_list_lock, irqflag);
+			ec_write_unlock(&pv_sysfile_list_lock);
 			return -ENOENT;
 		}
 		else {
-			foreach (flist_itr, &pv_sysfile_list) {
-				if ((list_get_node(flist_itr, file_t, file_list)) == file) {
-					ec_unlock_irqrestore(&pv_sysfile_list_lock, irqflag);
-					return -EFREGED;  // file already registed in the list.
-				}
-				else {
-					// continue;
-				}
+			hash = __name_hash(file->file_name);
+			if (__hash_lookup(file->file_name, hash) != NULL) {
+				ec_write_unlock(&pv_sysfile_list_lock);
+				return -EFREGED;  // file or its name already registed in the list.
+			}
+			err = vfs_link(file);
+			if (err != 0) {
+				ec_write_unlock(&pv_sysfile_list_lock);
+				return err;	 // path clashes with a file or mount point.
+			}
+			else {
+				file->file_hash = hash;
+				list_append(&(file->file_hash_list), __hash_bucket(hash));
+				list_append(&(file->file_list), &pv_sysfile_list);
+				ec_write_unlock(&pv_sysfile_list_lock);
+				return 0;
 			}
-			list_append(&(file->file_list), &pv_sysfile_list);
-			ec_unlock_irqrestore(&pv_sysfile_list_lock, irqflag);
-			return 0;
 		}
 	}
 }
 
 int32_t file_deregist(file_t *file)
 {
-	uint32_t irqflag;
-	if (ec_try_lock_irqsave(&pv_sysfile_list_lock, &irqflag) != 0) {
-		return -EBUSY;
+	if (ec_write_lock(&pv_sysfile_list_lock) != 0) {
+		return -EBUSY;	// only from ISR
 	}
 	else {
 		if (file == NULL) {
-			ec_unlock_irqrestore(&pv_sysfile_list_lock, irqflag);
+			ec_write_unlock(&pv_sysfile_list_lock);
 			return -ENOENT;
 		}
+		else if (__hash_lookup(file->file_name, __name_hash(file->file_name)) == file) {
+			vfs_unlink(file);
+			list_delete(&(file->file_hash_list));
+			list_delete(&(file->file_list));
+			ec_write_unlock(&pv_sysfile_list_lock);
+			return 0;
+		}
 		else {
-			foreach (flist_itr, &pv_sysfile_list) {
-				if (list_get_node(flist_itr, file_t, file_list) == file) {
-					list_delete(&(file->file_list));
-					ec_unlock_irqrestore(&pv_sysfile_list_lock, irqflag);
-					return 0;
-				}
-				else {
-					// continue;
-				}
-			}
-			ec_unlock_irqrestore(&pv_sysfile_list_lock, irqflag);
+			ec_write_unlock(&pv_sysfile_list_lock);
 			return -EFNOREG;
 		}
 	}
@@ -92,28 +121,27 @@ int32_t file_deregist(file_t *file)
 file_t *create_file(const char *filename, file_opts_t *fopts, void *content)
 {
 	file_t *file;
-	file_t *file_itr;
 	if (strlen(filename) > _FILE_NAME_MAXLEN) {
 		// file name invalid
 		return NULL;
 	}
-	foreach (flist_itr, &pv_sysfile_list) {
-		file_itr = list_get_node(flist_itr, file_t, file_list);
-		if (strcmp(file_itr->file_name, filename) == 0) {
-			// file name already exist
-			return NULL;
-		}
-		else {
-			// continue;
-		}
+	file = search_file(filename);
+	if (file != NULL) {
+		// file name already exist
+		put_file(file);
+		return NULL;
 	}
-	file = (file_t *)ecmalloc(sizeof(file_t));
+	file = (file_t *)ecslab_alloc(sizeof(file_t));
 	if (file == NULL) {
 		// do something
 		return NULL;
 	}
 	else {
 		strcpy(file->file_name, filename);
+		list_clear(&(file->file_list));
+		list_clear(&(file->file_hash_list));
+		file->file_hash = 0;
+		memset(&(file->file_dentry), 0, sizeof(ec_dentry_t));
 		atomic_set(&(file->file_refs), 0);
 		file->file_lock = e_Unlocked;
 		file->file_opts = fopts;
@@ -124,42 +152,78 @@ file_t *create_file(const char *filename, file_opts_t *fopts, void *content)
 
 int32_t delete_file(file_t *file)
 {
-	uint32_t irqflag;
-	if (ec_try_lock_irqsave(&pv_sysfile_list_lock, &irqflag) != 0) {
-		return -EBUSY;
+	if (ec_write_lock(&pv_sysfile_list_lock) != 0) {
+		return -EBUSY;	// only from ISR
 	}
 	else {
 		if (atomic_get(&(file->file_refs)) > 0) {
+			ec_write_unlock(&pv_sysfile_list_lock);
 			return -EBUSY;  // file is opened by someone
 		}
-		if (list_is_in(&pv_sysfile_list, &(file->file_list)) == 0) {
-			ec_unlock_irqrestore(&pv_sysfile_list_lock, irqflag);
+		if (__hash_lookup(file->file_name, __name_hash(file->file_name)) != file) {
+			ec_write_unlock(&pv_sysfile_list_lock);
 			return -EFNOREG;  // *file is not in system file list
 		}
+		else if (vfs_unlink_unused(file) != 0) {
+			// Looked up through the trie meanwhile.
+			ec_write_unlock(&pv_sysfile_list_lock);
+			return -EBUSY;
+		}
 		else {
-			ecfree(file);
-			ec_unlock_irqrestore(&pv_sysfile_list_lock, irqflag);
+			list_delete(&(file->file_hash_list));
+			list_delete(&(file->file_list));
+			ec_write_unlock(&pv_sysfile_list_lock);
+			destroy_file(file);
 			return 0;
 		}
 	}
 }
 
+/**
+ * Free a file made by create_file() that is not registered (any more),
+ * with whatever its release op hangs off file_content.
+ */
+void destroy_file(file_t *file)
+{
+	if (file == NULL) {
+		return;
+	}
+	if ((file->file_opts != NULL) && (file->file_opts->release != NULL)) {
+		file->file_opts->release(file);
+	}
+	ecslab_free(file, sizeof(file_t));
+}
+
+/**
+ * The file comes back with a file_refs reference taken under the list
+ * lock, so delete_file() refuses it until put_file() drops it again.
+ */
 file_t *search_file(const char *filename)
 {
-	file_t *file_itr;
+	file_t *file;
 	if (strlen(filename) > _FILE_NAME_MAXLEN) {
 		return NULL;
 	}
-	foreach (flist_itr, &pv_sysfile_list) {
-		file_itr = list_get_node(flist_itr, file_t, file_list);
-		if (strcmp(file_itr->file_name, filename) == 0) {
-			return file_itr;
-		}
-		else {
-			// continue;
-		}
+	if (ec_read_lock(&pv_sysfile_list_lock) != 0) {
+		return NULL;
+	}
+	file = __hash_lookup(filename, __name_hash(filename));
+	if (file != NULL) {
+		atomic_inc(&(file->file_refs));
+	}
+	ec_read_unlock(&pv_sysfile_list_lock);
+	if (file == NULL) {
+		// Not registered, maybe below a mount point.
+		file = vfs_lookup(filename);
+	}
+	return file;
+}
+
+void put_file(file_t *file)
+{
+	if (file != NULL) {
+		atomic_dec(&(file->file_refs));
 	}
-	return NULL;
 }
 
 int32_t empty_file(file_t *file)
@@ -169,14 +233,50 @@ int32_t empty_file(file_t *file)
 		return -ENOENT;  // file pointer is null.
 	}
 	else {
-		if (ec_try_lock_irqsave(&(file->file_lock), &irqflag) != 0) {
+		if (ec_try_lock_irqsave_stat(&(file->file_lock), &irqflag, pv_file_lock_stat) != 0) {
 			return -EBUSY;  // file is locked.
 		}
 		else {
 			file->file_opts = NULL;
 			file->file_content = NULL;
-			ec_unlock_irqrestore(&(file->file_lock), irqflag);
+			ec_unlock_irqrestore_stat(&(file->file_lock), irqflag, pv_file_lock_stat);
 			return 0;
 		}
 	}
 }
+
+/**
+ * BKDR string hash.
+ */
+static inline uint32_t __name_hash(const char *name)
+{
+	uint32_t hash = 0;
+	while (*name != '\0') {
+		hash = hash * 131U + (uint8_t)(*name++);
+	}
+	return hash;
+}
+
+static inline list_t *__hash_bucket(uint32_t hash)
+{
+	return &pv_sysfile_hash[hash & (_FILE_HASH_BUCKETS - 1)];
+}
+
+/**
+ * Caller holds pv_sysfile_list_lock, for reading at least.
+ */
+static file_t *__hash_lookup(const char *filename, uint32_t hash)
+{
+	file_t *file_itr;
+	list_t *bucket = __hash_bucket(hash);
+	foreach (hlist_itr, bucket) {
+		file_itr = list_get_node(hlist_itr, file_t, file_hash_list);
+		if ((file_itr->file_hash == hash) && (strcmp(file_itr->file_name, filename) == 0)) {
+			return file_itr;
+		}
+		else {
+			// continue;
+		}
+	}
+	return NULL;
+}
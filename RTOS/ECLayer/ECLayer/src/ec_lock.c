@@ -22,17 +22,253 @@
 
 #include "ec_lock.h"
 
-#include "cmsis_port.h"
 #include "ec_atomic.h"
+#include "ec_config.h"
 #include "exceptions.h"
 
+#if !_EC_HOST_BUILD
+#	include "cmsis_port.h"
+#endif
+
+#if _WITH_CMSISOS_V2
+#	include "FreeRTOS.h"
+#	include "semphr.h"
+#	include "task.h"
+#endif
+
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 
-int32_t ec_try_lock_irqsave(ec_lock_t *lock, uint32_t *irqflag)
+#if _LOCK_STATS && _EC_HOST_BUILD
+#	include <time.h>
+#endif
+
+#if _EC_HOST_BUILD
+/**
+ * A host has no interrupts to mask. One process wide flag stands in for
+ * PRIMASK so that the critical sections still exclude each other, and
+ * it nests per thread the way PRIMASK does.
+ */
+static atomic_t pv_host_irq = 0;
+static _Thread_local uint32_t pv_host_irq_depth = 0;
+
+static inline uint32_t __irq_save(void)
+{
+	if (pv_host_irq_depth++ == 0) {
+		while (atomic_cmpxchg(&pv_host_irq, 0, 1) != 0) {
+		}
+	}
+	return 0;
+}
+
+static inline void __irq_restore(uint32_t irqflag)
+{
+	(void)irqflag;
+	if (--pv_host_irq_depth == 0) {
+		atomic_set(&pv_host_irq, 0);
+	}
+}
+
+static inline int32_t __in_isr(void)
 {
-	*irqflag = __get_PRIMASK();
+	return 0;
+}
+#else
+static inline uint32_t __irq_save(void)
+{
+	uint32_t irqflag = __get_PRIMASK();
 	__set_PRIMASK(1);
+	return irqflag;
+}
+
+static inline void __irq_restore(uint32_t irqflag)
+{
+	__set_PRIMASK(irqflag);
+}
+
+static inline int32_t __in_isr(void)
+{
+	return __get_IPSR() != 0;
+}
+#endif
+
+#if _LOCK_STATS
+static ec_lock_stat_t pv_lock_stats[_LOCK_STATS_MAXNUM];
+static atomic_t pv_lock_stats_num = 0;
+
+/**
+ * Free running time stamp, CPU cycles on target, nanoseconds on a host.
+ */
+static inline uint32_t __lock_cycles(void)
+{
+#if _EC_HOST_BUILD
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec);
+#else
+	return DWT->CYCCNT;
+#endif
+}
+
+/**
+ * Called by the new holder, the lock itself serialises the updates of
+ * its entry. Only contended is bumped by callers without the lock. The
+ * entry is cached in the mutex or passed by the spin lock caller,
+ * nothing is searched while the lock is held.
+ */
+static inline void __stat_acquired(ec_lock_stat_t *stat, int32_t contended)
+{
+	if (stat != NULL) {
+		stat->acquires++;
+		if (contended) {
+			atomic_inc(&(stat->contended));
+		}
+		stat->since = __lock_cycles();
+	}
+}
+
+static inline void __stat_busy(ec_lock_stat_t *stat)
+{
+	if (stat != NULL) {
+		atomic_inc(&(stat->contended));
+	}
+}
+
+static inline void __stat_released(ec_lock_stat_t *stat)
+{
+	uint32_t hold;
+	if (stat != NULL) {
+		hold = __lock_cycles() - stat->since;
+		stat->hold_total += hold;
+		if (hold > stat->hold_max) {
+			stat->hold_max = hold;
+		}
+	}
+}
+
+/**
+ * Take the next free entry, IRQs masked by the caller.
+ */
+static ec_lock_stat_t *__stat_new(const ec_mutex_t *mutex, const char *name)
+{
+	atomic_t num = atomic_get(&pv_lock_stats_num);
+	if (num >= _LOCK_STATS_MAXNUM) {
+		return NULL;
+	}
+#if !_EC_HOST_BUILD
+	if (num == 0) {
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	}
+#endif
+	pv_lock_stats[num] = (ec_lock_stat_t){.mutex = mutex, .name = name};
+	ec_wmb();
+	atomic_set(&pv_lock_stats_num, num + 1);
+	return &pv_lock_stats[num];
+}
+
+int32_t ec_lock_stat_regist(ec_mutex_t *mutex, const char *name)
+{
+	uint32_t irqflag = __irq_save();
+	ec_lock_stat_t *stat;
+	int32_t err = 0;
+	if (mutex->stat != NULL) {
+		err = -EEXIST;
+	}
+	else {
+		stat = __stat_new(mutex, name);
+		if (stat == NULL) {
+			err = -ENOMEM;
+		}
+		else {
+			mutex->stat = stat;
+		}
+	}
+	__irq_restore(irqflag);
+	return err;
+}
+
+/**
+ * Entry for spin locks, a name already in use by spin locks gives back
+ * its entry, so code that sets up many locks of one kind may call this
+ * for each of them. NULL once the table is full.
+ */
+ec_lock_stat_t *ec_lock_stat_new(const char *name)
+{
+	uint32_t irqflag = __irq_save();
+	ec_lock_stat_t *stat = NULL;
+	for (atomic_t i = 0; i < atomic_get(&pv_lock_stats_num); i++) {
+		if ((pv_lock_stats[i].mutex == NULL) && (strcmp(pv_lock_stats[i].name, name) == 0)) {
+			stat = &pv_lock_stats[i];
+			break;
+		}
+	}
+	if (stat == NULL) {
+		stat = __stat_new(NULL, name);
+	}
+	__irq_restore(irqflag);
+	return stat;
+}
+
+int32_t ec_lock_stat_get(uint32_t index, ec_lock_stat_t *stat)
+{
+	uint32_t irqflag;
+	if (index >= (uint32_t)atomic_get(&pv_lock_stats_num)) {
+		return -ENOENT;
+	}
+	irqflag = __irq_save();
+	*stat = pv_lock_stats[index];
+	__irq_restore(irqflag);
+	return 0;
+}
+
+void ec_lock_stat_reset(void)
+{
+	uint32_t irqflag = __irq_save();
+	for (atomic_t i = 0; i < atomic_get(&pv_lock_stats_num); i++) {
+		pv_lock_stats[i].acquires = 0;
+		atomic_set(&(pv_lock_stats[i].contended), 0);
+		pv_lock_stats[i].hold_max = 0;
+		pv_lock_stats[i].hold_total = 0;
+	}
+	__irq_restore(irqflag);
+}
+#else
+#	define __stat_acquired(stat, contended)
+#	define __stat_busy(stat)
+#	define __stat_released(stat)
+#endif
+
+/**
+ * Bare flag operations, ec_mutex_t keeps its own statistics on top.
+ */
+static inline int32_t __try_lock(ec_lock_t *lock)
+{
+	uint32_t irqflag = __irq_save();
+	int32_t rtval;
+	ec_lock_t lock_state = atomic_get((atomic_t *)lock);
+	if (lock_state == e_Unlocked) {
+		atomic_set((atomic_t *)lock, e_Locked);
+		rtval = 0;
+	}
+	else {
+		rtval = -EBUSY;
+	}
+	__irq_restore(irqflag);
+	return rtval;
+}
+
+static inline void __unlock(ec_lock_t *lock)
+{
+	uint32_t irqflag = __irq_save();
+	atomic_set((atomic_t *)lock, e_Unlocked);
+	__irq_restore(irqflag);
+}
+
+int32_t ec_try_lock_irqsave(ec_lock_t *lock, uint32_t *irqflag)
+{
+	*irqflag = __irq_save();
 	ec_lock_t lock_state = atomic_get((atomic_t *)lock);
 	if (lock_state == e_Unlocked) {
 		atomic_set((atomic_t *)lock, e_Locked);
@@ -41,7 +277,7 @@ int32_t ec_try_lock_irqsave(ec_lock_t *lock, uint32_t *irqflag)
 	else {
 		// If we failed to acquire the lock, we should recover
 		// the IRQ status.
-		__set_PRIMASK(*irqflag);
+		__irq_restore(*irqflag);
 		return -EBUSY;
 	}
 }
@@ -49,32 +285,255 @@ int32_t ec_try_lock_irqsave(ec_lock_t *lock, uint32_t *irqflag)
 void ec_unlock_irqrestore(ec_lock_t *lock, uint32_t irqflag)
 {
 	atomic_set((atomic_t *)lock, e_Unlocked);
-	__set_PRIMASK(irqflag);
+	__irq_restore(irqflag);
 	return;
 }
 
+#if _LOCK_STATS
+int32_t ec_try_lock_irqsave_stat(ec_lock_t *lock, uint32_t *irqflag, ec_lock_stat_t *stat)
+{
+	if (ec_try_lock_irqsave(lock, irqflag) != 0) {
+		__stat_busy(stat);
+		return -EBUSY;
+	}
+	__stat_acquired(stat, 0);
+	return 0;
+}
+
+void ec_unlock_irqrestore_stat(ec_lock_t *lock, uint32_t irqflag, ec_lock_stat_t *stat)
+{
+	__stat_released(stat);
+	ec_unlock_irqrestore(lock, irqflag);
+}
+#endif
+
 int32_t ec_try_lock(ec_lock_t *lock)
 {
-	uint32_t irqflag = __get_PRIMASK();
-	int32_t rtval;
-	__set_PRIMASK(1);
-	ec_lock_t lock_state = atomic_get((atomic_t *)lock);
-	if (lock_state == e_Unlocked) {
-		atomic_set((atomic_t *)lock, e_Locked);
-		rtval = 0;
+	return __try_lock(lock);
+}
+
+void ec_unlock(ec_lock_t *lock)
+{
+	__unlock(lock);
+	return;
+}
+
+#if _WITH_CMSISOS_V2
+/**
+ * Once the scheduler has started, tasks always go through the RTOS mutex,
+ * so a task never finds the flag held by another task.
+ */
+static inline int32_t __mutex_is_task(void)
+{
+	return !__in_isr() && (xTaskGetSchedulerState() != taskSCHEDULER_NOT_STARTED);
+}
+
+/**
+ * Tasks may sleep only while the scheduler runs, and never in ISR.
+ */
+static inline int32_t __mutex_can_sleep(void)
+{
+	return !__in_isr() && (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING);
+}
+#endif
+
+/**
+ * Create the RTOS mutex up front, so that taking the mutex never has to
+ * allocate and a waiting task always sleeps on it. Call it once before
+ * the first lock, statically initialised mutexes included.
+ */
+int32_t ec_mutex_init(ec_mutex_t *mutex)
+{
+#if _WITH_CMSISOS_V2
+	if (mutex->os_mutex == NULL) {
+		mutex->os_mutex = (void *)xSemaphoreCreateMutex();
+		if (mutex->os_mutex == NULL) {
+			return -ENOMEM;
+		}
+	}
+#else
+	(void)mutex;
+#endif
+	return 0;
+}
+
+int32_t ec_mutex_lock(ec_mutex_t *mutex)
+{
+	int32_t contended = 0;
+#if _WITH_CMSISOS_V2
+	SemaphoreHandle_t os_mutex = (SemaphoreHandle_t)mutex->os_mutex;
+	if (__mutex_is_task()) {
+		if (os_mutex == NULL) {
+			return -ENOLCK;	 // ec_mutex_init() missing or failed
+		}
+		if (xSemaphoreTake(os_mutex, 0) != pdTRUE) {
+			contended = 1;
+			if (!__mutex_can_sleep()) {
+				// Scheduler suspended, we must not sleep.
+				__stat_busy(mutex->stat);
+				return -EBUSY;
+			}
+			xSemaphoreTake(os_mutex, portMAX_DELAY);
+		}
+		// No other task holds the flag now, and an ISR that took it has
+		// returned before we run again, so this does not loop.
+		while (__try_lock(&(mutex->lock)) != 0) {
+		}
+		__stat_acquired(mutex->stat, contended);
+		return 0;
+	}
+#endif
+	for (uint32_t spin = 0; __try_lock(&(mutex->lock)) != 0; spin++) {
+		contended = 1;
+		if (__in_isr() && (spin >= _MUTEX_SPIN_COUNT)) {
+			__stat_busy(mutex->stat);
+			return -EBUSY;
+		}
+	}
+	__stat_acquired(mutex->stat, contended);
+	(void)contended;
+	return 0;
+}
+
+int32_t ec_mutex_trylock(ec_mutex_t *mutex)
+{
+#if _WITH_CMSISOS_V2
+	SemaphoreHandle_t os_mutex = (SemaphoreHandle_t)mutex->os_mutex;
+	if (__mutex_is_task()) {
+		if (os_mutex == NULL) {
+			return -ENOLCK;
+		}
+		if (xSemaphoreTake(os_mutex, 0) != pdTRUE) {
+			__stat_busy(mutex->stat);
+			return -EBUSY;
+		}
+		while (__try_lock(&(mutex->lock)) != 0) {
+		}
+		__stat_acquired(mutex->stat, 0);
+		return 0;
+	}
+#endif
+	if (__try_lock(&(mutex->lock)) != 0) {
+		__stat_busy(mutex->stat);
+		return -EBUSY;
+	}
+	__stat_acquired(mutex->stat, 0);
+	return 0;
+}
+
+void ec_mutex_unlock(ec_mutex_t *mutex)
+{
+	__stat_released(mutex->stat);
+	__unlock(&(mutex->lock));
+#if _WITH_CMSISOS_V2
+	if (__mutex_is_task() && (mutex->os_mutex != NULL)) {
+		xSemaphoreGive((SemaphoreHandle_t)mutex->os_mutex);
+	}
+#endif
+}
+
+int32_t ec_rwlock_init(ec_rwlock_t *rwlock)
+{
+#if _WITH_CMSISOS_V2
+	if (rwlock->drained == NULL) {
+		rwlock->drained = (void *)xSemaphoreCreateBinary();
+		if (rwlock->drained == NULL) {
+			return -ENOMEM;
+		}
+	}
+#endif
+	return ec_mutex_init(&(rwlock->writer));
+}
+
+#define __RW_WRITER 0x40000000
+
+int32_t ec_read_lock(ec_rwlock_t *rwlock)
+{
+	atomic_t state;
+	for (;;) {
+		state = atomic_get(&(rwlock->readers));
+		if ((state & __RW_WRITER) == 0) {
+			if (atomic_cmpxchg(&(rwlock->readers), state, state + 1) == state) {
+				ec_mb();
+				return 0;
+			}
+			else {
+				// Another reader got in, retry.
+			}
+		}
+		else {
+			// The flag is only set while the writer owns its mutex.
+			if (ec_mutex_lock(&(rwlock->writer)) != 0) {
+				return -EBUSY;
+			}
+			ec_mutex_unlock(&(rwlock->writer));
+		}
+	}
+}
+
+void ec_read_unlock(ec_rwlock_t *rwlock)
+{
+	ec_mb();
+	if (atomic_fetch_add(&(rwlock->readers), -1) != (__RW_WRITER | 1)) {
+		// Other readers still inside, or no writer waiting.
+		return;
+	}
+#if _WITH_CMSISOS_V2
+	// Last reader out while a writer waits. A give the writer does not
+	// sleep for stays pending and costs the next writer one extra check.
+	if (rwlock->drained == NULL) {
+		// ec_rwlock_init() missing, the writer only spins then.
+	}
+	else if (__in_isr()) {
+		BaseType_t woken = pdFALSE;
+		xSemaphoreGiveFromISR((SemaphoreHandle_t)rwlock->drained, &woken);
+		portYIELD_FROM_ISR(woken);
 	}
 	else {
-		rtval = -EBUSY;
+		xSemaphoreGive((SemaphoreHandle_t)rwlock->drained);
 	}
-	__set_PRIMASK(irqflag);
-	return rtval;
+#endif
 }
 
-void ec_unlock(ec_lock_t *lock)
+/**
+ * Readers inside are tasks the writer preempted or ISRs it is nested in,
+ * spinning cannot help them on one core. A task sleeps until the last of
+ * them gives the drained semaphore, anything else waits only for a short
+ * while.
+ */
+static inline int32_t __rw_wait_readers(ec_rwlock_t *rwlock, uint32_t spin)
 {
-	uint32_t irqflag = __get_PRIMASK();
-	__set_PRIMASK(1);
-	atomic_set((atomic_t *)lock, e_Unlocked);
-	__set_PRIMASK(irqflag);
-	return;
+#if _WITH_CMSISOS_V2
+	if (__mutex_can_sleep() && (rwlock->drained != NULL)) {
+		xSemaphoreTake((SemaphoreHandle_t)rwlock->drained, portMAX_DELAY);
+		return 0;
+	}
+#else
+	(void)rwlock;
+#endif
+	return (spin < _MUTEX_SPIN_COUNT) ? 0 : -EBUSY;
+}
+
+int32_t ec_write_lock(ec_rwlock_t *rwlock)
+{
+	if (ec_mutex_lock(&(rwlock->writer)) != 0) {
+		return -EBUSY;
+	}
+	atomic_fetch_or(&(rwlock->readers), __RW_WRITER);
+	for (uint32_t spin = 0; atomic_get(&(rwlock->readers)) != __RW_WRITER; spin++) {
+		if (__rw_wait_readers(rwlock, spin) != 0) {
+			atomic_fetch_and(&(rwlock->readers), ~__RW_WRITER);
+			ec_mutex_unlock(&(rwlock->writer));
+			return -EBUSY;
+		}
+	}
+	ec_mb();
+	return 0;
+}
+
+void ec_write_unlock(ec_rwlock_t *rwlock)
+{
+	ec_mb();
+	atomic_fetch_and(&(rwlock->readers), ~__RW_WRITER);
+	ec_mutex_unlock(&(rwlock->writer));
 }
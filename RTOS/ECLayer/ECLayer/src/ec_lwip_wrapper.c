@@ -43,19 +43,32 @@
 #	include "exceptions.h"
 #	include "ec_fdlist.h"
 #	include "ec_file.h"
+#	include "ec_lwip_wrapper.h"
 #	include "string.h"
 #	include "heap_port.h"
 
-int ec_fd2sock(int32_t fd)
+/**
+  *@brief	Pin fd and return its lwip socket, release with ec_sock_put().
+  *@retval	-EBADF		fd is not open, or its socket is being closed
+  *@retval	-ENOTSOCK	fd is not a socket
+  */
+int ec_sock_get(int32_t fd, ec_sockref_t *ref)
 {
 	file_des_t *fd_st;
-	fd_st = get_fd_struct(fd);
+	ref->slot = fd_resolve(fd);
+	fd_st = fd_pin(ref->slot);
+	ref->fd_st = fd_st;
 	if (fd_st == NULL) {
 		return -EBADF;
 	}
 	else if (fd_st->file_type != e_FTYPE_SOCKET) {
+		ec_sock_put(ref);
 		return -ENOTSOCK;
 	}
+	else if (fd_st->sock_num < 0) {
+		ec_sock_put(ref);
+		return -EBADF;
+	}
 	else {
 		return fd_st->sock_num;
 	}
@@ -85,28 +98,38 @@ int socket(int domain, int type, int protocol)
 
 	int32_t err;
 	int32_t fd;
+	int32_t lfd;
 	file_des_t *fd_st;
-	fd_st = (file_des_t *)ecmalloc(sizeof(file_des_t));
+	fd_st = (file_des_t *)ecslab_alloc(sizeof(file_des_t));
 	if (fd_st == NULL) {
 		err = -ENOMEM;
 		goto close_socket;
 	}
 	else {
-		do {
-			fd = alloc_fd(fd_st);
-		} while (fd == -EBUSY);
+		fd = alloc_fd(fd_st);
 		if (fd < 0) {
 			err = fd;
-			ecfree(fd_st);
-			while (free_fd(fd) != 0)
-				;
+			ecslab_free(fd_st, sizeof(file_des_t));
+			goto close_socket;
+		}
+		lfd = fd_install(fd);
+		if (lfd < 0) {
+			err = lfd;
+			free_fd(fd);
+			ecslab_free(fd_st, sizeof(file_des_t));
 			goto close_socket;
 		}
 		else {
+			atomic_set(&(fd_st->file_des_refs), 1);
 			fd_st->file_flags = O_RDWR;
 			fd_st->file_pos = 0;
+			fd_st->read_min = 0;
+			fd_st->read_timeout = 0;
+			fd_st->read_interval = 0;
 			fd_st->file_type = e_FTYPE_SOCKET;
 			fd_st->sock_num = sock_n;
+			fd_publish(fd);
+			err = lfd;
 		}
 	}
 	return err;
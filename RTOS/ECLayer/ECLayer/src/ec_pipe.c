@@ -0,0 +1,517 @@
+/**
+ * @file	ec_pipe.c
+ * @brief	Anonymous pipes for streaming between tasks.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "ec_pipe.h"
+
+#include "cfifo.h"
+#include "cmsis_port.h"
+#include "ec_atomic.h"
+#include "ec_config.h"
+#include "ec_fcntl.h"
+#include "ec_fdlist.h"
+#include "ec_file.h"
+#include "ec_list.h"
+#include "ec_lock.h"
+#include "ec_poll.h"
+#include "exceptions.h"
+#include "heap_port.h"
+
+#if _WITH_CMSISOS_V2
+#	include "cmsis_os2.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#if _WITH_CMSISOS_V2
+
+/**
+ * Pipes come from a static pool since the file_t is still touched by
+ * ECLayer after the last close. A slot is reused once its last close has
+ * torn it down and cleared in_use, file_refs only counts open ends, a
+ * reused slot adds to it so that a late drop by the previous user still
+ * balances. The read end has a single reader and the write end a single
+ * writer at a time, so the fifo runs lock free like the USART ones.
+*/
+typedef struct ec_pipe_s {
+	file_t file;
+	cfifo_t *fifo;
+	osSemaphoreId_t rd_sem;	 //!< serialises readers
+	osSemaphoreId_t wr_sem;	 //!< serialises writers
+	osSemaphoreId_t rx_sem;	 //!< a blocked reader sleeps here
+	osSemaphoreId_t tx_sem;	 //!< a blocked writer sleeps here
+	volatile uint32_t rx_wait_level;
+	volatile uint32_t tx_wait_level;
+	atomic_t readers;
+	atomic_t writers;
+	atomic_t ends;	//!< ends not closed yet, the last one tears down
+	uint32_t in_use;
+	ec_waitq_t poll_waitq;
+} ec_pipe_t;
+
+static int32_t __pipe_read(file_des_t *fd, char *data, size_t count);
+static int32_t __pipe_write(file_des_t *fd, const char *data, size_t count);
+static int32_t __pipe_close(file_des_t *fd);
+static uint32_t __pipe_poll(file_des_t *fd, ec_poll_table_t *table);
+static ec_pipe_t *__pipe_of(file_des_t *fd);
+static int32_t __pipe_lock(osSemaphoreId_t sem, uint32_t flags);
+static void __pipe_rx_wakeup(ec_pipe_t *pipe);
+static void __pipe_tx_wakeup(ec_pipe_t *pipe);
+static uint32_t __pipe_ticks(uint32_t ms);
+
+static file_opts_t pv_pipe_opts = {
+	.open = NULL,
+	.read = __pipe_read,
+	.write = __pipe_write,
+	.ioctl = NULL,
+	.lseek = NULL,
+	.mmap = NULL,
+	.close = __pipe_close,
+	.poll = __pipe_poll,
+	.readv = NULL,
+	.writev = NULL,
+};
+
+static ec_pipe_t pv_pipes[_PIPE_MAXNUM];
+static ec_mutex_t pv_pipes_lock = EC_MUTEX_INIT;
+
+void pipe_list_init(void)
+{
+	ec_mutex_init(&pv_pipes_lock);
+	ec_lock_stat_regist(&pv_pipes_lock, "pipes");
+}
+
+/**
+ * Create a pipe, fds[0] is the read end and fds[1] the write end.
+ * Both are plain fds, read/write/poll/close work on them as usual.
+ * A read returns 0 once the write end is closed and the pipe drained,
+ * a write fails with -EPIPE once the read end is closed.
+*/
+int32_t ec_pipe(int32_t fds[2])
+{
+	ec_pipe_t *pipe = NULL;
+	file_des_t *rd_st;
+	file_des_t *wr_st;
+	int32_t rd_fd;
+	int32_t wr_fd;
+	int32_t err;
+
+	if (fds == NULL) {
+		return -EINVAL;
+	}
+	if (ec_mutex_lock(&pv_pipes_lock) != 0) {
+		return -EBUSY;
+	}
+	for (uint32_t i = 0; i < _PIPE_MAXNUM; i++) {
+		if (pv_pipes[i].in_use == 0) {
+			pipe = &pv_pipes[i];
+			pipe->in_use = 1;
+			// One ref for each end
+			atomic_add(&(pipe->file.file_refs), 2);
+			break;
+		}
+	}
+	ec_mutex_unlock(&pv_pipes_lock);
+	if (pipe == NULL) {
+		return -ENFILE;
+	}
+
+	// Never registered, so nobody can open() it by name.
+	snprintf(pipe->file.file_name, sizeof(pipe->file.file_name), "pipe:%u", (unsigned int)(pipe - pv_pipes));
+	list_clear(&(pipe->file.file_list));
+	list_clear(&(pipe->file.file_hash_list));
+	pipe->file.file_hash = 0;
+	pipe->file.file_lock = e_Unlocked;
+	pipe->file.file_opts = &pv_pipe_opts;
+	pipe->file.file_content = pipe;
+	pipe->rx_wait_level = 0;
+	pipe->tx_wait_level = 0;
+	atomic_set(&(pipe->readers), 1);
+	atomic_set(&(pipe->writers), 1);
+	atomic_set(&(pipe->ends), 2);
+	ec_waitq_init(&(pipe->poll_waitq));
+
+	pipe->fifo = cfifo_new(_PIPE_BUFFER_SIZE, e_CFIFO_Reject);
+	if (pipe->fifo == NULL) {
+		err = -ENOMEM;
+		goto release_slot;
+	}
+	pipe->rd_sem = osSemaphoreNew(1, 1, NULL);
+	if (pipe->rd_sem == NULL) {
+		err = -ENOMEM;
+		goto release_fifo;
+	}
+	pipe->wr_sem = osSemaphoreNew(1, 1, NULL);
+	if (pipe->wr_sem == NULL) {
+		err = -ENOMEM;
+		goto release_rd_sem;
+	}
+	pipe->rx_sem = osSemaphoreNew(1, 0, NULL);
+	if (pipe->rx_sem == NULL) {
+		err = -ENOMEM;
+		goto release_wr_sem;
+	}
+	pipe->tx_sem = osSemaphoreNew(1, 0, NULL);
+	if (pipe->tx_sem == NULL) {
+		err = -ENOMEM;
+		goto release_rx_sem;
+	}
+
+	rd_st = (file_des_t *)ecslab_alloc(sizeof(file_des_t));
+	if (rd_st == NULL) {
+		err = -ENOMEM;
+		goto release_tx_sem;
+	}
+	wr_st = (file_des_t *)ecslab_alloc(sizeof(file_des_t));
+	if (wr_st == NULL) {
+		err = -ENOMEM;
+		goto release_rd_st;
+	}
+	rd_fd = alloc_fd(rd_st);
+	if (rd_fd < 0) {
+		err = rd_fd;
+		goto release_wr_st;
+	}
+	wr_fd = alloc_fd(wr_st);
+	if (wr_fd < 0) {
+		err = wr_fd;
+		goto release_rd_fd;
+	}
+	fds[0] = fd_install(rd_fd);
+	if (fds[0] < 0) {
+		err = fds[0];
+		goto release_wr_fd;
+	}
+	fds[1] = fd_install(wr_fd);
+	if (fds[1] < 0) {
+		err = fds[1];
+		fd_forget(fds[0]);
+		goto release_wr_fd;
+	}
+
+	atomic_set(&(rd_st->file_des_refs), 1);
+	atomic_set(&(wr_st->file_des_refs), 1);
+	rd_st->file_flags = O_RDONLY;
+	wr_st->file_flags = O_WRONLY;
+	rd_st->file_pos = wr_st->file_pos = 0;
+	rd_st->read_min = wr_st->read_min = 0;
+	rd_st->read_timeout = wr_st->read_timeout = 0;
+	rd_st->read_interval = wr_st->read_interval = 0;
+	rd_st->file_type = wr_st->file_type = e_FTYPE_PIPE;
+	rd_st->file = wr_st->file = &(pipe->file);
+	fd_publish(rd_fd);
+	fd_publish(wr_fd);
+	return 0;
+
+release_wr_fd:
+	free_fd(wr_fd);
+release_rd_fd:
+	free_fd(rd_fd);
+release_wr_st:
+	ecslab_free(wr_st, sizeof(file_des_t));
+release_rd_st:
+	ecslab_free(rd_st, sizeof(file_des_t));
+release_tx_sem:
+	osSemaphoreDelete(pipe->tx_sem);
+release_rx_sem:
+	osSemaphoreDelete(pipe->rx_sem);
+release_wr_sem:
+	osSemaphoreDelete(pipe->wr_sem);
+release_rd_sem:
+	osSemaphoreDelete(pipe->rd_sem);
+release_fifo:
+	cfifo_delete(pipe->fifo);
+	pipe->fifo = NULL;
+release_slot:
+	atomic_add(&(pipe->file.file_refs), -2);
+	pipe->in_use = 0;
+	return err;
+}
+
+/**
+ * Same blocking rules as the USART: without read_min/read_timeout/
+ * read_interval on the fd a read waits for the whole count, or for the
+ * write end to close.
+*/
+static int32_t __pipe_read(file_des_t *fd, char *data, size_t count)
+{
+	ec_pipe_t *pipe = __pipe_of(fd);
+	size_t rest_count = count;
+	int32_t err;
+
+	if (pipe == NULL) {
+		return -EBADFD;
+	}
+	else if ((fd->file_flags & O_RDONLY) == 0) {
+		return -ENOTSUP;
+	}
+	else {
+	}
+
+	err = __pipe_lock(pipe->rd_sem, fd->file_flags);
+	if (err != 0) {
+		return err;
+	}
+	if ((fd->file_flags & O_NOBLOCK) || (__get_IPSR() != 0)) {
+		err = cfifo_popn(pipe->fifo, data, count);
+		if (err > 0) {
+			__pipe_tx_wakeup(pipe);
+		}
+		else if ((err == -EFIFOEMPTY) && (atomic_get(&(pipe->writers)) == 0)) {
+			err = 0;
+		}
+		else {
+		}
+	}
+	else {
+		size_t min_count = ((fd->read_min == 0) || (fd->read_min > count)) ? count : fd->read_min;
+		uint32_t start = osKernelGetTickCount();
+		uint32_t total = __pipe_ticks(fd->read_timeout);
+		uint32_t interval = __pipe_ticks(fd->read_interval);
+		while (rest_count > 0) {
+			err = cfifo_popn(pipe->fifo, &data[count - rest_count], rest_count);
+			if (err >= 0) {
+				rest_count -= err;
+				__pipe_tx_wakeup(pipe);
+				continue;
+			}
+			if ((count - rest_count) >= min_count) {
+				break;
+			}
+			if (atomic_get(&(pipe->writers)) == 0) {
+				// Writer is gone, drain what it left then report EOF.
+				if (cfifo_used(pipe->fifo) > 0) {
+					continue;
+				}
+				break;
+			}
+			uint32_t level = min_count - (count - rest_count);
+			uint32_t timeout = osWaitForever;
+			uint32_t tail = pipe->fifo->tail;
+			int32_t gap_wait = 0;
+			osStatus_t stat;
+			if (level > (uint32_t)pipe->fifo->depth) {
+				level = (uint32_t)pipe->fifo->depth;
+			}
+			if (fd->read_timeout != 0) {
+				uint32_t elapsed = osKernelGetTickCount() - start;
+				if (elapsed >= total) {
+					break;
+				}
+				timeout = total - elapsed;
+			}
+			if ((fd->read_interval != 0) && (rest_count < count) && (interval < timeout)) {
+				timeout = interval;
+				gap_wait = 1;
+			}
+			pipe->rx_wait_level = level;
+			if ((cfifo_used(pipe->fifo) < (int32_t)level) && (atomic_get(&(pipe->writers)) != 0)) {
+				stat = osSemaphoreAcquire(pipe->rx_sem, timeout);
+				if ((stat == osErrorTimeout) && gap_wait && (pipe->fifo->tail == tail)) {
+					pipe->rx_wait_level = 0;
+					break;
+				}
+			}
+			pipe->rx_wait_level = 0;
+		}
+		err = count - rest_count;
+	}
+	osSemaphoreRelease(pipe->rd_sem);
+	return err;
+}
+
+static int32_t __pipe_write(file_des_t *fd, const char *data, size_t count)
+{
+	ec_pipe_t *pipe = __pipe_of(fd);
+	size_t rest_count = count;
+	int32_t err;
+
+	if (pipe == NULL) {
+		return -EBADFD;
+	}
+	else if ((fd->file_flags & O_WRONLY) == 0) {
+		return -ENOTSUP;
+	}
+	else if (atomic_get(&(pipe->readers)) == 0) {
+		return -EPIPE;
+	}
+	else {
+	}
+
+	err = __pipe_lock(pipe->wr_sem, fd->file_flags);
+	if (err != 0) {
+		return err;
+	}
+	if ((fd->file_flags & O_NOBLOCK) || (__get_IPSR() != 0)) {
+		err = cfifo_pushn(pipe->fifo, data, count);
+		if (err > 0) {
+			__pipe_rx_wakeup(pipe);
+		}
+	}
+	else {
+		err = 0;
+		while (rest_count > 0) {
+			if (atomic_get(&(pipe->readers)) == 0) {
+				err = -EPIPE;
+				break;
+			}
+			err = cfifo_pushn(pipe->fifo, &data[count - rest_count], rest_count);
+			if (err >= 0) {
+				rest_count -= err;
+				__pipe_rx_wakeup(pipe);
+				continue;
+			}
+			// Wake on a quarter fifo of space, not on every char read.
+			uint32_t level = (uint32_t)pipe->fifo->depth / 4;
+			if (level > rest_count) {
+				level = rest_count;
+			}
+			if (level == 0) {
+				level = 1;
+			}
+			pipe->tx_wait_level = level;
+			if ((cfifo_free(pipe->fifo) < (int32_t)level) && (atomic_get(&(pipe->readers)) != 0)) {
+				osSemaphoreAcquire(pipe->tx_sem, osWaitForever);
+			}
+			pipe->tx_wait_level = 0;
+		}
+		if ((err != -EPIPE) || (rest_count < count)) {
+			err = count - rest_count;
+		}
+	}
+	osSemaphoreRelease(pipe->wr_sem);
+	return err;
+}
+
+/**
+ * The last close of an end wakes whoever waits on the other one. The
+ * last close of both frees the fifo and semaphores and frees the slot,
+ * all under pv_pipes_lock.
+*/
+static int32_t __pipe_close(file_des_t *fd)
+{
+	ec_pipe_t *pipe = __pipe_of(fd);
+	if (pipe == NULL) {
+		return -EBADFD;
+	}
+	if (fd->file_flags & O_RDONLY) {
+		if (atomic_dec_and_test(&(pipe->readers)) == 0) {
+			pipe->tx_wait_level = 0;
+			osSemaphoreRelease(pipe->tx_sem);
+		}
+	}
+	else {
+		if (atomic_dec_and_test(&(pipe->writers)) == 0) {
+			pipe->rx_wait_level = 0;
+			osSemaphoreRelease(pipe->rx_sem);
+		}
+	}
+	ec_waitq_wake(&(pipe->poll_waitq));
+	if (atomic_dec_and_test(&(pipe->ends)) == 0) {
+		// ec_pipe() only takes the slot once in_use is clear again.
+		ec_mutex_lock(&pv_pipes_lock);
+		cfifo_delete(pipe->fifo);
+		pipe->fifo = NULL;
+		osSemaphoreDelete(pipe->rd_sem);
+		osSemaphoreDelete(pipe->wr_sem);
+		osSemaphoreDelete(pipe->rx_sem);
+		osSemaphoreDelete(pipe->tx_sem);
+		pipe->in_use = 0;
+		ec_mutex_unlock(&pv_pipes_lock);
+	}
+	// ECLayer drops the file_refs of this end itself.
+	return 0;
+}
+
+static uint32_t __pipe_poll(file_des_t *fd, ec_poll_table_t *table)
+{
+	ec_pipe_t *pipe = __pipe_of(fd);
+	uint32_t mask = 0;
+	if (pipe == NULL) {
+		return EC_POLLERR;
+	}
+	ec_poll_wait(&(pipe->poll_waitq), table);
+	if (fd->file_flags & O_RDONLY) {
+		if (cfifo_used(pipe->fifo) > 0) {
+			mask |= EC_POLLIN;
+		}
+		if (atomic_get(&(pipe->writers)) == 0) {
+			mask |= EC_POLLHUP;
+		}
+	}
+	else {
+		if (cfifo_free(pipe->fifo) > 0) {
+			mask |= EC_POLLOUT;
+		}
+		if (atomic_get(&(pipe->readers)) == 0) {
+			mask |= EC_POLLERR;
+		}
+	}
+	return mask;
+}
+
+static ec_pipe_t *__pipe_of(file_des_t *fd)
+{
+	if ((fd == NULL) || (fd->file == NULL)) {
+		return NULL;
+	}
+	else {
+		return (ec_pipe_t *)fd->file->file_content;
+	}
+}
+
+static int32_t __pipe_lock(osSemaphoreId_t sem, uint32_t flags)
+{
+	if ((__get_IPSR() != 0) || (flags & O_NOBLOCK)) {
+		return (osSemaphoreAcquire(sem, 0) == osOK) ? 0 : -EBUSY;
+	}
+	else {
+		return (osSemaphoreAcquire(sem, osWaitForever) == osOK) ? 0 : -ENOLCK;
+	}
+}
+
+static void __pipe_rx_wakeup(ec_pipe_t *pipe)
+{
+	uint32_t level = pipe->rx_wait_level;
+	ec_waitq_wake(&(pipe->poll_waitq));
+	if ((level != 0) && (cfifo_used(pipe->fifo) >= (int32_t)level)) {
+		pipe->rx_wait_level = 0;
+		osSemaphoreRelease(pipe->rx_sem);
+	}
+}
+
+static void __pipe_tx_wakeup(ec_pipe_t *pipe)
+{
+	uint32_t level = pipe->tx_wait_level;
+	ec_waitq_wake(&(pipe->poll_waitq));
+	if ((level != 0) && (cfifo_free(pipe->fifo) >= (int32_t)level)) {
+		pipe->tx_wait_level = 0;
+		osSemaphoreRelease(pipe->tx_sem);
+	}
+}
+
+static uint32_t __pipe_ticks(uint32_t ms)
+{
+	return (uint32_t)(((uint64_t)ms * osKernelGetTickFreq() + 999U) / 1000U);
+}
+
+#endif
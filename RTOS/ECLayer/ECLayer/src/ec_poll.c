@@ -0,0 +1,118 @@
+/**
+ * @file	ec_poll.c
+ * @brief	Wait queues that let drivers wake tasks sleeping in ec_poll().
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "ec_poll.h"
+
+#include "ec_config.h"
+#include "ec_list.h"
+#include "ec_lock.h"
+
+#if _WITH_CMSISOS_V2
+#	include "cmsis_os2.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Wait queue locks are held one at a time, they share one entry.
+static ec_lock_stat_t *pv_waitq_stat = NULL;
+
+/**
+ * Name the wait queue locks for lock statistics, called once by
+ * EC_Layer_Initialize().
+ */
+void ec_poll_init(void)
+{
+	pv_waitq_stat = ec_lock_stat_new("waitq");
+}
+
+void ec_waitq_init(ec_waitq_t *waitq)
+{
+	list_clear(&(waitq->waiters));
+	waitq->lock = e_Unlocked;
+}
+
+/**
+ * Callable from ISR. Waiters are only flagged, each one re-scans its
+ * fds itself, so a spurious wakeup costs nothing but a scan.
+*/
+void ec_waitq_wake(ec_waitq_t *waitq)
+{
+	list_t *head = &(waitq->waiters);
+	uint32_t irqflag;
+	// Nobody is polling, the common case costs a single load.
+	if (list_is_empty(head)) {
+		return;
+	}
+	while (ec_try_lock_irqsave_stat(&(waitq->lock), &irqflag, pv_waitq_stat) != 0)
+		;
+	foreach (itr, head) {
+		ec_poll_entry_t *entry = list_get_node(itr, ec_poll_entry_t, node);
+#if _WITH_CMSISOS_V2
+		osThreadFlagsSet((osThreadId_t)entry->thread, _POLL_THREAD_FLAG);
+#else
+		(void)entry;
+#endif
+	}
+	ec_unlock_irqrestore_stat(&(waitq->lock), irqflag, pv_waitq_stat);
+}
+
+/**
+ * Hook the polling task on a wait queue, called by file_opts_t::poll.
+ * Does nothing on rescans, where table is NULL.
+*/
+void ec_poll_wait(ec_waitq_t *waitq, ec_poll_table_t *table)
+{
+	ec_poll_entry_t *entry;
+	uint32_t irqflag;
+	if ((waitq == NULL) || (table == NULL) || (table->nentries >= table->maxentries)) {
+		return;
+	}
+	entry = &(table->entries[table->nentries]);
+	entry->waitq = waitq;
+#if _WITH_CMSISOS_V2
+	entry->thread = (void *)osThreadGetId();
+#else
+	entry->thread = NULL;
+#endif
+	while (ec_try_lock_irqsave_stat(&(waitq->lock), &irqflag, pv_waitq_stat) != 0)
+		;
+	list_append(&(entry->node), &(waitq->waiters));
+	ec_unlock_irqrestore_stat(&(waitq->lock), irqflag, pv_waitq_stat);
+	table->nentries++;
+}
+
+/**
+ * Unhook every entry ec_poll_wait() added to the table.
+*/
+void ec_poll_unwait(ec_poll_table_t *table)
+{
+	ec_poll_entry_t *entry;
+	uint32_t irqflag;
+	for (uint32_t i = 0; i < table->nentries; i++) {
+		entry = &(table->entries[i]);
+		while (ec_try_lock_irqsave_stat(&(entry->waitq->lock), &irqflag, pv_waitq_stat) != 0)
+			;
+		list_delete(&(entry->node));
+		ec_unlock_irqrestore_stat(&(entry->waitq->lock), irqflag, pv_waitq_stat);
+	}
+	table->nentries = 0;
+}
@@ -0,0 +1,435 @@
+/**
+ * @file	ec_tmpfs.c
+ * @brief	RAM backed files, created by open() with O_CREAT.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "ec_tmpfs.h"
+
+#include "ec_atomic.h"
+#include "ec_config.h"
+#include "ec_fcntl.h"
+#include "ec_file.h"
+#include "ec_list.h"
+#include "exceptions.h"
+#include "heap_port.h"
+
+#if _WITH_CMSISOS_V2
+#	include "cmsis_os2.h"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if _USE_TMPFS && _WITH_CMSISOS_V2
+
+// Largest file, keeps every offset in an int32_t.
+#	define __TMPFS_MAX_SIZE ((uint32_t)INT32_MAX)
+
+/**
+ * A file is a chain of extents laid back to back from offset 0. Each
+ * new extent is at least as big as the file so far, so the chain stays
+ * logarithmic in the file size. An extent handed out by mmap is never
+ * moved or freed again.
+*/
+typedef struct tmpfs_extent_s {
+	list_t list;
+	uint32_t offset;  //!< file offset of data[0]
+	uint32_t size;	  //!< bytes of storage in data[]
+	uint32_t mapped;  //!< pointed into by an mmap()
+	uint32_t reserved;
+	char data[];
+} tmpfs_extent_t;
+
+typedef struct tmpfs_file_s {
+	list_t extents;
+	uint32_t size;		//!< file length
+	uint32_t capacity;	//!< storage of all extents
+	osMutexId_t lock;
+} tmpfs_file_t;
+
+static int32_t __tmpfs_open(file_des_t *fd, const char *filename, uint32_t flags);
+static int32_t __tmpfs_read(file_des_t *fd, char *data, size_t count);
+static int32_t __tmpfs_write(file_des_t *fd, const char *data, size_t count);
+static int64_t __tmpfs_lseek(file_des_t *fd, int64_t offset, int32_t origin);
+static void *__tmpfs_mmap(file_des_t *fd, size_t len, int32_t offset);
+static void __tmpfs_release(file_t *file);
+static tmpfs_file_t *__tmpfs_of(file_des_t *fd);
+static int32_t __tmpfs_grow(tmpfs_file_t *tf, uint32_t need);
+static void __tmpfs_trunc(tmpfs_file_t *tf);
+static tmpfs_extent_t *__tmpfs_find(tmpfs_file_t *tf, uint32_t pos);
+static void __tmpfs_copy(tmpfs_file_t *tf, uint32_t pos, char *buf, uint32_t n, int32_t in);
+
+static file_opts_t pv_tmpfs_opts = {
+	.open = __tmpfs_open,
+	.read = __tmpfs_read,
+	.write = __tmpfs_write,
+	.ioctl = NULL,
+	.lseek = __tmpfs_lseek,
+	.mmap = __tmpfs_mmap,
+	.close = NULL,
+	.poll = NULL,
+	.readv = NULL,
+	.writev = NULL,
+	.release = __tmpfs_release,
+};
+
+/**
+ * New empty file, not registered yet.
+*/
+file_t *tmpfs_create(const char *filename)
+{
+	tmpfs_file_t *tf;
+	file_t *file;
+
+	tf = (tmpfs_file_t *)ecslab_alloc(sizeof(tmpfs_file_t));
+	if (tf == NULL) {
+		return NULL;
+	}
+	list_clear(&(tf->extents));
+	tf->size = 0;
+	tf->capacity = 0;
+	tf->lock = osMutexNew(NULL);
+	if (tf->lock == NULL) {
+		ecslab_free(tf, sizeof(tmpfs_file_t));
+		return NULL;
+	}
+	file = create_file(filename, &pv_tmpfs_opts, tf);
+	if (file == NULL) {
+		osMutexDelete(tf->lock);
+		ecslab_free(tf, sizeof(tmpfs_file_t));
+		return NULL;
+	}
+	return file;
+}
+
+/**
+ * The file_t goes away, unregistered and not open, so nobody takes the
+ * lock any more. Mapped extents go too, mappings must not outlive it.
+*/
+static void __tmpfs_release(file_t *file)
+{
+	tmpfs_file_t *tf = (tmpfs_file_t *)file->file_content;
+	tmpfs_extent_t *ext;
+	if (tf == NULL) {
+		return;
+	}
+	while (!list_is_empty((&(tf->extents)))) {
+		ext = list_get_node(list_lastof(&(tf->extents)), tmpfs_extent_t, list);
+		list_delete(&(ext->list));
+		_TMPFS_FREE(ext);
+	}
+	osMutexDelete(tf->lock);
+	ecslab_free(tf, sizeof(tmpfs_file_t));
+	file->file_content = NULL;
+}
+
+static int32_t __tmpfs_open(file_des_t *fd, const char *filename, uint32_t flags)
+{
+	tmpfs_file_t *tf = __tmpfs_of(fd);
+	if (tf == NULL) {
+		return -EBADFD;
+	}
+	if (flags & O_TRUNC) {
+		osMutexAcquire(tf->lock, osWaitForever);
+		__tmpfs_trunc(tf);
+		osMutexRelease(tf->lock);
+	}
+	// Any number of opens, ECLayer holds the file ref of each.
+	return 0;
+}
+
+static int32_t __tmpfs_read(file_des_t *fd, char *data, size_t count)
+{
+	tmpfs_file_t *tf = __tmpfs_of(fd);
+	uint32_t pos;
+	uint32_t n;
+
+	if (tf == NULL) {
+		return -EBADFD;
+	}
+	else if ((fd->file_flags & O_RDONLY) == 0) {
+		return -ENOTSUP;
+	}
+	else {
+	}
+
+	osMutexAcquire(tf->lock, osWaitForever);
+	if (fd->file_pos >= (int64_t)tf->size) {
+		n = 0;
+	}
+	else {
+		pos = (uint32_t)fd->file_pos;
+		n = ((tf->size - pos) < count) ? (tf->size - pos) : (uint32_t)count;
+		__tmpfs_copy(tf, pos, data, n, 0);
+		fd->file_pos += n;
+	}
+	osMutexRelease(tf->lock);
+	return (int32_t)n;
+}
+
+static int32_t __tmpfs_write(file_des_t *fd, const char *data, size_t count)
+{
+	tmpfs_file_t *tf = __tmpfs_of(fd);
+	uint32_t pos;
+	int32_t err;
+
+	if (tf == NULL) {
+		return -EBADFD;
+	}
+	else if ((fd->file_flags & O_WRONLY) == 0) {
+		return -ENOTSUP;
+	}
+	else if (count == 0) {
+		return 0;
+	}
+	else {
+	}
+
+	osMutexAcquire(tf->lock, osWaitForever);
+	if (fd->file_flags & O_APPEND) {
+		fd->file_pos = tf->size;
+	}
+	if ((fd->file_pos > (int64_t)__TMPFS_MAX_SIZE) || (count > (__TMPFS_MAX_SIZE - (uint32_t)fd->file_pos))) {
+		err = -EFBIG;
+		goto unlock;
+	}
+	pos = (uint32_t)fd->file_pos;
+	err = __tmpfs_grow(tf, pos + count);
+	if (err != 0) {
+		goto unlock;
+	}
+	if (pos > tf->size) {
+		// Hole left by a seek past the end reads back as zeros.
+		__tmpfs_copy(tf, tf->size, NULL, pos - tf->size, 1);
+	}
+	__tmpfs_copy(tf, pos, (char *)data, count, 1);
+	pos += count;
+	if (pos > tf->size) {
+		tf->size = pos;
+	}
+	fd->file_pos = pos;
+	err = (int32_t)count;
+unlock:
+	osMutexRelease(tf->lock);
+	return err;
+}
+
+/**
+ * Seeking past the end is allowed, the file grows on the next write.
+*/
+static int64_t __tmpfs_lseek(file_des_t *fd, int64_t offset, int32_t origin)
+{
+	tmpfs_file_t *tf = __tmpfs_of(fd);
+	int64_t pos;
+
+	if (tf == NULL) {
+		return -EBADFD;
+	}
+	osMutexAcquire(tf->lock, osWaitForever);
+	switch (origin) {
+	case EC_SEEK_SET:
+		pos = offset;
+		break;
+	case EC_SEEK_CUR:
+		pos = fd->file_pos + offset;
+		break;
+	case EC_SEEK_END:
+		pos = (int64_t)tf->size + offset;
+		break;
+	default:
+		pos = -1;
+		break;
+	}
+	if ((pos < 0) || (pos > (int64_t)__TMPFS_MAX_SIZE)) {
+		pos = -EINVAL;
+	}
+	else {
+		fd->file_pos = pos;
+	}
+	osMutexRelease(tf->lock);
+	return pos;
+}
+
+/**
+ * Pointer straight into the extent holding [offset, offset + len),
+ * which must lie inside the file. A range spanning several extents is
+ * first merged into one, unless one of them is already mapped.
+ * The mapping stays valid for the life of the file, O_TRUNC included.
+*/
+static void *__tmpfs_mmap(file_des_t *fd, size_t len, int32_t offset)
+{
+	tmpfs_file_t *tf = __tmpfs_of(fd);
+	tmpfs_extent_t *first;
+	tmpfs_extent_t *last;
+	tmpfs_extent_t *merged;
+	list_t *itr;
+	list_t *stop;
+	uint32_t end;
+	void *rtptr;
+
+	if (tf == NULL) {
+		return (void *)-EBADFD;
+	}
+	osMutexAcquire(tf->lock, osWaitForever);
+	if ((offset < 0) || (len == 0) || (len > tf->size) || ((uint32_t)offset > (tf->size - len))) {
+		rtptr = (void *)-EINVAL;
+		goto unlock;
+	}
+	end = (uint32_t)offset + len;
+	first = __tmpfs_find(tf, (uint32_t)offset);
+	last = __tmpfs_find(tf, end - 1);
+	if (first != last) {
+		for (itr = &(first->list); itr != last->list.next; itr = itr->next) {
+			if (list_get_node(itr, tmpfs_extent_t, list)->mapped) {
+				rtptr = (void *)-EBUSY;
+				goto unlock;
+			}
+		}
+		merged = (tmpfs_extent_t *)_TMPFS_MALLOC(sizeof(tmpfs_extent_t) + (last->offset + last->size - first->offset));
+		if (merged == NULL) {
+			rtptr = (void *)-ENOMEM;
+			goto unlock;
+		}
+		merged->offset = first->offset;
+		merged->size = last->offset + last->size - first->offset;
+		merged->mapped = 0;
+		stop = last->list.next;
+		list_insert(&(merged->list), first->list.prev, &(first->list));
+		while (merged->list.next != stop) {
+			first = list_get_node(merged->list.next, tmpfs_extent_t, list);
+			memcpy(&(merged->data[first->offset - merged->offset]), first->data, first->size);
+			list_delete(&(first->list));
+			_TMPFS_FREE(first);
+		}
+		first = merged;
+	}
+	first->mapped = 1;
+	rtptr = &(first->data[(uint32_t)offset - first->offset]);
+unlock:
+	osMutexRelease(tf->lock);
+	return rtptr;
+}
+
+static tmpfs_file_t *__tmpfs_of(file_des_t *fd)
+{
+	if ((fd == NULL) || (fd->file == NULL)) {
+		return NULL;
+	}
+	else {
+		return (tmpfs_file_t *)fd->file->file_content;
+	}
+}
+
+/**
+ * Make room for need bytes, the new extent at least doubles the file.
+*/
+static int32_t __tmpfs_grow(tmpfs_file_t *tf, uint32_t need)
+{
+	tmpfs_extent_t *ext;
+	uint32_t add;
+	if (need <= tf->capacity) {
+		return 0;
+	}
+	add = need - tf->capacity;
+	if (add < tf->capacity) {
+		add = tf->capacity;
+	}
+	if (add < _TMPFS_EXTENT_MIN) {
+		add = _TMPFS_EXTENT_MIN;
+	}
+	add = (add + 3U) & ~3U;
+	ext = (tmpfs_extent_t *)_TMPFS_MALLOC(sizeof(tmpfs_extent_t) + add);
+	if (ext == NULL) {
+		// Try again without the headroom.
+		add = ((need - tf->capacity) + 3U) & ~3U;
+		ext = (tmpfs_extent_t *)_TMPFS_MALLOC(sizeof(tmpfs_extent_t) + add);
+		if (ext == NULL) {
+			return -ENOMEM;
+		}
+	}
+	ext->offset = tf->capacity;
+	ext->size = add;
+	ext->mapped = 0;
+	list_append(&(ext->list), &(tf->extents));
+	tf->capacity += add;
+	return 0;
+}
+
+/**
+ * Empty the file, freeing trailing extents up to the last mapped one.
+*/
+static void __tmpfs_trunc(tmpfs_file_t *tf)
+{
+	tmpfs_extent_t *ext;
+	while (!list_is_empty((&(tf->extents)))) {
+		ext = list_get_node(list_lastof(&(tf->extents)), tmpfs_extent_t, list);
+		if (ext->mapped) {
+			break;
+		}
+		list_delete(&(ext->list));
+		tf->capacity = ext->offset;
+		_TMPFS_FREE(ext);
+	}
+	tf->size = 0;
+}
+
+static tmpfs_extent_t *__tmpfs_find(tmpfs_file_t *tf, uint32_t pos)
+{
+	tmpfs_extent_t *ext;
+	foreach (itr, &(tf->extents)) {
+		ext = list_get_node(itr, tmpfs_extent_t, list);
+		if ((pos - ext->offset) < ext->size) {
+			return ext;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Copy n bytes between buf and the file at pos, into the file if in is
+ * set. A NULL buf zero fills. The range must be within capacity.
+*/
+static void __tmpfs_copy(tmpfs_file_t *tf, uint32_t pos, char *buf, uint32_t n, int32_t in)
+{
+	tmpfs_extent_t *ext = __tmpfs_find(tf, pos);
+	uint32_t skip;
+	uint32_t chunk;
+	while (n > 0) {
+		skip = pos - ext->offset;
+		chunk = ((ext->size - skip) < n) ? (ext->size - skip) : n;
+		if (!in) {
+			memcpy(buf, &(ext->data[skip]), chunk);
+		}
+		else if (buf == NULL) {
+			memset(&(ext->data[skip]), 0, chunk);
+		}
+		else {
+			memcpy(&(ext->data[skip]), buf, chunk);
+		}
+		if (buf != NULL) {
+			buf += chunk;
+		}
+		pos += chunk;
+		n -= chunk;
+		ext = list_get_node(ext->list.next, tmpfs_extent_t, list);
+	}
+}
+
+#endif
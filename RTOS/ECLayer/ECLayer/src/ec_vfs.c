@@ -0,0 +1,574 @@
+/**
+ * @file	ec_vfs.c
+ * @brief	Path component trie over the registered files, with mount
+ * 			points delegating whole subtrees to a filesystem driver.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "ec_vfs.h"
+
+#include "ec_atomic.h"
+#include "ec_config.h"
+#include "ec_file.h"
+#include "ec_list.h"
+#include "ec_lock.h"
+#include "exceptions.h"
+#include "heap_port.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * Directories are never created by hand, they come and go with the files
+ * and mount points below them, taken from and given back to the slab.
+ */
+typedef struct vfs_dir_s {
+	ec_dentry_t dentry;
+	char name[_FILE_NAME_MAXLEN + 1];
+} vfs_dir_t;
+
+struct ec_dir_s {
+	ec_dentry_t *dentry;  //!< directory listed, NULL when mount is set
+	ec_mount_t *mount;
+	list_t *cursor;		  //!< last child returned, valid while gen matches
+	uint32_t gen;
+	uint32_t index;
+	ec_dirent_t ent;
+	char path[_FILE_NAME_MAXLEN + 1];  //!< relative to mount
+};
+
+static ec_dentry_t pv_vfs_root = {
+	.d_sibling = {.prev = &(pv_vfs_root.d_sibling), .next = &(pv_vfs_root.d_sibling)},
+	.d_children = {.prev = &(pv_vfs_root.d_children), .next = &(pv_vfs_root.d_children)},
+	.d_parent = NULL,
+	.d_cache = NULL,
+	.d_mount = NULL,
+	.d_name = "",
+	.d_hash = 0,
+	.d_gen = 0,
+	.d_namelen = 0,
+	.d_type = EC_DT_DIR,
+	.d_refs = 0,
+};
+static ec_mutex_t pv_vfs_lock = EC_MUTEX_INIT;
+
+static inline uint32_t __next_comp(const char **path, const char **comp);
+static inline uint32_t __comp_hash(const char *comp, uint32_t len);
+static ec_dentry_t *__child_lookup(ec_dentry_t *dir, const char *comp, uint32_t len, uint32_t hash);
+static void __child_add(ec_dentry_t *dir, ec_dentry_t *child, uint32_t hash);
+static void __child_del(ec_dentry_t *child);
+static ec_dentry_t *__dir_alloc(const char *comp, uint32_t len);
+static void __dir_prune(ec_dentry_t *dir);
+static ec_dentry_t *__walk(const char *path, const char **rest);
+static ec_dentry_t *__mkpath(const char *path, const char **leaf, uint32_t *leaflen, int32_t *err);
+
+void vfs_init(void)
+{
+	ec_mutex_init(&pv_vfs_lock);
+	ec_lock_stat_regist(&pv_vfs_lock, "vfs");
+}
+
+int32_t vfs_link(file_t *file)
+{
+	ec_dentry_t *dir;
+	ec_dentry_t *leaf = &(file->file_dentry);
+	const char *comp;
+	uint32_t len;
+	uint32_t hash;
+	int32_t err;
+	ec_mutex_lock(&pv_vfs_lock);
+	dir = __mkpath(file->file_name, &comp, &len, &err);
+	if (dir == NULL) {
+		goto unlock;
+	}
+	hash = __comp_hash(comp, len);
+	if (__child_lookup(dir, comp, len, hash) != NULL) {
+		__dir_prune(dir);
+		err = -EFREGED;
+	}
+	else {
+		leaf->d_name = comp;
+		leaf->d_namelen = len;
+		leaf->d_type = EC_DT_REG;
+		__child_add(dir, leaf, hash);
+		err = 0;
+	}
+unlock:
+	ec_mutex_unlock(&pv_vfs_lock);
+	return err;
+}
+
+static void __unlink(file_t *file)
+{
+	ec_dentry_t *leaf = &(file->file_dentry);
+	ec_dentry_t *dir;
+	dir = leaf->d_parent;
+	if (dir != NULL) {
+		__child_del(leaf);
+		leaf->d_type = EC_DT_NONE;
+		__dir_prune(dir);
+	}
+	else {
+		// never linked.
+	}
+}
+
+void vfs_unlink(file_t *file)
+{
+	ec_mutex_lock(&pv_vfs_lock);
+	__unlink(file);
+	ec_mutex_unlock(&pv_vfs_lock);
+}
+
+/**
+ * vfs_lookup() takes its file_refs reference under the trie lock, so the
+ * check has to happen under it as well.
+ */
+int32_t vfs_unlink_unused(file_t *file)
+{
+	int32_t err;
+	ec_mutex_lock(&pv_vfs_lock);
+	if (atomic_get(&(file->file_refs)) > 0) {
+		err = -EBUSY;
+	}
+	else {
+		__unlink(file);
+		err = 0;
+	}
+	ec_mutex_unlock(&pv_vfs_lock);
+	return err;
+}
+
+/**
+ * Only reached for names the hash index in ec_file.c does not hold, which
+ * are either missing or live below a mount point. Like search_file(), a
+ * file comes back with a file_refs reference taken.
+ */
+file_t *vfs_lookup(const char *path)
+{
+	ec_dentry_t *dentry;
+	ec_mount_t *mnt = NULL;
+	file_t *file = NULL;
+	const char *rest;
+	ec_mutex_lock(&pv_vfs_lock);
+	dentry = __walk(path, &rest);
+	if (dentry == NULL) {
+		// no such path.
+	}
+	else if ((dentry->d_type == EC_DT_REG) && (*rest == '\0')) {
+		file = list_get_node(dentry, file_t, file_dentry);
+		atomic_inc(&(file->file_refs));
+	}
+	else if ((dentry->d_type == EC_DT_MOUNT) && (dentry->d_mount->mnt_opts->lookup != NULL)) {
+		mnt = dentry->d_mount;
+		atomic_inc(&(mnt->mnt_refs));
+	}
+	else {
+		// a directory, or a path below a file.
+	}
+	ec_mutex_unlock(&pv_vfs_lock);
+	if (mnt != NULL) {
+		// The driver may sleep, call it unlocked.
+		file = mnt->mnt_opts->lookup(mnt, rest);
+		atomic_dec(&(mnt->mnt_refs));
+	}
+	return file;
+}
+
+/**
+ * Hand the subtree at path to a filesystem driver. Directories on the
+ * way are created, the mount point itself must be empty.
+ */
+int32_t ec_mount(const char *path, ec_fs_opts_t *fs_opts, void *fs_data)
+{
+	ec_mount_t *mnt;
+	ec_dentry_t *dentry;
+	int32_t err;
+	if (fs_opts == NULL) {
+		return -EINVAL;
+	}
+	mnt = (ec_mount_t *)ecslab_alloc(sizeof(ec_mount_t));
+	if (mnt == NULL) {
+		return -ENOMEM;
+	}
+	mnt->mnt_opts = fs_opts;
+	mnt->mnt_data = fs_data;
+	atomic_set(&(mnt->mnt_refs), 0);
+
+	ec_mutex_lock(&pv_vfs_lock);
+	dentry = __mkpath(path, NULL, NULL, &err);
+	if (dentry == NULL) {
+		// err set by __mkpath().
+	}
+	else if (dentry == &pv_vfs_root) {
+		err = -EINVAL;
+	}
+	else if ((dentry->d_refs != 0) || (!list_is_empty((&(dentry->d_children))))) {
+		err = -EBUSY;
+	}
+	else {
+		dentry->d_type = EC_DT_MOUNT;
+		dentry->d_mount = mnt;
+		err = 0;
+	}
+	ec_mutex_unlock(&pv_vfs_lock);
+	if (err != 0) {
+		ecslab_free(mnt, sizeof(ec_mount_t));
+	}
+	return err;
+}
+
+int32_t ec_umount(const char *path)
+{
+	ec_dentry_t *dentry;
+	ec_mount_t *mnt = NULL;
+	const char *rest;
+	int32_t err;
+	ec_mutex_lock(&pv_vfs_lock);
+	dentry = __walk(path, &rest);
+	if ((dentry == NULL) || (dentry->d_type != EC_DT_MOUNT) || (*rest != '\0')) {
+		err = -EINVAL;
+	}
+	else if (atomic_get(&(dentry->d_mount->mnt_refs)) != 0) {
+		err = -EBUSY;
+	}
+	else {
+		mnt = dentry->d_mount;
+		dentry->d_mount = NULL;
+		dentry->d_type = EC_DT_DIR;
+		__dir_prune(dentry);
+		err = 0;
+	}
+	ec_mutex_unlock(&pv_vfs_lock);
+	if (mnt != NULL) {
+		ecslab_free(mnt, sizeof(ec_mount_t));
+	}
+	return err;
+}
+
+ec_dir_t *opendir(const char *path)
+{
+	ec_dir_t *dir;
+	ec_dentry_t *dentry;
+	const char *rest;
+	dir = (ec_dir_t *)ecslab_alloc(sizeof(ec_dir_t));
+	if (dir == NULL) {
+		return NULL;
+	}
+	dir->dentry = NULL;
+	dir->mount = NULL;
+	dir->cursor = NULL;
+	dir->gen = 0;
+	dir->index = 0;
+	ec_mutex_lock(&pv_vfs_lock);
+	dentry = __walk(path, &rest);
+	if (dentry == NULL) {
+		// no such path.
+	}
+	else if (dentry->d_type == EC_DT_DIR) {
+		if (dentry->d_refs < UINT8_MAX) {
+			dentry->d_refs++;
+			dir->dentry = dentry;
+		}
+		else {
+			// too many open handles, d_refs would wrap.
+		}
+	}
+	else if ((dentry->d_type == EC_DT_MOUNT) && (dentry->d_mount->mnt_opts->readdir != NULL) && (strlen(rest) <= _FILE_NAME_MAXLEN)) {
+		strcpy(dir->path, rest);
+		atomic_inc(&(dentry->d_mount->mnt_refs));
+		dir->mount = dentry->d_mount;
+	}
+	else {
+		// not a directory.
+	}
+	ec_mutex_unlock(&pv_vfs_lock);
+	if ((dir->dentry == NULL) && (dir->mount == NULL)) {
+		ecslab_free(dir, sizeof(ec_dir_t));
+		return NULL;
+	}
+	return dir;
+}
+
+/**
+ * Entries added or removed while a directory is listed may be missed or
+ * returned twice, every other entry is returned once.
+ */
+ec_dirent_t *readdir(ec_dir_t *dir)
+{
+	ec_dentry_t *parent;
+	ec_dentry_t *child;
+	list_t *itr;
+	if (dir == NULL) {
+		return NULL;
+	}
+	if (dir->mount != NULL) {
+		if (dir->mount->mnt_opts->readdir(dir->mount, dir->path, dir->index, &(dir->ent)) != 0) {
+			return NULL;
+		}
+		dir->index++;
+		return &(dir->ent);
+	}
+
+	parent = dir->dentry;
+	ec_mutex_lock(&pv_vfs_lock);
+	if ((dir->cursor != NULL) && (dir->gen == parent->d_gen)) {
+		itr = dir->cursor->next;
+	}
+	else {
+		// Children changed since the last call, count up to the index again.
+		itr = parent->d_children.next;
+		for (uint32_t i = 0; (i < dir->index) && (itr != &(parent->d_children)); i++) {
+			itr = itr->next;
+		}
+	}
+	if (itr == &(parent->d_children)) {
+		ec_mutex_unlock(&pv_vfs_lock);
+		return NULL;
+	}
+	child = list_get_node(itr, ec_dentry_t, d_sibling);
+	memcpy(dir->ent.d_name, child->d_name, child->d_namelen);
+	dir->ent.d_name[child->d_namelen] = '\0';
+	dir->ent.d_type = (child->d_type == EC_DT_REG) ? EC_DT_REG : EC_DT_DIR;
+	dir->cursor = itr;
+	dir->gen = parent->d_gen;
+	dir->index++;
+	ec_mutex_unlock(&pv_vfs_lock);
+	return &(dir->ent);
+}
+
+int32_t closedir(ec_dir_t *dir)
+{
+	if (dir == NULL) {
+		return -EINVAL;
+	}
+	if (dir->mount != NULL) {
+		atomic_dec(&(dir->mount->mnt_refs));
+	}
+	else {
+		ec_mutex_lock(&pv_vfs_lock);
+		dir->dentry->d_refs--;
+		__dir_prune(dir->dentry);
+		ec_mutex_unlock(&pv_vfs_lock);
+	}
+	ecslab_free(dir, sizeof(ec_dir_t));
+	return 0;
+}
+
+/**
+ * Split the next component off path, skipping empty ones. Returns its
+ * length, 0 at the end of path.
+ */
+static inline uint32_t __next_comp(const char **path, const char **comp)
+{
+	const char *p = *path;
+	uint32_t len = 0;
+	while (*p == '/') {
+		p++;
+	}
+	*comp = p;
+	while ((p[len] != '\0') && (p[len] != '/')) {
+		len++;
+	}
+	*path = p + len;
+	return len;
+}
+
+/**
+ * BKDR, same as the name index in ec_file.c.
+ */
+static inline uint32_t __comp_hash(const char *comp, uint32_t len)
+{
+	uint32_t hash = 0;
+	for (uint32_t i = 0; i < len; i++) {
+		hash = hash * 131U + (uint8_t)comp[i];
+	}
+	return hash;
+}
+
+/**
+ * Repeated lookups through the same directory, the usual case when a
+ * device class is scanned, hit d_cache without touching the list.
+ */
+static ec_dentry_t *__child_lookup(ec_dentry_t *dir, const char *comp, uint32_t len, uint32_t hash)
+{
+	ec_dentry_t *child = dir->d_cache;
+	if ((child != NULL) && (child->d_hash == hash) && (child->d_namelen == len) && (memcmp(child->d_name, comp, len) == 0)) {
+		return child;
+	}
+	foreach (itr, &(dir->d_children)) {
+		child = list_get_node(itr, ec_dentry_t, d_sibling);
+		if ((child->d_hash == hash) && (child->d_namelen == len) && (memcmp(child->d_name, comp, len) == 0)) {
+			dir->d_cache = child;
+			return child;
+		}
+		else {
+			// continue;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * d_name, d_namelen and d_type of child are set by the caller.
+ */
+static void __child_add(ec_dentry_t *dir, ec_dentry_t *child, uint32_t hash)
+{
+	list_clear(&(child->d_children));
+	child->d_parent = dir;
+	child->d_cache = NULL;
+	child->d_mount = NULL;
+	child->d_hash = hash;
+	child->d_gen = 0;
+	child->d_refs = 0;
+	list_append(&(child->d_sibling), &(dir->d_children));
+	dir->d_gen++;
+}
+
+static void __child_del(ec_dentry_t *child)
+{
+	ec_dentry_t *dir = child->d_parent;
+	if (dir->d_cache == child) {
+		dir->d_cache = NULL;
+	}
+	list_delete(&(child->d_sibling));
+	child->d_parent = NULL;
+	dir->d_gen++;
+}
+
+static ec_dentry_t *__dir_alloc(const char *comp, uint32_t len)
+{
+	vfs_dir_t *dir;
+	dir = (vfs_dir_t *)ecslab_alloc(sizeof(vfs_dir_t));
+	if (dir == NULL) {
+		return NULL;
+	}
+	memcpy(dir->name, comp, len);
+	dir->name[len] = '\0';
+	dir->dentry.d_name = dir->name;
+	dir->dentry.d_namelen = len;
+	dir->dentry.d_type = EC_DT_DIR;
+	return &(dir->dentry);
+}
+
+/**
+ * Give empty directories from dir upwards back to the slab, stopping at
+ * the root, mount points and directories being listed.
+ */
+static void __dir_prune(ec_dentry_t *dir)
+{
+	ec_dentry_t *parent;
+	while ((dir != &pv_vfs_root) && (dir->d_type == EC_DT_DIR) && (dir->d_refs == 0) && (list_is_empty((&(dir->d_children))))) {
+		parent = dir->d_parent;
+		__child_del(dir);
+		ecslab_free(list_get_node(dir, vfs_dir_t, dentry), sizeof(vfs_dir_t));
+		dir = parent;
+	}
+}
+
+/**
+ * Walk down from the root as far as directories go. Returns the node
+ * reached, with *rest pointing at what is left of path, or NULL if a
+ * component is missing. Caller holds pv_vfs_lock.
+ */
+static ec_dentry_t *__walk(const char *path, const char **rest)
+{
+	ec_dentry_t *dentry = &pv_vfs_root;
+	ec_dentry_t *child;
+	const char *comp;
+	uint32_t len;
+	while (dentry->d_type == EC_DT_DIR) {
+		len = __next_comp(&path, &comp);
+		if (len == 0) {
+			break;
+		}
+		child = __child_lookup(dentry, comp, len, __comp_hash(comp, len));
+		if (child == NULL) {
+			return NULL;
+		}
+		dentry = child;
+	}
+	while (*path == '/') {
+		path++;
+	}
+	*rest = path;
+	return dentry;
+}
+
+/**
+ * Walk path creating missing directories. With leaf set the last
+ * component is left out and returned through leaf and leaflen. Returns
+ * the directory reached, or NULL with *err set, directories created on
+ * the way are pruned again. Caller holds pv_vfs_lock.
+ */
+static ec_dentry_t *__mkpath(const char *path, const char **leaf, uint32_t *leaflen, int32_t *err)
+{
+	ec_dentry_t *dentry = &pv_vfs_root;
+	ec_dentry_t *child;
+	const char *comp;
+	const char *next;
+	uint32_t len;
+	uint32_t nextlen;
+	uint32_t hash;
+	len = __next_comp(&path, &comp);
+	if ((len == 0) && (leaf != NULL)) {
+		*err = -EINVAL;
+		return NULL;
+	}
+	while (len != 0) {
+		nextlen = __next_comp(&path, &next);
+		if ((nextlen == 0) && (leaf != NULL)) {
+			*leaf = comp;
+			*leaflen = len;
+			return dentry;
+		}
+		hash = __comp_hash(comp, len);
+		child = __child_lookup(dentry, comp, len, hash);
+		if (child == NULL) {
+			if (len > _FILE_NAME_MAXLEN) {
+				*err = -ENAMETOOLONG;	// would not fit vfs_dir_t.name.
+				goto error;
+			}
+			child = __dir_alloc(comp, len);
+			if (child == NULL) {
+				*err = -ENOMEM;
+				goto error;
+			}
+			__child_add(dentry, child, hash);
+		}
+		else if (child->d_type == EC_DT_MOUNT) {
+			*err = -EBUSY;	// path lies in a mounted filesystem.
+			goto error;
+		}
+		else if (child->d_type != EC_DT_DIR) {
+			*err = -ENOTDIR;
+			goto error;
+		}
+		else {
+			// existing directory.
+		}
+		dentry = child;
+		comp = next;
+		len = nextlen;
+	}
+	return dentry;
+error:
+	__dir_prune(dentry);
+	return NULL;
+}
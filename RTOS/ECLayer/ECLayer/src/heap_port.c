@@ -25,10 +25,16 @@
  * limitations under the License.
 */
 
+#include "heap_port.h"
+
 #include "FreeRTOS.h"
+#include "cmsis_port.h"
 #include "ec_config.h"
+#include "ec_lock.h"
+#include "exceptions.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 /*
  * You can imply your own memory pool method, or port to a 
@@ -57,3 +63,232 @@ void *eccalloc(size_t n, size_t size)
 	return pvPortCalloc(n, size);
 }
 
+/**
+ * Heap objects handed to ecslab_free() in an ISR, linked through their
+ * first word. The heap suspends the scheduler, so they are given back by
+ * the next ecslab_alloc() or ecslab_free() called from a task.
+ */
+static void *pv_deferred = NULL;
+static ec_lock_t pv_deferred_lock = e_Unlocked;
+
+static void __free_deferred(void *p)
+{
+	uint32_t irqflag;
+	while (ec_try_lock_irqsave(&pv_deferred_lock, &irqflag) != 0)
+		;
+	*(void **)p = pv_deferred;
+	pv_deferred = p;
+	ec_unlock_irqrestore(&pv_deferred_lock, irqflag);
+}
+
+static void __drain_deferred(void)
+{
+	uint32_t irqflag;
+	void *p;
+	if (pv_deferred == NULL) {
+		return;
+	}
+	while (ec_try_lock_irqsave(&pv_deferred_lock, &irqflag) != 0)
+		;
+	p = pv_deferred;
+	pv_deferred = NULL;
+	ec_unlock_irqrestore(&pv_deferred_lock, irqflag);
+	while (p != NULL) {
+		void *next = *(void **)p;
+		ecfree(p);
+		p = next;
+	}
+}
+
+/**
+ * Heap side of ecslab_alloc(), an ISR gets NULL.
+ */
+static inline void *__heap_alloc(size_t size)
+{
+	if (__get_IPSR() != 0) {
+		return NULL;
+	}
+	__drain_deferred();
+	return ecmalloc(size);
+}
+
+static inline void __heap_free(void *p)
+{
+	if (__get_IPSR() != 0) {
+		__free_deferred(p);
+	}
+	else {
+		__drain_deferred();
+		ecfree(p);
+	}
+}
+
+#if _USE_SLAB
+#define __SLAB_MIN_SHIFT 4
+#define __SLAB_CLASS_NUM 5
+
+#if _SLAB_PAGE_SIZE < (1 << (__SLAB_MIN_SHIFT + __SLAB_CLASS_NUM - 1))
+#	error "_SLAB_PAGE_SIZE must hold one object of the largest class"
+#endif
+
+/**
+ * Free objects are linked through their first word. Objects never freed
+ * yet are carved from [carve, end), the static storage of the class at
+ * first and a heap page once that runs out, as avl_fastbin does.
+ */
+typedef struct slab_class_s {
+	void *free;
+	char *carve;
+	char *end;
+	ec_lock_t lock;
+} slab_class_t;
+
+#define __SLAB_OFS_0 0
+#define __SLAB_OFS_1 (__SLAB_OFS_0 + 16 * _SLAB_STATIC_16)
+#define __SLAB_OFS_2 (__SLAB_OFS_1 + 32 * _SLAB_STATIC_32)
+#define __SLAB_OFS_3 (__SLAB_OFS_2 + 64 * _SLAB_STATIC_64)
+#define __SLAB_OFS_4 (__SLAB_OFS_3 + 128 * _SLAB_STATIC_128)
+#define __SLAB_OFS_5 (__SLAB_OFS_4 + 256 * _SLAB_STATIC_256)
+
+// One spare word so that the array is never empty.
+static uint64_t pv_slab_static[__SLAB_OFS_5 / sizeof(uint64_t) + 1];
+
+#define __SLAB_CLASS(i, next)                              \
+	{                                                      \
+		.free = NULL,                                      \
+		.carve = (char *)pv_slab_static + __SLAB_OFS_##i,  \
+		.end = (char *)pv_slab_static + __SLAB_OFS_##next, \
+		.lock = e_Unlocked,                                \
+	}
+
+static slab_class_t pv_slab[__SLAB_CLASS_NUM] = {
+	__SLAB_CLASS(0, 1),
+	__SLAB_CLASS(1, 2),
+	__SLAB_CLASS(2, 3),
+	__SLAB_CLASS(3, 4),
+	__SLAB_CLASS(4, 5),
+};
+
+// Class locks never nest, they share one entry.
+static ec_lock_stat_t *pv_slab_stat = NULL;
+
+void ecslab_init(void)
+{
+	pv_slab_stat = ec_lock_stat_new("slab");
+}
+
+/**
+ * Index of the smallest class that holds size, -1 if none does.
+ */
+static inline int32_t __slab_class(size_t size)
+{
+	int32_t cls;
+	if (size <= (1U << __SLAB_MIN_SHIFT)) {
+		return 0;
+	}
+	cls = (int32_t)(32U - __CLZ((uint32_t)size - 1U)) - __SLAB_MIN_SHIFT;
+	return (cls < __SLAB_CLASS_NUM) ? cls : -1;
+}
+
+/**
+ * Give an exhausted class a fresh heap page to carve, out of the lock
+ * since the heap suspends the scheduler. An ISR cannot do that and gets
+ * NULL from ecslab_alloc() instead.
+ */
+static int32_t __slab_grow(slab_class_t *slab, uint32_t obj_size)
+{
+	char *page;
+	uint32_t irqflag;
+	if (__get_IPSR() != 0) {
+		return -EBUSY;
+	}
+	page = (char *)ecmalloc(_SLAB_PAGE_SIZE);
+	if (page == NULL) {
+		return -ENOMEM;
+	}
+	while (ec_try_lock_irqsave_stat(&(slab->lock), &irqflag, pv_slab_stat) != 0)
+		;
+	if ((slab->free == NULL) && (slab->carve >= slab->end)) {
+		slab->carve = page;
+		slab->end = page + (_SLAB_PAGE_SIZE / obj_size) * obj_size;
+		page = NULL;
+	}
+	ec_unlock_irqrestore_stat(&(slab->lock), irqflag, pv_slab_stat);
+	if (page != NULL) {
+		// Another task refilled the class meanwhile.
+		ecfree(page);
+	}
+	return 0;
+}
+
+void *ecslab_alloc(size_t size)
+{
+	int32_t cls = __slab_class(size);
+	slab_class_t *slab;
+	uint32_t obj_size;
+	uint32_t irqflag;
+	void *obj;
+	if (cls < 0) {
+		return __heap_alloc(size);
+	}
+	slab = &pv_slab[cls];
+	obj_size = 1U << (cls + __SLAB_MIN_SHIFT);
+	do {
+		while (ec_try_lock_irqsave_stat(&(slab->lock), &irqflag, pv_slab_stat) != 0)
+			;
+		obj = slab->free;
+		if (obj != NULL) {
+			slab->free = *(void **)obj;
+		}
+		else if (slab->carve < slab->end) {
+			obj = slab->carve;
+			slab->carve += obj_size;
+		}
+		else {
+			// Empty, grow below and retry.
+		}
+		ec_unlock_irqrestore_stat(&(slab->lock), irqflag, pv_slab_stat);
+		if (obj != NULL) {
+			return obj;
+		}
+	} while (__slab_grow(slab, obj_size) == 0);
+	return NULL;
+}
+
+void ecslab_free(void *p, size_t size)
+{
+	int32_t cls = __slab_class(size);
+	slab_class_t *slab;
+	uint32_t irqflag;
+	if (p == NULL) {
+		return;
+	}
+	if (cls < 0) {
+		__heap_free(p);
+		return;
+	}
+	slab = &pv_slab[cls];
+	while (ec_try_lock_irqsave_stat(&(slab->lock), &irqflag, pv_slab_stat) != 0)
+		;
+	*(void **)p = slab->free;
+	slab->free = p;
+	ec_unlock_irqrestore_stat(&(slab->lock), irqflag, pv_slab_stat);
+}
+#else
+void ecslab_init(void)
+{
+}
+
+void *ecslab_alloc(size_t size)
+{
+	return __heap_alloc(size);
+}
+
+void ecslab_free(void *p, size_t size)
+{
+	(void)size;
+	if (p != NULL) {
+		__heap_free(p);
+	}
+}
+#endif
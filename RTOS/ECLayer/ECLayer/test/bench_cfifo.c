@@ -0,0 +1,339 @@
+/**
+ * @file	bench_cfifo.c
+ * @brief	Host benchmark of cfifo against the fifo it replaced.
+ * @details	Not part of the firmware. Times three builds in one binary:
+ * 			"baseline" is cfifo_base/, the fifo before the power-of-2
+ * 			rework, "locked" is the current one with _CFIFO_LOCKFREE_SPSC 0
+ * 			and "spsc" the current one as shipped. Build and run it on Linux
+ * 			from this directory with
+ * 			gcc -std=gnu11 -O2 -pthread -D_ATOMIC_USE_STDATOMIC=1 -D_EC_HOST_BUILD=1
+ * 				-Ihost -I../inc -I../../../Middlewares/Third_Party/FreeRTOS/Source/CMSIS_RTOS_V2
+ * 				bench_cfifo.c bench_cfifo_base.c bench_cfifo_locked.c host/host_port.c
+ * 				../src/cfifo.c ../src/ec_atomic.c ../src/ec_lock.c ../src/heap_port.c
+ * 				-o bench_cfifo
+ * 			./bench_cfifo
+ * 			Every push and pop result and every byte moved is checked, it
+ * 			exits with 0 when all of them were right. The timings are only
+ * 			printed. Push and pop take one ec_wmb() or ec_rmb() each, a
+ * 			release or acquire fence on the host and a DMB on the M4.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "cfifo.h"
+#include "exceptions.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if !_CFIFO_LOCKFREE_SPSC
+#	error "build without -D_CFIFO_LOCKFREE_SPSC=0, bench_cfifo_locked.c covers it"
+#endif
+
+// The same sizes as the fifobench shell command.
+#define DEPTH	 1024
+#define BLOCK	 256
+#define TOTAL	 (16 * 1024 * 1024)
+#define STREAMED (4 * 1024 * 1024)
+
+// bench_cfifo_base.c
+typedef struct base_cfifo_s base_cfifo_t;
+base_cfifo_t *base_cfifo_new(int32_t n);
+void base_cfifo_delete(base_cfifo_t *fifo);
+int32_t base_cfifo_push(base_cfifo_t *fifo, const char ch);
+int32_t base_cfifo_pop(base_cfifo_t *fifo, char *ch);
+int32_t base_cfifo_pushn(base_cfifo_t *fifo, const char ch[], int32_t n);
+int32_t base_cfifo_popn(base_cfifo_t *fifo, char ch[], int32_t n);
+
+// bench_cfifo_locked.c
+cfifo_t *locked_cfifo_new(int32_t n, cfifo_policy_t policy);
+void locked_cfifo_delete(cfifo_t *fifo);
+int32_t locked_cfifo_push(cfifo_t *fifo, const char ch);
+int32_t locked_cfifo_pop(cfifo_t *fifo, char *ch);
+int32_t locked_cfifo_pushn(cfifo_t *fifo, const char ch[], int32_t n);
+int32_t locked_cfifo_popn(cfifo_t *fifo, char ch[], int32_t n);
+
+/**
+ * One set of calls per build, so that every run below goes through the
+ * same indirection.
+ */
+typedef struct {
+	const char *name;
+	void *(*create)(int32_t n);
+	void (*destroy)(void *fifo);
+	int32_t (*push)(void *fifo, const char ch);
+	int32_t (*pop)(void *fifo, char *ch);
+	int32_t (*pushn)(void *fifo, const char ch[], int32_t n);
+	int32_t (*popn)(void *fifo, char ch[], int32_t n);
+} bench_fifo_t;
+
+#define BENCH_CALLS(tag, prefix, type)                                                       \
+	static void __##tag##_destroy(void *fifo)                                                \
+	{                                                                                        \
+		prefix##cfifo_delete((type *)fifo);                                                  \
+	}                                                                                        \
+	static int32_t __##tag##_push(void *fifo, const char ch)                                 \
+	{                                                                                        \
+		return prefix##cfifo_push((type *)fifo, ch);                                         \
+	}                                                                                        \
+	static int32_t __##tag##_pop(void *fifo, char *ch)                                       \
+	{                                                                                        \
+		return prefix##cfifo_pop((type *)fifo, ch);                                          \
+	}                                                                                        \
+	static int32_t __##tag##_pushn(void *fifo, const char ch[], int32_t n)                   \
+	{                                                                                        \
+		return prefix##cfifo_pushn((type *)fifo, ch, n);                                     \
+	}                                                                                        \
+	static int32_t __##tag##_popn(void *fifo, char ch[], int32_t n)                          \
+	{                                                                                        \
+		return prefix##cfifo_popn((type *)fifo, ch, n);                                      \
+	}
+
+BENCH_CALLS(base, base_, base_cfifo_t)
+BENCH_CALLS(locked, locked_, cfifo_t)
+BENCH_CALLS(spsc, , cfifo_t)
+
+static void *__base_create(int32_t n)
+{
+	return base_cfifo_new(n);
+}
+
+static void *__locked_create(int32_t n)
+{
+	return locked_cfifo_new(n, e_CFIFO_Reject);
+}
+
+static void *__spsc_create(int32_t n)
+{
+	return cfifo_new(n, e_CFIFO_Reject);
+}
+
+#define BENCH_FIFO(tag)                                                                      \
+	{                                                                                        \
+		#tag, __##tag##_create, __##tag##_destroy, __##tag##_push, __##tag##_pop,            \
+			__##tag##_pushn, __##tag##_popn                                                  \
+	}
+
+static const bench_fifo_t pv_fifos[] = {
+	BENCH_FIFO(base),
+	BENCH_FIFO(locked),
+	BENCH_FIFO(spsc),
+};
+
+static int32_t pv_failed = 0;
+
+static void __check(int32_t ok, const char *name, const char *what)
+{
+	printf("%-8s%-32s %s\n", name, what, ok ? "ok" : "FAIL");
+	if (!ok) {
+		pv_failed = 1;
+	}
+}
+
+static uint64_t __now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double __mbps(uint32_t bytes, uint64_t ns)
+{
+	return (ns == 0) ? 0.0 : ((double)bytes * 1000.0) / ((double)ns * 1.048576);
+}
+
+/**
+ * One block in char by char, the same block out, like fifobench.
+ */
+static double __char_run(const bench_fifo_t *bench, void *fifo, uint32_t *errors)
+{
+	char buf[BLOCK];
+	char ch;
+	uint64_t start;
+
+	for (uint32_t i = 0; i < BLOCK; i++) {
+		buf[i] = (char)(i * 7U);
+	}
+	start = __now_ns();
+	for (uint32_t moved = 0; moved < TOTAL; moved += BLOCK) {
+		for (uint32_t i = 0; i < BLOCK; i++) {
+			if (bench->push(fifo, buf[i]) != 0) {
+				(*errors)++;
+			}
+		}
+		for (uint32_t i = 0; i < BLOCK; i++) {
+			if ((bench->pop(fifo, &ch) != 0) || (ch != buf[i])) {
+				(*errors)++;
+			}
+		}
+	}
+	return __mbps(TOTAL, __now_ns() - start);
+}
+
+/**
+ * Blocks through pushn/popn. The offset walks the indexes round the ring
+ * so that the wrapping copies are timed too.
+ */
+static double __block_run(const bench_fifo_t *bench, void *fifo, uint32_t *errors)
+{
+	char in[BLOCK];
+	char out[BLOCK];
+	uint64_t start;
+	uint32_t round = 0;
+
+	for (uint32_t i = 0; i < BLOCK; i++) {
+		in[i] = (char)(i * 13U);
+	}
+	if (bench->pushn(fifo, in, 100) != 100) {
+		(*errors)++;
+	}
+	start = __now_ns();
+	for (uint32_t moved = 0; moved < TOTAL; moved += BLOCK) {
+		in[0] = (char)round++;
+		if (bench->pushn(fifo, in, BLOCK) != BLOCK) {
+			(*errors)++;
+		}
+		if (bench->popn(fifo, out, BLOCK) != BLOCK) {
+			(*errors)++;
+		}
+	}
+	start = __now_ns() - start;
+	if (bench->popn(fifo, out, 100) != 100) {
+		(*errors)++;
+	}
+	// The 100 bytes left behind are the last block pushed, minus its tail.
+	if (memcmp(out, &in[BLOCK - 100], 100) != 0) {
+		(*errors)++;
+	}
+	return __mbps(TOTAL, start);
+}
+
+typedef struct {
+	const bench_fifo_t *bench;
+	void *fifo;
+	uint32_t errors;
+} bench_stream_t;
+
+/**
+ * A byte counter in blocks of varying size, retrying a full fifo.
+ */
+static void *__producer(void *argument)
+{
+	bench_stream_t *stream = (bench_stream_t *)argument;
+	char buf[BLOCK];
+	uint32_t sent = 0;
+	int32_t ret;
+
+	while (sent < STREAMED) {
+		int32_t n = (int32_t)(1U + (sent % BLOCK));
+		if (n > (int32_t)(STREAMED - sent)) {
+			n = (int32_t)(STREAMED - sent);
+		}
+		for (int32_t i = 0; i < n; i++) {
+			buf[i] = (char)(sent + (uint32_t)i);
+		}
+		ret = stream->bench->pushn(stream->fifo, buf, n);
+		if (ret > 0) {
+			sent += (uint32_t)ret;
+		}
+		else if ((ret == -EFIFOFULL) || (ret == 0)) {
+			sched_yield();
+		}
+		else {
+			stream->errors++;
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Two threads, one pushing and one popping, the way a driver ISR and a
+ * reading task share a fifo.
+ */
+static double __stream_run(const bench_fifo_t *bench, void *fifo, uint32_t *errors)
+{
+	bench_stream_t stream = {.bench = bench, .fifo = fifo, .errors = 0};
+	pthread_t producer;
+	char buf[BLOCK];
+	uint32_t received = 0;
+	uint64_t start;
+	int32_t ret;
+
+	start = __now_ns();
+	pthread_create(&producer, NULL, __producer, &stream);
+	while (received < STREAMED) {
+		ret = bench->popn(fifo, buf, BLOCK);
+		if (ret > 0) {
+			for (int32_t i = 0; i < ret; i++) {
+				if (buf[i] != (char)(received + (uint32_t)i)) {
+					(*errors)++;
+				}
+			}
+			received += (uint32_t)ret;
+		}
+		else if ((ret == -EFIFOEMPTY) || (ret == 0)) {
+			sched_yield();
+		}
+		else {
+			(*errors)++;
+			sched_yield();
+		}
+	}
+	pthread_join(producer, NULL);
+	start = __now_ns() - start;
+	*errors += stream.errors;
+	return __mbps(STREAMED, start);
+}
+
+int main(void)
+{
+	double mbps[3][sizeof(pv_fifos) / sizeof(pv_fifos[0])];
+	uint32_t errors;
+
+	for (uint32_t f = 0; f < sizeof(pv_fifos) / sizeof(pv_fifos[0]); f++) {
+		const bench_fifo_t *bench = &pv_fifos[f];
+		void *fifo = bench->create(DEPTH);
+		char ch;
+
+		if (fifo == NULL) {
+			__check(0, bench->name, "create");
+			continue;
+		}
+		errors = 0;
+		mbps[0][f] = __char_run(bench, fifo, &errors);
+		__check(errors == 0, bench->name, "push/pop every char");
+		errors = 0;
+		mbps[1][f] = __block_run(bench, fifo, &errors);
+		__check(errors == 0, bench->name, "pushn/popn every block");
+		errors = 0;
+		mbps[2][f] = __stream_run(bench, fifo, &errors);
+		__check(errors == 0, bench->name, "two thread stream in order");
+		__check(bench->pop(fifo, &ch) == -EFIFOEMPTY, bench->name, "empty at the end");
+		bench->destroy(fifo);
+	}
+
+	printf("\n%-8s%12s%12s%12s  (MB/s)\n", "", "char", "block", "stream");
+	for (uint32_t f = 0; f < sizeof(pv_fifos) / sizeof(pv_fifos[0]); f++) {
+		printf("%-8s%12.1f%12.1f%12.1f\n", pv_fifos[f].name, mbps[0][f], mbps[1][f], mbps[2][f]);
+	}
+	return pv_failed;
+}
@@ -0,0 +1,34 @@
+/**
+ * @file	bench_cfifo_base.c
+ * @brief	The cfifo before the power-of-2 rework, under base_cfifo_ names.
+ * @details	cfifo_base/ holds cfifo.h and cfifo.c exactly as they were
+ * 			before the rework. They are built here with every exported name
+ * 			renamed, so that bench_cfifo.c links them next to the current
+ * 			fifo. See bench_cfifo.c for how to build it.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#define cfifo_new	 base_cfifo_new
+#define cfifo_delete base_cfifo_delete
+#define cfifo_push	 base_cfifo_push
+#define cfifo_pop	 base_cfifo_pop
+#define cfifo_pushn	 base_cfifo_pushn
+#define cfifo_popn	 base_cfifo_popn
+
+// Its "cfifo.h" resolves next to it, not to ../inc.
+#include "cfifo_base/cfifo.c"
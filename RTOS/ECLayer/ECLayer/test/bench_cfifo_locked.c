@@ -0,0 +1,42 @@
+/**
+ * @file	bench_cfifo_locked.c
+ * @brief	The current cfifo built with _CFIFO_LOCKFREE_SPSC 0, under
+ * 			locked_cfifo_ names.
+ * @details	Lets bench_cfifo.c time the locked build next to the lock-free
+ * 			one in a single binary. See bench_cfifo.c for how to build it.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#define _CFIFO_LOCKFREE_SPSC 0
+
+#define cfifo_new			locked_cfifo_new
+#define cfifo_delete		locked_cfifo_delete
+#define cfifo_init			locked_cfifo_init
+#define cfifo_stat_init		locked_cfifo_stat_init
+#define cfifo_push			locked_cfifo_push
+#define cfifo_pop			locked_cfifo_pop
+#define cfifo_pushn			locked_cfifo_pushn
+#define cfifo_popn			locked_cfifo_popn
+#define cfifo_write_reserve locked_cfifo_write_reserve
+#define cfifo_write_commit	locked_cfifo_write_commit
+#define cfifo_write_advance locked_cfifo_write_advance
+#define cfifo_write_guard	locked_cfifo_write_guard
+#define cfifo_read_peek		locked_cfifo_read_peek
+#define cfifo_read_release	locked_cfifo_read_release
+
+#include "../src/cfifo.c"
@@ -0,0 +1,60 @@
+/**
+ * @file	FreeRTOS.h
+ * @brief	Host stand-in for the FreeRTOS types, heap and config ECLayer uses.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE	((BaseType_t)1)
+#define pdPASS	pdTRUE
+#define pdFAIL	pdFALSE
+
+#define portMAX_DELAY				((TickType_t)0xffffffffU)
+#define portYIELD_FROM_ISR(woken)	((void)(woken))
+
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS 4
+
+/**
+ * Counting semaphore on a pthread mutex and condition, behind semaphores,
+ * mutexes and CMSIS-RTOS2 semaphores alike. There is no priority
+ * inheritance, host threads are not prioritised anyway.
+ */
+typedef struct host_sem_s {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t count;
+	uint32_t max;
+	int32_t is_static;
+} StaticSemaphore_t;
+
+void *pvPortMalloc(size_t size);
+
+void vPortFree(void *p);
+
+#endif
@@ -0,0 +1,438 @@
+/**
+ * @file	host_port.c
+ * @brief	Host port of the CMSIS-RTOS2, FreeRTOS and time APIs ECLayer uses,
+ * 			on pthreads. Linked into every host test that needs an RTOS.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "FreeRTOS.h"
+#include "cmsis_os2.h"
+#include "host_port.h"
+#include "semphr.h"
+#include "stm32f4xx.h"
+#include "systime_port.h"
+#include "task.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+_Thread_local uint32_t host_ipsr = 0;
+_Thread_local uint32_t host_exclusive = 0;
+
+DMA_TypeDef host_dma1;
+DMA_TypeDef host_dma2;
+
+typedef struct host_thread_s {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t flags;
+	osThreadFunc_t func;
+	void *argument;
+	void *tls[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+} host_thread_t;
+
+/**
+ * Threads the test did not create with osThreadNew() get their control
+ * block on first use. Control blocks are never freed, a late
+ * osThreadFlagsSet() to a finished thread stays harmless.
+ */
+static _Thread_local host_thread_t *pv_self = NULL;
+
+static pthread_mutex_t pv_time_lock = PTHREAD_MUTEX_INITIALIZER;
+static timeStamp_t pv_time = {0, 0};
+
+static host_thread_t *__thread_new(void)
+{
+	host_thread_t *thread = calloc(1, sizeof(host_thread_t));
+	if (thread != NULL) {
+		pthread_mutex_init(&(thread->lock), NULL);
+		pthread_cond_init(&(thread->cond), NULL);
+	}
+	return thread;
+}
+
+static host_thread_t *__self(void)
+{
+	if (pv_self == NULL) {
+		pv_self = __thread_new();
+	}
+	return pv_self;
+}
+
+/**
+ * Absolute CLOCK_REALTIME deadline ticks (milliseconds) from now, the
+ * clock pthread_cond_timedwait() waits on by default.
+ */
+static void __deadline(struct timespec *ts, uint32_t ticks)
+{
+	clock_gettime(CLOCK_REALTIME, ts);
+	ts->tv_sec += ticks / 1000U;
+	ts->tv_nsec += (long)(ticks % 1000U) * 1000000L;
+	if (ts->tv_nsec >= 1000000000L) {
+		ts->tv_sec++;
+		ts->tv_nsec -= 1000000000L;
+	}
+}
+
+static void __sem_init(struct host_sem_s *sem, uint32_t max, uint32_t initial, int32_t is_static)
+{
+	pthread_mutex_init(&(sem->lock), NULL);
+	pthread_cond_init(&(sem->cond), NULL);
+	sem->count = initial;
+	sem->max = max;
+	sem->is_static = is_static;
+}
+
+static struct host_sem_s *__sem_new(uint32_t max, uint32_t initial, void *cb_mem)
+{
+	struct host_sem_s *sem = cb_mem;
+	if (sem == NULL) {
+		sem = malloc(sizeof(struct host_sem_s));
+		if (sem == NULL) {
+			return NULL;
+		}
+	}
+	__sem_init(sem, max, initial, cb_mem != NULL);
+	return sem;
+}
+
+/**
+ * @retval	0 when taken, -1 on time out.
+ */
+static int32_t __sem_take(struct host_sem_s *sem, uint32_t ticks)
+{
+	struct timespec deadline;
+	int32_t ret = 0;
+	if ((ticks != 0) && (ticks != osWaitForever)) {
+		__deadline(&deadline, ticks);
+	}
+	pthread_mutex_lock(&(sem->lock));
+	while (sem->count == 0) {
+		if (ticks == 0) {
+			ret = -1;
+			break;
+		}
+		else if (ticks == osWaitForever) {
+			pthread_cond_wait(&(sem->cond), &(sem->lock));
+		}
+		else if (pthread_cond_timedwait(&(sem->cond), &(sem->lock), &deadline) == ETIMEDOUT) {
+			ret = (sem->count == 0) ? -1 : 0;
+			break;
+		}
+	}
+	if (ret == 0) {
+		sem->count--;
+	}
+	pthread_mutex_unlock(&(sem->lock));
+	return ret;
+}
+
+/**
+ * @retval	0 when given, -1 when the count is at its maximum already.
+ */
+static int32_t __sem_give(struct host_sem_s *sem)
+{
+	int32_t ret = -1;
+	pthread_mutex_lock(&(sem->lock));
+	if (sem->count < sem->max) {
+		sem->count++;
+		pthread_cond_signal(&(sem->cond));
+		ret = 0;
+	}
+	pthread_mutex_unlock(&(sem->lock));
+	return ret;
+}
+
+static void __sem_delete(struct host_sem_s *sem)
+{
+	pthread_cond_destroy(&(sem->cond));
+	pthread_mutex_destroy(&(sem->lock));
+	if (!sem->is_static) {
+		free(sem);
+	}
+}
+
+void host_set_time(uint64_t sec, uint32_t ns)
+{
+	pthread_mutex_lock(&pv_time_lock);
+	pv_time.ts_sec = sec;
+	pv_time.ts_ns = ns;
+	pthread_mutex_unlock(&pv_time_lock);
+}
+
+void ECTimeStamp(timeStamp_t *ts)
+{
+	pthread_mutex_lock(&pv_time_lock);
+	*ts = pv_time;
+	pthread_mutex_unlock(&pv_time_lock);
+}
+
+void *pvPortMalloc(size_t size)
+{
+	return malloc(size);
+}
+
+void *pvPortCalloc(size_t n, size_t size)
+{
+	return calloc(n, size);
+}
+
+void *pvPortRealloc(void *p, size_t size)
+{
+	return realloc(p, size);
+}
+
+void vPortFree(void *p)
+{
+	free(p);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+	return __sem_new(1, 1, NULL);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+	return __sem_new(1, 0, NULL);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+	return (__sem_take(sem, ticks) == 0) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+	return (__sem_give(sem) == 0) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+	if (woken != NULL) {
+		*woken = pdFALSE;
+	}
+	return xSemaphoreGive(sem);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+	__sem_delete(sem);
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+	return taskSCHEDULER_RUNNING;
+}
+
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void *value)
+{
+	(void)task;
+	__self()->tls[index] = value;
+}
+
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index)
+{
+	(void)task;
+	return __self()->tls[index];
+}
+
+uint32_t osKernelGetTickCount(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000U + (uint64_t)ts.tv_nsec / 1000000U);
+}
+
+uint32_t osKernelGetTickFreq(void)
+{
+	return 1000U;
+}
+
+osStatus_t osDelay(uint32_t ticks)
+{
+	struct timespec ts = {
+		.tv_sec = ticks / 1000U,
+		.tv_nsec = (long)(ticks % 1000U) * 1000000L,
+	};
+	nanosleep(&ts, NULL);
+	return osOK;
+}
+
+osSemaphoreId_t osSemaphoreNew(uint32_t max_count, uint32_t initial_count, const osSemaphoreAttr_t *attr)
+{
+	return __sem_new(max_count, initial_count, (attr != NULL) ? attr->cb_mem : NULL);
+}
+
+osStatus_t osSemaphoreAcquire(osSemaphoreId_t semaphore_id, uint32_t timeout)
+{
+	if (semaphore_id == NULL) {
+		return osErrorParameter;
+	}
+	if (__sem_take(semaphore_id, timeout) != 0) {
+		return (timeout == 0) ? osErrorResource : osErrorTimeout;
+	}
+	return osOK;
+}
+
+osStatus_t osSemaphoreRelease(osSemaphoreId_t semaphore_id)
+{
+	if (semaphore_id == NULL) {
+		return osErrorParameter;
+	}
+	return (__sem_give(semaphore_id) == 0) ? osOK : osErrorResource;
+}
+
+osStatus_t osSemaphoreDelete(osSemaphoreId_t semaphore_id)
+{
+	if (semaphore_id == NULL) {
+		return osErrorParameter;
+	}
+	__sem_delete(semaphore_id);
+	return osOK;
+}
+
+/**
+ * Plain binary semaphores, no recursion and no priority inheritance.
+ */
+osMutexId_t osMutexNew(const osMutexAttr_t *attr)
+{
+	return __sem_new(1, 1, (attr != NULL) ? attr->cb_mem : NULL);
+}
+
+osStatus_t osMutexAcquire(osMutexId_t mutex_id, uint32_t timeout)
+{
+	return osSemaphoreAcquire(mutex_id, timeout);
+}
+
+osStatus_t osMutexRelease(osMutexId_t mutex_id)
+{
+	return osSemaphoreRelease(mutex_id);
+}
+
+osStatus_t osMutexDelete(osMutexId_t mutex_id)
+{
+	return osSemaphoreDelete(mutex_id);
+}
+
+static void *__thread_entry(void *arg)
+{
+	host_thread_t *thread = arg;
+	pv_self = thread;
+	thread->func(thread->argument);
+	return NULL;
+}
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr)
+{
+	pthread_t pthread;
+	host_thread_t *thread;
+	(void)attr;
+	thread = __thread_new();
+	if (thread == NULL) {
+		return NULL;
+	}
+	thread->func = func;
+	thread->argument = argument;
+	if (pthread_create(&pthread, NULL, __thread_entry, thread) != 0) {
+		free(thread);
+		return NULL;
+	}
+	pthread_detach(pthread);
+	return thread;
+}
+
+osThreadId_t osThreadGetId(void)
+{
+	return __self();
+}
+
+void osThreadExit(void)
+{
+	pthread_exit(NULL);
+}
+
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags)
+{
+	host_thread_t *thread = thread_id;
+	uint32_t ret;
+	if ((thread == NULL) || ((flags & osFlagsError) != 0)) {
+		return osFlagsErrorParameter;
+	}
+	pthread_mutex_lock(&(thread->lock));
+	thread->flags |= flags;
+	ret = thread->flags;
+	pthread_cond_broadcast(&(thread->cond));
+	pthread_mutex_unlock(&(thread->lock));
+	return ret;
+}
+
+uint32_t osThreadFlagsClear(uint32_t flags)
+{
+	host_thread_t *thread = __self();
+	uint32_t ret;
+	pthread_mutex_lock(&(thread->lock));
+	ret = thread->flags;
+	thread->flags &= ~flags;
+	pthread_mutex_unlock(&(thread->lock));
+	return ret;
+}
+
+static inline int32_t __flags_ready(host_thread_t *thread, uint32_t flags, uint32_t options)
+{
+	uint32_t got = thread->flags & flags;
+	return (options & osFlagsWaitAll) ? (got == flags) : (got != 0);
+}
+
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout)
+{
+	host_thread_t *thread = __self();
+	struct timespec deadline;
+	uint32_t ret;
+	if ((timeout != 0) && (timeout != osWaitForever)) {
+		__deadline(&deadline, timeout);
+	}
+	pthread_mutex_lock(&(thread->lock));
+	for (;;) {
+		if (__flags_ready(thread, flags, options)) {
+			ret = thread->flags;
+			if ((options & osFlagsNoClear) == 0) {
+				thread->flags &= ~flags;
+			}
+			break;
+		}
+		if (timeout == 0) {
+			ret = osFlagsErrorResource;
+			break;
+		}
+		else if (timeout == osWaitForever) {
+			pthread_cond_wait(&(thread->cond), &(thread->lock));
+		}
+		else if ((pthread_cond_timedwait(&(thread->cond), &(thread->lock), &deadline) == ETIMEDOUT)
+				 && !__flags_ready(thread, flags, options)) {
+			ret = osFlagsErrorTimeout;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&(thread->lock));
+	return ret;
+}
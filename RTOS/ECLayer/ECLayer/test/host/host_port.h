@@ -0,0 +1,38 @@
+/**
+ * @file	host_port.h
+ * @brief	Hooks of the host port that tests drive.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __HOST_PORT_H
+#define __HOST_PORT_H
+
+#include <stdint.h>
+
+/**
+ * __get_IPSR() of the calling thread. A test sets it around a call to
+ * an IRQ handler, so the code under test takes its ISR paths.
+ */
+extern _Thread_local uint32_t host_ipsr;
+
+/**
+ * Time ECTimeStamp() reports until the next call, 0 at start.
+ */
+void host_set_time(uint64_t sec, uint32_t ns);
+
+#endif
@@ -0,0 +1,41 @@
+/**
+ * @file	semphr.h
+ * @brief	Host stand-in for the FreeRTOS semaphore API.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include "FreeRTOS.h"
+
+typedef struct host_sem_s *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks);
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken);
+
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#endif
@@ -0,0 +1,205 @@
+/**
+ * @file	stm32f4xx.h
+ * @brief	Host stand-in for the device and CMSIS-Core headers.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+/**
+ * Only what ECLayer and the STM32 USART driver use. Peripherals are
+ * plain structs a test can inspect and poke, with the register names of
+ * the reference manual. Core intrinsics map to compiler builtins, an
+ * exclusive store succeeds when the word still holds the value loaded
+ * by the matching exclusive load.
+ */
+
+#ifndef __STM32F4xx_H
+#define __STM32F4xx_H
+
+#include "host_port.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define __IO		  volatile
+#define __STATIC_INLINE static inline
+#define __ALIGNED(x)  __attribute__((aligned(x)))
+
+#define SET_BIT(REG, BIT)	((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT) ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)	((REG) & (BIT))
+#define WRITE_REG(REG, VAL) ((REG) = (VAL))
+#define READ_REG(REG)		((REG))
+
+typedef int32_t IRQn_Type;
+
+typedef enum {
+	SUCCESS = 0,
+	ERROR = !SUCCESS
+} ErrorStatus;
+
+typedef struct {
+	__IO uint32_t SR;
+	__IO uint32_t DR;
+	__IO uint32_t BRR;
+	__IO uint32_t CR1;
+	__IO uint32_t CR2;
+	__IO uint32_t CR3;
+	__IO uint32_t GTPR;
+} USART_TypeDef;
+
+#define USART_SR_IDLE	 0x00000010U
+#define USART_SR_RXNE	 0x00000020U
+#define USART_SR_TXE	 0x00000080U
+#define USART_CR1_RE	 0x00000004U
+#define USART_CR1_TE	 0x00000008U
+#define USART_CR1_IDLEIE 0x00000010U
+#define USART_CR1_RXNEIE 0x00000020U
+#define USART_CR1_TXEIE	 0x00000080U
+#define USART_CR1_OVER8	 0x00008000U
+#define USART_CR1_UE	 0x00002000U
+#define USART_CR3_DMAR	 0x00000040U
+#define USART_CR3_DMAT	 0x00000080U
+#define USART_CR3_CTSE	 0x00000200U
+
+#define IS_UART_HWFLOW_INSTANCE(INSTANCE) ((INSTANCE) != NULL)
+
+typedef struct {
+	__IO uint32_t CR;
+	__IO uint32_t NDTR;
+	__IO uint32_t PAR;
+	__IO uint32_t M0AR;
+	__IO uint32_t M1AR;
+	__IO uint32_t FCR;
+} DMA_Stream_TypeDef;
+
+/**
+ * Streams live inside the controller here, on the target they follow it
+ * in the address map.
+ */
+typedef struct {
+	__IO uint32_t LISR;
+	__IO uint32_t HISR;
+	__IO uint32_t LIFCR;
+	__IO uint32_t HIFCR;
+	DMA_Stream_TypeDef stream[8];
+} DMA_TypeDef;
+
+#define DMA_SxCR_EN	   0x00000001U
+#define DMA_SxCR_HTIE  0x00000008U
+#define DMA_SxCR_TCIE  0x00000010U
+#define DMA_SxCR_CIRC  0x00000100U
+#define DMA_SxFCR_DMDIS 0x00000004U
+
+#define DMA_LIFCR_CFEIF0  0x00000001U
+#define DMA_LIFCR_CDMEIF0 0x00000004U
+#define DMA_LIFCR_CTEIF0  0x00000008U
+#define DMA_LIFCR_CHTIF0  0x00000010U
+#define DMA_LIFCR_CTCIF0  0x00000020U
+
+extern DMA_TypeDef host_dma1;
+extern DMA_TypeDef host_dma2;
+#define DMA1 (&host_dma1)
+#define DMA2 (&host_dma2)
+
+typedef struct {
+	__IO uint32_t MODER;
+	__IO uint32_t ODR;
+} GPIO_TypeDef;
+
+static inline uint32_t __get_IPSR(void)
+{
+	return host_ipsr;
+}
+
+static inline void __DMB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void __DSB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void __ISB(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t __CLZ(uint32_t value)
+{
+	return (value == 0U) ? 32U : (uint32_t)__builtin_clz(value);
+}
+
+static inline uint32_t __RBIT(uint32_t value)
+{
+	uint32_t result = 0;
+	for (int32_t i = 0; i < 32; i++) {
+		result = (result << 1) | (value & 1U);
+		value >>= 1;
+	}
+	return result;
+}
+
+extern _Thread_local uint32_t host_exclusive;
+
+static inline uint32_t __LDREXW(volatile uint32_t *addr)
+{
+	host_exclusive = __atomic_load_n(addr, __ATOMIC_SEQ_CST);
+	return host_exclusive;
+}
+
+static inline uint32_t __STREXW(uint32_t value, volatile uint32_t *addr)
+{
+	uint32_t expected = host_exclusive;
+	return __atomic_compare_exchange_n(addr, &expected, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST) ? 0U : 1U;
+}
+
+static inline void __CLREX(void)
+{
+}
+
+static inline void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority)
+{
+	(void)irqn;
+	(void)priority;
+}
+
+static inline uint32_t NVIC_GetPriorityGrouping(void)
+{
+	return 0;
+}
+
+static inline uint32_t NVIC_EncodePriority(uint32_t group, uint32_t preempt, uint32_t sub)
+{
+	(void)group;
+	(void)sub;
+	return preempt;
+}
+
+static inline void NVIC_EnableIRQ(IRQn_Type irqn)
+{
+	(void)irqn;
+}
+
+static inline void NVIC_DisableIRQ(IRQn_Type irqn)
+{
+	(void)irqn;
+}
+
+#endif
@@ -0,0 +1,45 @@
+/**
+ * @file	stm32f4xx_ll_bus.h
+ * @brief	Host stand-in for the bus clock LL driver, clocks are always on.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __STM32F4xx_LL_BUS_H
+#define __STM32F4xx_LL_BUS_H
+
+#include "stm32f4xx.h"
+
+#define LL_AHB1_GRP1_PERIPH_DMA1 0x00200000U
+#define LL_AHB1_GRP1_PERIPH_DMA2 0x00400000U
+
+static inline void LL_AHB1_GRP1_EnableClock(uint32_t Periphs)
+{
+	(void)Periphs;
+}
+
+static inline void LL_APB1_GRP1_EnableClock(uint32_t Periphs)
+{
+	(void)Periphs;
+}
+
+static inline void LL_APB2_GRP1_EnableClock(uint32_t Periphs)
+{
+	(void)Periphs;
+}
+
+#endif
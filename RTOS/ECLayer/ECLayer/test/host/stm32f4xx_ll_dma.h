@@ -0,0 +1,127 @@
+/**
+ * @file	stm32f4xx_ll_dma.h
+ * @brief	Host stand-in for the DMA LL driver, on a plain DMA_TypeDef.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+/**
+ * Addresses are 32 bit registers as on the target, a 64 bit host keeps
+ * the low half of a pointer. Tests find the buffer a stream points at by
+ * comparing those bits, they never dereference M0AR.
+ */
+
+#ifndef __STM32F4xx_LL_DMA_H
+#define __STM32F4xx_LL_DMA_H
+
+#include "stm32f4xx.h"
+
+#define LL_DMA_STREAM_0 0U
+#define LL_DMA_STREAM_1 1U
+#define LL_DMA_STREAM_2 2U
+#define LL_DMA_STREAM_3 3U
+#define LL_DMA_STREAM_4 4U
+#define LL_DMA_STREAM_5 5U
+#define LL_DMA_STREAM_6 6U
+#define LL_DMA_STREAM_7 7U
+
+#define LL_DMA_CHANNEL_0 0x00000000U
+#define LL_DMA_CHANNEL_4 0x08000000U
+#define LL_DMA_CHANNEL_5 0x0A000000U
+
+#define LL_DMA_DIRECTION_PERIPH_TO_MEMORY 0x00000000U
+#define LL_DMA_DIRECTION_MEMORY_TO_PERIPH 0x00000040U
+#define LL_DMA_MODE_NORMAL				  0x00000000U
+#define LL_DMA_MODE_CIRCULAR			  DMA_SxCR_CIRC
+#define LL_DMA_PERIPH_NOINCREMENT		  0x00000000U
+#define LL_DMA_MEMORY_INCREMENT			  0x00000400U
+#define LL_DMA_PDATAALIGN_BYTE			  0x00000000U
+#define LL_DMA_MDATAALIGN_BYTE			  0x00000000U
+#define LL_DMA_PRIORITY_MEDIUM			  0x00010000U
+#define LL_DMA_PRIORITY_HIGH			  0x00020000U
+
+static inline void LL_DMA_EnableStream(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	SET_BIT(DMAx->stream[Stream].CR, DMA_SxCR_EN);
+}
+
+static inline void LL_DMA_DisableStream(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	CLEAR_BIT(DMAx->stream[Stream].CR, DMA_SxCR_EN);
+}
+
+static inline uint32_t LL_DMA_IsEnabledStream(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	return READ_BIT(DMAx->stream[Stream].CR, DMA_SxCR_EN) != 0U;
+}
+
+static inline void LL_DMA_SetChannelSelection(DMA_TypeDef *DMAx, uint32_t Stream, uint32_t Channel)
+{
+	DMAx->stream[Stream].CR = (DMAx->stream[Stream].CR & ~0x0E000000U) | Channel;
+}
+
+static inline void LL_DMA_ConfigTransfer(DMA_TypeDef *DMAx, uint32_t Stream, uint32_t Configuration)
+{
+	DMAx->stream[Stream].CR = (DMAx->stream[Stream].CR & (0x0E000000U | DMA_SxCR_EN | DMA_SxCR_HTIE | DMA_SxCR_TCIE)) | Configuration;
+}
+
+static inline void LL_DMA_DisableFifoMode(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	CLEAR_BIT(DMAx->stream[Stream].FCR, DMA_SxFCR_DMDIS);
+}
+
+static inline void LL_DMA_SetPeriphAddress(DMA_TypeDef *DMAx, uint32_t Stream, uint32_t PeriphAddress)
+{
+	DMAx->stream[Stream].PAR = PeriphAddress;
+}
+
+static inline void LL_DMA_SetMemoryAddress(DMA_TypeDef *DMAx, uint32_t Stream, uint32_t MemoryAddress)
+{
+	DMAx->stream[Stream].M0AR = MemoryAddress;
+}
+
+static inline void LL_DMA_SetDataLength(DMA_TypeDef *DMAx, uint32_t Stream, uint32_t NbData)
+{
+	DMAx->stream[Stream].NDTR = NbData;
+}
+
+static inline uint32_t LL_DMA_GetDataLength(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	return DMAx->stream[Stream].NDTR;
+}
+
+static inline void LL_DMA_EnableIT_HT(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	SET_BIT(DMAx->stream[Stream].CR, DMA_SxCR_HTIE);
+}
+
+static inline void LL_DMA_DisableIT_HT(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	CLEAR_BIT(DMAx->stream[Stream].CR, DMA_SxCR_HTIE);
+}
+
+static inline void LL_DMA_EnableIT_TC(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	SET_BIT(DMAx->stream[Stream].CR, DMA_SxCR_TCIE);
+}
+
+static inline void LL_DMA_DisableIT_TC(DMA_TypeDef *DMAx, uint32_t Stream)
+{
+	CLEAR_BIT(DMAx->stream[Stream].CR, DMA_SxCR_TCIE);
+}
+
+#endif
@@ -0,0 +1,53 @@
+/**
+ * @file	stm32f4xx_ll_gpio.h
+ * @brief	Host stand-in for the GPIO LL driver.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __STM32F4xx_LL_GPIO_H
+#define __STM32F4xx_LL_GPIO_H
+
+#include "stm32f4xx.h"
+
+typedef struct {
+	uint32_t Pin;
+	uint32_t Mode;
+	uint32_t Speed;
+	uint32_t OutputType;
+	uint32_t Pull;
+	uint32_t Alternate;
+} LL_GPIO_InitTypeDef;
+
+static inline ErrorStatus LL_GPIO_Init(GPIO_TypeDef *GPIOx, LL_GPIO_InitTypeDef *init)
+{
+	(void)GPIOx;
+	(void)init;
+	return SUCCESS;
+}
+
+static inline void LL_GPIO_SetOutputPin(GPIO_TypeDef *GPIOx, uint32_t PinMask)
+{
+	SET_BIT(GPIOx->ODR, PinMask);
+}
+
+static inline void LL_GPIO_ResetOutputPin(GPIO_TypeDef *GPIOx, uint32_t PinMask)
+{
+	CLEAR_BIT(GPIOx->ODR, PinMask);
+}
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * @file	stm32f4xx_ll_rcc.h
+ * @brief	Host stand-in for the RCC LL driver, fixed bus clocks.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __STM32F4xx_LL_RCC_H
+#define __STM32F4xx_LL_RCC_H
+
+#include "stm32f4xx.h"
+
+#define LL_RCC_PERIPH_FREQUENCY_NO 0x00000000U
+
+typedef struct {
+	uint32_t SYSCLK_Frequency;
+	uint32_t HCLK_Frequency;
+	uint32_t PCLK1_Frequency;
+	uint32_t PCLK2_Frequency;
+} LL_RCC_ClocksTypeDef;
+
+static inline void LL_RCC_GetSystemClocksFreq(LL_RCC_ClocksTypeDef *RCC_Clocks)
+{
+	RCC_Clocks->SYSCLK_Frequency = 180000000U;
+	RCC_Clocks->HCLK_Frequency = 180000000U;
+	RCC_Clocks->PCLK1_Frequency = 45000000U;
+	RCC_Clocks->PCLK2_Frequency = 90000000U;
+}
+
+#endif
@@ -0,0 +1,204 @@
+/**
+ * @file	stm32f4xx_ll_usart.h
+ * @brief	Host stand-in for the USART LL driver, on a plain USART_TypeDef.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __STM32F4xx_LL_USART_H
+#define __STM32F4xx_LL_USART_H
+
+#include "stm32f4xx.h"
+
+typedef struct {
+	uint32_t BaudRate;
+	uint32_t DataWidth;
+	uint32_t StopBits;
+	uint32_t Parity;
+	uint32_t TransferDirection;
+	uint32_t HardwareFlowControl;
+	uint32_t OverSampling;
+} LL_USART_InitTypeDef;
+
+#define LL_USART_DATAWIDTH_8B	   0x00000000U
+#define LL_USART_STOPBITS_1		   0x00000000U
+#define LL_USART_PARITY_NONE	   0x00000000U
+#define LL_USART_DIRECTION_NONE	   0x00000000U
+#define LL_USART_DIRECTION_RX	   USART_CR1_RE
+#define LL_USART_DIRECTION_TX	   USART_CR1_TE
+#define LL_USART_DIRECTION_TX_RX   (USART_CR1_TE | USART_CR1_RE)
+#define LL_USART_HWCONTROL_NONE	   0x00000000U
+#define LL_USART_OVERSAMPLING_16   0x00000000U
+#define LL_USART_OVERSAMPLING_8	   USART_CR1_OVER8
+
+/**
+ * BRR holds the baud rate itself, the host has no clock to divide.
+ */
+static inline ErrorStatus LL_USART_Init(USART_TypeDef *USARTx, LL_USART_InitTypeDef *init)
+{
+	USARTx->CR1 = init->TransferDirection | init->OverSampling;
+	USARTx->BRR = init->BaudRate;
+	USARTx->SR = USART_SR_TXE;
+	return SUCCESS;
+}
+
+static inline void LL_USART_ConfigAsyncMode(USART_TypeDef *USARTx)
+{
+	(void)USARTx;
+}
+
+static inline void LL_USART_Enable(USART_TypeDef *USARTx)
+{
+	SET_BIT(USARTx->CR1, USART_CR1_UE);
+}
+
+static inline void LL_USART_Disable(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->CR1, USART_CR1_UE);
+}
+
+static inline uint32_t LL_USART_IsEnabled(USART_TypeDef *USARTx)
+{
+	return READ_BIT(USARTx->CR1, USART_CR1_UE) != 0U;
+}
+
+static inline uint32_t LL_USART_GetTransferDirection(USART_TypeDef *USARTx)
+{
+	return READ_BIT(USARTx->CR1, USART_CR1_TE | USART_CR1_RE);
+}
+
+static inline uint32_t LL_USART_GetOverSampling(USART_TypeDef *USARTx)
+{
+	return READ_BIT(USARTx->CR1, USART_CR1_OVER8);
+}
+
+static inline void LL_USART_SetBaudRate(USART_TypeDef *USARTx, uint32_t periphclk, uint32_t oversampling, uint32_t baudrate)
+{
+	(void)periphclk;
+	(void)oversampling;
+	USARTx->BRR = baudrate;
+}
+
+static inline uint32_t LL_USART_GetBaudRate(USART_TypeDef *USARTx, uint32_t periphclk, uint32_t oversampling)
+{
+	(void)periphclk;
+	(void)oversampling;
+	return USARTx->BRR;
+}
+
+static inline void LL_USART_EnableIT_RXNE(USART_TypeDef *USARTx)
+{
+	SET_BIT(USARTx->CR1, USART_CR1_RXNEIE);
+}
+
+static inline void LL_USART_DisableIT_RXNE(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->CR1, USART_CR1_RXNEIE);
+}
+
+static inline void LL_USART_EnableIT_IDLE(USART_TypeDef *USARTx)
+{
+	SET_BIT(USARTx->CR1, USART_CR1_IDLEIE);
+}
+
+static inline void LL_USART_DisableIT_IDLE(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->CR1, USART_CR1_IDLEIE);
+}
+
+static inline uint32_t LL_USART_IsEnabledIT_IDLE(USART_TypeDef *USARTx)
+{
+	return READ_BIT(USARTx->CR1, USART_CR1_IDLEIE) != 0U;
+}
+
+static inline void LL_USART_EnableIT_TXE(USART_TypeDef *USARTx)
+{
+	SET_BIT(USARTx->CR1, USART_CR1_TXEIE);
+}
+
+static inline void LL_USART_DisableIT_TXE(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->CR1, USART_CR1_TXEIE);
+}
+
+static inline uint32_t LL_USART_IsEnabledIT_TXE(USART_TypeDef *USARTx)
+{
+	return READ_BIT(USARTx->CR1, USART_CR1_TXEIE) != 0U;
+}
+
+static inline uint32_t LL_USART_IsActiveFlag_RXNE(USART_TypeDef *USARTx)
+{
+	return READ_BIT(USARTx->SR, USART_SR_RXNE) != 0U;
+}
+
+static inline uint32_t LL_USART_IsActiveFlag_IDLE(USART_TypeDef *USARTx)
+{
+	return READ_BIT(USARTx->SR, USART_SR_IDLE) != 0U;
+}
+
+static inline uint32_t LL_USART_IsActiveFlag_TXE(USART_TypeDef *USARTx)
+{
+	return READ_BIT(USARTx->SR, USART_SR_TXE) != 0U;
+}
+
+static inline void LL_USART_ClearFlag_IDLE(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->SR, USART_SR_IDLE);
+}
+
+static inline uint8_t LL_USART_ReceiveData8(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->SR, USART_SR_RXNE);
+	return (uint8_t)USARTx->DR;
+}
+
+static inline void LL_USART_TransmitData8(USART_TypeDef *USARTx, uint8_t value)
+{
+	USARTx->DR = value;
+}
+
+static inline void LL_USART_EnableDMAReq_RX(USART_TypeDef *USARTx)
+{
+	SET_BIT(USARTx->CR3, USART_CR3_DMAR);
+}
+
+static inline void LL_USART_DisableDMAReq_RX(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->CR3, USART_CR3_DMAR);
+}
+
+static inline void LL_USART_EnableDMAReq_TX(USART_TypeDef *USARTx)
+{
+	SET_BIT(USARTx->CR3, USART_CR3_DMAT);
+}
+
+static inline void LL_USART_DisableDMAReq_TX(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->CR3, USART_CR3_DMAT);
+}
+
+static inline void LL_USART_EnableCTSHWFlowCtrl(USART_TypeDef *USARTx)
+{
+	SET_BIT(USARTx->CR3, USART_CR3_CTSE);
+}
+
+static inline void LL_USART_DisableCTSHWFlowCtrl(USART_TypeDef *USARTx)
+{
+	CLEAR_BIT(USARTx->CR3, USART_CR3_CTSE);
+}
+
+#endif
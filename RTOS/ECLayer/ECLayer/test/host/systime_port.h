@@ -0,0 +1,39 @@
+/**
+ * @file	systime_port.h
+ * @brief	Host port of systime_port.h, time set by the test.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef __SYSTIME_PORT_H
+#define __SYSTIME_PORT_H
+
+#include "host_port.h"
+
+#include <stdint.h>
+
+typedef struct timeStamp_s {
+	uint64_t ts_sec;
+	uint32_t ts_ns;
+} timeStamp_t;
+
+/**
+ * Reports what host_set_time() set last.
+ */
+void ECTimeStamp(timeStamp_t *ts);
+
+#endif
@@ -0,0 +1,42 @@
+/**
+ * @file	task.h
+ * @brief	Host stand-in for the FreeRTOS task API, the scheduler always runs.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+#define taskSCHEDULER_SUSPENDED	  ((BaseType_t)0)
+#define taskSCHEDULER_NOT_STARTED ((BaseType_t)1)
+#define taskSCHEDULER_RUNNING	  ((BaseType_t)2)
+
+BaseType_t xTaskGetSchedulerState(void);
+
+/**
+ * Only the calling task, NULL, is supported.
+ */
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void *value);
+
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index);
+
+#endif
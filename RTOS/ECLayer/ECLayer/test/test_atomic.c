@@ -0,0 +1,180 @@
+/**
+ * @file	test_atomic.c
+ * @brief	Host stress test of the <stdatomic.h> backend of ec_atomic.
+ * @details	Not part of the firmware. Build and run it on Linux from this
+ * 			directory with
+ * 			gcc -std=c11 -O2 -pthread -D_ATOMIC_USE_STDATOMIC=1 -D_EC_HOST_BUILD=1
+ * 				-I../inc test_atomic.c ../src/ec_atomic.c -o test_atomic
+ * 			./test_atomic
+ * 			It exits with 0 when every check passed.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "ec_atomic.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !_ATOMIC_USE_STDATOMIC
+#	error "build with -D_ATOMIC_USE_STDATOMIC=1, see the top of this file"
+#endif
+
+#define THREADS	   8
+#define ITERATIONS 200000
+
+static atomic_t pv_counter;
+static atomic_t pv_ticket;
+static uint8_t pv_seen[THREADS * ITERATIONS];
+static atomic_t pv_lock;
+static atomic_ptr_t pv_owner;
+static atomic_t pv_bits;
+static uint32_t pv_plain;
+static uint32_t pv_plain_ptr;
+static atomic_t pv_bit_errors;
+static int32_t pv_failed = 0;
+
+static void __check(int32_t ok, const char *what)
+{
+	printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok) {
+		pv_failed = 1;
+	}
+}
+
+static void __run(void *(*func)(void *))
+{
+	pthread_t thread[THREADS];
+	for (intptr_t i = 0; i < THREADS; i++) {
+		pthread_create(&thread[i], NULL, func, (void *)i);
+	}
+	for (int32_t i = 0; i < THREADS; i++) {
+		pthread_join(thread[i], NULL);
+	}
+}
+
+static void *__inc_worker(void *argument)
+{
+	(void)argument;
+	for (int32_t i = 0; i < ITERATIONS; i++) {
+		atomic_inc(&pv_counter);
+	}
+	return NULL;
+}
+
+/**
+ * Every old value fetch_add hands out must be unique.
+ */
+static void *__ticket_worker(void *argument)
+{
+	(void)argument;
+	for (int32_t i = 0; i < ITERATIONS; i++) {
+		pv_seen[atomic_fetch_add(&pv_ticket, 1)]++;
+	}
+	return NULL;
+}
+
+/**
+ * Spin lock on atomic_cmpxchg, the barriers must keep the plain counter
+ * inside the critical section.
+ */
+static void *__cas_worker(void *argument)
+{
+	(void)argument;
+	for (int32_t i = 0; i < ITERATIONS; i++) {
+		while (atomic_cmpxchg(&pv_lock, 0, 1) != 0) {
+		}
+		ec_mb();
+		pv_plain++;
+		ec_mb();
+		atomic_set(&pv_lock, 0);
+	}
+	return NULL;
+}
+
+static void *__ptr_worker(void *argument)
+{
+	void *self = &pv_seen[(intptr_t)argument];
+	for (int32_t i = 0; i < ITERATIONS; i++) {
+		while (atomic_ptr_cmpxchg(&pv_owner, NULL, self) != NULL) {
+		}
+		ec_mb();
+		pv_plain_ptr++;
+		ec_mb();
+		if (atomic_ptr_xchg(&pv_owner, NULL) != self) {
+			atomic_inc(&pv_bit_errors);
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Each thread owns one bit, the others flip theirs meanwhile.
+ */
+static void *__bits_worker(void *argument)
+{
+	atomic_t bit = (atomic_t)(1U << (intptr_t)argument);
+	for (int32_t i = 0; i < ITERATIONS; i++) {
+		if ((atomic_fetch_or(&pv_bits, bit) & bit) != 0) {
+			atomic_inc(&pv_bit_errors);
+		}
+		if ((atomic_fetch_and(&pv_bits, ~bit) & bit) == 0) {
+			atomic_inc(&pv_bit_errors);
+		}
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	atomic_t value;
+	uint32_t dup = 0;
+	int dummy;
+
+	// Single threaded semantics first.
+	atomic_set(&value, 1);
+	__check((atomic_dec_and_test(&value) == 0) && (atomic_get(&value) == 0), "atomic_dec_and_test reaching 0");
+	__check(atomic_cmpxchg(&value, 1, 5) == 0 && atomic_get(&value) == 0, "atomic_cmpxchg mismatch leaves value");
+	__check(atomic_cmpxchg(&value, 0, 5) == 0 && atomic_get(&value) == 5, "atomic_cmpxchg match stores value");
+	__check(atomic_xchg(&value, 7) == 5 && atomic_get(&value) == 7, "atomic_xchg");
+	__check(atomic_fetch_add(&value, -2) == 7 && atomic_get(&value) == 5, "atomic_fetch_add negative");
+	atomic_ptr_set(&pv_owner, &dummy);
+	__check(atomic_ptr_get(&pv_owner) == &dummy, "atomic_ptr_set/get");
+	atomic_ptr_set(&pv_owner, NULL);
+
+	__run(__inc_worker);
+	__check(atomic_get(&pv_counter) == THREADS * ITERATIONS, "atomic_inc from threads");
+
+	__run(__ticket_worker);
+	for (uint32_t i = 0; i < THREADS * ITERATIONS; i++) {
+		dup += (pv_seen[i] != 1) ? 1U : 0U;
+	}
+	__check(dup == 0, "atomic_fetch_add tickets unique");
+
+	__run(__cas_worker);
+	__check(pv_plain == THREADS * ITERATIONS, "atomic_cmpxchg spin lock");
+
+	__run(__ptr_worker);
+	__check((pv_plain_ptr == THREADS * ITERATIONS) && (atomic_get(&pv_bit_errors) == 0), "atomic_ptr_cmpxchg/xchg owner");
+
+	__run(__bits_worker);
+	__check((atomic_get(&pv_bit_errors) == 0) && (atomic_get(&pv_bits) == 0), "atomic_fetch_or/and bits");
+
+	return pv_failed;
+}
@@ -0,0 +1,395 @@
+/**
+ * @file	test_fdlist.c
+ * @brief	Host test of the fd bitmap behind alloc_fd() and free_fd(), and
+ * 			of dup2() on top of it.
+ * @details	Not part of the firmware. The default _FD_LIST_MAXNUM fits in
+ * 			one summary word, build it with a table large enough for
+ * 			several, ending in a partial word, on Linux from this directory
+ * 			gcc -std=gnu11 -O2 -pthread -D_ATOMIC_USE_STDATOMIC=1 -D_EC_HOST_BUILD=1
+ * 				-D_FD_LIST_MAXNUM=4100 -Ihost -I../inc -I../../ECDriver/drivers/Inc
+ * 				-I../../../Middlewares/Third_Party/FreeRTOS/Source/CMSIS_RTOS_V2
+ * 				test_fdlist.c host/host_port.c ../src/cfifo.c ../src/ec_api.c
+ * 				../src/ec_atomic.c ../src/ec_dev.c ../src/ec_fdlist.c ../src/ec_file.c
+ * 				../src/ec_list.c ../src/ec_lock.c ../src/ec_pipe.c ../src/ec_poll.c
+ * 				../src/ec_tmpfs.c ../src/ec_vfs.c ../src/heap_port.c -o test_fdlist
+ * 			./test_fdlist
+ * 			It exits with 0 when every check passed, any _FD_LIST_MAXNUM
+ * 			works.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "ec_api.h"
+#include "ec_config.h"
+#include "ec_fdlist.h"
+#include "ec_file.h"
+#include "exceptions.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define RANDOM_OPS 200000
+#define RACE_OPS   200000
+
+static uint8_t pv_used[_FD_LIST_MAXNUM];
+static uint32_t pv_seed = 1;
+static int32_t pv_failed = 0;
+
+static int32_t __yield_write(file_des_t *file_des, const char *data, size_t length);
+
+// write() holds the fd pinned across a yield, the other ops are missing.
+static file_opts_t pv_opts = {
+	.write = __yield_write,
+};
+static file_t *pv_file_a;
+static file_t *pv_file_b;
+static int32_t pv_race_fd;
+static int32_t pv_race_ok;
+static int32_t pv_gate;
+static uint32_t pv_dup2_won;
+static uint32_t pv_open_won;
+
+static void __check(int32_t ok, const char *what)
+{
+	printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok) {
+		pv_failed = 1;
+	}
+}
+
+static uint32_t __random(void)
+{
+	pv_seed = pv_seed * 1103515245U + 12345U;
+	return pv_seed >> 8;
+}
+
+// A distinct description per fd, never dereferenced.
+static file_des_t *__des(int32_t fd)
+{
+	return (file_des_t *)(void *)&pv_used[fd];
+}
+
+static int32_t __lowest_free(void)
+{
+	for (int32_t fd = 0; fd < _FD_LIST_MAXNUM; fd++) {
+		if (pv_used[fd] == 0) {
+			return fd;
+		}
+	}
+	return -EBADF;
+}
+
+static int32_t __alloc(void)
+{
+	int32_t fd = alloc_fd(NULL);
+	if ((fd >= 0) && (fd < _FD_LIST_MAXNUM)) {
+		pv_used[fd] = 1;
+	}
+	return fd;
+}
+
+static int32_t __free(int32_t fd)
+{
+	pv_used[fd] = 0;
+	return free_fd(fd);
+}
+
+/**
+ * Every fd from 0 up, in order, until the table is full.
+ */
+static int32_t __fill(void)
+{
+	int32_t ok = 1;
+	for (int32_t fd = 0; fd < _FD_LIST_MAXNUM; fd++) {
+		if (pv_used[fd] == 0) {
+			ok &= (alloc_fd(__des(fd)) == fd);
+			pv_used[fd] = 1;
+		}
+	}
+	return ok;
+}
+
+static void __race_fail(void)
+{
+	__atomic_store_n(&pv_race_ok, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * States of the gate the main thread holds one write() in flight with.
+ */
+#define GATE_OFF	 0
+#define GATE_ARMED	 1
+#define GATE_INSIDE	 2
+#define GATE_RELEASE 3
+
+static int32_t __gate_get(void)
+{
+	return __atomic_load_n(&pv_gate, __ATOMIC_ACQUIRE);
+}
+
+static void __gate_set(int32_t state)
+{
+	__atomic_store_n(&pv_gate, state, __ATOMIC_RELEASE);
+}
+
+/**
+ * Only pv_race_fd is written. The slot stays bound to the description of
+ * a call in flight, closed or not, neither open() nor dup2() may take it.
+ */
+static int32_t __yield_write(file_des_t *file_des, const char *data, size_t length)
+{
+	(void)data;
+	if (__gate_get() == GATE_ARMED) {
+		__gate_set(GATE_INSIDE);
+		while (__gate_get() != GATE_RELEASE) {
+			sched_yield();
+		}
+	}
+	else {
+		sched_yield();
+	}
+	if (get_fd_struct(pv_race_fd) != file_des) {
+		__race_fail();
+	}
+	return (int32_t)length;
+}
+
+static file_t *__file(const char *name)
+{
+	file_t *file = create_file(name, &pv_opts, NULL);
+	if ((file != NULL) && (file_regist(file) != 0)) {
+		destroy_file(file);
+		file = NULL;
+	}
+	return file;
+}
+
+// dup2(oldfd, pv_race_fd) over and over.
+static void *__race_dup2(void *argument)
+{
+	int32_t oldfd = (int32_t)(intptr_t)argument;
+	int32_t err;
+	for (uint32_t i = 0; i < RACE_OPS; i++) {
+		err = dup2(oldfd, pv_race_fd);
+		if (err == pv_race_fd) {
+			pv_dup2_won++;
+		}
+		else if (err != -EBUSY) {
+			__race_fail();
+		}
+	}
+	return NULL;
+}
+
+// Closes pv_race_fd and opens file b, which lands on it while it is free.
+static void *__race_reopen(void *argument)
+{
+	int32_t fd;
+	int32_t err;
+	(void)argument;
+	for (uint32_t i = 0; i < RACE_OPS; i++) {
+		err = close(pv_race_fd);
+		if ((err != 0) && (err != -EBADF)) {
+			__race_fail();
+		}
+		fd = open("/dup/b", O_RDWR);
+		if (fd == pv_race_fd) {
+			pv_open_won++;
+		}
+		else if ((fd < 0) || (close(fd) != 0)) {
+			__race_fail();
+		}
+	}
+	return NULL;
+}
+
+// Keeps pv_race_fd pinned by calls in flight.
+static void *__race_pin(void *argument)
+{
+	int32_t err;
+	(void)argument;
+	for (uint32_t i = 0; i < RACE_OPS; i++) {
+		err = write(pv_race_fd, "x", 1);
+		if ((err != 1) && (err != -EBADF)) {
+			__race_fail();
+		}
+	}
+	return NULL;
+}
+
+// One write() on pv_race_fd, held inside until the gate is released.
+static void *__gated_write(void *argument)
+{
+	(void)argument;
+	if (write(pv_race_fd, "x", 1) != 1) {
+		__race_fail();
+	}
+	return NULL;
+}
+
+static void __test_dup2(void)
+{
+	pthread_t thread[3];
+	atomic_t refs_a;
+	atomic_t refs_b;
+	int32_t fd_a;
+	int32_t fd_b;
+	int32_t fd_c;
+	int32_t ok;
+
+	pv_file_a = __file("/dup/a");
+	pv_file_b = __file("/dup/b");
+	__check((pv_file_a != NULL) && (pv_file_b != NULL), "register dup2 files");
+	refs_a = pv_file_a->file_refs;
+	refs_b = pv_file_b->file_refs;
+
+	fd_a = open("/dup/a", O_RDWR);
+	fd_b = open("/dup/b", O_RDWR);
+	__check((fd_a == 0) && (fd_b == 1), "open lowest fds");
+	__check(dup2(fd_a, fd_a) == fd_a, "dup2 onto itself");
+
+	// oldfd is checked first, newfd stays bound on any error.
+	fd_c = open("/dup/b", O_RDWR);
+	ok = (fd_c == 2) && (close(fd_c) == 0);
+	ok &= (dup2(-1, fd_b) == -EBADF) && (dup2(fd_c, fd_b) == -EBADF);
+	ok &= (dup2(_FD_LIST_MAXNUM, fd_b) == -EBADF);
+	ok &= (get_fd_struct(fd_b)->file == pv_file_b);
+	__check(ok, "dup2 of a bad oldfd leaves newfd open");
+	ok = (dup2(fd_a, -1) == -EBADF) && (dup2(fd_a, _FD_LIST_MAXNUM) == -EBADF);
+	ok &= (get_fd_struct(fd_a)->file_des_refs == 1);
+	__check(ok, "dup2 to a bad newfd");
+
+	// The description newfd had is dropped, its file reference with it.
+	ok = (dup2(fd_a, fd_b) == fd_b) && (get_fd_struct(fd_b) == get_fd_struct(fd_a));
+	ok &= (get_fd_struct(fd_a)->file_des_refs == 2) && (pv_file_b->file_refs == refs_b);
+	__check(ok, "dup2 over an open newfd");
+	ok = (close(fd_a) == 0) && (get_fd_struct(fd_b)->file == pv_file_a);
+	ok &= (get_fd_struct(fd_b)->file_des_refs == 1) && (pv_file_a->file_refs == refs_a + 1);
+	__check(ok, "newfd outlives a closed oldfd");
+	ok = (close(fd_b) == 0) && (close(fd_b) == -EBADF) && (pv_file_a->file_refs == refs_a);
+	__check(ok, "close the dup2 copy");
+
+	// A call in flight on newfd keeps it, closed or not.
+	fd_a = open("/dup/a", O_RDWR);
+	pv_race_fd = open("/dup/b", O_RDWR);
+	pv_race_ok = 1;
+	__gate_set(GATE_ARMED);
+	pthread_create(&thread[0], NULL, __gated_write, NULL);
+	while (__gate_get() != GATE_INSIDE) {
+		sched_yield();
+	}
+	ok = (dup2(fd_a, pv_race_fd) == -EBUSY) && (get_fd_struct(pv_race_fd)->file == pv_file_b);
+	__check(ok, "dup2 onto a pinned newfd is refused");
+	fd_c = open("/dup/b", O_RDWR);
+	ok = (close(pv_race_fd) == 0) && (fd_c == pv_race_fd + 1) && (close(fd_c) == 0);
+	ok &= (dup2(fd_a, pv_race_fd) == -EBUSY);
+	fd_c = open("/dup/b", O_RDWR);
+	ok &= (fd_c == pv_race_fd + 1) && (close(fd_c) == 0);
+	__check(ok, "closed in flight, nothing takes it");
+	__gate_set(GATE_RELEASE);
+	pthread_join(thread[0], NULL);
+	__gate_set(GATE_OFF);
+	fd_c = open("/dup/b", O_RDWR);
+	ok = pv_race_ok && (fd_c == pv_race_fd) && (close(fd_c) == 0) && (pv_file_b->file_refs == refs_b);
+	__check(ok, "free once the call returned");
+
+	// dup2 onto it while it is closed, reopened and pinned elsewhere.
+	pthread_create(&thread[0], NULL, __race_dup2, (void *)(intptr_t)fd_a);
+	pthread_create(&thread[1], NULL, __race_reopen, NULL);
+	pthread_create(&thread[2], NULL, __race_pin, NULL);
+	for (uint32_t i = 0; i < 3; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	__check(pv_race_ok, "dup2 racing close and open");
+	__check((pv_dup2_won > 0) && (pv_open_won > 0), "both sides won the fd at times");
+	close(pv_race_fd);
+	ok = (get_fd_struct(fd_a)->file_des_refs == 1) && (pv_file_a->file_refs == refs_a + 1);
+	ok &= (pv_file_b->file_refs == refs_b);
+	fd_c = open("/dup/b", O_RDWR);
+	ok &= (fd_c == pv_race_fd) && (close(fd_c) == 0) && (close(fd_a) == 0);
+	ok &= (pv_file_a->file_refs == refs_a);
+	__check(ok, "no description or fd leaked");
+}
+
+int main(void)
+{
+	// Last fd of each summary word, the word after it, and the very last.
+	const int32_t scattered[] = {_FD_LIST_MAXNUM - 1, 1024, 1023, 32, 31, 0};
+	int32_t ok;
+	int32_t fd;
+
+	EC_Layer_Initialize();
+
+	__check(__fill(), "alloc_fd hands out 0..max in order");
+	__check(alloc_fd(NULL) == -EBADF, "alloc_fd on a full table");
+	ok = 1;
+	for (fd = 0; fd < _FD_LIST_MAXNUM; fd++) {
+		ok &= (get_fd_struct(fd) == __des(fd));
+	}
+	__check(ok, "get_fd_struct of every fd");
+	__check((get_fd_struct(-1) == NULL) && (get_fd_struct(_FD_LIST_MAXNUM) == NULL), "get_fd_struct out of range");
+	__check((free_fd(-1) == -EBADF) && (free_fd(_FD_LIST_MAXNUM) == -EBADF), "free_fd out of range");
+
+	// Freed highest first, they must come back lowest first.
+	ok = 1;
+	for (uint32_t i = 0; i < sizeof(scattered) / sizeof(scattered[0]); i++) {
+		if ((scattered[i] < _FD_LIST_MAXNUM) && (pv_used[scattered[i]] != 0)) {
+			ok &= (__free(scattered[i]) == 0);
+		}
+	}
+	while (ok && ((fd = __lowest_free()) >= 0)) {
+		ok &= (__alloc() == fd);
+	}
+	__check(ok && (alloc_fd(NULL) == -EBADF), "scattered fds reused lowest first");
+	__check(get_fd_struct(0) == NULL, "free_fd unbinds the description");
+
+	// A whole word freed in the last summary word clears its full bit.
+	ok = 1;
+	for (fd = (_FD_LIST_MAXNUM - 1) & ~31; fd < _FD_LIST_MAXNUM; fd++) {
+		ok &= (__free(fd) == 0);
+	}
+	for (fd = (_FD_LIST_MAXNUM - 1) & ~31; fd < _FD_LIST_MAXNUM; fd++) {
+		ok &= (__alloc() == fd);
+	}
+	__check(ok && (alloc_fd(NULL) == -EBADF), "last word emptied and refilled");
+
+	// Random churn against a plain array.
+	ok = 1;
+	for (uint32_t i = 0; (i < RANDOM_OPS) && ok; i++) {
+		fd = (int32_t)(__random() % _FD_LIST_MAXNUM);
+		if (pv_used[fd] != 0) {
+			ok &= (__free(fd) == 0);
+		}
+		else {
+			int32_t expect = __lowest_free();
+			ok &= (__alloc() == expect);
+		}
+	}
+	__check(ok, "random alloc_fd/free_fd match a model");
+
+	for (fd = 0; fd < _FD_LIST_MAXNUM; fd++) {
+		if (pv_used[fd] != 0) {
+			__free(fd);
+		}
+	}
+	__check((__alloc() == 0) && (__free(0) == 0), "alloc_fd after freeing everything");
+
+	__test_dup2();
+	return pv_failed;
+}
@@ -0,0 +1,244 @@
+/**
+ * @file	test_rwlock.c
+ * @brief	Host stress test of ec_rwlock_t and the file registry it guards.
+ * @details	Not part of the firmware. Build and run it on Linux from this
+ * 			directory with
+ * 			gcc -std=gnu11 -O2 -pthread -D_ATOMIC_USE_STDATOMIC=1 -D_EC_HOST_BUILD=1
+ * 				-Ihost -I../inc -I../../../Middlewares/Third_Party/FreeRTOS/Source/CMSIS_RTOS_V2
+ * 				test_rwlock.c host/host_port.c ../src/ec_atomic.c ../src/ec_file.c
+ * 				../src/ec_list.c ../src/ec_lock.c ../src/ec_vfs.c ../src/heap_port.c
+ * 				-o test_rwlock
+ * 			./test_rwlock
+ * 			It exits with 0 when every check passed.
+ * @author	Eggcar
+*/
+
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "ec_atomic.h"
+#include "ec_file.h"
+#include "ec_lock.h"
+#include "ec_vfs.h"
+#include "exceptions.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define READERS	   6
+#define CHURNERS   2
+#define STABLE	   32
+#define CHURN	   16
+#define ROUNDS	   2000
+#define ITERATIONS 100000
+
+static ec_rwlock_t pv_lock = EC_RWLOCK_INIT;
+static uint32_t pv_pair[2];
+static atomic_t pv_run;
+static atomic_t pv_torn;
+static atomic_t pv_lookups;
+static atomic_t pv_misses;
+static atomic_t pv_wrong;
+static atomic_t pv_churn_errors;
+static int32_t pv_failed = 0;
+
+static void __check(int32_t ok, const char *what)
+{
+	printf("%-44s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok) {
+		pv_failed = 1;
+	}
+}
+
+static void __run(void *(*reader)(void *), void *(*writer)(void *), int32_t writers)
+{
+	pthread_t thread[READERS + CHURNERS];
+	atomic_set(&pv_run, 1);
+	for (intptr_t i = 0; i < READERS; i++) {
+		pthread_create(&thread[i], NULL, reader, (void *)i);
+	}
+	for (intptr_t i = 0; i < writers; i++) {
+		pthread_create(&thread[READERS + i], NULL, writer, (void *)i);
+	}
+	// Writers end the run, readers stop once it is over.
+	for (int32_t i = 0; i < writers; i++) {
+		pthread_join(thread[READERS + i], NULL);
+	}
+	atomic_set(&pv_run, 0);
+	for (int32_t i = 0; i < READERS; i++) {
+		pthread_join(thread[i], NULL);
+	}
+}
+
+/**
+ * The writer keeps both halves of the pair equal, a reader must never
+ * see them differ. Both yield half way, so the other side gets to run
+ * inside the critical section even on a single core.
+ */
+static void *__pair_reader(void *argument)
+{
+	uint32_t first;
+	uint32_t second;
+	(void)argument;
+	while (atomic_get(&pv_run) != 0) {
+		if (ec_read_lock(&pv_lock) != 0) {
+			atomic_inc(&pv_torn);
+			continue;
+		}
+		first = *(volatile uint32_t *)&pv_pair[0];
+		sched_yield();
+		second = *(volatile uint32_t *)&pv_pair[1];
+		ec_read_unlock(&pv_lock);
+		if (first != second) {
+			atomic_inc(&pv_torn);
+		}
+	}
+	return NULL;
+}
+
+static void *__pair_writer(void *argument)
+{
+	(void)argument;
+	for (int32_t i = 0; i < ITERATIONS; i++) {
+		if (ec_write_lock(&pv_lock) != 0) {
+			atomic_inc(&pv_torn);
+			continue;
+		}
+		*(volatile uint32_t *)&pv_pair[0] += 1;
+		sched_yield();
+		*(volatile uint32_t *)&pv_pair[1] += 1;
+		ec_write_unlock(&pv_lock);
+	}
+	return NULL;
+}
+
+static void __name(char name[16], char kind, uint32_t i)
+{
+	snprintf(name, 16, "/rw/%c%u", kind, (unsigned int)i);
+}
+
+/**
+ * Stable names are registered for the whole run, every lookup of them
+ * must hit the right file however the churn reshapes the buckets.
+ */
+static void *__lookup_reader(void *argument)
+{
+	char name[16];
+	uint32_t i = (uint32_t)(intptr_t)argument;
+	int32_t lookups = 0;
+	int32_t misses = 0;
+	int32_t wrong = 0;
+	file_t *file;
+
+	while (atomic_get(&pv_run) != 0) {
+		__name(name, 's', i++ % STABLE);
+		file = search_file(name);
+		if (file == NULL) {
+			misses++;
+		}
+		else {
+			wrong += (strcmp(file->file_name, name) != 0) ? 1 : 0;
+			put_file(file);
+		}
+		// Churned names come and go, they only load the lock.
+		__name(name, (char)('a' + i % CHURNERS), i % CHURN);
+		put_file(search_file(name));
+		lookups++;
+	}
+	atomic_add(&pv_lookups, lookups);
+	atomic_add(&pv_misses, misses);
+	atomic_add(&pv_wrong, wrong);
+	return NULL;
+}
+
+static void *__churn_writer(void *argument)
+{
+	char name[16];
+	char kind = (char)('a' + (intptr_t)argument);
+	int32_t errors = 0;
+	int32_t err;
+	file_t *file;
+
+	for (int32_t r = 0; r < ROUNDS; r++) {
+		for (uint32_t i = 0; i < CHURN; i++) {
+			__name(name, kind, i);
+			file = create_file(name, NULL, NULL);
+			if ((file == NULL) || (file_regist(file) != 0)) {
+				destroy_file(file);
+				errors++;
+			}
+		}
+		for (uint32_t i = 0; i < CHURN; i++) {
+			__name(name, kind, i);
+			file = search_file(name);
+			put_file(file);
+			err = (file == NULL) ? -ENOENT : delete_file(file);
+			while (err == -EBUSY) {
+				// A reader holds it for the length of one lookup.
+				sched_yield();
+				err = delete_file(file);
+			}
+			errors += (err != 0) ? 1 : 0;
+		}
+	}
+	atomic_add(&pv_churn_errors, errors);
+	return NULL;
+}
+
+int main(void)
+{
+	char name[16];
+	file_t *file;
+	int32_t errors = 0;
+
+	__check(ec_rwlock_init(&pv_lock) == 0, "ec_rwlock_init");
+	__run(__pair_reader, __pair_writer, 1);
+	__check((atomic_get(&pv_torn) == 0) && (pv_pair[0] == ITERATIONS) && (pv_pair[1] == ITERATIONS),
+			"readers never see a write half done");
+
+	file_list_init();
+	vfs_init();
+	for (uint32_t i = 0; i < STABLE; i++) {
+		__name(name, 's', i);
+		file = create_file(name, NULL, NULL);
+		if ((file == NULL) || (file_regist(file) != 0)) {
+			errors++;
+		}
+	}
+	__check(errors == 0, "stable files registered");
+	__run(__lookup_reader, __churn_writer, CHURNERS);
+	printf("%ld lookups\n", (long)atomic_get(&pv_lookups));
+	__check(atomic_get(&pv_churn_errors) == 0, "churn registers and deletes cleanly");
+	__check((atomic_get(&pv_misses) == 0) && (atomic_get(&pv_wrong) == 0), "stable names never missed");
+
+	errors = 0;
+	for (uint32_t i = 0; i < STABLE; i++) {
+		__name(name, 's', i);
+		file = search_file(name);
+		put_file(file);
+		errors += ((file == NULL) || (atomic_get(&(file->file_refs)) != 0) || (delete_file(file) != 0)) ? 1 : 0;
+	}
+	for (uint32_t i = 0; i < CHURN * CHURNERS; i++) {
+		__name(name, (char)('a' + i / CHURN), i % CHURN);
+		errors += (search_file(name) != NULL) ? 1 : 0;
+	}
+	__check(errors == 0, "no references leaked, no churned file left");
+
+	return pv_failed;
+}
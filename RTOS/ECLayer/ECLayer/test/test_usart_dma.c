@@ -0,0 +1,357 @@
+/**
+ * @file	test_usart_dma.c
+ * @brief	Host test of the STM32 USART driver's RX and TX DMA paths,
+ * 			against a fake USART and DMA streams.
+ * @details	Not part of the firmware. Build and run it on Linux from this
+ * 			directory with
+ * 			gcc -std=gnu11 -O2 -pthread -no-pie -D_ATOMIC_USE_STDATOMIC=1 -D_EC_HOST_BUILD=1
+ * 				-Ihost -I../inc -I../../ECDriver/drivers/Inc
+ * 				-I../../../Middlewares/Third_Party/FreeRTOS/Source/CMSIS_RTOS_V2
+ * 				test_usart_dma.c host/host_port.c ../../ECDriver/drivers/Src/ec_drv_stm32_usart.c
+ * 				../src/cfifo.c ../src/ec_atomic.c ../src/ec_lock.c ../src/ec_poll.c ../src/heap_port.c
+ * 				-o test_usart_dma
+ * 			./test_usart_dma
+ * 			Add -D_CFIFO_LOCKFREE_SPSC=0 to run it on the locked fifo as well.
+ * 			The driver passes addresses as 32 bit values, -no-pie keeps the
+ * 			static data handed to it below 4 GiB. It exits with 0 when
+ * 			every check passed.
+ * @author	Eggcar
+*/
+
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "cfifo.h"
+#include "ec_dev.h"
+#include "ec_drv_stm32_usart.h"
+#include "ec_fcntl.h"
+#include "ec_file.h"
+#include "host_port.h"
+#include "ioctl_cmd.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if !_EN_USART_STATIC_BUFFER || !_EN_USART_TIMESTAMP
+#	error "the test expects the default _EN_USART_STATIC_BUFFER and _EN_USART_TIMESTAMP"
+#endif
+
+#define RX_DEPTH  64
+#define RX_STREAM LL_DMA_STREAM_1
+#define TX_DEPTH  64
+#define TX_STREAM LL_DMA_STREAM_3
+#define STREAM	  256
+
+static CFIFO_STORAGE(pv_rx_storage, RX_DEPTH);
+static CFIFO_STORAGE(pv_tx_storage, TX_DEPTH);
+static USART_TypeDef pv_usart;
+static GPIO_TypeDef pv_gpio;
+static LL_GPIO_InitTypeDef pv_pin;
+static LL_USART_InitTypeDef pv_usart_conf = {
+	.BaudRate = 115200,
+	.DataWidth = LL_USART_DATAWIDTH_8B,
+	.StopBits = LL_USART_STOPBITS_1,
+	.Parity = LL_USART_PARITY_NONE,
+	.TransferDirection = LL_USART_DIRECTION_TX_RX,
+	.HardwareFlowControl = LL_USART_HWCONTROL_NONE,
+	.OverSampling = LL_USART_OVERSAMPLING_16,
+};
+
+static config_stm32_usart_t pv_config = {
+	.clock_bus = USART_Bus_APB1,
+	.rx_buffer_size = RX_DEPTH,
+	.tx_buffer_size = TX_DEPTH,
+	.rx_pin_conf = &pv_pin,
+	.tx_pin_conf = &pv_pin,
+	.rx_io_port = &pv_gpio,
+	.tx_io_port = &pv_gpio,
+	.usart_conf = &pv_usart_conf,
+	.rx_dma = DMA1,
+	.rx_dma_stream = RX_STREAM,
+	.rx_dma_channel = LL_DMA_CHANNEL_4,
+	.tx_dma = DMA1,
+	.tx_dma_stream = TX_STREAM,
+	.tx_dma_channel = LL_DMA_CHANNEL_4,
+	.rx_fifo_storage = pv_rx_storage,
+	.tx_fifo_storage = pv_tx_storage,
+	.rx_ts_chunk = 0,
+};
+
+static dev_stm32_usart_t pv_usart_dev = {
+	.handle = &pv_usart,
+	.config = &pv_config,
+};
+
+static ec_dev_t pv_dev = {
+	.dev_name = "ttyS0",
+	.private_data = &pv_usart_dev,
+};
+
+static file_t pv_file = {
+	.file_content = &pv_dev,
+};
+
+static file_des_t pv_fd = {
+	.file_flags = O_RDWR | O_NOBLOCK,
+	.file = &pv_file,
+};
+
+// Everything the line carried, in order, and how much of it the fake DMA
+// has written so far.
+static char pv_stream[STREAM];
+static uint32_t pv_sent = 0;
+static uint32_t pv_received = 0;
+
+// ioctl arguments go through the driver as 32 bit addresses.
+static char pv_data[RX_DEPTH];
+static usart_rx_mark_t pv_marks[4];
+static usart_ts_read_t pv_req;
+static uint32_t pv_drops;
+
+// What the TX DMA put on the line.
+static char pv_wire[STREAM];
+static uint32_t pv_wired = 0;
+
+static int32_t pv_failed = 0;
+
+static void __check(int32_t ok, const char *what)
+{
+	printf("%-52s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok) {
+		pv_failed = 1;
+	}
+}
+
+/**
+ * The DMA moves n chars of the stream from DR into the buffer M0AR points
+ * at, counting NDTR down and reloading it in circular mode. No interrupt
+ * is raised here, the test fires HT/TC/IDLE where it wants them, late
+ * ones included.
+ */
+static void __line_rx(uint32_t n)
+{
+	DMA_Stream_TypeDef *stream = &(DMA1->stream[RX_STREAM]);
+	char *buffer = pv_usart_dev.rx_buffer->fifo;
+	for (uint32_t i = 0; i < n; i++) {
+		buffer[RX_DEPTH - stream->NDTR] = pv_stream[pv_sent++];
+		if (--(stream->NDTR) == 0) {
+			stream->NDTR = RX_DEPTH;
+		}
+	}
+}
+
+static void __irq_rxdma(void)
+{
+	host_ipsr = 1;
+	ECDRV_IRQ_Handler_USART_RXDMA(&pv_dev);
+	host_ipsr = 0;
+}
+
+static void __irq_idle(void)
+{
+	SET_BIT(pv_usart.SR, USART_SR_IDLE);
+	host_ipsr = 1;
+	ECDRV_IRQ_Handler_USART(&pv_dev);
+	host_ipsr = 0;
+}
+
+/**
+ * CMD_USART_READTS of everything buffered. The chars must be the latest
+ * ones the line carried, every older one counted as dropped.
+ */
+static int32_t __read_ts(void)
+{
+	int32_t n;
+	memset(&pv_req, 0, sizeof(pv_req));
+	pv_req.data = pv_data;
+	pv_req.size = sizeof(pv_data);
+	pv_req.marks = pv_marks;
+	pv_req.nmarks = sizeof(pv_marks) / sizeof(pv_marks[0]);
+	n = stm32_usart_ioctl(&pv_fd, CMD_USART_READTS, (uint64_t)(uintptr_t)&pv_req);
+	if (n > 0) {
+		stm32_usart_ioctl(&pv_fd, CMD_USART_GETRXDROPS, (uint64_t)(uintptr_t)&pv_drops);
+		pv_received += (uint32_t)n;
+		if ((pv_received + pv_drops != pv_sent) || (memcmp(pv_data, &pv_stream[pv_sent - (uint32_t)n], (size_t)n) != 0)) {
+			return -1;
+		}
+	}
+	return n;
+}
+
+/**
+ * The TX DMA sends NDTR chars from M0AR and stops, normal mode clears EN,
+ * then its TC interrupt comes. M0AR holds the low 32 bits of a pointer
+ * into the TX fifo buffer.
+ */
+static uint32_t __line_tx(void)
+{
+	DMA_Stream_TypeDef *stream = &(DMA1->stream[TX_STREAM]);
+	const char *buffer = pv_usart_dev.tx_buffer->fifo;
+	uint32_t offset = stream->M0AR - (uint32_t)(uintptr_t)buffer;
+	uint32_t n = stream->NDTR;
+
+	if (!(stream->CR & DMA_SxCR_EN) || (offset + n > TX_DEPTH)) {
+		return 0;
+	}
+	memcpy(&pv_wire[pv_wired], &buffer[offset], n);
+	pv_wired += n;
+	stream->NDTR = 0;
+	CLEAR_BIT(stream->CR, DMA_SxCR_EN);
+	host_ipsr = 1;
+	ECDRV_IRQ_Handler_USART_TXDMA(&pv_dev);
+	host_ipsr = 0;
+	return n;
+}
+
+/**
+ * Transfer in flight: n chars starting at offset of the TX fifo buffer.
+ */
+static int32_t __tx_in_flight(uint32_t offset, uint32_t n)
+{
+	DMA_Stream_TypeDef *stream = &(DMA1->stream[TX_STREAM]);
+	return (stream->CR & DMA_SxCR_EN) && (stream->NDTR == n) && (pv_usart_dev.tx_dma_len == n) &&
+		   (stream->M0AR == (uint32_t)(uintptr_t)&(pv_usart_dev.tx_buffer->fifo[offset]));
+}
+
+static int32_t __mark_is(uint32_t i, uint32_t offset, uint64_t sec)
+{
+	return (pv_marks[i].offset == offset) && (pv_marks[i].ts.ts_sec == sec) && (pv_marks[i].ts.ts_ns == (uint32_t)sec * 100U);
+}
+
+static void __test_rx(void)
+{
+	DMA_Stream_TypeDef *stream = &(DMA1->stream[RX_STREAM]);
+	cfifo_t *fifo;
+
+	__check(stm32_usart_open(&pv_fd, "ttyS0", pv_fd.file_flags) == 0, "open");
+	fifo = pv_usart_dev.rx_buffer;
+	__check((stream->M0AR == (uint32_t)(uintptr_t)fifo->fifo) && (stream->NDTR == RX_DEPTH) &&
+				(stream->CR & DMA_SxCR_EN) && (stream->CR & DMA_SxCR_CIRC) &&
+				(stream->CR & DMA_SxCR_HTIE) && (stream->CR & DMA_SxCR_TCIE) && (pv_usart.CR3 & USART_CR3_DMAR),
+			"RX DMA circular on the fifo buffer");
+	__check(LL_USART_IsEnabledIT_IDLE(&pv_usart) && !(pv_usart.CR1 & USART_CR1_RXNEIE), "IDLE on, RXNE off");
+
+	// Short burst, only the idle line publishes it.
+	host_set_time(1, 100);
+	__line_rx(10);
+	__check(cfifo_used(fifo) == 0, "nothing published before an interrupt");
+	__irq_idle();
+	__check((__read_ts() == 10) && (pv_drops == 0), "IDLE publishes a short burst");
+	__check((pv_req.marks_len == 1) && __mark_is(0, 0, 1), "mark at the start of the burst");
+
+	// 22 up to HT, 20 more up to IDLE, 12 more wrapping at TC. The
+	// fifo keeps the half the DMA writes next free, the oldest 22 go.
+	host_set_time(2, 200);
+	__line_rx(22);
+	__irq_rxdma();
+	__check(cfifo_used(fifo) == 22, "HT publishes the first half");
+	host_set_time(3, 300);
+	__line_rx(20);
+	__irq_idle();
+	host_set_time(4, 400);
+	__line_rx(12);
+	__irq_rxdma();
+	__check((stream->NDTR == RX_DEPTH) && (fifo->tail == 64), "TC at the wrap");
+	stm32_usart_ioctl(&pv_fd, CMD_USART_GETRXDROPS, (uint64_t)(uintptr_t)&pv_drops);
+	__check((cfifo_used(fifo) == RX_DEPTH / 2) && (pv_drops == 22), "half of the fifo kept free for the DMA");
+	__irq_idle();
+
+	// HT missed, the DMA runs 8 chars into unread data before the late
+	// interrupt. Those 8 and the 24 behind them are dropped, nothing
+	// stale is read back.
+	host_set_time(5, 500);
+	__line_rx(40);
+	__irq_rxdma();
+	stm32_usart_ioctl(&pv_fd, CMD_USART_GETRXDROPS, (uint64_t)(uintptr_t)&pv_drops);
+	__check((cfifo_used(fifo) == 40) && (pv_drops == 22 + 8 + 24), "late HT drops what the DMA overran");
+	__check(__read_ts() == 40, "only the chars after the overrun are read");
+	__check((pv_req.marks_len == 1) && __mark_is(0, 0, 5), "overrun burst keeps its own mark");
+
+	// Next burst, TC and HT in a row on the second lap, read in between.
+	__irq_idle();
+	host_set_time(6, 600);
+	__line_rx(24);
+	__irq_rxdma();
+	__check((__read_ts() == 24) && (pv_req.marks_len == 1) && __mark_is(0, 0, 6), "TC publishes the second half");
+	__line_rx(32);
+	__irq_rxdma();
+	__check((__read_ts() == 32) && (pv_drops == 54), "HT on the next lap, no drops");
+	__check((pv_req.marks_len == 1) && __mark_is(0, 0, 6), "mark carried over to the rest of the burst");
+
+	// The DMA takes no push lock, so it must not release one it never took.
+	fifo->pushlock = e_Locked;
+	__line_rx(8);
+	__irq_idle();
+	__check((fifo->pushlock == e_Locked) && (cfifo_used(fifo) == 8), "publish leaves the push lock alone");
+	fifo->pushlock = e_Unlocked;
+	__check(__read_ts() == 8, "published chars read");
+
+	__check(stm32_usart_close(&pv_fd) == 0, "close");
+	__check(!(stream->CR & DMA_SxCR_EN) && !(pv_usart.CR3 & USART_CR3_DMAR), "RX DMA stopped on close");
+}
+
+static void __test_tx(void)
+{
+	DMA_Stream_TypeDef *stream = &(DMA1->stream[TX_STREAM]);
+	cfifo_t *fifo;
+
+	__check(stm32_usart_open(&pv_fd, "ttyS0", pv_fd.file_flags) == 0, "open");
+	fifo = pv_usart_dev.tx_buffer;
+	__check(!(stream->CR & DMA_SxCR_EN) && (stream->CR & DMA_SxCR_TCIE) && !(stream->CR & DMA_SxCR_CIRC) &&
+				(pv_usart.CR3 & USART_CR3_DMAT) && !(pv_usart.CR1 & USART_CR1_TXEIE),
+			"TX DMA idle, TXE interrupt off");
+
+	// The first write launches, the second one queues behind it.
+	__check(stm32_usart_write(&pv_fd, pv_stream, 40) == 40, "write 40");
+	__check(__tx_in_flight(0, 40) && (cfifo_used(fifo) == 40), "launched from the fifo head");
+	__check(stm32_usart_write(&pv_fd, &pv_stream[40], 20) == 20, "write 20 while in flight");
+	__check(__tx_in_flight(0, 40) && (cfifo_used(fifo) == 60), "no second launch while in flight");
+
+	// TC releases exactly the sent span and chains the queued one.
+	__check(__line_tx() == 40, "first transfer sent");
+	__check((cfifo_used(fifo) == 20) && __tx_in_flight(40, 20), "TC releases 40, chains 20");
+	__check(__line_tx() == 20, "second transfer sent");
+	__check((cfifo_used(fifo) == 0) && (pv_usart_dev.tx_dma_len == 0) && !(stream->CR & DMA_SxCR_EN), "TC on an empty fifo stops");
+
+	// 30 chars from offset 60 wrap: span[0] of 4, span[1] of 26 goes
+	// by a second launch from the TC interrupt.
+	__check(stm32_usart_write(&pv_fd, &pv_stream[60], 30) == 30, "write 30 across the wrap");
+	__check(__tx_in_flight(60, 4) && (cfifo_used(fifo) == 30), "first span up to the end of the buffer");
+	__check(__line_tx() == 4, "first span sent");
+	__check((cfifo_used(fifo) == 26) && __tx_in_flight(0, 26), "TC releases 4, launches the wrapped span");
+	__check(__line_tx() == 26, "wrapped span sent");
+	__check((cfifo_used(fifo) == 0) && !(stream->CR & DMA_SxCR_EN), "everything released");
+
+	// A full fifo takes no more without blocking, the rest is sent later.
+	__check(stm32_usart_write(&pv_fd, &pv_stream[90], 100) == TX_DEPTH, "O_NOBLOCK write stops at a full fifo");
+	while (__line_tx() > 0) {
+	}
+	__check((pv_wired == 90 + TX_DEPTH) && (memcmp(pv_wire, pv_stream, pv_wired) == 0), "line carried every char in order");
+
+	__check(stm32_usart_close(&pv_fd) == 0, "close");
+	__check(!(stream->CR & DMA_SxCR_EN) && !(pv_usart.CR3 & USART_CR3_DMAT), "TX DMA stopped on close");
+}
+
+int main(void)
+{
+	for (uint32_t i = 0; i < STREAM; i++) {
+		pv_stream[i] = (char)(i * 7U + 1U);
+	}
+	__test_rx();
+	__test_tx();
+	return pv_failed;
+}
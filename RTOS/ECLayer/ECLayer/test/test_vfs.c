@@ -0,0 +1,140 @@
+/**
+ * @file	test_vfs.c
+ * @brief	Host test of the path trie behind file_regist(), opendir() and
+ * 			readdir().
+ * @details	Not part of the firmware. Build and run it on Linux from this
+ * 			directory with
+ * 			gcc -std=gnu11 -O2 -pthread -D_ATOMIC_USE_STDATOMIC=1 -D_EC_HOST_BUILD=1
+ * 				-Ihost -I../inc -I../../../Middlewares/Third_Party/FreeRTOS/Source/CMSIS_RTOS_V2
+ * 				test_vfs.c host/host_port.c ../src/ec_atomic.c ../src/ec_file.c
+ * 				../src/ec_list.c ../src/ec_lock.c ../src/ec_vfs.c ../src/heap_port.c
+ * 				-o test_vfs
+ * 			./test_vfs
+ * 			It exits with 0 when every check passed.
+ * @author	Eggcar
+*/
+
+/**
+ * Copyright EggCar(eggcar@qq.com)
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ * 	http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+
+#include "ec_file.h"
+#include "ec_vfs.h"
+#include "exceptions.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Far more directories than a static pool would hold.
+#define CLASSES 96
+#define FILES	4
+
+static file_t *pv_files[CLASSES][FILES];
+static ec_dir_t *pv_dirs[UINT8_MAX];
+static int32_t pv_failed = 0;
+
+static void __check(int32_t ok, const char *what)
+{
+	printf("%-44s %s\n", what, ok ? "ok" : "FAIL");
+	if (!ok) {
+		pv_failed = 1;
+	}
+}
+
+static void __name(char *name, uint32_t cls, uint32_t n)
+{
+	snprintf(name, _FILE_NAME_MAXLEN + 1, "/dev/c%u/f%u", (unsigned)cls, (unsigned)n);
+}
+
+static uint32_t __count(const char *path)
+{
+	ec_dir_t *dir = opendir(path);
+	uint32_t count = 0;
+	if (dir == NULL) {
+		return 0;
+	}
+	while (readdir(dir) != NULL) {
+		count++;
+	}
+	closedir(dir);
+	return count;
+}
+
+int main(void)
+{
+	char name[_FILE_NAME_MAXLEN + 1];
+	file_t *file;
+	int32_t ok;
+
+	file_list_init();
+	vfs_init();
+
+	ok = 1;
+	for (uint32_t c = 0; c < CLASSES; c++) {
+		for (uint32_t n = 0; n < FILES; n++) {
+			__name(name, c, n);
+			pv_files[c][n] = create_file(name, NULL, NULL);
+			ok &= (pv_files[c][n] != NULL) && (file_regist(pv_files[c][n]) == 0);
+		}
+	}
+	__check(ok, "register files in many directories");
+	__check(__count("/dev") == CLASSES, "readdir lists every directory");
+	__check(__count("/dev/c42") == FILES, "readdir lists every file");
+
+	ok = 1;
+	for (uint32_t c = 0; c < CLASSES; c++) {
+		for (uint32_t n = 0; n < FILES; n++) {
+			__name(name, c, n);
+			file = search_file(name);
+			ok &= (file == pv_files[c][n]);
+			put_file(file);
+		}
+	}
+	__check(ok, "search_file finds every file");
+
+	ok = 1;
+	for (uint32_t c = 0; c < CLASSES; c++) {
+		for (uint32_t n = 0; n < FILES; n++) {
+			ok &= (delete_file(pv_files[c][n]) == 0);
+		}
+	}
+	__check(ok, "delete every file");
+	__check(opendir("/dev") == NULL, "empty directories are pruned");
+
+	// The slab takes the pruned directories back for the next round.
+	ok = 1;
+	for (uint32_t c = 0; c < CLASSES; c++) {
+		__name(name, c, 0);
+		file = create_file(name, NULL, NULL);
+		ok &= (file != NULL) && (file_regist(file) == 0) && (delete_file(file) == 0);
+	}
+	__check(ok, "directories recreated after pruning");
+
+	// d_refs is 8 bits, the handle past its limit must be refused.
+	file = create_file("/dev/held/f", NULL, NULL);
+	ok = (file != NULL) && (file_regist(file) == 0);
+	for (uint32_t i = 0; i < UINT8_MAX; i++) {
+		pv_dirs[i] = opendir("/dev/held");
+		ok &= (pv_dirs[i] != NULL);
+	}
+	__check(ok && (opendir("/dev/held") == NULL), "opendir refused at the d_refs limit");
+	ok = (delete_file(file) == 0) && (__count("/dev") == 1) && (readdir(pv_dirs[0]) == NULL);
+	__check(ok, "open directory outlives its last file");
+	for (uint32_t i = 0; i < UINT8_MAX; i++) {
+		closedir(pv_dirs[i]);
+	}
+	__check(opendir("/dev") == NULL, "pruned after the last closedir");
+	return pv_failed;
+}
@@ -27,13 +27,21 @@
  * SOFTWARE.
 */
 
+#include "cfifo.h"
+#include "cmsis_os2.h"
 #include "console_codes.h"
 #include "ec_api.h"
+#include "ec_atomic.h"
+#include "ec_lock.h"
 #include "ecshell_exec_def.h"
+#include "heap_port.h"
+#include "ioctl_cmd.h"
 #include "optparse.h"
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 int ecshell_cmd_clear_screen(int argc, char *argv[], void *env)
@@ -69,3 +77,1037 @@ int ecshell_cmd_clear_screen(int argc, char *argv[], void *env)
 	write(ofd, "\x1b[H\x1b[2J", 7);
 	return 0;
 }
+
+#define PIPEBENCH_MAX_BLOCK 256
+
+/**
+ * Heap block the writer owns once it runs, the shell may leave early.
+ */
+struct pipebench_arg_s {
+	int32_t fd;
+	uint32_t total;
+	uint32_t block;
+};
+
+/**
+ * Options the throughput benchmarks share: [-s kbytes] [-b block] and,
+ * if path is not NULL, a device. kbytes and block come in holding the
+ * defaults. Help and invalid arguments are printed here.
+ * @retval	1 to run the benchmark, 0 if it is done already
+ */
+static int32_t bench_options(int32_t ofd, char *argv[], const char *help_info, uint32_t *kbytes, uint32_t *block, const char **path)
+{
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	struct optparse_long longopts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"size", 's', OPTPARSE_REQUIRED},
+		{"block", 'b', OPTPARSE_REQUIRED},
+		{0},
+	};
+	struct optparse options;
+	optparse_init(&options, argv);
+	int option;
+
+	while ((option = optparse_long(&options, longopts, NULL)) != -1) {
+		switch (option) {
+		case 'h':
+			write(ofd, help_info, strlen(help_info));
+			return 0;
+		case 's':
+			*kbytes = (uint32_t)strtoul(options.optarg, NULL, 0);
+			break;
+		case 'b':
+			*block = (uint32_t)strtoul(options.optarg, NULL, 0);
+			break;
+		default:
+			write(ofd, err_info, strlen(err_info));
+			return 0;
+		}
+	}
+	if (path != NULL) {
+		*path = optparse_arg(&options);
+	}
+	if (((path != NULL) && (*path == NULL)) || (*kbytes == 0) || (*block == 0) || (*block > PIPEBENCH_MAX_BLOCK)) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	return 1;
+}
+
+static void pipebench_writer(void *argument)
+{
+	struct pipebench_arg_s *arg = (struct pipebench_arg_s *)argument;
+	char buf[PIPEBENCH_MAX_BLOCK];
+	int32_t fd = arg->fd;
+	uint32_t total = arg->total;
+	uint32_t block = arg->block;
+	uint32_t sent = 0;
+	int32_t err;
+
+	ecfree(arg);
+	memset(buf, 0x5a, sizeof(buf));
+	while (sent < total) {
+		err = write(fd, buf, ((total - sent) < block) ? (total - sent) : block);
+		if (err <= 0) {
+			break;
+		}
+		sent += err;
+	}
+	// Reader sees EOF.
+	close(fd);
+#if _FD_PER_TASK
+	ec_thread_exit();
+#else
+	osThreadExit();
+#endif
+}
+
+int ecshell_cmd_pipebench(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "pipebench [-s kbytes] [-b block]" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																								"Stream data through a pipe from a helper task and print the throughput.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	uint32_t kbytes = 64;
+	uint32_t block = PIPEBENCH_MAX_BLOCK;
+
+	if (!bench_options(ofd, argv, help_info, &kbytes, &block, NULL)) {
+		return 0;
+	}
+
+	const osThreadAttr_t writer_attr = {
+		.name = "pipebench",
+		.priority = osPriorityNormal,
+		.stack_size = 256 * 4,
+	};
+	struct pipebench_arg_s *arg;
+	osThreadId_t writer;
+	char buf[PIPEBENCH_MAX_BLOCK];
+	char result[80];
+	int32_t fds[2];
+	uint32_t received = 0;
+	uint32_t start;
+	uint32_t ms;
+	int32_t err;
+
+	arg = (struct pipebench_arg_s *)ecmalloc(sizeof(struct pipebench_arg_s));
+	if (arg == NULL) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	if (ec_pipe(fds) != 0) {
+		ecfree(arg);
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	arg->total = kbytes * 1024U;
+	arg->block = block;
+	start = osKernelGetTickCount();
+#if _FD_PER_TASK
+	// The writer gets the write end as its stdout, in its own fd table.
+	const int32_t writer_fds[3] = {-1, fds[1], 2};
+	arg->fd = 1;
+	writer = ec_thread_new_fds(pipebench_writer, arg, &writer_attr, writer_fds);
+	if (writer != NULL) {
+		// Only the writer's copy may keep the pipe open.
+		close(fds[1]);
+	}
+#else
+	arg->fd = fds[1];
+	writer = osThreadNew(pipebench_writer, arg, &writer_attr);
+#endif
+	if (writer == NULL) {
+		ecfree(arg);
+		close(fds[0]);
+		close(fds[1]);
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	while ((err = read(fds[0], buf, block)) > 0) {
+		received += err;
+	}
+	ms = (uint32_t)((uint64_t)(osKernelGetTickCount() - start) * 1000U / osKernelGetTickFreq());
+	close(fds[0]);
+
+	snprintf(result, sizeof(result), "%lu bytes in %lu ms, %lu KB/s\r\n",
+			 (unsigned long)received, (unsigned long)ms,
+			 (unsigned long)((ms == 0) ? 0 : ((uint64_t)received * 1000U / 1024U / ms)));
+	write(ofd, result, strlen(result));
+	return 0;
+}
+
+/**
+ * Milliseconds since a tick count taken with osKernelGetTickCount().
+ */
+static uint32_t bench_ms(uint32_t start)
+{
+	return (uint32_t)((uint64_t)(osKernelGetTickCount() - start) * 1000U / osKernelGetTickFreq());
+}
+
+static void bench_report(int32_t ofd, const char *label, uint32_t bytes, uint32_t ms)
+{
+	char result[96];
+	snprintf(result, sizeof(result), "%-8s %lu bytes in %lu ms, %lu KB/s\r\n", label,
+			 (unsigned long)bytes, (unsigned long)ms,
+			 (unsigned long)((ms == 0) ? 0 : ((uint64_t)bytes * 1000U / 1024U / ms)));
+	write(ofd, result, strlen(result));
+}
+
+#define FIFOBENCH_DEPTH 1024
+
+int ecshell_cmd_fifobench(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "fifobench [-s kbytes] [-b block]" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																								"Move data through a cfifo char by char and in blocks, print both throughputs.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	uint32_t kbytes = 256;
+	uint32_t block = PIPEBENCH_MAX_BLOCK;
+
+	if (!bench_options(ofd, argv, help_info, &kbytes, &block, NULL)) {
+		return 0;
+	}
+
+	char buf[PIPEBENCH_MAX_BLOCK];
+	uint32_t total = kbytes * 1024U;
+	uint32_t moved;
+	uint32_t start;
+	uint32_t errors = 0;
+	cfifo_t *fifo = cfifo_new(FIFOBENCH_DEPTH, e_CFIFO_Reject);
+	char ch;
+
+	if (fifo == NULL) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	memset(buf, 0x5a, sizeof(buf));
+
+	// One block in, one block out, so the fifo never fills.
+	start = osKernelGetTickCount();
+	for (moved = 0; moved < total; moved += block) {
+		for (uint32_t i = 0; i < block; i++) {
+			if (cfifo_push(fifo, buf[i]) != 0) {
+				errors++;
+			}
+		}
+		for (uint32_t i = 0; i < block; i++) {
+			if ((cfifo_pop(fifo, &ch) != 0) || (ch != buf[i])) {
+				errors++;
+			}
+		}
+	}
+	bench_report(ofd, "char", moved, bench_ms(start));
+
+	start = osKernelGetTickCount();
+	for (moved = 0; moved < total; moved += block) {
+		if (cfifo_pushn(fifo, buf, (int32_t)block) != (int32_t)block) {
+			errors++;
+		}
+		if (cfifo_popn(fifo, buf, (int32_t)block) != (int32_t)block) {
+			errors++;
+		}
+	}
+	bench_report(ofd, "block", moved, bench_ms(start));
+	cfifo_delete(fifo);
+
+	if (errors != 0) {
+		char result[48];
+		snprintf(result, sizeof(result), "%lu errors\r\n", (unsigned long)errors);
+		write(ofd, result, strlen(result));
+	}
+	return 0;
+}
+
+#define UARTLOOP_TIMEOUT_MS 100
+
+/**
+ * Wait until fd is ready for events, 0 on timeout.
+ */
+static int32_t bench_wait(int32_t fd, uint16_t events)
+{
+	ec_pollfd_t pfd = {.fd = fd, .events = events, .revents = 0};
+	return ec_poll(&pfd, 1, UARTLOOP_TIMEOUT_MS);
+}
+
+int ecshell_cmd_uartloop(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "uartloop [-s kbytes] [-b block] device" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																									   "Send a counting pattern out of a port wired TX to RX, check what comes back.\r\n"
+																									   "Blocks larger than half the RX fifo exercise the DMA wraparound.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	const char *path;
+	uint32_t kbytes = 16;
+	uint32_t block = PIPEBENCH_MAX_BLOCK;
+
+	if (!bench_options(ofd, argv, help_info, &kbytes, &block, &path)) {
+		return 0;
+	}
+
+	char tx[PIPEBENCH_MAX_BLOCK];
+	char rx[PIPEBENCH_MAX_BLOCK];
+	char result[80];
+	uint32_t total = kbytes * 1024U;
+	uint32_t moved = 0;
+	uint32_t mismatch = 0;
+	uint32_t drops_before = 0;
+	uint32_t drops_after = 0;
+	uint8_t seq = 0;
+	uint32_t start;
+	int32_t err;
+	int32_t fd = open(path, O_RDWR | O_NOBLOCK);
+
+	if (fd < 0) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	// Whatever was pending before the run would shift the pattern.
+	while (read(fd, rx, sizeof(rx)) > 0) {
+	}
+	ioctl(fd, CMD_USART_GETRXDROPS, (uint64_t)(uintptr_t)&drops_before);
+	start = osKernelGetTickCount();
+	while (moved < total) {
+		uint32_t n = ((total - moved) < block) ? (total - moved) : block;
+		uint32_t done;
+		for (uint32_t i = 0; i < n; i++) {
+			tx[i] = (char)(seq + i);
+		}
+		for (done = 0; done < n;) {
+			if (bench_wait(fd, EC_POLLOUT) <= 0) {
+				break;
+			}
+			err = write(fd, &tx[done], n - done);
+			done += (err > 0) ? (uint32_t)err : 0U;
+		}
+		for (done = 0; done < n;) {
+			if (bench_wait(fd, EC_POLLIN) <= 0) {
+				break;
+			}
+			err = read(fd, &rx[done], n - done);
+			done += (err > 0) ? (uint32_t)err : 0U;
+		}
+		for (uint32_t i = 0; i < done; i++) {
+			mismatch += (rx[i] != tx[i]) ? 1U : 0U;
+		}
+		moved += done;
+		seq = (uint8_t)(seq + n);
+		if (done < n) {
+			// Nothing came back in time, no loopback or chars were lost.
+			mismatch += n - done;
+			break;
+		}
+	}
+	ioctl(fd, CMD_USART_GETRXDROPS, (uint64_t)(uintptr_t)&drops_after);
+	bench_report(ofd, "loop", moved, bench_ms(start));
+	close(fd);
+
+	snprintf(result, sizeof(result), "%lu bad or missing, %lu dropped\r\n",
+			 (unsigned long)mismatch, (unsigned long)(drops_after - drops_before));
+	write(ofd, result, strlen(result));
+	return 0;
+}
+
+int ecshell_cmd_uarttx(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "uarttx [-s kbytes] [-b block] device" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																									 "Stream data out of a port with blocking writes, print the throughput\r\n"
+																									 "and how close it comes to the line rate.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	const char *path;
+	uint32_t kbytes = 16;
+	uint32_t block = PIPEBENCH_MAX_BLOCK;
+
+	if (!bench_options(ofd, argv, help_info, &kbytes, &block, &path)) {
+		return 0;
+	}
+
+	char buf[PIPEBENCH_MAX_BLOCK];
+	char result[64];
+	uint32_t total = kbytes * 1024U;
+	uint32_t sent = 0;
+	uint32_t baud = 0;
+	uint32_t ms;
+	uint32_t start;
+	int32_t err;
+	int32_t fd = open(path, O_WRONLY);
+
+	if (fd < 0) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	ioctl(fd, CMD_USART_GETBAUD, (uint64_t)(uintptr_t)&baud);
+	for (uint32_t i = 0; i < block; i++) {
+		buf[i] = (char)('0' + (i % 64U));
+	}
+	start = osKernelGetTickCount();
+	while (sent < total) {
+		err = write(fd, buf, ((total - sent) < block) ? (total - sent) : block);
+		if (err <= 0) {
+			break;
+		}
+		sent += err;
+	}
+	// The TX fifo still holds the tail, long runs make that negligible.
+	ms = bench_ms(start);
+	close(fd);
+
+	bench_report(ofd, "tx", sent, ms);
+	// 10 bits a char at 8N1.
+	snprintf(result, sizeof(result), "%lu%% of line rate\r\n",
+			 (unsigned long)(((ms == 0) || (baud == 0)) ? 0 : ((uint64_t)sent * 10U * 1000U * 100U / baud / ms)));
+	write(ofd, result, strlen(result));
+	return 0;
+}
+
+#define LOOKUPBENCH_MAX_FILES 1024
+
+/**
+ * "/bench/" kind and 4 digits of i, cheap enough to stay inside the
+ * timed loops unlike snprintf().
+ */
+static void lookupbench_name(char name[13], char kind, uint32_t i)
+{
+	memcpy(name, "/bench/", 7);
+	name[7] = kind;
+	name[8] = (char)('0' + (i / 1000U) % 10U);
+	name[9] = (char)('0' + (i / 100U) % 10U);
+	name[10] = (char)('0' + (i / 10U) % 10U);
+	name[11] = (char)('0' + i % 10U);
+	name[12] = '\0';
+}
+
+int ecshell_cmd_lookupbench(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "lookupbench [-n files] [-l loops]" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																								 "Register n empty files, time search_file() on all of them and on missing\r\n"
+																								 "names, then remove them again.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	struct optparse_long longopts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"files", 'n', OPTPARSE_REQUIRED},
+		{"loops", 'l', OPTPARSE_REQUIRED},
+		{0},
+	};
+	struct optparse options;
+	optparse_init(&options, argv);
+	int option;
+	uint32_t files = 256;
+	uint32_t loops = 16;
+
+	while ((option = optparse_long(&options, longopts, NULL)) != -1) {
+		switch (option) {
+		case 'h':
+			write(ofd, help_info, strlen(help_info));
+			return 0;
+		case 'n':
+			files = (uint32_t)strtoul(options.optarg, NULL, 0);
+			break;
+		case 'l':
+			loops = (uint32_t)strtoul(options.optarg, NULL, 0);
+			break;
+		default:
+			write(ofd, err_info, strlen(err_info));
+			return 0;
+		}
+	}
+	if ((files == 0) || (files > LOOKUPBENCH_MAX_FILES) || (loops == 0)) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+
+	char name[13];
+	char result[96];
+	uint32_t made = 0;
+	uint32_t found = 0;
+	uint32_t missed = 0;
+	uint32_t start;
+	uint32_t ms;
+	file_t *file;
+
+	for (made = 0; made < files; made++) {
+		lookupbench_name(name, 'f', made);
+		file = create_file(name, NULL, NULL);
+		if (file == NULL) {
+			break;
+		}
+		if (file_regist(file) != 0) {
+			destroy_file(file);
+			break;
+		}
+	}
+
+	start = osKernelGetTickCount();
+	for (uint32_t l = 0; l < loops; l++) {
+		for (uint32_t i = 0; i < made; i++) {
+			lookupbench_name(name, 'f', i);
+			file = search_file(name);
+			if (file != NULL) {
+				found++;
+				put_file(file);
+			}
+		}
+	}
+	ms = bench_ms(start);
+	snprintf(result, sizeof(result), "hit      %lu of %lu in %lu ms, %lu ns each\r\n",
+			 (unsigned long)found, (unsigned long)(made * loops), (unsigned long)ms,
+			 (unsigned long)((made == 0) ? 0 : ((uint64_t)ms * 1000000U / made / loops)));
+	write(ofd, result, strlen(result));
+
+	start = osKernelGetTickCount();
+	for (uint32_t l = 0; l < loops; l++) {
+		for (uint32_t i = 0; i < made; i++) {
+			lookupbench_name(name, 'm', i);
+			file = search_file(name);
+			if (file == NULL) {
+				missed++;
+			}
+			else {
+				put_file(file);
+			}
+		}
+	}
+	ms = bench_ms(start);
+	snprintf(result, sizeof(result), "miss     %lu of %lu in %lu ms, %lu ns each\r\n",
+			 (unsigned long)missed, (unsigned long)(made * loops), (unsigned long)ms,
+			 (unsigned long)((made == 0) ? 0 : ((uint64_t)ms * 1000000U / made / loops)));
+	write(ofd, result, strlen(result));
+
+	for (uint32_t i = 0; i < made; i++) {
+		lookupbench_name(name, 'f', i);
+		file = search_file(name);
+		if (file != NULL) {
+			put_file(file);
+			delete_file(file);
+		}
+	}
+	if (made < files) {
+		snprintf(result, sizeof(result), "only %lu files could be registered\r\n", (unsigned long)made);
+		write(ofd, result, strlen(result));
+	}
+	return 0;
+}
+
+/**
+ * Helper tasks of the benchmarks do file I/O, give them their own fd
+ * table where there are any.
+ */
+static osThreadId_t bench_thread_new(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr)
+{
+#if _FD_PER_TASK
+	return ec_thread_new(func, argument, attr);
+#else
+	return osThreadNew(func, argument, attr);
+#endif
+}
+
+static void bench_thread_exit(void)
+{
+#if _FD_PER_TASK
+	ec_thread_exit();
+#else
+	osThreadExit();
+#endif
+}
+
+#define FDSTRESS_MAX_TASKS 8
+#define FDSTRESS_FILE	   "/tmp/fdstress"
+#define FDSTRESS_WAIT_MS   10000
+
+/**
+ * Shared by the shell and the stress tasks, freed by whoever leaves it
+ * last so that the shell may give up waiting.
+ */
+struct fdstress_arg_s {
+	uint32_t iterations;
+	atomic_t errors;
+	atomic_t running;
+	atomic_t users;
+};
+
+static void fdstress_put(struct fdstress_arg_s *arg)
+{
+	if (atomic_fetch_add(&(arg->users), -1) == 1) {
+		ecfree(arg);
+	}
+}
+
+static void fdstress_task(void *argument)
+{
+	struct fdstress_arg_s *arg = (struct fdstress_arg_s *)argument;
+	int32_t errors = 0;
+	int32_t fd;
+	int32_t fd2;
+
+	for (uint32_t i = 0; i < arg->iterations; i++) {
+		fd = open(FDSTRESS_FILE, O_RDWR);
+		if (fd < 0) {
+			errors++;
+			continue;
+		}
+		fd2 = dup(fd);
+		if (fd2 < 0) {
+			errors++;
+		}
+		else {
+			// Take over fd2 while it is open, then drop both.
+			errors += (dup2(fd, fd2) != fd2) ? 1 : 0;
+			errors += (close(fd2) != 0) ? 1 : 0;
+		}
+		errors += (close(fd) != 0) ? 1 : 0;
+	}
+	atomic_add(&(arg->errors), errors);
+	atomic_dec(&(arg->running));
+	fdstress_put(arg);
+	bench_thread_exit();
+}
+
+int ecshell_cmd_fdstress(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "fdstress [-t tasks] [-n iterations]" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																								   "Open, dup, dup2 and close the same file from several tasks at once,\r\n"
+																								   "then check that every fd came back.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	struct optparse_long longopts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"tasks", 't', OPTPARSE_REQUIRED},
+		{"iterations", 'n', OPTPARSE_REQUIRED},
+		{0},
+	};
+	struct optparse options;
+	optparse_init(&options, argv);
+	int option;
+	uint32_t tasks = 4;
+	uint32_t iterations = 1000;
+
+	while ((option = optparse_long(&options, longopts, NULL)) != -1) {
+		switch (option) {
+		case 'h':
+			write(ofd, help_info, strlen(help_info));
+			return 0;
+		case 't':
+			tasks = (uint32_t)strtoul(options.optarg, NULL, 0);
+			break;
+		case 'n':
+			iterations = (uint32_t)strtoul(options.optarg, NULL, 0);
+			break;
+		default:
+			write(ofd, err_info, strlen(err_info));
+			return 0;
+		}
+	}
+	if ((tasks == 0) || (tasks > FDSTRESS_MAX_TASKS) || (iterations == 0)) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+
+	const osThreadAttr_t task_attr = {
+		.name = "fdstress",
+		.priority = osPriorityBelowNormal,
+		.stack_size = 256 * 4,
+	};
+	struct fdstress_arg_s *arg;
+	char result[96];
+	uint32_t started = 0;
+	uint32_t start;
+	uint32_t ms;
+	int32_t probe;
+	int32_t probe_after;
+	int32_t fd;
+
+	// Lowest free fd before and after, a leaked fd shows up as a change.
+	fd = open(FDSTRESS_FILE, O_RDWR | O_CREAT);
+	if (fd < 0) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	probe = dup(fd);
+	close(probe);
+	arg = (struct fdstress_arg_s *)ecmalloc(sizeof(struct fdstress_arg_s));
+	if (arg == NULL) {
+		close(fd);
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	arg->iterations = iterations;
+	atomic_set(&(arg->errors), 0);
+	atomic_set(&(arg->running), (atomic_t)tasks);
+	atomic_set(&(arg->users), (atomic_t)(tasks + 1));
+
+	start = osKernelGetTickCount();
+	for (started = 0; started < tasks; started++) {
+		if (bench_thread_new(fdstress_task, arg, &task_attr) == NULL) {
+			break;
+		}
+	}
+	// Tasks that never started are not waited for.
+	atomic_add(&(arg->running), -(int32_t)(tasks - started));
+	atomic_add(&(arg->users), -(int32_t)(tasks - started));
+	while ((atomic_get(&(arg->running)) > 0) && (bench_ms(start) < FDSTRESS_WAIT_MS)) {
+		osDelay(10);
+	}
+	ms = bench_ms(start);
+
+	snprintf(result, sizeof(result), "%lu tasks x %lu rounds in %lu ms, %ld errors, %ld still running\r\n",
+			 (unsigned long)started, (unsigned long)iterations, (unsigned long)ms,
+			 (long)atomic_get(&(arg->errors)), (long)atomic_get(&(arg->running)));
+	write(ofd, result, strlen(result));
+	if (atomic_get(&(arg->running)) == 0) {
+		probe_after = dup(fd);
+		close(probe_after);
+		if (probe_after != probe) {
+			snprintf(result, sizeof(result), "fd leak: lowest free fd %ld, was %ld\r\n", (long)probe_after, (long)probe);
+			write(ofd, result, strlen(result));
+		}
+	}
+	fdstress_put(arg);
+	close(fd);
+	return 0;
+}
+
+#define RWSTRESS_STABLE 4
+#define RWSTRESS_CHURN	16
+
+/**
+ * Shared like fdstress_arg_s. The churn task stops the readers by
+ * clearing run once it is done.
+ */
+struct rwstress_arg_s {
+	uint32_t rounds;
+	atomic_t run;
+	atomic_t lookups;
+	atomic_t misses;
+	atomic_t churn_errors;
+	atomic_t running;
+	atomic_t users;
+};
+
+static void rwstress_put(struct rwstress_arg_s *arg)
+{
+	if (atomic_fetch_add(&(arg->users), -1) == 1) {
+		ecfree(arg);
+	}
+}
+
+static void rwstress_reader(void *argument)
+{
+	struct rwstress_arg_s *arg = (struct rwstress_arg_s *)argument;
+	char name[13];
+	int32_t lookups = 0;
+	int32_t misses = 0;
+	file_t *file;
+
+	while (atomic_get(&(arg->run)) != 0) {
+		for (uint32_t i = 0; i < RWSTRESS_STABLE; i++) {
+			lookupbench_name(name, 's', i);
+			file = search_file(name);
+			if (file == NULL) {
+				misses++;
+			}
+			else {
+				put_file(file);
+			}
+			lookups++;
+		}
+		// Churned names come and go, only the stable ones must be found.
+		lookupbench_name(name, 'c', (uint32_t)lookups % RWSTRESS_CHURN);
+		put_file(search_file(name));
+		lookups++;
+	}
+	atomic_add(&(arg->lookups), lookups);
+	atomic_add(&(arg->misses), misses);
+	atomic_dec(&(arg->running));
+	rwstress_put(arg);
+	bench_thread_exit();
+}
+
+static void rwstress_churn(void *argument)
+{
+	struct rwstress_arg_s *arg = (struct rwstress_arg_s *)argument;
+	char name[13];
+	int32_t errors = 0;
+	int32_t err;
+	file_t *file;
+
+	for (uint32_t r = 0; r < arg->rounds; r++) {
+		for (uint32_t i = 0; i < RWSTRESS_CHURN; i++) {
+			lookupbench_name(name, 'c', i);
+			file = create_file(name, NULL, NULL);
+			if ((file == NULL) || (file_regist(file) != 0)) {
+				destroy_file(file);
+				errors++;
+			}
+		}
+		for (uint32_t i = 0; i < RWSTRESS_CHURN; i++) {
+			lookupbench_name(name, 'c', i);
+			file = search_file(name);
+			put_file(file);
+			err = (file == NULL) ? -ENOENT : delete_file(file);
+			while (err == -EBUSY) {
+				// A reader holds it for the length of one lookup.
+				osThreadYield();
+				err = delete_file(file);
+			}
+			if (err != 0) {
+				errors++;
+			}
+		}
+	}
+	atomic_add(&(arg->churn_errors), errors);
+	atomic_set(&(arg->run), 0);
+	atomic_dec(&(arg->running));
+	rwstress_put(arg);
+	bench_thread_exit();
+}
+
+int ecshell_cmd_rwstress(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "rwstress [-t readers] [-n rounds]" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																								 "Look up files from several tasks while another one keeps registering\r\n"
+																								 "and deleting files, count lookups that missed a file that never left.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	struct optparse_long longopts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"readers", 't', OPTPARSE_REQUIRED},
+		{"rounds", 'n', OPTPARSE_REQUIRED},
+		{0},
+	};
+	struct optparse options;
+	optparse_init(&options, argv);
+	int option;
+	uint32_t readers = 4;
+	uint32_t rounds = 100;
+
+	while ((option = optparse_long(&options, longopts, NULL)) != -1) {
+		switch (option) {
+		case 'h':
+			write(ofd, help_info, strlen(help_info));
+			return 0;
+		case 't':
+			readers = (uint32_t)strtoul(options.optarg, NULL, 0);
+			break;
+		case 'n':
+			rounds = (uint32_t)strtoul(options.optarg, NULL, 0);
+			break;
+		default:
+			write(ofd, err_info, strlen(err_info));
+			return 0;
+		}
+	}
+	if ((readers == 0) || (readers > FDSTRESS_MAX_TASKS) || (rounds == 0)) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+
+	const osThreadAttr_t task_attr = {
+		.name = "rwstress",
+		.priority = osPriorityBelowNormal,
+		.stack_size = 256 * 4,
+	};
+	struct rwstress_arg_s *arg;
+	char name[13];
+	char result[112];
+	uint32_t started;
+	uint32_t start;
+	uint32_t ms;
+	file_t *file;
+
+	for (uint32_t i = 0; i < RWSTRESS_STABLE; i++) {
+		lookupbench_name(name, 's', i);
+		file = create_file(name, NULL, NULL);
+		if ((file != NULL) && (file_regist(file) != 0)) {
+			// Left over from an earlier run.
+			destroy_file(file);
+		}
+	}
+	arg = (struct rwstress_arg_s *)ecmalloc(sizeof(struct rwstress_arg_s));
+	if (arg == NULL) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	arg->rounds = rounds;
+	atomic_set(&(arg->run), 1);
+	atomic_set(&(arg->lookups), 0);
+	atomic_set(&(arg->misses), 0);
+	atomic_set(&(arg->churn_errors), 0);
+	atomic_set(&(arg->running), (atomic_t)(readers + 1));
+	atomic_set(&(arg->users), (atomic_t)(readers + 2));
+
+	start = osKernelGetTickCount();
+	for (started = 0; started < readers; started++) {
+		if (bench_thread_new(rwstress_reader, arg, &task_attr) == NULL) {
+			break;
+		}
+	}
+	atomic_add(&(arg->running), -(int32_t)(readers - started));
+	atomic_add(&(arg->users), -(int32_t)(readers - started));
+	if (bench_thread_new(rwstress_churn, arg, &task_attr) == NULL) {
+		atomic_set(&(arg->run), 0);
+		atomic_dec(&(arg->running));
+		atomic_dec(&(arg->users));
+	}
+	while ((atomic_get(&(arg->running)) > 0) && (bench_ms(start) < FDSTRESS_WAIT_MS)) {
+		osDelay(10);
+	}
+	ms = bench_ms(start);
+	// Readers must not outlive a churn task that never started or hangs.
+	atomic_set(&(arg->run), 0);
+
+	snprintf(result, sizeof(result), "%lu readers, %ld lookups in %lu ms, %ld missed, %ld churn errors\r\n",
+			 (unsigned long)started, (long)atomic_get(&(arg->lookups)), (unsigned long)ms,
+			 (long)atomic_get(&(arg->misses)), (long)atomic_get(&(arg->churn_errors)));
+	write(ofd, result, strlen(result));
+	if (atomic_get(&(arg->running)) == 0) {
+		for (uint32_t i = 0; i < RWSTRESS_STABLE; i++) {
+			lookupbench_name(name, 's', i);
+			file = search_file(name);
+			if (file != NULL) {
+				put_file(file);
+				delete_file(file);
+			}
+		}
+	}
+	rwstress_put(arg);
+	return 0;
+}
+
+int ecshell_cmd_ls(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "ls [path]" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																 "List a directory, / by default.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "No such directory.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	struct optparse_long longopts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{0},
+	};
+	struct optparse options;
+	optparse_init(&options, argv);
+	int option;
+
+	while ((option = optparse_long(&options, longopts, NULL)) != -1) {
+		switch (option) {
+		case 'h':
+			write(ofd, help_info, strlen(help_info));
+			return 0;
+		default:
+			write(ofd, err_info, strlen(err_info));
+			return 0;
+		}
+	}
+
+	const char *path = optparse_arg(&options);
+	ec_dir_t *dir;
+	ec_dirent_t *ent;
+	dir = opendir((path != NULL) ? path : "/");
+	if (dir == NULL) {
+		write(ofd, err_info, strlen(err_info));
+		return 0;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_type == EC_DT_DIR) {
+			write(ofd, CSI_SGR(SGR_COL_FRONT(COL_BLUE)), strlen(CSI_SGR(SGR_COL_FRONT(COL_BLUE))));
+			write(ofd, ent->d_name, strlen(ent->d_name));
+			write(ofd, "/" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n", strlen("/" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"));
+		}
+		else {
+			write(ofd, ent->d_name, strlen(ent->d_name));
+			write(ofd, "\r\n", 2);
+		}
+	}
+	closedir(dir);
+	return 0;
+}
+
+int ecshell_cmd_lockstat(int argc, char *argv[], void *env)
+{
+	int32_t ofd;
+	ofd = ((ecshell_env_t *)env)->stdout_fd;
+
+	const char help_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_CYAN)) "lockstat [-r]" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n"
+																	 "Print acquires, contention and hold cycles of named locks, -r clears them.\r\n";
+	const char err_info[] =
+		CSI_SGR(SGR_COL_FRONT(COL_RED)) "Invalid argument.\r\n" CSI_SGR(SGR_COL_FRONT(COL_DEFAULT)) "\r\n";
+	struct optparse_long longopts[] = {
+		{"help", 'h', OPTPARSE_NONE},
+		{"reset", 'r', OPTPARSE_NONE},
+		{0},
+	};
+	struct optparse options;
+	optparse_init(&options, argv);
+	int option;
+	int reset = 0;
+
+	while ((option = optparse_long(&options, longopts, NULL)) != -1) {
+		switch (option) {
+		case 'h':
+			write(ofd, help_info, strlen(help_info));
+			return 0;
+		case 'r':
+			reset = 1;
+			break;
+		default:
+			write(ofd, err_info, strlen(err_info));
+			return 0;
+		}
+	}
+
+#if _LOCK_STATS
+	ec_lock_stat_t stat;
+	char line[96];
+	if (reset) {
+		ec_lock_stat_reset();
+		return 0;
+	}
+	snprintf(line, sizeof(line), "%-12s %10s %10s %10s %10s\r\n", "lock", "acquires", "contended", "max", "avg");
+	write(ofd, line, strlen(line));
+	for (uint32_t i = 0; ec_lock_stat_get(i, &stat) == 0; i++) {
+		snprintf(line, sizeof(line), "%-12s %10lu %10lu %10lu %10lu\r\n", stat.name,
+				 (unsigned long)stat.acquires, (unsigned long)stat.contended, (unsigned long)stat.hold_max,
+				 (unsigned long)((stat.acquires == 0) ? 0 : (stat.hold_total / stat.acquires)));
+		write(ofd, line, strlen(line));
+	}
+#else
+	const char off_info[] = "Lock statistics are off, set _LOCK_STATS in ec_config.h.\r\n";
+	(void)reset;
+	write(ofd, off_info, strlen(off_info));
+#endif
+	return 0;
+}
@@ -58,12 +58,30 @@ static size_t BKDRHash(const uint8_t *str)
 }
 
 extern int ecshell_cmd_clear_screen(int argc, char *argv[], void *env);
+extern int ecshell_cmd_pipebench(int argc, char *argv[], void *env);
+extern int ecshell_cmd_ls(int argc, char *argv[], void *env);
+extern int ecshell_cmd_lockstat(int argc, char *argv[], void *env);
+extern int ecshell_cmd_fifobench(int argc, char *argv[], void *env);
+extern int ecshell_cmd_uartloop(int argc, char *argv[], void *env);
+extern int ecshell_cmd_uarttx(int argc, char *argv[], void *env);
+extern int ecshell_cmd_lookupbench(int argc, char *argv[], void *env);
+extern int ecshell_cmd_fdstress(int argc, char *argv[], void *env);
+extern int ecshell_cmd_rwstress(int argc, char *argv[], void *env);
 
 void ecshell_cmd_map_init(void)
 {
 	avl_map_init(&cmd_map, BKDRHash, strcmp);
 	/** Begin to regist your own cmds */
 	REGIST_COMMAND(ecshell_cmd_clear_screen, "clear");
+	REGIST_COMMAND(ecshell_cmd_pipebench, "pipebench");
+	REGIST_COMMAND(ecshell_cmd_ls, "ls");
+	REGIST_COMMAND(ecshell_cmd_lockstat, "lockstat");
+	REGIST_COMMAND(ecshell_cmd_fifobench, "fifobench");
+	REGIST_COMMAND(ecshell_cmd_uartloop, "uartloop");
+	REGIST_COMMAND(ecshell_cmd_uarttx, "uarttx");
+	REGIST_COMMAND(ecshell_cmd_lookupbench, "lookupbench");
+	REGIST_COMMAND(ecshell_cmd_fdstress, "fdstress");
+	REGIST_COMMAND(ecshell_cmd_rwstress, "rwstress");
 }
 
 void ecshell_regist_cmd(ecshell_cmd_t *cmd, char *name)